@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench.h"
+#include "../src/editor.h"
+
+#define BENCH_LONG_LINE_BYTES 8192
+
+BenchConfig g_bench_config = {
+    .filter = NULL,
+    .iterations = 20,
+    .budget_ms = 2000,
+    .json = false,
+};
+
+static int saved_stdout = -1;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+bool bench_enabled(const char *name) {
+    return !g_bench_config.filter || strstr(name, g_bench_config.filter) != NULL;
+}
+
+void bench_run(const char *name, const BenchInput *input, size_t bytes, BenchFn fn, BenchFn reset, void *arg) {
+    if (!bench_enabled(name)) {
+        return;
+    }
+
+    int capacity = g_bench_config.iterations > 3 ? g_bench_config.iterations : 3;
+    double *samples = malloc(sizeof(double) * capacity);
+    if (!samples) {
+        fprintf(stderr, "bench_run: malloc failed\n");
+        exit(1);
+    }
+
+    // One untimed warm-up run.
+    if (reset) reset(arg);
+    fn(arg);
+
+    int count = 0;
+    double spent = 0;
+    while (count < capacity && (count < 3 || spent < g_bench_config.budget_ms)) {
+        if (reset) reset(arg);
+        double start = now_ms();
+        fn(arg);
+        samples[count] = now_ms() - start;
+        spent += samples[count];
+        count++;
+    }
+
+    qsort(samples, count, sizeof(double), compare_double);
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    double mean = sum / count;
+    double variance = 0;
+    for (int i = 0; i < count; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean);
+    }
+    double stddev = count > 1 ? sqrt(variance / (count - 1)) : 0;
+    double median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    int p95_idx = (int)ceil(0.95 * count) - 1;
+    double p95 = samples[p95_idx < 0 ? 0 : p95_idx];
+    double mb_per_sec = bytes && median > 0 ? (bytes / (1024.0 * 1024.0)) / (median / 1000.0) : 0;
+
+    if (g_bench_config.json) {
+        printf("{\"name\":\"%s\",\"input\":\"%s\",\"bytes\":%zu,\"samples\":%d,"
+               "\"min_ms\":%.4f,\"median_ms\":%.4f,\"mean_ms\":%.4f,\"p95_ms\":%.4f,\"stddev_ms\":%.4f,\"mb_per_sec\":%.2f}\n",
+               name, input->label, bytes, count, samples[0], median, mean, p95, stddev, mb_per_sec);
+    } else {
+        printf("  %-28s %-22s %4d %10.4f %10.4f %10.4f %10.4f %10.4f %10.2f\n",
+               name, input->label, count, samples[0], median, mean, p95, stddev, mb_per_sec);
+    }
+    fflush(stdout);
+    free(samples);
+}
+
+static const char *ascii_segments[] = {
+    "int value_%u = compute(value_%u, %u);",
+    " if (value_%u > limit_%u) { return %u; }",
+    " // refresh the cached line %u of %u (%u)",
+};
+
+static const char *cjk_segments[] = {
+    "文字列_%u = 変換(値_%u, %u);",
+    " // 東京都の漢字かなカナ混じり文 %u %u %u",
+    " 表示する行 %u から %u まで %u",
+};
+
+bool bench_generate(BenchInput *input, const char *dir, const char *extension) {
+    static const char *charset_names[] = { "ascii", "cjk" };
+    static const char *shape_names[] = { "lines", "long" };
+    char size_label[16];
+    if (input->size >= 1024 * 1024 * 1024) {
+        snprintf(size_label, sizeof(size_label), "%zuG", input->size / (1024 * 1024 * 1024));
+    } else if (input->size >= 1024 * 1024) {
+        snprintf(size_label, sizeof(size_label), "%zuM", input->size / (1024 * 1024));
+    } else {
+        snprintf(size_label, sizeof(size_label), "%zuK", input->size / 1024);
+    }
+    snprintf(input->label, sizeof(input->label), "%s/%s/%s", size_label, charset_names[input->charset], shape_names[input->shape]);
+    snprintf(input->path, sizeof(input->path), "%s/bench_%s_%s_%s.%s", dir, size_label, charset_names[input->charset], shape_names[input->shape], extension);
+
+    FILE *fp = fopen(input->path, "w");
+    if (!fp) {
+        fprintf(stderr, "bench_generate: unable to create %s\n", input->path);
+        return false;
+    }
+
+    const char **segments = input->charset == BENCH_CHARSET_CJK ? cjk_segments : ascii_segments;
+    size_t line_bytes = input->shape == BENCH_SHAPE_LONG_LINES ? BENCH_LONG_LINE_BYTES : 1;
+    size_t written = 0;
+    size_t line_len = 0;
+    unsigned int seed = 1;
+    char segment[256];
+    while (written + 1 < input->size) {
+        seed = seed * 1103515245 + 12345;
+        unsigned int n = (seed >> 16) & 0x7fff;
+        int len = snprintf(segment, sizeof(segment), segments[n % 3], n, n / 3, n % 97);
+        if (written + len + 1 > input->size) {
+            break;
+        }
+        fwrite(segment, 1, len, fp);
+        written += len;
+        line_len += len;
+        if (line_len >= line_bytes) {
+            fputc('\n', fp);
+            written++;
+            line_len = 0;
+        }
+    }
+    fputc('\n', fp);
+    fclose(fp);
+    return true;
+}
+
+void bench_buffer_load(Buffer *b, const BenchInput *input) {
+    buffer_init(b, input->path);
+    buffer_set_line_num_width(b);
+}
+
+Buffer *bench_activate(Buffer *b) {
+    Buffer *previous = editor.buffers[editor.active_buffer_idx];
+    editor.buffers[editor.active_buffer_idx] = b;
+    return previous;
+}
+
+void bench_stdout_mute(void) {
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd != -1) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+}
+
+void bench_stdout_restore(void) {
+    if (saved_stdout == -1) {
+        return;
+    }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    saved_stdout = -1;
+}
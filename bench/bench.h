@@ -0,0 +1,64 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "../src/buffer.h"
+
+typedef enum {
+    BENCH_CHARSET_ASCII,
+    BENCH_CHARSET_CJK,
+} BenchCharset;
+
+typedef enum {
+    BENCH_SHAPE_MANY_LINES,
+    BENCH_SHAPE_LONG_LINES,
+} BenchShape;
+
+// A generated input file; path carries the extension that picks the grammar.
+typedef struct {
+    size_t size;
+    BenchCharset charset;
+    BenchShape shape;
+    char path[256];
+    char label[64];
+} BenchInput;
+
+typedef struct {
+    const char *filter;
+    int iterations;
+    double budget_ms;
+    bool json;
+} BenchConfig;
+
+extern BenchConfig g_bench_config;
+
+typedef void (*BenchFn)(void *arg);
+
+// Runs fn until g_bench_config.iterations samples are taken or the time
+// budget is spent (at least 3 samples), then prints min/median/mean/p95/stddev.
+// reset, if set, runs untimed before every sample. bytes is used for the
+// throughput column and may be 0.
+void bench_run(const char *name, const BenchInput *input, size_t bytes, BenchFn fn, BenchFn reset, void *arg);
+bool bench_enabled(const char *name);
+
+bool bench_generate(BenchInput *input, const char *dir, const char *extension);
+void bench_buffer_load(Buffer *b, const BenchInput *input);
+
+// Makes b the editor's active buffer and returns the previous one, so kernels
+// that go through editor.c run without opening files or starting LSP servers.
+Buffer *bench_activate(Buffer *b);
+
+// Redirects stdout to /dev/null while drawing.
+void bench_stdout_mute(void);
+void bench_stdout_restore(void);
+
+void bench_buffer_suite(const BenchInput *input);
+void bench_fuzzy_suite(const BenchInput *input);
+void bench_render_suite(const BenchInput *input);
+void bench_git_suite(const BenchInput *input);
+void bench_search_suite(const BenchInput *input);
+void bench_lsp_suite(const BenchInput *input);
+void bench_lsp_storm_suite(void);
+
+#endif
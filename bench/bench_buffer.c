@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../src/editor.h"
+
+typedef struct {
+    const BenchInput *input;
+    Buffer buffer;
+    const char *term;
+    int edits;
+} BufferBench;
+
+static void run_init(void *arg) {
+    BufferBench *bench = arg;
+    Buffer b;
+    buffer_init(&b, bench->input->path);
+    buffer_destroy(&b);
+}
+
+static void run_get_content(void *arg) {
+    BufferBench *bench = arg;
+    free(buffer_get_content(&bench->buffer));
+}
+
+static void reset_search(void *arg) {
+    BufferBench *bench = arg;
+    buffer_clear_search_state(&bench->buffer);
+}
+
+static void run_search(void *arg) {
+    BufferBench *bench = arg;
+    buffer_update_search_matches(&bench->buffer, bench->term);
+}
+
+// Undoes and redoes every edit made by the setup, so each sample leaves the
+// buffer and history as it found them.
+static void run_undo_redo(void *arg) {
+    BufferBench *bench = arg;
+    for (int i = 0; i < bench->edits; i++) {
+        editor_undo();
+    }
+    for (int i = 0; i < bench->edits; i++) {
+        editor_redo();
+    }
+}
+
+static void setup_edits(BufferBench *bench) {
+    Buffer *b = &bench->buffer;
+    int stride = b->line_count / bench->edits;
+    if (stride < 1) stride = 1;
+    for (int i = 0; i < bench->edits; i++) {
+        b->position_y = (i * stride) % b->line_count;
+        b->position_x = 0;
+        editor_insert_char("x");
+    }
+}
+
+void bench_buffer_suite(const BenchInput *input) {
+    BufferBench bench = {
+        .input = input,
+        .term = input->charset == BENCH_CHARSET_CJK ? "漢字" : "value_1",
+        .edits = 100,
+    };
+    bench_run("buffer_init", input, input->size, run_init, NULL, &bench);
+
+    bench_buffer_load(&bench.buffer, input);
+    bench_run("buffer_get_content", input, input->size, run_get_content, NULL, &bench);
+    bench_run("buffer_update_search_matches", input, input->size, run_search, reset_search, &bench);
+    buffer_clear_search_state(&bench.buffer);
+
+    if (bench_enabled("undo_redo")) {
+        Buffer *previous = bench_activate(&bench.buffer);
+        setup_edits(&bench);
+        bench_run("undo_redo", input, 0, run_undo_redo, NULL, &bench);
+        bench_activate(previous);
+    }
+    buffer_destroy(&bench.buffer);
+}
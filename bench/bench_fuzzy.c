@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../src/fuzzy.h"
+
+typedef struct {
+    const char **lines;
+    int line_count;
+    int *indices;
+    const char *query;
+} FuzzyBench;
+
+static void run_fuzzy(void *arg) {
+    FuzzyBench *bench = arg;
+    fuzzy_search(bench->lines, bench->line_count, bench->query, bench->indices);
+}
+
+// Every line of the input is a candidate, like file paths in the file picker.
+void bench_fuzzy_suite(const BenchInput *input) {
+    Buffer buffer;
+    bench_buffer_load(&buffer, input);
+
+    FuzzyBench bench = {
+        .line_count = buffer.line_count,
+        .query = input->charset == BENCH_CHARSET_CJK ? "東都" : "vlcmp",
+    };
+    bench.lines = malloc(sizeof(char *) * buffer.line_count);
+    bench.indices = malloc(sizeof(int) * buffer.line_count);
+    if (!bench.lines || !bench.indices) {
+        fprintf(stderr, "bench_fuzzy_suite: malloc failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < buffer.line_count; i++) {
+        bench.lines[i] = buffer.lines[i]->text;
+    }
+
+    bench_run("fuzzy_search", input, input->size, run_fuzzy, NULL, &bench);
+
+    free(bench.lines);
+    free(bench.indices);
+    buffer_destroy(&buffer);
+}
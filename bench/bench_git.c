@@ -0,0 +1,80 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include "bench.h"
+#include "../src/git.h"
+
+typedef struct {
+    Buffer buffer;
+} GitBench;
+
+static void run_git_diff(void *arg) {
+    GitBench *bench = arg;
+    git_update_diff(&bench->buffer);
+}
+
+static void reset_full_diff(void *arg) {
+    GitBench *bench = arg;
+    git_note_unknown_edit(&bench->buffer);
+}
+
+// A keystroke in the middle of the file, flipping between two texts.
+static void reset_line_edit(void *arg) {
+    GitBench *bench = arg;
+    int y = bench->buffer.line_count / 2;
+    BufferLine *line = bench->buffer.lines[y];
+    if (line->text_len > 0) {
+        line->text[0] = line->text[0] == '@' ? '%' : '@';
+    }
+    git_note_edit(&bench->buffer, y, y, y);
+}
+
+// Commits the input to a scratch repository, modifies one line in a hundred
+// and diffs the buffer against HEAD: in full, then after a one-line edit.
+void bench_git_suite(const BenchInput *input) {
+    if (!bench_enabled("git_update_diff")) {
+        return;
+    }
+
+    char cwd[PATH_MAX];
+    char repo[] = "/tmp/arc_bench_git_XXXXXX";
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(repo)) {
+        fprintf(stderr, "bench_git_suite: unable to create scratch repository\n");
+        return;
+    }
+
+    const char *name = strrchr(input->path, '/') ? strrchr(input->path, '/') + 1 : input->path;
+    char command[PATH_MAX * 3];
+    snprintf(command, sizeof(command),
+             "cp '%s' '%s/%s' && cd '%s' && git init -q && git add '%s' && "
+             "git -c user.name=bench -c user.email=bench@localhost commit -q -m bench",
+             input->path, repo, name, repo, name);
+    if (system(command) != 0 || chdir(repo) != 0) {
+        fprintf(stderr, "bench_git_suite: git setup failed, skipping\n");
+    } else {
+        GitBench bench;
+        BenchInput local = *input;
+        snprintf(local.path, sizeof(local.path), "%s", name);
+        bench_buffer_load(&bench.buffer, &local);
+        for (int i = 0; i < bench.buffer.line_count; i += 100) {
+            if (bench.buffer.lines[i]->text_len > 0) {
+                bench.buffer.lines[i]->text[0] = '#';
+            }
+        }
+        bench_run("git_update_diff", input, input->size, run_git_diff, reset_full_diff, &bench);
+        bench_run("git_update_diff_edit", input, 0, run_git_diff, reset_line_edit, &bench);
+        buffer_destroy(&bench.buffer);
+        if (chdir(cwd) != 0) {
+            fprintf(stderr, "bench_git_suite: unable to restore working directory\n");
+        }
+    }
+
+    snprintf(command, sizeof(command), "rm -rf '%s'", repo);
+    if (system(command) != 0) {
+        fprintf(stderr, "bench_git_suite: unable to remove %s\n", repo);
+    }
+}
@@ -0,0 +1,256 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench.h"
+#include "../src/alloc.h"
+#include "../src/config.h"
+#include "../src/editor.h"
+#include "../src/lsp.h"
+#include "cJSON.h"
+
+#define MOCK_LSP "build/test/mock_lsp"
+#define STORM_FILES 1000
+#define STORM_PER_FILE 10
+
+typedef struct {
+    int fd;
+    size_t bytes;
+} ParseBench;
+
+typedef struct {
+    Config config;
+    int expected;
+} StormBench;
+
+typedef struct {
+    Buffer buffer;
+} DrawBench;
+
+static bool mock_lsp_config(Config *config, const char *args) {
+    if (access(MOCK_LSP, X_OK) != 0) {
+        fprintf(stderr, "bench_lsp: %s is not built (make %s), skipping\n", MOCK_LSP, MOCK_LSP);
+        return false;
+    }
+    config_init(config);
+    char toml[256];
+    int len = snprintf(toml, sizeof(toml), "[lsp]\nc = \"%s %s\"\n", MOCK_LSP, args);
+    config->toml_result = toml_parse(toml, len);
+    return config->toml_result.ok;
+}
+
+static int diagnostic_total(void) {
+    int totals[LSP_DIAGNOSTIC_SEVERITY_COUNT];
+    lsp_diagnostic_totals(totals);
+    int total = 0;
+    for (int i = 0; i < LSP_DIAGNOSTIC_SEVERITY_COUNT; i++) {
+        total += totals[i];
+    }
+    return total;
+}
+
+static bool wait_for_diagnostics(int expected) {
+    struct timespec ts = { 0, 200 * 1000 };
+    for (int i = 0; i < 50000; i++) {
+        if (diagnostic_total() == expected) {
+            return true;
+        }
+        nanosleep(&ts, NULL);
+    }
+    fprintf(stderr, "bench_lsp: timed out waiting for %d diagnostics (have %d)\n", expected, diagnostic_total());
+    return false;
+}
+
+// Writes STORM_FILES framed publishDiagnostics messages, the same shape the
+// mock server sends, to an unlinked temporary file.
+static bool parse_bench_setup(ParseBench *bench) {
+    char path[] = "/tmp/arc_bench_lsp_XXXXXX";
+    bench->fd = mkstemp(path);
+    if (bench->fd == -1) {
+        return false;
+    }
+    unlink(path);
+    FILE *fp = fdopen(dup(bench->fd), "w");
+    if (!fp) {
+        close(bench->fd);
+        return false;
+    }
+
+    size_t capacity = 4096;
+    char *body = malloc(capacity);
+    bench->bytes = 0;
+    for (int file = 0; file < STORM_FILES; file++) {
+        size_t len = 0;
+        for (;;) {
+            len = snprintf(body, capacity,
+                           "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\","
+                           "\"params\":{\"uri\":\"file:///mock_lsp/file%d.c\",\"diagnostics\":[", file);
+            for (int i = 0; i < STORM_PER_FILE && len < capacity; i++) {
+                len += snprintf(body + len, capacity - len,
+                                "%s{\"range\":{\"start\":{\"line\":%d,\"character\":0},"
+                                "\"end\":{\"line\":%d,\"character\":8}},\"severity\":%d,"
+                                "\"message\":\"mock diagnostic %d of round 0: unused variable 'value_%d'\"}",
+                                i ? "," : "", i, i, i % 4 + 1, i, i);
+            }
+            if (len + 4 < capacity) {
+                len += snprintf(body + len, capacity - len, "]}}");
+                break;
+            }
+            capacity *= 2;
+            body = realloc(body, capacity);
+        }
+        bench->bytes += fprintf(fp, "Content-Length: %zu\r\n\r\n", len);
+        bench->bytes += fwrite(body, 1, len, fp);
+    }
+    free(body);
+    fclose(fp);
+    return true;
+}
+
+static void run_parse(void *arg) {
+    ParseBench *bench = arg;
+    lseek(bench->fd, 0, SEEK_SET);
+    LspReader reader;
+    lsp_reader_init(&reader);
+    cJSON *message;
+    while ((message = lsp_reader_next(&reader, bench->fd))) {
+        cJSON_Delete(message);
+    }
+    lsp_reader_destroy(&reader);
+}
+
+// The reader thread's fast path: framing plus the streaming decoder.
+static void run_parse_scan(void *arg) {
+    ParseBench *bench = arg;
+    lseek(bench->fd, 0, SEEK_SET);
+    LspReader reader;
+    lsp_reader_init(&reader);
+    const char *body;
+    size_t len;
+    while (lsp_reader_next_raw(&reader, bench->fd, &body, &len)) {
+        lsp_diagnostics_release(lsp_parse_publish_diagnostics(body, len));
+    }
+    lsp_reader_destroy(&reader);
+}
+
+// Server start and initialize are included; they are small next to the storm.
+static void run_storm(void *arg) {
+    StormBench *bench = arg;
+    lsp_init(&bench->config, "storm.c");
+    wait_for_diagnostics(bench->expected);
+    lsp_shutdown_all();
+}
+
+static long resident_kb(void) {
+    long size = 0, pages = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf(fp, "%ld %ld", &size, &pages) != 2) {
+            pages = 0;
+        }
+        fclose(fp);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Resident size is for the whole process with the storm loaded; the lsp
+// allocation delta is exact but needs ALLOC_STATS=1.
+static void report_storm_memory(StormBench *bench, const BenchInput *input) {
+    AllocStats stats_before;
+    alloc_stats_get(ALLOC_TAG_LSP, &stats_before);
+    lsp_init(&bench->config, "storm.c");
+    wait_for_diagnostics(bench->expected);
+    long rss_kb = resident_kb();
+    AllocStats stats;
+    alloc_stats_get(ALLOC_TAG_LSP, &stats);
+    long long live = (long long)(stats.live_bytes - stats_before.live_bytes);
+    lsp_shutdown_all();
+
+    if (g_bench_config.json) {
+        printf("{\"name\":\"lsp_storm_memory\",\"input\":\"%s\",\"rss_kb\":%ld,\"lsp_live_bytes\":%lld}\n",
+               input->label, rss_kb, alloc_stats_enabled() ? live : -1);
+    } else if (alloc_stats_enabled()) {
+        printf("  %-28s %-22s rss %ld KiB, lsp live %lld bytes\n", "lsp_storm_memory", input->label, rss_kb, live);
+    } else {
+        printf("  %-28s %-22s rss %ld KiB\n", "lsp_storm_memory", input->label, rss_kb);
+    }
+}
+
+// Client-side cost of a diagnostic storm (STORM_FILES files with
+// STORM_PER_FILE diagnostics each): framing and JSON parsing alone, then
+// with the streaming decoder, then ingestion end to end against the mock
+// server.
+void bench_lsp_storm_suite(void) {
+    BenchInput input = { 0 };
+    snprintf(input.label, sizeof(input.label), "%dx%d", STORM_FILES, STORM_PER_FILE);
+
+    ParseBench parse;
+    if (bench_enabled("lsp_parse") && parse_bench_setup(&parse)) {
+        bench_run("lsp_parse", &input, parse.bytes, run_parse, NULL, &parse);
+        bench_run("lsp_parse_scan", &input, parse.bytes, run_parse_scan, NULL, &parse);
+        close(parse.fd);
+    }
+
+    if (!bench_enabled("lsp_storm")) {
+        return;
+    }
+    StormBench storm = { .expected = STORM_FILES * STORM_PER_FILE };
+    char args[64];
+    snprintf(args, sizeof(args), "storm %d %d", STORM_FILES, STORM_PER_FILE);
+    if (!mock_lsp_config(&storm.config, args)) {
+        return;
+    }
+    bench_run("lsp_storm_ingest", &input, 0, run_storm, NULL, &storm);
+    report_storm_memory(&storm, &input);
+    config_destroy(&storm.config);
+}
+
+static void reset_draw(void *arg) {
+    DrawBench *bench = arg;
+    bench->buffer.needs_draw = 1;
+}
+
+static void run_editor_draw(void *arg) {
+    (void)arg;
+    bench_stdout_mute();
+    editor_draw();
+    bench_stdout_restore();
+}
+
+// Frame time with no language server, then with the storm loaded and the
+// input itself carrying diagnostics.
+void bench_lsp_suite(const BenchInput *input) {
+    if (!bench_enabled("editor_draw")) {
+        return;
+    }
+    DrawBench bench;
+    bench_buffer_load(&bench.buffer, input);
+    if (bench.buffer.parser) {
+        buffer_parse(&bench.buffer);
+    }
+    bench.buffer.needs_parse = 0;
+    Buffer *previous = bench_activate(&bench.buffer);
+    bench_run("editor_draw", input, 0, run_editor_draw, reset_draw, &bench);
+
+    Config config;
+    char args[64];
+    snprintf(args, sizeof(args), "storm %d %d", STORM_FILES, STORM_PER_FILE);
+    if (mock_lsp_config(&config, args)) {
+        lsp_init(&config, input->path);
+        char *content = buffer_get_content(&bench.buffer);
+        lsp_did_open(buffer_get_absolute_path(&bench.buffer), "c", content);
+        free(content);
+        if (wait_for_diagnostics(STORM_FILES * STORM_PER_FILE + STORM_PER_FILE)) {
+            bench_run("editor_draw_storm", input, 0, run_editor_draw, reset_draw, &bench);
+        }
+        lsp_shutdown_all();
+        config_destroy(&config);
+    }
+
+    bench_activate(previous);
+    buffer_destroy(&bench.buffer);
+}
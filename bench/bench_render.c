@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "bench.h"
+#include "../src/editor.h"
+#include "../src/lsp.h"
+
+void draw_buffer(const Diagnostic *diagnostics, int diagnostics_count);
+
+typedef struct {
+    Buffer buffer;
+} RenderBench;
+
+static void reset_highlight(void *arg) {
+    RenderBench *bench = arg;
+    for (int i = 0; i < bench->buffer.line_count; i++) {
+        bench->buffer.lines[i]->needs_highlight = 1;
+    }
+}
+
+static void run_highlight(void *arg) {
+    RenderBench *bench = arg;
+    Buffer *b = &bench->buffer;
+    uint32_t start_byte = 0;
+    for (int i = 0; i < b->line_count; i++) {
+        buffer_line_apply_syntax_highlighting(b, b->lines[i], start_byte, &editor.current_theme);
+        start_byte += b->lines[i]->text_len + 1;
+    }
+}
+
+static void run_draw(void *arg) {
+    (void)arg;
+    bench_stdout_mute();
+    draw_buffer(NULL, 0);
+    bench_stdout_restore();
+}
+
+void bench_render_suite(const BenchInput *input) {
+    RenderBench bench;
+    bench_buffer_load(&bench.buffer, input);
+    if (bench.buffer.parser) {
+        buffer_parse(&bench.buffer);
+    }
+
+    bench_run("highlight", input, input->size, run_highlight, reset_highlight, &bench);
+
+    // A full-screen frame from the middle of the file, highlighting included.
+    Buffer *previous = bench_activate(&bench.buffer);
+    bench.buffer.position_y = bench.buffer.line_count / 2;
+    bench.buffer.offset_y = bench.buffer.position_y;
+    buffer_reset_offset_y(&bench.buffer, editor.screen_rows);
+    bench_run("draw_buffer", input, 0, run_draw, reset_highlight, &bench);
+    bench_activate(previous);
+
+    buffer_destroy(&bench.buffer);
+}
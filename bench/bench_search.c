@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../src/project_search.h"
+
+#define BENCH_SEARCH_FILES 64
+
+typedef struct {
+    char *paths[BENCH_SEARCH_FILES];
+    const char *query;
+} SearchBench;
+
+static void run_search(void *arg) {
+    SearchBench *bench = arg;
+    project_search_start(bench->paths, BENCH_SEARCH_FILES, bench->query, NULL);
+    project_search_wait();
+}
+
+// The input listed as many files, like a project in the page cache: once for
+// a query found on some lines, once for one found nowhere.
+void bench_search_suite(const BenchInput *input) {
+    SearchBench bench = {
+        .query = input->charset == BENCH_CHARSET_CJK ? "東京都" : "limit_1",
+    };
+    for (int i = 0; i < BENCH_SEARCH_FILES; i++) {
+        bench.paths[i] = (char *)input->path;
+    }
+    bench_run("project_search", input, input->size * BENCH_SEARCH_FILES, run_search, NULL, &bench);
+    bench.query = "zqxj";
+    bench_run("project_search_miss", input, input->size * BENCH_SEARCH_FILES, run_search, NULL, &bench);
+    project_search_stop();
+}
@@ -0,0 +1,123 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench.h"
+#include "../src/editor.h"
+
+#define BENCH_MAX_SIZES 16
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: bench_runner [--sizes 1K,64K,1M] [--charset ascii|cjk|all] [--shape lines|long|all]\n"
+            "                    [--filter NAME] [--iterations N>=3] [--budget-ms N] [--json]\n");
+}
+
+static size_t parse_size(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    switch (*end) {
+        case 'k': case 'K': value *= 1024; break;
+        case 'm': case 'M': value *= 1024 * 1024; break;
+        case 'g': case 'G': value *= 1024 * 1024 * 1024; break;
+    }
+    return value > 0 ? (size_t)value : 0;
+}
+
+static int parse_sizes(char *list, size_t *sizes) {
+    int count = 0;
+    char *save = NULL;
+    for (char *item = strtok_r(list, ",", &save); item && count < BENCH_MAX_SIZES; item = strtok_r(NULL, ",", &save)) {
+        size_t size = parse_size(item);
+        if (size == 0) {
+            return -1;
+        }
+        sizes[count++] = size;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    size_t sizes[BENCH_MAX_SIZES] = { 1024, 64 * 1024, 1024 * 1024 };
+    int size_count = 3;
+    int charset_from = BENCH_CHARSET_ASCII, charset_to = BENCH_CHARSET_CJK;
+    int shape_from = BENCH_SHAPE_MANY_LINES, shape_to = BENCH_SHAPE_LONG_LINES;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--json") == 0) {
+            g_bench_config.json = true;
+        } else if (!value) {
+            usage();
+            return 1;
+        } else if (strcmp(arg, "--sizes") == 0) {
+            size_count = parse_sizes(argv[++i], sizes);
+        } else if (strcmp(arg, "--filter") == 0) {
+            g_bench_config.filter = argv[++i];
+        } else if (strcmp(arg, "--iterations") == 0) {
+            g_bench_config.iterations = atoi(argv[++i]);
+            if (g_bench_config.iterations < 3) {
+                size_count = -1;
+            }
+        } else if (strcmp(arg, "--budget-ms") == 0) {
+            g_bench_config.budget_ms = atof(argv[++i]);
+        } else if (strcmp(arg, "--charset") == 0) {
+            i++;
+            if (strcmp(value, "ascii") == 0) charset_to = BENCH_CHARSET_ASCII;
+            else if (strcmp(value, "cjk") == 0) charset_from = BENCH_CHARSET_CJK;
+            else if (strcmp(value, "all") != 0) size_count = -1;
+        } else if (strcmp(arg, "--shape") == 0) {
+            i++;
+            if (strcmp(value, "lines") == 0) shape_to = BENCH_SHAPE_MANY_LINES;
+            else if (strcmp(value, "long") == 0) shape_from = BENCH_SHAPE_LONG_LINES;
+            else if (strcmp(value, "all") != 0) size_count = -1;
+        } else {
+            size_count = -1;
+        }
+        if (size_count <= 0) {
+            usage();
+            return 1;
+        }
+    }
+
+    char dir[] = "/tmp/arc_bench_XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "bench: unable to create %s\n", dir);
+        return 1;
+    }
+
+    // editor_init sets the cursor shape, which would corrupt --json output.
+    bench_stdout_mute();
+    editor_init(NULL, true);
+    editor_set_screen_size(40, 120);
+    bench_stdout_restore();
+
+    if (!g_bench_config.json) {
+        printf("  %-28s %-22s %4s %10s %10s %10s %10s %10s %10s\n",
+               "benchmark", "input", "n", "min ms", "median ms", "mean ms", "p95 ms", "stddev ms", "MB/s");
+    }
+    bench_lsp_storm_suite();
+    for (int s = 0; s < size_count; s++) {
+        for (int charset = charset_from; charset <= charset_to; charset++) {
+            for (int shape = shape_from; shape <= shape_to; shape++) {
+                BenchInput input = { .size = sizes[s], .charset = charset, .shape = shape };
+                if (!bench_generate(&input, dir, "c")) {
+                    continue;
+                }
+                bench_buffer_suite(&input);
+                bench_fuzzy_suite(&input);
+                bench_render_suite(&input);
+                bench_git_suite(&input);
+                bench_search_suite(&input);
+                bench_lsp_suite(&input);
+                unlink(input.path);
+            }
+        }
+    }
+
+    rmdir(dir);
+    return 0;
+}
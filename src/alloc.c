@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "alloc.h"
+#include "log.h"
+
+static const char *tag_names[ALLOC_TAG_COUNT] = {
+    [ALLOC_TAG_BUFFER] = "buffer",
+    [ALLOC_TAG_EDITOR] = "editor",
+    [ALLOC_TAG_HISTORY] = "history",
+    [ALLOC_TAG_LSP] = "lsp",
+    [ALLOC_TAG_GIT] = "git",
+    [ALLOC_TAG_PICKER] = "picker",
+    [ALLOC_TAG_CONFIG] = "config",
+};
+
+static atomic_uint_fast64_t keystrokes = 0;
+
+const char *alloc_tag_name(AllocTag tag) {
+    return tag_names[tag];
+}
+
+void alloc_note_keystroke(void) {
+    atomic_fetch_add_explicit(&keystrokes, 1, memory_order_relaxed);
+}
+
+uint64_t alloc_keystrokes(void) {
+    return atomic_load_explicit(&keystrokes, memory_order_relaxed);
+}
+
+#ifdef ARC_ALLOC_STATS
+
+#define ALLOC_MAP_INITIAL_CAPACITY 4096
+#define ALLOC_SLOT_EMPTY 0
+#define ALLOC_SLOT_DELETED 1
+
+// Live allocations by address, so frees are charged to the tag that
+// allocated the block even when another subsystem releases it. Pointers that
+// are not in the map (getline buffers, library allocations) are freed
+// without being counted.
+typedef struct {
+    uintptr_t ptr;
+    size_t size;
+    AllocTag tag;
+} AllocEntry;
+
+static struct {
+    atomic_uint_fast64_t allocations;
+    atomic_uint_fast64_t frees;
+    atomic_uint_fast64_t bytes;
+    atomic_int_fast64_t live_bytes;
+} stats[ALLOC_TAG_COUNT];
+
+static pthread_mutex_t map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static AllocEntry *map = NULL;
+static size_t map_capacity = 0;
+static size_t map_used = 0; // live entries and tombstones
+
+static size_t hash_ptr(uintptr_t ptr) {
+    uint64_t h = (uint64_t)ptr >> 4;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+static void map_insert_entry(AllocEntry *entries, size_t capacity, AllocEntry entry) {
+    size_t i = hash_ptr(entry.ptr) & (capacity - 1);
+    while (entries[i].ptr > ALLOC_SLOT_DELETED) {
+        i = (i + 1) & (capacity - 1);
+    }
+    entries[i] = entry;
+}
+
+// Rehashes to drop tombstones, doubling only if the map is really filling up.
+static void map_grow(void) {
+    size_t live = 0;
+    for (size_t i = 0; i < map_capacity; i++) {
+        if (map[i].ptr > ALLOC_SLOT_DELETED) live++;
+    }
+    size_t capacity = map_capacity ? map_capacity : ALLOC_MAP_INITIAL_CAPACITY;
+    if (live * 2 >= capacity) {
+        capacity *= 2;
+    }
+    AllocEntry *entries = calloc(capacity, sizeof(AllocEntry));
+    if (!entries) {
+        log_error("alloc.map_grow: calloc failed");
+        exit(1);
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < map_capacity; i++) {
+        if (map[i].ptr > ALLOC_SLOT_DELETED) {
+            map_insert_entry(entries, capacity, map[i]);
+            used++;
+        }
+    }
+    free(map);
+    map = entries;
+    map_capacity = capacity;
+    map_used = used;
+}
+
+static void map_put(void *ptr, size_t size, AllocTag tag) {
+    pthread_mutex_lock(&map_mutex);
+    if ((map_used + 1) * 4 >= map_capacity * 3) {
+        map_grow();
+    }
+    map_insert_entry(map, map_capacity, (AllocEntry){ .ptr = (uintptr_t)ptr, .size = size, .tag = tag });
+    map_used++;
+    pthread_mutex_unlock(&map_mutex);
+}
+
+static bool map_take(void *ptr, AllocEntry *out) {
+    bool found = false;
+    pthread_mutex_lock(&map_mutex);
+    if (map_capacity) {
+        size_t i = hash_ptr((uintptr_t)ptr) & (map_capacity - 1);
+        while (map[i].ptr != ALLOC_SLOT_EMPTY) {
+            if (map[i].ptr == (uintptr_t)ptr) {
+                *out = map[i];
+                map[i].ptr = ALLOC_SLOT_DELETED;
+                found = true;
+                break;
+            }
+            i = (i + 1) & (map_capacity - 1);
+        }
+    }
+    pthread_mutex_unlock(&map_mutex);
+    return found;
+}
+
+static void count_allocation(AllocTag tag, void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&stats[tag].allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats[tag].bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats[tag].live_bytes, size, memory_order_relaxed);
+    map_put(ptr, size, tag);
+}
+
+static void count_release(const AllocEntry *entry, bool is_free) {
+    if (is_free) {
+        atomic_fetch_add_explicit(&stats[entry->tag].frees, 1, memory_order_relaxed);
+    }
+    atomic_fetch_sub_explicit(&stats[entry->tag].live_bytes, entry->size, memory_order_relaxed);
+}
+
+void *alloc_malloc(AllocTag tag, size_t size) {
+    void *ptr = malloc(size);
+    if (ptr) {
+        count_allocation(tag, ptr, size);
+    }
+    return ptr;
+}
+
+void *alloc_calloc(AllocTag tag, size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (ptr) {
+        count_allocation(tag, ptr, count * size);
+    }
+    return ptr;
+}
+
+void *alloc_realloc(AllocTag tag, void *ptr, size_t size) {
+    AllocEntry old;
+    bool tracked = ptr && map_take(ptr, &old);
+    void *new_ptr = realloc(ptr, size);
+    if (!new_ptr) {
+        if (tracked && size != 0) {
+            map_put(ptr, old.size, old.tag);
+        } else if (tracked) {
+            count_release(&old, true);
+        }
+        return NULL;
+    }
+    if (tracked) {
+        count_release(&old, false);
+    }
+    count_allocation(tag, new_ptr, size);
+    return new_ptr;
+}
+
+char *alloc_strdup(AllocTag tag, const char *s) {
+    char *copy = strdup(s);
+    if (copy) {
+        count_allocation(tag, copy, strlen(copy) + 1);
+    }
+    return copy;
+}
+
+void alloc_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    AllocEntry entry;
+    if (map_take(ptr, &entry)) {
+        count_release(&entry, true);
+    }
+    free(ptr);
+}
+
+bool alloc_stats_enabled(void) {
+    return true;
+}
+
+void alloc_stats_get(AllocTag tag, AllocStats *out) {
+    out->allocations = atomic_load_explicit(&stats[tag].allocations, memory_order_relaxed);
+    out->frees = atomic_load_explicit(&stats[tag].frees, memory_order_relaxed);
+    out->bytes = atomic_load_explicit(&stats[tag].bytes, memory_order_relaxed);
+    out->live_bytes = atomic_load_explicit(&stats[tag].live_bytes, memory_order_relaxed);
+}
+
+#else
+
+bool alloc_stats_enabled(void) {
+    return false;
+}
+
+void alloc_stats_get(AllocTag tag, AllocStats *out) {
+    (void)tag;
+    memset(out, 0, sizeof(*out));
+}
+
+#endif
+
+void alloc_stats_total(AllocStats *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < ALLOC_TAG_COUNT; i++) {
+        AllocStats tag_stats;
+        alloc_stats_get(i, &tag_stats);
+        out->allocations += tag_stats.allocations;
+        out->frees += tag_stats.frees;
+        out->bytes += tag_stats.bytes;
+        out->live_bytes += tag_stats.live_bytes;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Optional allocation accounting, built with -DARC_ALLOC_STATS
+// (make ALLOC_STATS=1). A source file opts in by defining ALLOC_TAG before
+// including this header, after all system headers:
+//
+//   #define ALLOC_TAG ALLOC_TAG_BUFFER
+//   #include "alloc.h"
+//
+// malloc, calloc, realloc, strdup and free in that file are then routed
+// through counting wrappers. Without ARC_ALLOC_STATS the macros are not
+// defined and the stats functions report nothing.
+
+typedef enum {
+    ALLOC_TAG_BUFFER,
+    ALLOC_TAG_EDITOR,
+    ALLOC_TAG_HISTORY,
+    ALLOC_TAG_LSP,
+    ALLOC_TAG_GIT,
+    ALLOC_TAG_PICKER,
+    ALLOC_TAG_CONFIG,
+    ALLOC_TAG_COUNT,
+} AllocTag;
+
+typedef struct {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes;
+    int64_t live_bytes;
+} AllocStats;
+
+bool alloc_stats_enabled(void);
+const char *alloc_tag_name(AllocTag tag);
+void alloc_stats_get(AllocTag tag, AllocStats *out);
+void alloc_stats_total(AllocStats *out);
+
+// Called once per key handled, so allocations can be reported per keystroke.
+void alloc_note_keystroke(void);
+uint64_t alloc_keystrokes(void);
+
+#ifdef ARC_ALLOC_STATS
+void *alloc_malloc(AllocTag tag, size_t size);
+void *alloc_calloc(AllocTag tag, size_t count, size_t size);
+void *alloc_realloc(AllocTag tag, void *ptr, size_t size);
+char *alloc_strdup(AllocTag tag, const char *s);
+void alloc_free(void *ptr);
+
+#ifdef ALLOC_TAG
+#define malloc(size) alloc_malloc(ALLOC_TAG, (size))
+#define calloc(count, size) alloc_calloc(ALLOC_TAG, (count), (size))
+#define realloc(ptr, size) alloc_realloc(ALLOC_TAG, (ptr), (size))
+#define strdup(s) alloc_strdup(ALLOC_TAG, (s))
+#define free(ptr) alloc_free(ptr)
+#endif
+#endif
+
+#endif
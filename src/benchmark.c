@@ -0,0 +1,486 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "benchmark.h"
+#include "editor.h"
+#include "utf8.h"
+#include "log.h"
+#include "perf.h"
+#include "alloc.h"
+#include "cJSON.h"
+
+#define BENCHMARK_DEFAULT_ROWS 40
+#define BENCHMARK_DEFAULT_COLS 120
+#define BENCHMARK_INSERT_TEXT "the quick brown fox jumps over the lazy dog "
+
+typedef enum {
+    REDRAW_KEY,
+    REDRAW_OP,
+    REDRAW_OFF,
+} RedrawMode;
+
+// Phases reported with hardware counters, and the span that measures each.
+static const struct {
+    const char *phase;
+    const char *span;
+} phases[] = {
+    { "load", "load" },
+    { "parse", "parse" },
+    { "highlight", "highlight" },
+    { "render", "draw" },
+    { "search", "search" },
+};
+
+#define PHASE_COUNT (sizeof(phases) / sizeof(phases[0]))
+
+typedef struct {
+    RedrawMode redraw;
+    bool quit;
+    long keystrokes;
+    double draw_ms;
+    bool counting;
+    PerfCounters counters[PHASE_COUNT];
+    AllocStats allocations;
+} BenchmarkState;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
+
+// Mirrors one iteration of the render loop; output goes to /dev/null.
+static void draw_frame(BenchmarkState *state, bool force) {
+    double start = now_ms();
+    if (force || atomic_exchange(&editor.redraw_requested, 0)) {
+        editor_needs_draw();
+    }
+    editor_draw();
+    state->draw_ms += now_ms() - start;
+}
+
+static void feed_key(BenchmarkState *state, const char *key) {
+    if (state->quit) {
+        return;
+    }
+    state->keystrokes++;
+    alloc_note_keystroke();
+    if (!editor_handle_input(key)) {
+        state->quit = true;
+        return;
+    }
+    if (state->redraw == REDRAW_KEY) {
+        draw_frame(state, false);
+    }
+}
+
+// Feeds every UTF-8 character of keys as a separate keystroke.
+static void feed_keys(BenchmarkState *state, const char *keys, size_t len) {
+    const char *p = keys;
+    const char *end = keys + len;
+    while (p < end && !state->quit) {
+        char key[8];
+        int key_len = utf8_char_len(p);
+        if (key_len <= 0 || p + key_len > end || key_len >= (int)sizeof(key)) {
+            key_len = 1;
+        }
+        memcpy(key, p, key_len);
+        key[key_len] = '\0';
+        feed_key(state, key);
+        p += key_len;
+    }
+}
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+// Decodes script escapes in place and returns the decoded length.
+static size_t unescape(char *text) {
+    char *out = text;
+    for (char *p = text; *p; p++) {
+        if (*p != '\\' || p[1] == '\0') {
+            *out++ = *p;
+            continue;
+        }
+        p++;
+        switch (*p) {
+            case 'e': *out++ = 27; break;
+            case 'r': *out++ = '\r'; break;
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            case 'x':
+                if (hex_value(p[1]) >= 0 && hex_value(p[2]) >= 0) {
+                    *out++ = (char)(hex_value(p[1]) * 16 + hex_value(p[2]));
+                    p += 2;
+                    break;
+                }
+                *out++ = 'x';
+                break;
+            default: *out++ = *p; break;
+        }
+    }
+    *out = '\0';
+    return out - text;
+}
+
+static long parse_count(const char *arg) {
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || value < 0) {
+        return -1;
+    }
+    return (long)value;
+}
+
+static void feed_count_key(BenchmarkState *state, long count, const char *key) {
+    char digits[32];
+    snprintf(digits, sizeof(digits), "%ld", count);
+    feed_keys(state, digits, strlen(digits));
+    feed_key(state, key);
+}
+
+static char *next_word(char **args) {
+    char *p = *args;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0') {
+        *args = p;
+        return NULL;
+    }
+    char *word = p;
+    while (*p && *p != ' ' && *p != '\t') p++;
+    if (*p) {
+        *p++ = '\0';
+    }
+    while (*p == ' ' || *p == '\t') p++;
+    *args = p;
+    return word;
+}
+
+// Returns false if the op is malformed.
+static bool run_op(BenchmarkState *state, char *op, char *args) {
+    if (strcmp(op, "open") == 0) {
+        if (*args == '\0') return false;
+        editor_open(args);
+    } else if (strcmp(op, "keys") == 0) {
+        size_t len = unescape(args);
+        feed_keys(state, args, len);
+    } else if (strcmp(op, "goto") == 0) {
+        long line = parse_count(args);
+        if (line < 1) return false;
+        Buffer *b = editor_get_active_buffer();
+        feed_key(state, "\x1b");
+        if (b->position_y > 0) {
+            feed_count_key(state, b->position_y, "\x15");
+        }
+        if (line > 1) {
+            feed_count_key(state, line - 1, "\x04");
+        }
+    } else if (strcmp(op, "insert") == 0) {
+        char *count_arg = next_word(&args);
+        long count = count_arg ? parse_count(count_arg) : -1;
+        if (count < 0) return false;
+        const char *text = BENCHMARK_INSERT_TEXT;
+        size_t text_len = strlen(text);
+        if (*args) {
+            text_len = unescape(args);
+            text = args;
+        }
+        feed_key(state, "i");
+        const char *p = text;
+        for (long i = 0; i < count && !state->quit; i++) {
+            char key[8];
+            int key_len = utf8_char_len(p);
+            if (key_len <= 0 || key_len >= (int)sizeof(key)) {
+                key_len = 1;
+            }
+            memcpy(key, p, key_len);
+            key[key_len] = '\0';
+            feed_key(state, key);
+            p += key_len;
+            if (p >= text + text_len) {
+                p = text;
+            }
+        }
+        feed_key(state, "\x1b");
+    } else if (strcmp(op, "undo-all") == 0) {
+        Buffer *b = editor_get_active_buffer();
+        while (b->history->undo_stack.count > 0 && !state->quit) {
+            feed_key(state, "u");
+        }
+    } else if (strcmp(op, "search") == 0) {
+        if (*args == '\0') return false;
+        size_t len = unescape(args);
+        feed_key(state, "/");
+        feed_keys(state, args, len);
+        feed_key(state, "\r");
+    } else if (strcmp(op, "scroll") == 0) {
+        long count = *args ? parse_count(args) : 1;
+        if (count < 0) return false;
+        for (long i = 0; i < count && !state->quit; i++) {
+            feed_key(state, "\x04");
+        }
+    } else if (strcmp(op, "draw") == 0) {
+        draw_frame(state, true);
+    } else if (strcmp(op, "set") == 0) {
+        char *name = next_word(&args);
+        if (!name) return false;
+        if (strcmp(name, "redraw") == 0) {
+            if (strcmp(args, "key") == 0) state->redraw = REDRAW_KEY;
+            else if (strcmp(args, "op") == 0) state->redraw = REDRAW_OP;
+            else if (strcmp(args, "off") == 0) state->redraw = REDRAW_OFF;
+            else return false;
+        } else if (strcmp(name, "size") == 0) {
+            char *rows = next_word(&args);
+            char *cols = next_word(&args);
+            if (!rows || !cols || atoi(rows) <= 0 || atoi(cols) <= 0) return false;
+            editor_set_screen_size(atoi(rows), atoi(cols));
+        } else {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static char *read_script(const char *script, bool *from_file) {
+    FILE *fp = fopen(script, "r");
+    *from_file = fp != NULL;
+    if (!fp) {
+        return strdup(script);
+    }
+    size_t capacity = 4096;
+    size_t len = 0;
+    char *text = malloc(capacity);
+    if (!text) {
+        log_error("benchmark.read_script: malloc failed");
+        exit(1);
+    }
+    size_t n;
+    while ((n = fread(text + len, 1, capacity - len - 1, fp)) > 0) {
+        len += n;
+        if (len + 1 == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+            if (!text) {
+                log_error("benchmark.read_script: realloc failed");
+                exit(1);
+            }
+        }
+    }
+    text[len] = '\0';
+    fclose(fp);
+    return text;
+}
+
+static void snapshot_counters(PerfCounters counters[PHASE_COUNT]) {
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+        perf_counters_get(phases[i].span, &counters[i]);
+    }
+}
+
+// Counter deltas per phase between two snapshots; phases that did not run are
+// left out and counters the machine does not have are null.
+static cJSON *counters_to_json(const PerfCounters before[PHASE_COUNT], const PerfCounters after[PHASE_COUNT]) {
+    cJSON *json = cJSON_CreateObject();
+    for (size_t i = 0; i < PHASE_COUNT; i++) {
+        uint64_t calls = after[i].calls - before[i].calls;
+        if (calls == 0) {
+            continue;
+        }
+        cJSON *phase = cJSON_CreateObject();
+        cJSON_AddNumberToObject(phase, "calls", calls);
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++) {
+            if (perf_counter_available(c)) {
+                cJSON_AddNumberToObject(phase, perf_counter_name(c), after[i].values[c] - before[i].values[c]);
+            } else {
+                cJSON_AddNullToObject(phase, perf_counter_name(c));
+            }
+        }
+        cJSON_AddItemToObject(json, phases[i].phase, phase);
+    }
+    return json;
+}
+
+static void add_timing(cJSON *item, double latency_ms, BenchmarkState *state) {
+    cJSON_AddNumberToObject(item, "latency_ms", latency_ms);
+    cJSON_AddNumberToObject(item, "keystrokes", state->keystrokes);
+    if (state->keystrokes > 0 && latency_ms > 0) {
+        cJSON_AddNumberToObject(item, "keys_per_sec", state->keystrokes / (latency_ms / 1000.0));
+    }
+    cJSON_AddNumberToObject(item, "draw_ms", state->draw_ms);
+    cJSON_AddNumberToObject(item, "peak_rss_kb", peak_rss_kb());
+    if (alloc_stats_enabled()) {
+        AllocStats now;
+        alloc_stats_total(&now);
+        cJSON *allocations = cJSON_CreateObject();
+        uint64_t count = now.allocations - state->allocations.allocations;
+        cJSON_AddNumberToObject(allocations, "count", count);
+        cJSON_AddNumberToObject(allocations, "bytes", now.bytes - state->allocations.bytes);
+        if (state->keystrokes > 0) {
+            cJSON_AddNumberToObject(allocations, "per_keystroke", (double)count / state->keystrokes);
+        }
+        cJSON_AddItemToObject(item, "allocations", allocations);
+        state->allocations = now;
+    }
+    if (state->counting) {
+        PerfCounters now[PHASE_COUNT];
+        snapshot_counters(now);
+        cJSON_AddItemToObject(item, "counters", counters_to_json(state->counters, now));
+        memcpy(state->counters, now, sizeof(now));
+    }
+}
+
+int benchmark_run(char *file_name, const char *script) {
+    // Everything the editor draws goes to /dev/null; the report goes to the
+    // original stdout.
+    fflush(stdout);
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (report_fd == -1 || null_fd == -1) {
+        fprintf(stderr, "arc: benchmark: unable to redirect stdout\n");
+        return 1;
+    }
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+
+    BenchmarkState state = { .redraw = REDRAW_OP };
+    cJSON *report = cJSON_CreateObject();
+    cJSON *ops = cJSON_CreateArray();
+    cJSON_AddStringToObject(report, "version", EDITOR_VERSION);
+    if (file_name) {
+        cJSON_AddStringToObject(report, "file", file_name);
+    } else {
+        cJSON_AddNullToObject(report, "file");
+    }
+
+    // Counter reads add a syscall at every span boundary on this thread.
+    const char *counters_reason = "built with NO_PERF";
+#ifndef ARC_NO_PERF
+    state.counting = perf_counters_open(&counters_reason);
+#endif
+
+    double run_start = now_ms();
+    PERF_START("load");
+    editor_init(file_name, true);
+    PERF_END();
+    editor_set_screen_size(BENCHMARK_DEFAULT_ROWS, BENCHMARK_DEFAULT_COLS);
+    cJSON *load = cJSON_CreateObject();
+    cJSON_AddStringToObject(load, "op", "load");
+    add_timing(load, now_ms() - run_start, &state);
+    cJSON_AddItemToArray(ops, load);
+
+    int status = 0;
+    // Inline scripts separate ops with ';', script files with newlines only so
+    // keys can contain ';'.
+    bool from_file = false;
+    char *text = script ? read_script(script, &from_file) : NULL;
+    const char *separators = from_file ? "\n" : ";\n";
+    char *save = NULL;
+    for (char *line = text ? strtok_r(text, separators, &save) : NULL; line && !state.quit; line = strtok_r(NULL, separators, &save)) {
+        char *args = line;
+        while (*args == ' ' || *args == '\t') args++;
+        if (*args == '\0' || *args == '#') {
+            continue;
+        }
+        size_t line_len = strlen(args);
+        while (line_len > 0 && (args[line_len - 1] == ' ' || args[line_len - 1] == '\t' || args[line_len - 1] == '\r')) {
+            args[--line_len] = '\0';
+        }
+        char *description = strdup(args);
+        char *op = next_word(&args);
+
+        state.keystrokes = 0;
+        state.draw_ms = 0;
+        double start = now_ms();
+        bool ok = run_op(&state, op, args);
+        if (ok && state.redraw == REDRAW_OP && strcmp(op, "draw") != 0 && strcmp(op, "set") != 0) {
+            draw_frame(&state, false);
+        }
+        double latency_ms = now_ms() - start;
+
+        if (!ok) {
+            fprintf(stderr, "arc: benchmark: invalid op '%s'\n", description);
+            free(description);
+            status = 1;
+            break;
+        }
+        if (strcmp(op, "set") != 0) {
+            cJSON *item = cJSON_CreateObject();
+            cJSON_AddStringToObject(item, "op", description);
+            add_timing(item, latency_ms, &state);
+            cJSON_AddItemToArray(ops, item);
+        }
+        free(description);
+    }
+    free(text);
+
+    cJSON_AddItemToObject(report, "ops", ops);
+    cJSON_AddNumberToObject(report, "total_ms", now_ms() - run_start);
+    cJSON_AddNumberToObject(report, "peak_rss_kb", peak_rss_kb());
+    if (alloc_stats_enabled()) {
+        cJSON *allocations = cJSON_CreateObject();
+        uint64_t keystrokes = alloc_keystrokes();
+        for (int i = 0; i <= ALLOC_TAG_COUNT; i++) {
+            AllocStats stats;
+            if (i == ALLOC_TAG_COUNT) {
+                alloc_stats_total(&stats);
+            } else {
+                alloc_stats_get(i, &stats);
+            }
+            cJSON *tag = cJSON_CreateObject();
+            cJSON_AddNumberToObject(tag, "count", stats.allocations);
+            cJSON_AddNumberToObject(tag, "bytes", stats.bytes);
+            cJSON_AddNumberToObject(tag, "live_bytes", stats.live_bytes);
+            if (keystrokes > 0) {
+                cJSON_AddNumberToObject(tag, "per_keystroke", (double)stats.allocations / keystrokes);
+            }
+            cJSON_AddItemToObject(allocations, i == ALLOC_TAG_COUNT ? "total" : alloc_tag_name(i), tag);
+        }
+        cJSON_AddItemToObject(report, "allocations", allocations);
+    } else {
+        cJSON_AddNullToObject(report, "allocations");
+    }
+    if (state.counting) {
+        PerfCounters zero[PHASE_COUNT] = {0};
+        PerfCounters totals[PHASE_COUNT];
+        snapshot_counters(totals);
+        cJSON_AddItemToObject(report, "counters", counters_to_json(zero, totals));
+        perf_counters_close();
+    } else {
+        cJSON_AddNullToObject(report, "counters");
+        cJSON_AddStringToObject(report, "counters_unavailable", counters_reason);
+    }
+
+    fflush(stdout);
+    dup2(report_fd, STDOUT_FILENO);
+    close(report_fd);
+    char *json = cJSON_PrintUnformatted(report);
+    if (json) {
+        printf("%s\n", json);
+        free(json);
+    }
+    fflush(stdout);
+    cJSON_Delete(report);
+    return status;
+}
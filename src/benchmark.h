@@ -0,0 +1,26 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Headless workload replay for --benchmark. script is either a path to a
+// script file (one op per line) or the script itself (ops separated by ';'):
+//
+//   open PATH          open a file in a new buffer
+//   keys TEXT          feed raw keys (\e, \r, \n, \t, \\ and \xHH escapes)
+//   goto N             jump to line N (1-based, accepts 1e5)
+//   insert N [TEXT]    insert N characters, cycling through TEXT
+//   undo-all           press u until the undo stack is empty
+//   search TERM        forward search for TERM
+//   scroll N           scroll down N half pages
+//   draw               draw one frame
+//   set redraw MODE    draw after every key, after every op, or never
+//                      (key | op | off, default op)
+//   set size ROWS COLS screen size used for drawing (default 40 120)
+//
+// Results are printed to stdout as JSON. Where perf_event_open is allowed,
+// every op also reports cycles, instructions, cache misses, branch misses and
+// page faults per phase (load, parse, highlight, render, search). Builds with
+// ALLOC_STATS=1 also report allocations per op, per keystroke and per subsystem.
+// Returns the process exit code.
+int benchmark_run(char *file_name, const char *script);
+
+#endif
@@ -1,7 +1,10 @@
 #include "str.h"
+#define _DEFAULT_SOURCE
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -15,7 +18,13 @@
 #include "history.h"
 #include "utf8.h"
 #include "git.h"
+#include "git_blame.h"
+#include "lsp.h"
+#include "perf.h"
+#define ALLOC_TAG ALLOC_TAG_BUFFER
+#include "alloc.h"
 
+#define BUFFER_EDIT_LOG_LIMIT 4096
 
 void buffer_set_line_num_width(Buffer *buffer) {
     buffer->line_num_width = (int)floor(log10(buffer->line_count)) + 3;
@@ -157,6 +166,7 @@ void buffer_update_search_matches(Buffer *b, const char *term) {
     if (!term || term[0] == '\0') {
         return;
     }
+    PERF_START("search");
     b->search_state.term = strdup(term);
 
     int capacity = 10;
@@ -193,6 +203,7 @@ void buffer_update_search_matches(Buffer *b, const char *term) {
     }
 
     buffer_update_current_search_match(b);
+    PERF_END();
 }
 
 void buffer_update_current_search_match(Buffer *b) {
@@ -374,7 +385,7 @@ void buffer_parse(Buffer *b) {
 
 int buffer_get_visual_position_x(Buffer *buffer) {
     BufferLine *line = buffer->lines[buffer->position_y];
-    int x = buffer->line_num_width + 3 + 1; // gutter width
+    int x = git_blame_width() + buffer->line_num_width + 3 + 1; // gutter width
 
     char *p = line->text;
     int char_idx = 0;
@@ -492,7 +503,9 @@ void buffer_line_destroy(BufferLine *line) {
 }
 
 void buffer_update_git_diff(Buffer *b) {
+    PERF_START("git_diff");
     git_update_diff(b);
+    PERF_END();
 }
 
 void buffer_init(Buffer *b, const char *file_name) {
@@ -505,6 +518,7 @@ void buffer_init(Buffer *b, const char *file_name) {
     } else {
         b->file_name = NULL;
     }
+    b->absolute_path = NULL;
     b->needs_draw = 1;
     b->dirty = 0;
     b->needs_parse = 1;
@@ -520,6 +534,19 @@ void buffer_init(Buffer *b, const char *file_name) {
     b->search_state.matches = NULL;
     b->search_state.count = 0;
     b->search_state.current = -1;
+    b->lsp_changes = NULL;
+    b->lsp_change_count = 0;
+    b->lsp_change_capacity = 0;
+    b->lsp_position_encoding = LSP_POSITION_UTF16;
+    b->display_diagnostics = NULL;
+    b->display_diagnostic_count = 0;
+    b->display_diagnostic_capacity = 0;
+    b->display_buffer_version = 0;
+    b->display_anchor_version = 0;
+    b->edit_log = NULL;
+    b->edit_log_count = 0;
+    b->edit_log_capacity = 0;
+    b->edit_log_base = b->version;
     b->lines = (BufferLine **)malloc(sizeof(BufferLine *) * b->capacity);
     if (b->lines == NULL) {
         log_error("buffer.buffer_init: failed to allocate lines for buffer");
@@ -538,6 +565,8 @@ void buffer_init(Buffer *b, const char *file_name) {
     b->tree = NULL;
     b->mtime = 0;
     b->hunks = NULL;
+    b->git_head = NULL;
+    b->git_blame = NULL;
     b->hunk_count = 0;
     if (file_name == NULL) {
         return;
@@ -642,6 +671,7 @@ void buffer_destroy(Buffer *b) {
     if (b->file_name) {
         free(b->file_name);
     }
+    free(b->absolute_path);
     if (b->cursor) {
         ts_query_cursor_delete(b->cursor);
     }
@@ -660,9 +690,265 @@ void buffer_destroy(Buffer *b) {
     if (b->hunks) {
         free(b->hunks);
     }
+    git_release_head(b);
+    git_blame_release(b);
+    buffer_clear_lsp_changes(b);
+    free(b->lsp_changes);
+    free(b->display_diagnostics);
+    free(b->edit_log);
     free(b->read_buffer);
 }
 
+const char *buffer_get_absolute_path(Buffer *b) {
+    if (!b->absolute_path && b->file_name) {
+        b->absolute_path = realpath(b->file_name, NULL);
+    }
+    return b->absolute_path;
+}
+
+// Lines with as many bytes as characters are ASCII, and every encoding
+// agrees with the byte offset there.
+static bool buffer_line_is_ascii(const BufferLine *line) {
+    return line->char_count == line->text_len;
+}
+
+int buffer_line_lsp_column(const Buffer *b, const BufferLine *line, int byte_x) {
+    if (b->lsp_position_encoding == LSP_POSITION_UTF8 || buffer_line_is_ascii(line)) {
+        return byte_x;
+    }
+    int units = 0;
+    for (int i = 0; i < byte_x && i < line->text_len; i++) {
+        unsigned char c = (unsigned char)line->text[i];
+        if ((c & 0xC0) != 0x80) {
+            units += c >= 0xF0 && b->lsp_position_encoding == LSP_POSITION_UTF16 ? 2 : 1;
+        }
+    }
+    return units;
+}
+
+int buffer_lsp_char_width(const Buffer *b, int char_len) {
+    switch (b->lsp_position_encoding) {
+        case LSP_POSITION_UTF8: return char_len;
+        case LSP_POSITION_UTF32: return 1;
+        default: return char_len == 4 ? 2 : 1;
+    }
+}
+
+int buffer_line_char_index(const BufferLine *line, int column, int encoding) {
+    if (encoding == LSP_POSITION_UTF32 || buffer_line_is_ascii(line)) {
+        return column;
+    }
+    int units = 0;
+    int chars = 0;
+    for (int i = 0; i < line->text_len && units < column; i++) {
+        unsigned char c = (unsigned char)line->text[i];
+        if ((c & 0xC0) == 0x80) {
+            continue;
+        }
+        if (encoding == LSP_POSITION_UTF8) {
+            units += utf8_char_len(line->text + i);
+        } else {
+            units += c >= 0xF0 ? 2 : 1;
+        }
+        chars++;
+    }
+    return chars + (units < column ? column - units : 0);
+}
+
+void buffer_convert_diagnostic_columns(const Buffer *b, Diagnostic *items, int count, int encoding) {
+    for (int i = 0; i < count; i++) {
+        if (items[i].line < 0 || items[i].line >= b->line_count) {
+            continue;
+        }
+        const BufferLine *line = b->lines[items[i].line];
+        items[i].col_start = buffer_line_char_index(line, items[i].col_start, encoding);
+        items[i].col_end = buffer_line_char_index(line, items[i].col_end, encoding);
+    }
+}
+
+// Moves a position past an edit the way the server will see it move. An end
+// position at the start of an insertion stays put, so typing right after a
+// flagged range does not extend it.
+static void edit_map_position(const BufferEdit *e, int *line, int *character, bool is_end) {
+    if (*line < e->start_line || (*line == e->start_line && *character < e->start_character) ||
+        (is_end && *line == e->start_line && *character == e->start_character)) {
+        return;
+    }
+    if (*line > e->end_line || (*line == e->end_line && *character >= e->end_character)) {
+        if (*line == e->end_line) {
+            *character = e->new_end_character + (*character - e->end_character);
+        }
+        *line += e->new_end_line - e->end_line;
+        return;
+    }
+    // Inside the replaced text.
+    *line = is_end ? e->new_end_line : e->start_line;
+    *character = is_end ? e->new_end_character : e->start_character;
+}
+
+static void buffer_remap_diagnostics(const Buffer *b, Diagnostic *items, int count, int anchor_version) {
+    if (anchor_version < b->edit_log_base) {
+        return; // an edit in between was not recorded
+    }
+    int first = 0;
+    while (first < b->edit_log_count && b->edit_log[first].version <= anchor_version) {
+        first++;
+    }
+    if (first == b->edit_log_count) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        int line = items[i].line, start = items[i].col_start;
+        int end_line = items[i].line, end = items[i].col_end;
+        for (int j = first; j < b->edit_log_count; j++) {
+            edit_map_position(&b->edit_log[j], &line, &start, false);
+            edit_map_position(&b->edit_log[j], &end_line, &end, true);
+        }
+        items[i].line = line;
+        items[i].col_start = start;
+        // Items only carry one line; a range split across lines runs to the end of it.
+        items[i].col_end = end_line == line ? end : INT_MAX;
+    }
+}
+
+// Drops entries an anchor at version no longer needs.
+static void buffer_trim_edit_log(Buffer *b, int version) {
+    if (version < b->edit_log_base) {
+        return;
+    }
+    int drop = 0;
+    while (drop < b->edit_log_count && b->edit_log[drop].version <= version) {
+        drop++;
+    }
+    memmove(b->edit_log, b->edit_log + drop, sizeof(BufferEdit) * (b->edit_log_count - drop));
+    b->edit_log_count -= drop;
+    b->edit_log_base = version;
+}
+
+// The cached copy keeps message pointers into set without a reference. It
+// is only returned for a set with the same version, which is the same live
+// set, since versions are never reused. Sets from servers that do not report
+// a document version are taken to match the buffer when they first arrive.
+const Diagnostic *buffer_display_diagnostics(Buffer *b, const DiagnosticSet *set, int *count) {
+    if (!set) {
+        b->diagnostics_version = 0;
+        *count = 0;
+        return NULL;
+    }
+    if (set->version != b->diagnostics_version) {
+        b->display_anchor_version = set->document_version >= 0 ? set->document_version : b->version;
+        buffer_trim_edit_log(b, b->display_anchor_version);
+        b->display_buffer_version = 0;
+    }
+    if (b->version != b->display_buffer_version) {
+        if (set->count > b->display_diagnostic_capacity) {
+            Diagnostic *items = realloc(b->display_diagnostics, sizeof(Diagnostic) * set->count);
+            if (!items) {
+                log_error("buffer.buffer_display_diagnostics: realloc failed");
+                exit(1);
+            }
+            b->display_diagnostics = items;
+            b->display_diagnostic_capacity = set->count;
+        }
+        if (set->count) {
+            memcpy(b->display_diagnostics, set->items, sizeof(Diagnostic) * set->count);
+        }
+        if ((int)set->position_encoding == b->lsp_position_encoding) {
+            buffer_remap_diagnostics(b, b->display_diagnostics, set->count, b->display_anchor_version);
+        }
+        buffer_convert_diagnostic_columns(b, b->display_diagnostics, set->count, set->position_encoding);
+        b->display_diagnostic_count = set->count;
+        b->diagnostics_version = set->version;
+        b->display_buffer_version = b->version;
+    }
+    *count = b->display_diagnostic_count;
+    return b->display_diagnostics;
+}
+
+void buffer_record_edit(Buffer *b, const TSInputEdit *edit, int start_character,
+                        int end_character, const char *text) {
+    if (b->parser && b->tree) {
+        ts_tree_edit(b->tree, edit);
+    }
+    git_note_edit(b, edit->start_point.row, edit->old_end_point.row, edit->new_end_point.row);
+
+    if (b->lsp_change_count == b->lsp_change_capacity) {
+        int capacity = b->lsp_change_capacity ? b->lsp_change_capacity * 2 : 4;
+        LspContentChange *changes = realloc(b->lsp_changes, sizeof(LspContentChange) * capacity);
+        if (!changes) {
+            log_error("buffer.buffer_record_edit: realloc failed");
+            exit(1);
+        }
+        b->lsp_changes = changes;
+        b->lsp_change_capacity = capacity;
+    }
+    LspContentChange *change = &b->lsp_changes[b->lsp_change_count++];
+    change->start_line = edit->start_point.row;
+    change->start_character = start_character;
+    change->end_line = edit->old_end_point.row;
+    change->end_character = end_character;
+    change->text = strdup(text ? text : "");
+}
+
+// End of text inserted at line:character, in the buffer's server columns.
+static void text_end_position(const Buffer *b, const char *text, int *line, int *character) {
+    for (const char *p = text; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '\n') {
+            (*line)++;
+            *character = 0;
+        } else if (b->lsp_position_encoding == LSP_POSITION_UTF8) {
+            (*character)++;
+        } else if ((c & 0xC0) != 0x80) {
+            *character += c >= 0xF0 && b->lsp_position_encoding == LSP_POSITION_UTF16 ? 2 : 1;
+        }
+    }
+}
+
+void buffer_log_edits(Buffer *b) {
+    if (b->lsp_change_count == 0) {
+        b->edit_log_count = 0;
+        b->edit_log_base = b->version;
+        return;
+    }
+    if (b->edit_log_count + b->lsp_change_count > BUFFER_EDIT_LOG_LIMIT) {
+        // Nothing has been published for a long time; forget the oldest half.
+        buffer_trim_edit_log(b, b->edit_log[b->edit_log_count / 2].version);
+    }
+    if (b->edit_log_count + b->lsp_change_count > b->edit_log_capacity) {
+        int capacity = b->edit_log_capacity ? b->edit_log_capacity : 16;
+        while (capacity < b->edit_log_count + b->lsp_change_count) {
+            capacity *= 2;
+        }
+        BufferEdit *log = realloc(b->edit_log, sizeof(BufferEdit) * capacity);
+        if (!log) {
+            log_error("buffer.buffer_log_edits: realloc failed");
+            exit(1);
+        }
+        b->edit_log = log;
+        b->edit_log_capacity = capacity;
+    }
+    for (int i = 0; i < b->lsp_change_count; i++) {
+        const LspContentChange *change = &b->lsp_changes[i];
+        BufferEdit *e = &b->edit_log[b->edit_log_count++];
+        e->version = b->version;
+        e->start_line = change->start_line;
+        e->start_character = change->start_character;
+        e->end_line = change->end_line;
+        e->end_character = change->end_character;
+        e->new_end_line = change->start_line;
+        e->new_end_character = change->start_character;
+        text_end_position(b, change->text, &e->new_end_line, &e->new_end_character);
+    }
+}
+
+void buffer_clear_lsp_changes(Buffer *b) {
+    for (int i = 0; i < b->lsp_change_count; i++) {
+        free(b->lsp_changes[i].text);
+    }
+    b->lsp_change_count = 0;
+}
+
 int is_line_empty(BufferLine *line) {
     if (line->text_len == 0) {
         return 1;
@@ -678,7 +964,7 @@ int is_line_empty(BufferLine *line) {
 int buffer_get_visual_x_for_line_pos(Buffer *buffer, int y, int logical_x) {
     if (y >= buffer->line_count) return 0;
     BufferLine *line = buffer->lines[y];
-    int x_pos = buffer->line_num_width + 1;
+    int x_pos = git_blame_width() + buffer->line_num_width + 1;
 
     char *p = line->text;
     int char_idx = 0;
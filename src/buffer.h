@@ -7,6 +7,22 @@
 #include "history.h"
 
 struct GitHunk;
+struct GitHead;
+struct LspContentChange;
+struct Diagnostic;
+struct DiagnosticSet;
+
+// One edit in the file's server columns, for moving positions published
+// against an older document version. See buffer_display_diagnostics.
+typedef struct {
+    int version; // document version the edit produced
+    int start_line;
+    int start_character;
+    int end_line;
+    int end_character;
+    int new_end_line;
+    int new_end_character;
+} BufferEdit;
 
 typedef enum {
     VISUAL_MODE_NONE,
@@ -47,6 +63,7 @@ typedef struct {
     char *read_buffer;
     int read_buffer_capacity;
     char *file_name;
+    char *absolute_path; // resolved lazily, see buffer_get_absolute_path
     time_t mtime;
     int tab_width;
     int line_num_width;
@@ -57,7 +74,7 @@ typedef struct {
     TSNode root;
     TSQuery *query;
     TSQueryCursor *cursor;
-    int diagnostics_version;
+    int diagnostics_version; // DiagnosticSet version of display_diagnostics
     History *history;
 
     struct {
@@ -72,6 +89,28 @@ typedef struct {
 
     struct GitHunk* hunks;
     int hunk_count;
+    struct GitHead *git_head;
+    struct GitBlame *git_blame; // NULL until the blame gutter has data
+
+    // Edits since the last editor_did_change_buffer, for incremental didChange.
+    struct LspContentChange *lsp_changes;
+    int lsp_change_count;
+    int lsp_change_capacity;
+    int lsp_position_encoding; // LspPositionEncoding of the file's server
+
+    // The file's diagnostics with columns as character indexes, rebuilt when
+    // the set or the buffer changes. See buffer_display_diagnostics.
+    struct Diagnostic *display_diagnostics;
+    int display_diagnostic_count;
+    int display_diagnostic_capacity;
+    int display_buffer_version;
+    int display_anchor_version; // document version the displayed items were published against
+
+    // Edits from edit_log_base onwards, appended by buffer_log_edits.
+    BufferEdit *edit_log;
+    int edit_log_count;
+    int edit_log_capacity;
+    int edit_log_base;
 } Buffer;
 
 void buffer_line_apply_syntax_highlighting(Buffer *b, BufferLine *line, uint32_t start_byte, Theme *theme);
@@ -104,5 +143,30 @@ void buffer_update_current_search_match(Buffer *b);
 int buffer_find_first_match(Buffer *b, const char *term, int start_y, int start_x, int *match_y, int *match_x);
 int buffer_find_last_match_before(Buffer *b, const char *term, int start_y, int start_x, int *match_y, int *match_x);
 void buffer_update_git_diff(Buffer *b);
+// Column of byte_x on line in the server's position encoding.
+int buffer_line_lsp_column(const Buffer *b, const BufferLine *line, int byte_x);
+// Server column units taken by one character of char_len bytes.
+int buffer_lsp_char_width(const Buffer *b, int char_len);
+// Character index on line of a server column in encoding (an
+// LspPositionEncoding). Columns past the end stay past the end.
+int buffer_line_char_index(const BufferLine *line, int column, int encoding);
+void buffer_convert_diagnostic_columns(const Buffer *b, struct Diagnostic *items, int count, int encoding);
+// Diagnostics of set for display, with columns as character indexes and
+// positions moved through the edits made since the version set was
+// published against.
+const struct Diagnostic *buffer_display_diagnostics(Buffer *b, const struct DiagnosticSet *set, int *count);
+// Moves the pending lsp_changes into the edit log under b->version. An edit
+// with no recorded changes cannot be replayed and restarts the log.
+void buffer_log_edits(Buffer *b);
+// The resolved path of the buffer's file, cached after the first success.
+// NULL for unnamed buffers and files that don't exist yet.
+const char *buffer_get_absolute_path(Buffer *b);
+
+// Records an edit for both incremental consumers: the tree-sitter tree gets
+// edit (byte offsets) and the pending LSP changes get the same range in
+// columns of the server's position encoding, replaced by text. Lines come from edit's start and old end.
+void buffer_record_edit(Buffer *b, const TSInputEdit *edit, int start_character,
+                        int end_character, const char *text);
+void buffer_clear_lsp_changes(Buffer *b);
 
 #endif
@@ -14,6 +14,8 @@
 #include "config.h"
 #include "log.h"
 #include "theme.h"
+#define ALLOC_TAG ALLOC_TAG_CONFIG
+#include "alloc.h"
 
 static const char* default_theme_toml =
     "[content]\n"
@@ -965,6 +967,7 @@ void config_load(Config *config) {
     config->whitespace.tab = WHITESPACE_RENDER_TRAILING;
     config->whitespace.space_char = strdup("·");
     config->whitespace.tab_char = strdup("→");
+    config->search_index = false;
     config->toml_result.ok = false;
 
     char *path = config_get_path();
@@ -1001,6 +1004,11 @@ void config_load(Config *config) {
         config->whitespace.tab_char = strdup(tab_char_data.u.s);
     }
 
+    toml_datum_t search_index_data = toml_seek(config->toml_result.toptab, "editor.search.index");
+    if (search_index_data.type == TOML_BOOLEAN) {
+        config->search_index = search_index_data.u.boolean;
+    }
+
     free(path);
 }
 
@@ -1010,6 +1018,7 @@ void config_init(Config *config) {
     config->whitespace.tab = WHITESPACE_RENDER_TRAILING;
     config->whitespace.space_char = strdup("·");
     config->whitespace.tab_char = strdup("→");
+    config->search_index = false;
     config->toml_result.ok = false;
 }
 
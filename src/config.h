@@ -1,6 +1,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdbool.h>
 #include "tree_sitter/api.h"
 #include "theme.h"
 #include "tomlc17.h"
@@ -21,6 +22,7 @@ typedef struct {
 typedef struct {
   char *theme;
   WhitespaceConfig whitespace;
+  bool search_index; // keep a trigram index of the project for the search picker
   toml_result_t toml_result;
 } Config;
 
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "diff.h"
+#include "log.h"
+#define ALLOC_TAG ALLOC_TAG_GIT
+#include "alloc.h"
+
+typedef struct {
+    const uint64_t *a;
+    const uint64_t *b;
+    bool *changed_a;
+    bool *changed_b;
+    int *forward;  // furthest x reached on each diagonal (x - y), offset
+    int *backward; // by `offset` so negative diagonals index from 0
+} DiffContext;
+
+uint64_t diff_hash_line(const char *text, size_t len) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Finds a point on an optimal edit path through a[a0, a1) and b[b0, b1) by
+// searching forward from the start and backward from the end until the two
+// searches overlap. Both ranges are non-empty and differ in their first and
+// last lines.
+static void find_middle_snake(DiffContext *c, int a0, int a1, int b0, int b1, int *mid_a, int *mid_b) {
+    int *fd = c->forward;
+    int *bd = c->backward;
+    int dmin = a0 - b1, dmax = a1 - b0;
+    int fmid = a0 - b0, bmid = a1 - b1;
+    int fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    bool odd = (fmid - bmid) & 1;
+    fd[fmid] = a0;
+    bd[bmid] = a1;
+
+    for (;;) {
+        if (fmin > dmin) fd[--fmin - 1] = -1; else fmin++;
+        if (fmax < dmax) fd[++fmax + 1] = -1; else fmax--;
+        for (int d = fmax; d >= fmin; d -= 2) {
+            int x = fd[d - 1] >= fd[d + 1] ? fd[d - 1] + 1 : fd[d + 1];
+            int y = x - d;
+            while (x < a1 && y < b1 && c->a[x] == c->b[y]) {
+                x++;
+                y++;
+            }
+            fd[d] = x;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+                *mid_a = x;
+                *mid_b = y;
+                return;
+            }
+        }
+
+        if (bmin > dmin) bd[--bmin - 1] = INT_MAX; else bmin++;
+        if (bmax < dmax) bd[++bmax + 1] = INT_MAX; else bmax--;
+        for (int d = bmax; d >= bmin; d -= 2) {
+            int x = bd[d - 1] < bd[d + 1] ? bd[d - 1] : bd[d + 1] - 1;
+            int y = x - d;
+            while (x > a0 && y > b0 && c->a[x - 1] == c->b[y - 1]) {
+                x--;
+                y--;
+            }
+            bd[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+                *mid_a = x;
+                *mid_b = y;
+                return;
+            }
+        }
+    }
+}
+
+static void compare_ranges(DiffContext *c, int a0, int a1, int b0, int b1) {
+    while (a0 < a1 && b0 < b1 && c->a[a0] == c->b[b0]) {
+        a0++;
+        b0++;
+    }
+    while (a1 > a0 && b1 > b0 && c->a[a1 - 1] == c->b[b1 - 1]) {
+        a1--;
+        b1--;
+    }
+    if (a0 == a1) {
+        for (int i = b0; i < b1; i++) c->changed_b[i] = true;
+    } else if (b0 == b1) {
+        for (int i = a0; i < a1; i++) c->changed_a[i] = true;
+    } else {
+        int mid_a, mid_b;
+        find_middle_snake(c, a0, a1, b0, b1, &mid_a, &mid_b);
+        compare_ranges(c, a0, mid_a, b0, mid_b);
+        compare_ranges(c, mid_a, a1, mid_b, b1);
+    }
+}
+
+int diff_lines(const uint64_t *old_lines, int old_count, const uint64_t *new_lines, int new_count,
+               DiffHunk **hunks) {
+    *hunks = NULL;
+    int diagonals = old_count + new_count + 3;
+    DiffContext c = {
+        .a = old_lines,
+        .b = new_lines,
+        .changed_a = calloc(old_count + 1, sizeof(bool)),
+        .changed_b = calloc(new_count + 1, sizeof(bool)),
+        .forward = malloc(sizeof(int) * diagonals),
+        .backward = malloc(sizeof(int) * diagonals),
+    };
+    if (!c.changed_a || !c.changed_b || !c.forward || !c.backward) {
+        log_error("diff.diff_lines: allocation failed");
+        exit(1);
+    }
+    c.forward += new_count + 1;
+    c.backward += new_count + 1;
+    compare_ranges(&c, 0, old_count, 0, new_count);
+
+    int count = 0, capacity = 0;
+    int i = 0, j = 0;
+    while (i < old_count || j < new_count) {
+        if (i < old_count && j < new_count && !c.changed_a[i] && !c.changed_b[j]) {
+            i++;
+            j++;
+            continue;
+        }
+        int start_i = i, start_j = j;
+        while (i < old_count && c.changed_a[i]) i++;
+        while (j < new_count && c.changed_b[j]) j++;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            DiffHunk *grown = realloc(*hunks, sizeof(DiffHunk) * capacity);
+            if (!grown) {
+                log_error("diff.diff_lines: realloc failed");
+                exit(1);
+            }
+            *hunks = grown;
+        }
+        DiffHunk *h = &(*hunks)[count++];
+        h->old_count = i - start_i;
+        h->new_count = j - start_j;
+        h->old_start = h->old_count ? start_i + 1 : start_i;
+        h->new_start = h->new_count ? start_j + 1 : start_j;
+    }
+
+    free(c.changed_a);
+    free(c.changed_b);
+    free(c.forward - (new_count + 1));
+    free(c.backward - (new_count + 1));
+    return count;
+}
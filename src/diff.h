@@ -0,0 +1,25 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A run of changed lines, numbered like `git diff -U0`: starts are 1-based,
+// and an empty side's start is the line before the change (0 at the top).
+typedef struct {
+    int old_start;
+    int old_count;
+    int new_start;
+    int new_count;
+} DiffHunk;
+
+// Hash of one line for diffing. Lines are compared by hash only.
+uint64_t diff_hash_line(const char *text, size_t len);
+
+// Diffs two sequences of line hashes with Myers' algorithm in linear space.
+// Stores a malloc'd array of hunks in *hunks (NULL when there are none) and
+// returns how many there are.
+int diff_lines(const uint64_t *old_lines, int old_count, const uint64_t *new_lines, int new_count,
+               DiffHunk **hunks);
+
+#endif // DIFF_H
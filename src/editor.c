@@ -28,6 +28,9 @@
 #include "visual.h"
 #include "editor.h"
 #include "git.h"
+#include "git_blame.h"
+#include "search_index.h"
+#include "perf.h"
 #include "theme.h"
 #include "config.h"
 #include "buffer.h"
@@ -38,6 +41,8 @@
 #include "search.h"
 #include "utf8.h"
 #include "str.h"
+#define ALLOC_TAG ALLOC_TAG_EDITOR
+#include "alloc.h"
 
 static pthread_mutex_t editor_mutex = PTHREAD_MUTEX_INITIALIZER;
 Editor editor;
@@ -198,9 +203,9 @@ static void diagnostic_cell_init(DiagnosticCell *cell, Style *style) {
     cell->style.style = 0;
 }
 
-static void diagnostic_cell_add(DiagnosticCell *cell) {
-    cell->count++;
-    cell->len = (int)floor(log10(cell->count)) + 4;
+static void diagnostic_cell_set(DiagnosticCell *cell, int count) {
+    cell->count = count;
+    cell->len = count ? (int)floor(log10(count)) + 4 : 0;
 }
 
 static void draw_diagnostic_cell(DiagnosticCell *cell, Style *statusline_text) {
@@ -211,7 +216,7 @@ static void draw_diagnostic_cell(DiagnosticCell *cell, Style *statusline_text) {
     printf("%d", cell->count);
 }
 
-void draw_statusline(Diagnostic *file_diagnostics, int file_diagnostic_count, Diagnostic *workspace_diagnostics, int workspace_diagnostic_count) {
+void draw_statusline(const DiagnosticSet *file_diagnostics, const int *workspace_totals) {
     printf("\x1b[%d;1H", editor.screen_rows);
 
     const char *mode;
@@ -244,11 +249,10 @@ void draw_statusline(Diagnostic *file_diagnostics, int file_diagnostic_count, Di
         file_name_len += buffer->file_name ? 4 : 3;
     }
 
-    char branch_name[256];
-    git_current_branch(branch_name, sizeof(branch_name));
-    int branch_name_len = strlen(branch_name);
+    const GitState *git = git_state();
+    int branch_name_len = strlen(git->branch);
     if (branch_name_len) {
-        branch_name_len += 1;
+        branch_name_len += git->dirty ? 2 : 1;
     }
 
     DiagnosticCell ws_errors;
@@ -259,22 +263,10 @@ void draw_statusline(Diagnostic *file_diagnostics, int file_diagnostic_count, Di
     diagnostic_cell_init(&ws_warnings, &editor.current_theme.diagnostics_warning);
     diagnostic_cell_init(&ws_infos, &editor.current_theme.diagnostics_info);
     diagnostic_cell_init(&ws_hints, &editor.current_theme.diagnostics_hint);
-    for (int i = 0; i < workspace_diagnostic_count; i++) {
-        switch (workspace_diagnostics[i].severity) {
-            case LSP_DIAGNOSTIC_SEVERITY_ERROR:
-                diagnostic_cell_add(&ws_errors);
-                break;
-            case LSP_DIAGNOSTIC_SEVERITY_WARNING:
-                diagnostic_cell_add(&ws_warnings);
-                break;
-            case LSP_DIAGNOSTIC_SEVERITY_INFO:
-                diagnostic_cell_add(&ws_infos);
-                break;
-            case LSP_DIAGNOSTIC_SEVERITY_HINT:
-                diagnostic_cell_add(&ws_hints);
-                break;
-        }
-    }
+    diagnostic_cell_set(&ws_errors, workspace_totals[LSP_DIAGNOSTIC_SEVERITY_ERROR]);
+    diagnostic_cell_set(&ws_warnings, workspace_totals[LSP_DIAGNOSTIC_SEVERITY_WARNING]);
+    diagnostic_cell_set(&ws_infos, workspace_totals[LSP_DIAGNOSTIC_SEVERITY_INFO]);
+    diagnostic_cell_set(&ws_hints, workspace_totals[LSP_DIAGNOSTIC_SEVERITY_HINT]);
     DiagnosticCell file_errors;
     DiagnosticCell file_warnings;
     DiagnosticCell file_infos;
@@ -283,21 +275,11 @@ void draw_statusline(Diagnostic *file_diagnostics, int file_diagnostic_count, Di
     diagnostic_cell_init(&file_warnings, &editor.current_theme.diagnostics_warning);
     diagnostic_cell_init(&file_infos, &editor.current_theme.diagnostics_info);
     diagnostic_cell_init(&file_hints, &editor.current_theme.diagnostics_hint);
-    for (int i = 0; i < file_diagnostic_count; i++) {
-        switch (file_diagnostics[i].severity) {
-            case LSP_DIAGNOSTIC_SEVERITY_ERROR:
-                diagnostic_cell_add(&file_errors);
-                break;
-            case LSP_DIAGNOSTIC_SEVERITY_WARNING:
-                diagnostic_cell_add(&file_warnings);
-                break;
-            case LSP_DIAGNOSTIC_SEVERITY_INFO:
-                diagnostic_cell_add(&file_infos);
-                break;
-            case LSP_DIAGNOSTIC_SEVERITY_HINT:
-                diagnostic_cell_add(&file_hints);
-                break;
-        }
+    if (file_diagnostics) {
+        diagnostic_cell_set(&file_errors, file_diagnostics->severity_counts[LSP_DIAGNOSTIC_SEVERITY_ERROR]);
+        diagnostic_cell_set(&file_warnings, file_diagnostics->severity_counts[LSP_DIAGNOSTIC_SEVERITY_WARNING]);
+        diagnostic_cell_set(&file_infos, file_diagnostics->severity_counts[LSP_DIAGNOSTIC_SEVERITY_INFO]);
+        diagnostic_cell_set(&file_hints, file_diagnostics->severity_counts[LSP_DIAGNOSTIC_SEVERITY_HINT]);
     }
     printf("%s", mode);
     editor_set_style(&editor.current_theme.statusline_text, 1, 1);
@@ -345,7 +327,7 @@ void draw_statusline(Diagnostic *file_diagnostics, int file_diagnostic_count, Di
         int right_space = (editor.screen_cols - half_cols) - right_len - (file_name_len - half_file_name_len) - (file_diagnostic_len - half_file_diagnostics_len);
 
         if (branch_name_len) {
-            printf(" %s", branch_name);
+            printf(" %s%s", git->branch, git->dirty ? "*" : "");
         }
 
         draw_diagnostic_cell(&ws_errors, &editor.current_theme.statusline_text);
@@ -417,7 +399,7 @@ static int is_in_selection(int y, int x) {
     return 1;
 }
 
-void draw_buffer(Diagnostic *diagnostics, int diagnostics_count) {
+void draw_buffer(const Diagnostic *diagnostics, int diagnostics_count) {
     uint32_t start_byte = 0;
     for (int i = 0; i < buffer->offset_y; i++) {
         start_byte += buffer->lines[i]->text_len + 1; // +1 for newline
@@ -425,6 +407,10 @@ void draw_buffer(Diagnostic *diagnostics, int diagnostics_count) {
 
     char utf8_buf[8];
     char line_num_str[16];
+    char blame_text[GIT_BLAME_WIDTH * 4 + 1];
+    int blame_width = git_blame_width();
+    time_t now = time(NULL);
+    git_blame_prepare(buffer);
 
     for (int row = buffer->offset_y; row < buffer->offset_y + editor.screen_rows - 1; row++) {
         int relative_y = row - buffer->offset_y;
@@ -435,7 +421,7 @@ void draw_buffer(Diagnostic *diagnostics, int diagnostics_count) {
             int chars_to_print = editor.screen_cols;
             if (buffer->offset_x) {
                 editor_set_style(&editor.current_theme.content_line_number_sticky, 0, 1);
-                for (int i = 0; i < line_num_len + 3; i++) {
+                for (int i = 0; i < blame_width + line_num_len + 3; i++) {
                     putchar(' ');
                     chars_to_print--;
                 }
@@ -451,7 +437,9 @@ void draw_buffer(Diagnostic *diagnostics, int diagnostics_count) {
         BufferLine *line = buffer->lines[row];
 
         if (line->needs_highlight) {
+            PERF_START("highlight");
             buffer_line_apply_syntax_highlighting(buffer, line, start_byte, &editor.current_theme);
+            PERF_END();
         }
 
         Style *char_styles = NULL;
@@ -491,6 +479,10 @@ void draw_buffer(Diagnostic *diagnostics, int diagnostics_count) {
         } else {
             editor_set_style(&editor.current_theme.content_line_number, 1, 1);
         }
+        if (blame_width) {
+            git_blame_format(buffer, row, now, blame_text, sizeof(blame_text));
+            printf("%s", blame_text);
+        }
 
         DiagnosticSeverity highest_severity = 0;
         for (int i = 0; i < diagnostics_count; i++) {
@@ -576,7 +568,7 @@ void draw_buffer(Diagnostic *diagnostics, int diagnostics_count) {
         Style *line_style = (row == buffer->position_y) ? &editor.current_theme.content_cursor_line : &editor.current_theme.content_background;
 
         int cols_to_skip = buffer->offset_x;
-        int chars_to_print = editor.screen_cols - buffer->line_num_width - 2;
+        int chars_to_print = editor.screen_cols - blame_width - buffer->line_num_width - 2;
         int visual_x = 0;
 
         char *p = line->text;
@@ -696,47 +688,46 @@ void draw_diagnostics(const Diagnostic *diagnostics, int diagnostics_count) {
     }
 }
 
+// Weak so tests can supply diagnostics without a server.
+const Diagnostic *__attribute__((weak)) editor_buffer_diagnostics(Buffer *b, DiagnosticSet **set, int *count) {
+    const char *absolute_path = buffer_get_absolute_path(b);
+    *set = absolute_path ? lsp_diagnostics_acquire(absolute_path) : NULL;
+    return buffer_display_diagnostics(b, *set, count);
+}
+
 void editor_draw() {
     if (!buffer->needs_draw) {
         return;
     }
+    PERF_START("draw");
     if (buffer->needs_parse) {
+        PERF_START("parse");
         buffer_parse(buffer);
+        PERF_END();
         buffer_update_git_diff(buffer);
+    } else if (git_diff_outdated(buffer)) {
+        buffer_update_git_diff(buffer); // buffers without a parser, or HEAD moved
     }
-    Diagnostic *diagnostics = NULL;
-    int diagnostic_count = 0;
-    if (buffer->file_name) {
-        buffer->diagnostics_version = lsp_get_diagnostics(buffer->file_name, &diagnostics, &diagnostic_count);
-    }
+    DiagnosticSet *diagnostics;
+    int diagnostic_count;
+    const Diagnostic *items = editor_buffer_diagnostics(buffer, &diagnostics, &diagnostic_count);
 
-    Diagnostic *workspace_diagnostics = NULL;
-    int workspace_diagnostic_count = lsp_get_all_diagnostics(&workspace_diagnostics);
+    int workspace_totals[LSP_DIAGNOSTIC_SEVERITY_COUNT];
+    lsp_diagnostic_totals(workspace_totals);
 
     editor_clear_screen();
-    draw_buffer(diagnostics, diagnostic_count);
-    draw_statusline(diagnostics, diagnostic_count, workspace_diagnostics, workspace_diagnostic_count);
+    draw_buffer(items, diagnostic_count);
+    draw_statusline(diagnostics, workspace_totals);
     if (editor_handle_input == normal_handle_input) {
-        draw_diagnostics(diagnostics, diagnostic_count);
+        draw_diagnostics(items, diagnostic_count);
     }
     draw_cursor();
     if (picker_is_open()) {
         picker_draw(editor.screen_cols, editor.screen_rows, &editor.current_theme);
     }
-    if (diagnostics) {
-        for (int i = 0; i < diagnostic_count; i++) {
-            free(diagnostics[i].message);
-        }
-        free(diagnostics);
-    }
-    if (workspace_diagnostics) {
-        for (int i = 0; i < workspace_diagnostic_count; i++) {
-            free(workspace_diagnostics[i].message);
-            free(workspace_diagnostics[i].uri);
-        }
-        free(workspace_diagnostics);
-    }
+    lsp_diagnostics_release(diagnostics);
     fflush(stdout);
+    PERF_END();
     buffer->needs_draw = 0;
 }
 
@@ -760,21 +751,28 @@ void editor_did_change_buffer() {
 
     if (buffer->file_name) {
         const char *lang_name = str_get_lang_name_from_file_name(buffer->file_name);
-        if (lsp_is_running(lang_name)) {
-            char *content = buffer_get_content(buffer);
-            if (content) {
-                char absolute_path[PATH_MAX];
-                if (realpath(buffer->file_name, absolute_path) != NULL) {
+        const char *absolute_path;
+        if (lsp_is_running(lang_name) && (absolute_path = buffer_get_absolute_path(buffer)) != NULL) {
+            if (!lsp_did_change_incremental(absolute_path, buffer->lsp_changes,
+                                            buffer->lsp_change_count, buffer->version)) {
+                char *content = buffer_get_content(buffer);
+                if (content) {
                     lsp_did_change(absolute_path, content, buffer->version);
+                    free(content);
                 }
-                free(content);
             }
         }
     }
+    if (buffer->lsp_change_count == 0) {
+        git_note_unknown_edit(buffer);
+    }
+    buffer_log_edits(buffer);
+    buffer_clear_lsp_changes(buffer);
     buffer_clear_search_state(buffer);
 }
 
 void *render_loop(void * arg __attribute__((unused))) {
+    PERF_THREAD_NAME("render");
     struct timespec req = {0};
     while (1) {
         req.tv_sec = 0;
@@ -784,6 +782,7 @@ void *render_loop(void * arg __attribute__((unused))) {
         check_for_resize();
         check_for_redraw_request();
         check_for_config_reload();
+        lsp_dispatch_responses();
         editor_draw();
         pthread_mutex_unlock(&editor_mutex);
     }
@@ -864,16 +863,15 @@ void editor_insert_new_line() {
     }
 
     buffer->line_count++;
-    if (buffer->parser && buffer->tree) {
-        ts_tree_edit(buffer->tree, &(TSInputEdit){
-            .start_byte = start_byte,
-            .old_end_byte = start_byte,
-            .new_end_byte = start_byte + 1,
-            .start_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
-            .old_end_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
-            .new_end_point = { (uint32_t)(buffer->position_y + 1), 0 }
-        });
-    }
+    int character = buffer_line_lsp_column(buffer, current_line, byte_pos_x);
+    buffer_record_edit(buffer, &(TSInputEdit){
+        .start_byte = start_byte,
+        .old_end_byte = start_byte,
+        .new_end_byte = start_byte + 1,
+        .start_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
+        .old_end_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
+        .new_end_point = { (uint32_t)(buffer->position_y + 1), 0 }
+    }, character, character, "\n");
     editor_add_insertion_to_history("\n");
     buffer->position_y++;
     buffer_reset_offset_y(buffer, editor.screen_rows);
@@ -965,12 +963,14 @@ static void editor_setup_lsp(const char *file_name) {
             if (content) {
                 lsp_did_open(absolute_path, lang_name, content);
                 free(content);
+                buffer->lsp_position_encoding = lsp_position_encoding(lang_name);
             }
         }
     }
 }
 
 void *watch_config_file(void *arg __attribute__((unused))) {
+    PERF_THREAD_NAME("config watcher");
     char *path = config_get_path();
     if (!path) {
         log_error("watch_config_file: config_get_path failed");
@@ -1165,15 +1165,11 @@ int editor_get_active_buffer_idx(void) {
     return editor.active_buffer_idx;
 }
 
-void editor_start(char *file_name, int benchmark_mode) {
-    editor_init(file_name, benchmark_mode);
-    if (benchmark_mode) {
-        // In benchmark mode, we just initialize, load the file, and exit.
-        // The performance metrics will be captured by the calling process.
-        return;
-    }
+void editor_start(char *file_name) {
+    editor_init(file_name, false);
     pthread_t render_thread_id;
     pthread_t config_watch_thread_id;
+    pthread_t git_watch_thread_id;
     editor_mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
     if (pthread_create(&render_thread_id, NULL, render_loop, NULL) != 0) {
         log_error("editor.editor_start: unable to create render thread");
@@ -1183,8 +1179,16 @@ void editor_start(char *file_name, int benchmark_mode) {
         log_error("editor.editor_start: unable to create config watch thread");
         exit(1);
     }
+    if (pthread_create(&git_watch_thread_id, NULL, watch_git_dir, NULL) != 0) {
+        log_error("editor.editor_start: unable to create git watch thread");
+        exit(1);
+    }
+    if (editor.config.search_index) {
+        search_index_start();
+    }
     char utf8_buf[8];
     while (read_utf8_char_from_stdin(utf8_buf, sizeof(utf8_buf)) > 0) {
+        alloc_note_keystroke();
         if (!editor_handle_input(utf8_buf)) {
             break;
         }
@@ -1212,29 +1216,28 @@ void editor_insert_char(const char *ch) {
     line->text[line->text_len] = '\0';
     line->char_count++;
 
-    editor_add_insertion_to_history(ch);
-    buffer->position_x++;
-    buffer_reset_offset_x(buffer, editor.screen_cols);
-    editor_did_change_buffer();
-
+    uint32_t start_byte = 0;
     if (buffer->parser && buffer->tree) {
-        uint32_t start_byte = 0;
         for (int i = 0; i < buffer->position_y; i++) {
             start_byte += buffer->lines[i]->text_len + 1;
         }
         start_byte += byte_pos_x;
-
-        ts_tree_edit(buffer->tree, &(TSInputEdit){
-            .start_byte = start_byte,
-            .old_end_byte = start_byte,
-            .new_end_byte = start_byte + ch_len,
-            .start_point = {(uint32_t)buffer->position_y, (uint32_t)byte_pos_x},
-            .old_end_point = {(uint32_t)buffer->position_y, (uint32_t)byte_pos_x},
-            .new_end_point = {(uint32_t)buffer->position_y, (uint32_t)(byte_pos_x + ch_len)}
-        });
         line->needs_highlight = 1;
-        buffer->needs_parse = 1;
     }
+    int character = buffer_line_lsp_column(buffer, line, byte_pos_x);
+    buffer_record_edit(buffer, &(TSInputEdit){
+        .start_byte = start_byte,
+        .old_end_byte = start_byte,
+        .new_end_byte = start_byte + ch_len,
+        .start_point = {(uint32_t)buffer->position_y, (uint32_t)byte_pos_x},
+        .old_end_point = {(uint32_t)buffer->position_y, (uint32_t)byte_pos_x},
+        .new_end_point = {(uint32_t)buffer->position_y, (uint32_t)(byte_pos_x + ch_len)}
+    }, character, character, ch);
+
+    editor_add_insertion_to_history(ch);
+    buffer->position_x++;
+    buffer_reset_offset_x(buffer, editor.screen_cols);
+    editor_did_change_buffer();
     pthread_mutex_unlock(&editor_mutex);
 }
 
@@ -1347,6 +1350,7 @@ void editor_write_force() {
         buffer->mtime = st.st_mtime;
     }
     buffer_update_git_diff(buffer);
+    git_state_refresh();
 
     buffer->needs_draw = 1;
     pthread_mutex_unlock(&editor_mutex);
@@ -1405,16 +1409,14 @@ void editor_delete() {
                 (buffer->line_count - buffer->position_y - 2) * sizeof(BufferLine *));
         buffer->line_count--;
         buffer_set_line_num_width(buffer);
-        if (buffer->parser && buffer->tree) {
-            ts_tree_edit(buffer->tree, &(TSInputEdit){
-                .start_byte = start_byte,
-                .old_end_byte = start_byte + 1,
-                .new_end_byte = start_byte,
-                .start_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
-                .old_end_point = { (uint32_t)(buffer->position_y + 1), 0 },
-                .new_end_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x }
-            });
-        }
+        buffer_record_edit(buffer, &(TSInputEdit){
+            .start_byte = start_byte,
+            .old_end_byte = start_byte + 1,
+            .new_end_byte = start_byte,
+            .start_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
+            .old_end_point = { (uint32_t)(buffer->position_y + 1), 0 },
+            .new_end_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x }
+        }, buffer_line_lsp_column(buffer, line, byte_pos_x), 0, NULL);
     } else {
         int char_len = utf8_char_len(line->text + byte_pos_x);
         if (!is_undo_redo_active) {
@@ -1433,15 +1435,16 @@ void editor_delete() {
 
         if (buffer->parser && buffer->tree) {
             line->needs_highlight = 1;
-            ts_tree_edit(buffer->tree, &(TSInputEdit){
-                .start_byte = start_byte,
-                .old_end_byte = start_byte + char_len,
-                .new_end_byte = start_byte,
-                .start_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
-                .old_end_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x + char_len) },
-                .new_end_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x }
-            });
         }
+        int character = buffer_line_lsp_column(buffer, line, byte_pos_x);
+        buffer_record_edit(buffer, &(TSInputEdit){
+            .start_byte = start_byte,
+            .old_end_byte = start_byte + char_len,
+            .new_end_byte = start_byte,
+            .start_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x },
+            .old_end_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x + char_len) },
+            .new_end_point = { (uint32_t)buffer->position_y, (uint32_t)byte_pos_x }
+        }, character, character + buffer_lsp_char_width(buffer, char_len), NULL);
     }
 
     editor_did_change_buffer();
@@ -1506,16 +1509,15 @@ void editor_backspace() {
                 (buffer->line_count - buffer->position_y - 1) * sizeof(BufferLine *));
         buffer->line_count--;
         buffer_set_line_num_width(buffer);
-        if (buffer->parser && buffer->tree) {
-            ts_tree_edit(buffer->tree, &(TSInputEdit){
-                .start_byte = start_byte - 1,
-                .old_end_byte = start_byte,
-                .new_end_byte = start_byte - 1,
-                .start_point = { (uint32_t)buffer->position_y -1, (uint32_t)prev_line->text_len },
-                .old_end_point = { (uint32_t)buffer->position_y, 0 },
-                .new_end_point = { (uint32_t)buffer->position_y - 1, (uint32_t)prev_line->text_len }
-            });
-        }
+        int join_x = prev_line->text_len - line->text_len;
+        buffer_record_edit(buffer, &(TSInputEdit){
+            .start_byte = start_byte - 1,
+            .old_end_byte = start_byte,
+            .new_end_byte = start_byte - 1,
+            .start_point = { (uint32_t)buffer->position_y - 1, (uint32_t)join_x },
+            .old_end_point = { (uint32_t)buffer->position_y, 0 },
+            .new_end_point = { (uint32_t)buffer->position_y - 1, (uint32_t)join_x }
+        }, buffer_line_lsp_column(buffer, prev_line, join_x), 0, NULL);
         buffer->position_y--;
         buffer_reset_offset_y(buffer, editor.screen_rows);
         buffer->position_x = prev_line_char_count;
@@ -1543,15 +1545,16 @@ void editor_backspace() {
 
         if (buffer->parser && buffer->tree) {
             line->needs_highlight = 1;
-            ts_tree_edit(buffer->tree, &(TSInputEdit){
-                .start_byte = start_byte - char_len,
-                .old_end_byte = start_byte,
-                .new_end_byte = start_byte - char_len,
-                .start_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x) },
-                .old_end_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x + char_len) },
-                .new_end_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x) }
-             });
         }
+        int character = buffer_line_lsp_column(buffer, line, byte_pos_x);
+        buffer_record_edit(buffer, &(TSInputEdit){
+            .start_byte = start_byte - char_len,
+            .old_end_byte = start_byte,
+            .new_end_byte = start_byte - char_len,
+            .start_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x) },
+            .old_end_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x + char_len) },
+            .new_end_point = { (uint32_t)buffer->position_y, (uint32_t)(byte_pos_x) }
+        }, character, character + buffer_lsp_char_width(buffer, char_len), NULL);
     }
 
     buffer_reset_offset_x(buffer, editor.screen_cols);
@@ -1842,11 +1845,9 @@ static void get_target_range(EditorCommand *cmd, Range *range) {
                 range->x_end = 0;
             }
             if (strcmp(cmd->specifier, "d") == 0) {
-                Diagnostic *diagnostics = NULL;
-                int diagnostic_count = 0;
-                if (buffer->file_name) {
-                    lsp_get_diagnostics(buffer->file_name, &diagnostics, &diagnostic_count);
-                }
+                DiagnosticSet *set;
+                int diagnostic_count;
+                const Diagnostic *diagnostics = editor_buffer_diagnostics(buffer, &set, &diagnostic_count);
                 if (diagnostic_count > 0) {
                     int next_diag_y = -1;
                     int next_diag_x = -1;
@@ -1874,7 +1875,7 @@ static void get_target_range(EditorCommand *cmd, Range *range) {
                         range->x_end = next_diag_x;
                     }
                 }
-                if (diagnostics) free(diagnostics);
+                lsp_diagnostics_release(set);
             }
             if (strcmp(cmd->specifier, "g") == 0) {
                 if (buffer->hunk_count > 0) {
@@ -1936,11 +1937,9 @@ static void get_target_range(EditorCommand *cmd, Range *range) {
                     range->x_end = 0;
                 }
                 if (strcmp(cmd->specifier, "d") == 0) {
-                    Diagnostic *diagnostics = NULL;
-                    int diagnostic_count = 0;
-                    if (buffer->file_name) {
-                        lsp_get_diagnostics(buffer->file_name, &diagnostics, &diagnostic_count);
-                    }
+                    DiagnosticSet *set;
+                    int diagnostic_count;
+                    const Diagnostic *diagnostics = editor_buffer_diagnostics(buffer, &set, &diagnostic_count);
                     if (diagnostic_count > 0) {
                         int prev_diag_y = -1;
                         int prev_diag_x = -1;
@@ -1968,7 +1967,7 @@ static void get_target_range(EditorCommand *cmd, Range *range) {
                             range->x_end = prev_diag_x;
                         }
                     }
-                    if (diagnostics) free(diagnostics);
+                    lsp_diagnostics_release(set);
                 }
                 if (strcmp(cmd->specifier, "g") == 0) {
                     if (buffer->hunk_count > 0) {
@@ -2401,29 +2400,31 @@ void range_delete(Buffer *b, Range *range, EditorCommand *cmd) {
         p += len;
     }
 
+    uint32_t start_byte = 0;
+    uint32_t old_end_byte = 0;
     if (b->parser && b->tree) {
         uint32_t start_byte_offset = 0;
         for (int i = 0; i < top; i++) {
             start_byte_offset += b->lines[i]->text_len + 1; // +1 for newline
         }
-        uint32_t start_byte = start_byte_offset + left_byte;
+        start_byte = start_byte_offset + left_byte;
 
-        uint32_t old_end_byte = start_byte_offset;
+        old_end_byte = start_byte_offset;
         for (int i = top; i < bottom; i++) {
             old_end_byte += b->lines[i]->text_len + 1;
         }
         old_end_byte += right_byte;
-
-        ts_tree_edit(b->tree, &(TSInputEdit){
-            .start_byte = start_byte,
-            .old_end_byte = old_end_byte,
-            .new_end_byte = start_byte,
-            .start_point = { (uint32_t)top, (uint32_t)left_byte },
-            .old_end_point = { (uint32_t)bottom, (uint32_t)right_byte },
-            .new_end_point = { (uint32_t)top, (uint32_t)left_byte }
-        });
         b->needs_parse = 1;
     }
+    buffer_record_edit(b, &(TSInputEdit){
+        .start_byte = start_byte,
+        .old_end_byte = old_end_byte,
+        .new_end_byte = start_byte,
+        .start_point = { (uint32_t)top, (uint32_t)left_byte },
+        .old_end_point = { (uint32_t)bottom, (uint32_t)right_byte },
+        .new_end_point = { (uint32_t)top, (uint32_t)left_byte }
+    }, buffer_line_lsp_column(b, b->lines[top], left_byte),
+       buffer_line_lsp_column(b, b->lines[bottom], right_byte), NULL);
 
     BufferLine *top_line = b->lines[top];
     BufferLine *bottom_line = b->lines[bottom];
@@ -2574,28 +2575,42 @@ void editor_command_exec(EditorCommand *cmd) {
                         }
                     }
 
-                    if (buffer->parser && buffer->tree) {
-                        uint32_t start_byte = 0;
-                        for (int i = 0; i < top; i++) {
-                            start_byte += buffer->lines[i]->text_len + 1;
-                        }
+                    uint32_t start_byte = 0;
+                    for (int i = 0; i < top; i++) {
+                        start_byte += buffer->lines[i]->text_len + 1;
+                    }
+                    uint32_t old_end_byte = start_byte;
+                    for (int i = top; i <= bottom; i++) {
+                        old_end_byte += buffer->lines[i]->text_len + 1;
+                    }
 
-                        uint32_t old_end_byte = start_byte;
-                        for (int i = top; i <= bottom; i++) {
-                            old_end_byte += buffer->lines[i]->text_len;
-                             if (i < buffer->line_count -1) {
-                                old_end_byte++;
-                            }
+                    // Whole lines go with their trailing newline; when they
+                    // run to the end of the file, the newline before them goes instead.
+                    TSPoint start_point = { (uint32_t)top, 0 };
+                    TSPoint old_end_point = { (uint32_t)bottom + 1, 0 };
+                    int start_character = 0;
+                    int end_character = 0;
+                    if (bottom == buffer->line_count - 1) {
+                        BufferLine *last = buffer->lines[bottom];
+                        old_end_byte--;
+                        old_end_point = (TSPoint){ (uint32_t)bottom, (uint32_t)last->text_len };
+                        end_character = buffer_line_lsp_column(buffer, last, last->text_len);
+                        if (top > 0) {
+                            BufferLine *prev = buffer->lines[top - 1];
+                            start_byte--;
+                            start_point = (TSPoint){ (uint32_t)top - 1, (uint32_t)prev->text_len };
+                            start_character = buffer_line_lsp_column(buffer, prev, prev->text_len);
                         }
-
-                        ts_tree_edit(buffer->tree, &(TSInputEdit){
-                            .start_byte = start_byte,
-                            .old_end_byte = old_end_byte,
-                            .new_end_byte = start_byte,
-                            .start_point = { (uint32_t)top, 0 },
-                            .old_end_point = { (uint32_t)bottom + 1, 0 },
-                            .new_end_point = { (uint32_t)top, 0 }
-                        });
+                    }
+                    buffer_record_edit(buffer, &(TSInputEdit){
+                        .start_byte = start_byte,
+                        .old_end_byte = old_end_byte,
+                        .new_end_byte = start_byte,
+                        .start_point = start_point,
+                        .old_end_point = old_end_point,
+                        .new_end_point = start_point
+                    }, start_character, end_character, NULL);
+                    if (buffer->parser) {
                         buffer->needs_parse = 1;
                     }
 
@@ -2733,9 +2748,11 @@ void editor_undo(void) {
             Range range = { .y_start = change->y, .x_start = change->x, .y_end = end_y, .x_end = end_x };
             EditorCommand cmd = {0}; // dummy cmd
             range_delete(buffer, &range, &cmd);
+            editor_did_change_buffer();
             buffer->position_y = change->y;
             buffer->position_x = change->x;
         } else { // CHANGE_TYPE_DELETE
+            // Each inserted character already reported its own change.
             pthread_mutex_unlock(&editor_mutex);
             editor_insert_string_at(change->text, change->y, change->x);
             pthread_mutex_lock(&editor_mutex);
@@ -2743,7 +2760,6 @@ void editor_undo(void) {
             buffer->position_x = change->x;
         }
         history_push_redo(buffer->history, change);
-        editor_did_change_buffer();
         if (buffer->history->undo_stack.count == 0) {
             buffer->dirty = 0;
         }
@@ -2764,6 +2780,7 @@ void editor_redo(void) {
         int end_y, end_x;
         calculate_end_point(change->text, change->y, change->x, &end_y, &end_x);
         if (change->type == CHANGE_TYPE_INSERT) {
+            // Each inserted character already reported its own change.
             pthread_mutex_unlock(&editor_mutex);
             editor_insert_string_at(change->text, change->y, change->x);
             pthread_mutex_lock(&editor_mutex);
@@ -2773,11 +2790,11 @@ void editor_redo(void) {
             Range range = { .y_start = change->y, .x_start = change->x, .y_end = end_y, .x_end = end_x };
             EditorCommand cmd = {0}; // dummy cmd
             range_delete(buffer, &range, &cmd);
+            editor_did_change_buffer();
             buffer->position_y = change->y;
             buffer->position_x = change->x;
         }
         history_push_undo(buffer->history, change);
-        editor_did_change_buffer();
         buffer_reset_offset_x(buffer, editor.screen_cols);
         buffer_reset_offset_y(buffer, editor.screen_rows);
     }
@@ -56,9 +56,12 @@ void editor_scroll_to_top(void);
 void editor_scroll_to_bottom(void);
 void editor_set_screen_size(int rows, int cols);
 void editor_draw();
+// The buffer's diagnostics as drawn: remapped through the edits made since
+// the server published them, in buffer columns. Release *set once done.
+const struct Diagnostic *editor_buffer_diagnostics(Buffer *b, struct DiagnosticSet **set, int *count);
 #include <stdbool.h>
 void editor_init(char *file_name, bool benchmark_mode);
-void editor_start(char *file_name, int benchmark_mode);
+void editor_start(char *file_name);
 void editor_open(char *file_name);
 void editor_open_and_jump_to_line(const char *file_path, int line, int col);
 Buffer **editor_get_buffers(int *count);
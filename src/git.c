@@ -1,163 +1,797 @@
+#define _DEFAULT_SOURCE
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <errno.h>
 #include <unistd.h>
+#include <limits.h>
 #include "log.h"
 #include "git.h"
 #include "buffer.h"
+#include "diff.h"
+#include "editor.h"
+#include "perf.h"
+#define ALLOC_TAG ALLOC_TAG_GIT
+#include "alloc.h"
 
-static char cached_branch_name[256] = "";
-static long last_update_ms = 0;
+// The HEAD version of a buffer's file as line hashes. It is fetched once and
+// kept until the watcher reports a change to HEAD, the current ref or the
+// index, so edits diff against memory. The buffer's own line hashes as of
+// the last diff are kept too, so an edit only re-diffs the lines around it.
+typedef struct GitHead {
+    unsigned generation; // head_generation the hashes were read at
+    bool exists; // false when the file is neither in HEAD nor on disk
+    uint64_t *hashes;
+    int count;
 
-long get_current_time_ms(void) {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+    uint64_t *lines; // buffer line hashes at the last diff, NULL if none
+    int line_count;
+    int line_capacity;
+    int buffer_line_count; // buffer->line_count at the last diff
+
+    // Lines touched since the last diff, in current line numbers.
+    int dirty_start; // INT_MAX when nothing changed
+    int dirty_end;
+    int dirty_delta; // lines added minus lines removed
+    bool dirty_all;
+} GitHead;
+
+// Bumped by watch_git_dir. Starts at 1 so a new GitHead (0) always loads.
+static atomic_uint head_generation = 1;
+
+// A long-running `git cat-file --batch` that answers blob requests over pipes.
+static struct {
+    pid_t pid;
+    FILE *to_git;
+    FILE *from_git;
+    char cwd[PATH_MAX]; // requests are relative to this directory
+    unsigned failed_generation; // do not respawn until HEAD changes
+} cat_file;
+static pthread_mutex_t cat_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void cat_file_stop(void) {
+    if (cat_file.pid <= 0) {
+        return;
+    }
+    fclose(cat_file.to_git);
+    fclose(cat_file.from_git);
+    waitpid(cat_file.pid, NULL, 0);
+    cat_file.pid = 0;
 }
 
-void git_current_branch(char *buffer, size_t buffer_size) {
-    if (buffer == NULL || buffer_size == 0) {
-        log_error("git.git_current_branch: null buffer provided to git_current_branch");
+static bool cat_file_start(void) {
+    int to_git[2], from_git[2];
+    if (pipe(to_git) == -1) {
+        log_error("git.cat_file_start: pipe failed");
+        return false;
+    }
+    if (pipe(from_git) == -1) {
+        log_error("git.cat_file_start: pipe failed");
+        close(to_git[0]);
+        close(to_git[1]);
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        log_error("git.cat_file_start: fork failed");
+        close(to_git[0]);
+        close(to_git[1]);
+        close(from_git[0]);
+        close(from_git[1]);
+        return false;
+    }
+    if (pid == 0) {
+        dup2(to_git[0], STDIN_FILENO);
+        dup2(from_git[1], STDOUT_FILENO);
+        close(to_git[0]);
+        close(to_git[1]);
+        close(from_git[0]);
+        close(from_git[1]);
+        int dev_null = open("/dev/null", O_WRONLY);
+        if (dev_null != -1) {
+            dup2(dev_null, STDERR_FILENO);
+            close(dev_null);
+        }
+        execlp("git", "git", "cat-file", "--batch", (char *)NULL);
+        _exit(127);
+    }
+    close(to_git[0]);
+    close(from_git[1]);
+    cat_file.pid = pid;
+    if (!getcwd(cat_file.cwd, sizeof(cat_file.cwd))) {
+        cat_file.cwd[0] = '\0';
+    }
+    cat_file.to_git = fdopen(to_git[1], "w");
+    cat_file.from_git = fdopen(from_git[0], "r");
+    if (!cat_file.to_git || !cat_file.from_git) {
+        log_error("git.cat_file_start: fdopen failed");
         exit(1);
     }
-    buffer[0] = '\0';
+    return true;
+}
 
-    long now_ms = get_current_time_ms();
-    if (now_ms - last_update_ms < 1000) {
-        snprintf(buffer, buffer_size, "%s", cached_branch_name);
-        return;
+// Reads the file's HEAD blob through the coprocess, starting it on first use.
+// Returns NULL if the file is not in HEAD or git is unavailable.
+static char *git_read_head_blob(const char *file_name, size_t *len, unsigned generation) {
+    if (strchr(file_name, '\n')) {
+        return NULL; // cannot be asked for in batch mode
+    }
+    pthread_mutex_lock(&cat_file_mutex);
+    char *data = NULL;
+    char cwd[PATH_MAX];
+    if (cat_file.pid > 0 && (!getcwd(cwd, sizeof(cwd)) || strcmp(cwd, cat_file.cwd) != 0)) {
+        cat_file_stop(); // paths are relative to the old directory
+    }
+    if (cat_file.pid > 0 && waitpid(cat_file.pid, NULL, WNOHANG) != 0) {
+        // Exited, e.g. outside a repository. Writing would raise SIGPIPE.
+        fclose(cat_file.to_git);
+        fclose(cat_file.from_git);
+        cat_file.pid = 0;
+        cat_file.failed_generation = generation;
+    }
+    if (cat_file.pid <= 0 && (cat_file.failed_generation == generation || !cat_file_start())) {
+        cat_file.failed_generation = generation;
+        pthread_mutex_unlock(&cat_file_mutex);
+        return NULL;
+    }
+
+    char header[256];
+    char type[32];
+    size_t size;
+    if (fprintf(cat_file.to_git, "HEAD:./%s\n", file_name) < 0 || fflush(cat_file.to_git) != 0 ||
+        !fgets(header, sizeof(header), cat_file.from_git)) {
+        log_error("git.git_read_head_blob: cat-file stopped responding");
+        cat_file_stop();
+        cat_file.failed_generation = generation;
+    } else if (sscanf(header, "%*s %31s %zu", type, &size) == 2) {
+        // The object is followed by a newline, read and dropped with it.
+        data = malloc(size + 1);
+        if (!data) {
+            log_error("git.git_read_head_blob: malloc failed");
+            exit(1);
+        }
+        if (fread(data, 1, size + 1, cat_file.from_git) != size + 1) {
+            log_error("git.git_read_head_blob: short read from cat-file");
+            cat_file_stop();
+            free(data);
+            data = NULL;
+        } else if (strcmp(type, "blob") != 0) {
+            free(data);
+            data = NULL;
+        } else {
+            *len = size;
+        }
     }
-    last_update_ms = now_ms;
+    // Anything else is "<name> missing": not in HEAD.
+    pthread_mutex_unlock(&cat_file_mutex);
+    return data;
+}
+
+// Line hashes match git's idea of a line: a final line without a newline
+// differs from the same text with one. The buffer drops carriage returns
+// when loading, so they are dropped here as well.
+static uint64_t hash_line(const char *text, size_t len, bool newline) {
+    if (len > 0 && text[len - 1] == '\r') {
+        len--;
+    }
+    uint64_t hash = diff_hash_line(text, len);
+    return newline ? hash : ~hash;
+}
 
-    FILE *head_file;
-    char line[256];
+static void git_load_head(GitHead *head, const char *file_name) {
+    free(head->hashes);
+    head->hashes = NULL;
+    head->count = 0;
+    head->generation = atomic_load(&head_generation);
 
-    head_file = fopen(".git/HEAD", "r");
-    if (head_file == NULL) {
-        snprintf(buffer, buffer_size, "");
-        snprintf(cached_branch_name, sizeof(cached_branch_name), "%s", buffer);
+    size_t len = 0;
+    char *blob = git_read_head_blob(file_name, &len, head->generation);
+    if (!blob) {
+        // Files that are not in HEAD diff as entirely added if they exist.
+        struct stat st;
+        head->exists = stat(file_name, &st) == 0;
         return;
     }
+    head->exists = true;
 
-    if (fgets(line, sizeof(line), head_file) != NULL) {
-        line[strcspn(line, "\n")] = 0; // Remove trailing newline
+    int capacity = 0;
+    for (size_t i = 0; i < len; i++) {
+        capacity += blob[i] == '\n';
+    }
+    head->hashes = malloc(sizeof(uint64_t) * (capacity + 1));
+    if (!head->hashes) {
+        log_error("git.git_load_head: malloc failed");
+        exit(1);
+    }
+    const char *p = blob, *end = blob + len;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        const char *stop = newline ? newline : end;
+        head->hashes[head->count++] = hash_line(p, stop - p, newline != NULL);
+        p = newline ? newline + 1 : end;
+    }
+    free(blob);
+}
 
-        if (strncmp(line, "ref: ", 4) == 0) {
-            char *branch_path = line + 4;
-            char *branch_name_start = strstr(branch_path, "refs/heads/");
-            if (branch_name_start != NULL) {
-                branch_name_start += strlen("refs/heads/");
-                snprintf(buffer, buffer_size, "%s", branch_name_start);
-            } else {
-                snprintf(buffer, buffer_size, "UNKNOWN_REF_FORMAT");
-            }
-        } else {
-            snprintf(buffer, buffer_size, "%s", line); // Detached HEAD, copy the commit hash
-        }
-    } else {
-        snprintf(buffer, buffer_size, "EMPTY_HEAD_FILE");
+void git_release_head(Buffer *buffer) {
+    if (buffer->git_head) {
+        free(buffer->git_head->hashes);
+        free(buffer->git_head->lines);
+        free(buffer->git_head);
+        buffer->git_head = NULL;
     }
+}
 
-    fclose(head_file);
-    snprintf(cached_branch_name, sizeof(cached_branch_name), "%s", buffer);
+static GitHead *git_head_get(Buffer *buffer) {
+    if (!buffer->git_head) {
+        buffer->git_head = calloc(1, sizeof(GitHead));
+        if (!buffer->git_head) {
+            log_error("git.git_head_get: calloc failed");
+            exit(1);
+        }
+        buffer->git_head->dirty_start = INT_MAX;
+    }
+    return buffer->git_head;
 }
 
-static void parse_hunk_header(const char* line, GitHunk* hunk) {
-    const char *p = line;
-    // Skip "@@ -"
-    p += 4;
-    hunk->old_start = strtol(p, (char**)&p, 10);
-    if (*p == ',') {
-        p++;
-        hunk->old_count = strtol(p, (char**)&p, 10);
+void git_note_edit(Buffer *buffer, int start_row, int old_end_row, int new_end_row) {
+    GitHead *head = buffer->git_head;
+    if (!head || head->dirty_all) {
+        return;
+    }
+    int delta = new_end_row - old_end_row;
+    if (head->dirty_start == INT_MAX) {
+        head->dirty_start = start_row;
+        head->dirty_end = new_end_row + 1;
     } else {
-        hunk->old_count = 1;
+        if (head->dirty_end > old_end_row) {
+            head->dirty_end += delta;
+        }
+        head->dirty_start = start_row < head->dirty_start ? start_row : head->dirty_start;
+        head->dirty_end = new_end_row + 1 > head->dirty_end ? new_end_row + 1 : head->dirty_end;
     }
+    head->dirty_delta += delta;
+}
 
-    // Skip " +"
-    while (*p == ' ') p++;
-    p++;
-    hunk->new_start = strtol(p, (char**)&p, 10);
-    if (*p == ',') {
-        p++;
-        hunk->new_count = strtol(p, (char**)&p, 10);
-    } else {
-        hunk->new_count = 1;
+void git_note_unknown_edit(Buffer *buffer) {
+    if (buffer->git_head) {
+        buffer->git_head->dirty_all = true;
     }
 }
 
-void git_update_diff(Buffer *buffer) {
-    if (buffer->hunks) {
-        free(buffer->hunks);
-        buffer->hunks = NULL;
+// Hashes buffer lines [start, end) into head->lines. A trailing empty buffer
+// line is the final newline, not a line, and is never hashed.
+static void hash_buffer_lines(GitHead *head, const Buffer *buffer, int start, int end) {
+    bool final_newline = buffer->lines[buffer->line_count - 1]->text_len == 0;
+    for (int i = start; i < end; i++) {
+        const BufferLine *line = buffer->lines[i];
+        head->lines[i] = hash_line(line->text, line->text_len, i < buffer->line_count - 1 || final_newline);
+    }
+}
+
+static void ensure_line_capacity(GitHead *head, int count) {
+    if (count <= head->line_capacity) {
+        return;
+    }
+    int capacity = head->line_capacity ? head->line_capacity : 64;
+    while (capacity < count) {
+        capacity *= 2;
     }
+    uint64_t *lines = realloc(head->lines, sizeof(uint64_t) * capacity);
+    if (!lines) {
+        log_error("git.ensure_line_capacity: realloc failed");
+        exit(1);
+    }
+    head->lines = lines;
+    head->line_capacity = capacity;
+}
+
+static void git_set_hunks(Buffer *buffer, const DiffHunk *hunks, int count) {
+    free(buffer->hunks);
+    buffer->hunks = NULL;
     buffer->hunk_count = 0;
+    if (count == 0) {
+        return;
+    }
+    buffer->hunks = malloc(sizeof(GitHunk) * count);
+    if (!buffer->hunks) {
+        log_error("git.git_set_hunks: malloc failed");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        buffer->hunks[i] = (GitHunk){
+            .old_start = hunks[i].old_start,
+            .old_count = hunks[i].old_count,
+            .new_start = hunks[i].new_start,
+            .new_count = hunks[i].new_count,
+        };
+    }
+    buffer->hunk_count = count;
+}
+
+static void git_full_diff(Buffer *buffer, GitHead *head, int count) {
+    ensure_line_capacity(head, count);
+    hash_buffer_lines(head, buffer, 0, count);
+    head->line_count = count;
+    DiffHunk *hunks;
+    int hunk_count = diff_lines(head->hashes, head->count, head->lines, count, &hunks);
+    git_set_hunks(buffer, hunks, hunk_count);
+    free(hunks);
+}
+
+// 0-based half-open line range of one side of a -U0 hunk.
+static int hunk_low(int start, int count) {
+    return count ? start - 1 : start;
+}
+
+// Re-diffs lines [start, end) of the buffer, widened to the nearest lines
+// that matched HEAD in the last diff, and splices the result into the
+// existing hunks. Lines outside the window are known to be unchanged, so
+// their hunks only move by the change in line count.
+static void git_window_diff(Buffer *buffer, GitHead *head, int count, int start, int end) {
+    int delta = count - head->line_count;
+    int window_start = start;
+    int window_end = end - delta; // in the previous line numbers
+    if (window_end < window_start) {
+        window_end = window_start;
+    }
 
+    // Take in every hunk that overlaps or touches the window, so both of its
+    // edges are lines that matched.
+    int first = 0;
+    int old_offset = 0; // old minus new line numbers before the window
+    while (first < buffer->hunk_count) {
+        const GitHunk *h = &buffer->hunks[first];
+        if (hunk_low(h->new_start, h->new_count) + h->new_count >= window_start) {
+            break;
+        }
+        old_offset += h->old_count - h->new_count;
+        first++;
+    }
+    int last = first;
+    int inner_offset = 0;
+    while (last < buffer->hunk_count) {
+        const GitHunk *h = &buffer->hunks[last];
+        int low = hunk_low(h->new_start, h->new_count);
+        if (low > window_end) {
+            break;
+        }
+        if (low < window_start) window_start = low;
+        if (low + h->new_count > window_end) window_end = low + h->new_count;
+        inner_offset += h->old_count - h->new_count;
+        last++;
+    }
+
+    // Move the unchanged tail of the line hashes and rehash the window.
+    ensure_line_capacity(head, count);
+    memmove(head->lines + window_end + delta, head->lines + window_end,
+            sizeof(uint64_t) * (head->line_count - window_end));
+    head->line_count = count;
+    hash_buffer_lines(head, buffer, window_start, window_end + delta);
+
+    int old_start = window_start + old_offset;
+    int old_end = window_end + old_offset + inner_offset;
+    DiffHunk *window_hunks;
+    int window_count = diff_lines(head->hashes + old_start, old_end - old_start,
+                                  head->lines + window_start, window_end + delta - window_start, &window_hunks);
+
+    int total = first + window_count + (buffer->hunk_count - last);
+    DiffHunk *hunks = malloc(sizeof(DiffHunk) * (total + 1));
+    if (!hunks) {
+        log_error("git.git_window_diff: malloc failed");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; i < first; i++) {
+        const GitHunk *h = &buffer->hunks[i];
+        hunks[n++] = (DiffHunk){ h->old_start, h->old_count, h->new_start, h->new_count };
+    }
+    for (int i = 0; i < window_count; i++) {
+        DiffHunk h = window_hunks[i];
+        h.old_start += old_start;
+        h.new_start += window_start;
+        hunks[n++] = h;
+    }
+    for (int i = last; i < buffer->hunk_count; i++) {
+        const GitHunk *h = &buffer->hunks[i];
+        hunks[n++] = (DiffHunk){ h->old_start, h->old_count, h->new_start + delta, h->new_count };
+    }
+    git_set_hunks(buffer, hunks, n);
+    free(hunks);
+    free(window_hunks);
+}
+
+unsigned git_head_generation(void) {
+    return atomic_load(&head_generation);
+}
+
+void git_invalidate_head(void) {
+    atomic_fetch_add(&head_generation, 1);
+}
+
+bool git_diff_outdated(const Buffer *buffer) {
+    const GitHead *head = buffer->git_head;
+    return head && (head->generation != atomic_load(&head_generation) || head->dirty_start != INT_MAX ||
+                    head->dirty_all);
+}
+
+int git_head_line(const Buffer *buffer, int row) {
+    const GitHead *head = buffer->git_head;
+    if (!head || !head->exists) {
+        return -1;
+    }
+    int line = row + 1, delta = 0;
+    for (int i = 0; i < buffer->hunk_count; i++) {
+        const GitHunk *h = &buffer->hunks[i];
+        // A hunk without new lines sits after line new_start.
+        if (h->new_count == 0 ? h->new_start >= line : h->new_start > line) {
+            break;
+        }
+        if (h->new_count > 0 && line < h->new_start + h->new_count) {
+            return -1;
+        }
+        delta += h->old_count - h->new_count;
+    }
+    return line - 1 + delta;
+}
+
+void git_update_diff(Buffer *buffer) {
     if (!buffer->file_name) {
+        git_set_hunks(buffer, NULL, 0);
+        return;
+    }
+
+    GitHead *head = git_head_get(buffer);
+    bool reloaded = false;
+    if (head->generation != atomic_load(&head_generation)) {
+        git_load_head(head, buffer->file_name);
+        reloaded = true;
+    } else if (!head->exists) {
+        struct stat st;
+        head->exists = stat(buffer->file_name, &st) == 0; // saved for the first time
+        reloaded = head->exists;
+    }
+
+    int dirty_start = head->dirty_start;
+    int dirty_end = head->dirty_end;
+    bool incremental = !reloaded && !head->dirty_all && head->lines &&
+                       buffer->line_count - head->buffer_line_count == head->dirty_delta;
+    head->dirty_start = INT_MAX;
+    head->dirty_delta = 0;
+    head->dirty_all = false;
+    head->buffer_line_count = buffer->line_count;
+
+    if (!head->exists) {
+        git_set_hunks(buffer, NULL, 0);
+        free(head->lines);
+        head->lines = NULL;
+        head->line_capacity = 0;
         return;
     }
 
-    char head_path[] = "/tmp/arc_git_head_XXXXXX";
-    int head_fd = mkstemp(head_path);
-    if (head_fd == -1) return;
+    int count = buffer->line_count;
+    if (buffer->lines[count - 1]->text_len == 0) {
+        count--;
+    }
+    if (!incremental) {
+        git_full_diff(buffer, head, count);
+    } else if (dirty_start == INT_MAX) {
+        return; // nothing changed since the last diff
+    } else if (dirty_end >= buffer->line_count - 1) {
+        // Edits on the last line can change which line is final, and
+        // whether it ends in a newline.
+        git_full_diff(buffer, head, count);
+    } else {
+        git_window_diff(buffer, head, count, dirty_start, dirty_end);
+    }
+}
+
+// The repository of the working directory, resolved once by the state
+// service.
+static GitRepository repository;
 
-    char command[1024];
-    snprintf(command, sizeof(command), "git show HEAD:./%s > %s 2>/dev/null", buffer->file_name, head_path);
-    int ret = system(command);
-    // if file is not in git, system will return non-zero
-    if (ret != 0) {
-        // check if the file exists on disk
+// State handed from the service to the render thread. The service swaps a
+// new state into pending_state; git_state takes it over on the render thread.
+static _Atomic(GitState *) pending_state = NULL;
+static GitState *current_state = NULL;
+static const GitState empty_state = { 0 };
+static atomic_int wake_fd = -1;
+
+static bool read_first_line(const char *path, char *line, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fgets(line, size, fp) != NULL;
+    fclose(fp);
+    line[strcspn(line, "\r\n")] = '\0';
+    return ok;
+}
+
+// Resolves path, relative to base unless absolute, into out.
+static bool resolve_relative(const char *base, const char *path, char *out) {
+    char joined[PATH_MAX * 2];
+    snprintf(joined, sizeof(joined), "%s%s%s", path[0] == '/' ? "" : base, path[0] == '/' ? "" : "/", path);
+    return realpath(joined, out) != NULL;
+}
+
+bool git_find_repository(GitRepository *repo) {
+    char dir[PATH_MAX];
+    if (!getcwd(dir, sizeof(dir))) {
+        return false;
+    }
+    for (;;) {
+        char path[PATH_MAX + 8];
+        snprintf(path, sizeof(path), "%s/.git", dir);
         struct stat st;
-        if (stat(buffer->file_name, &st) == 0) {
-            // file exists, but not in git. diff against empty file
-            FILE* f = fopen(head_path, "w");
-            if (f) fclose(f);
-        } else {
-            close(head_fd);
-            unlink(head_path);
-            return;
+        if (stat(path, &st) == 0) {
+            char line[PATH_MAX];
+            if (S_ISDIR(st.st_mode)) {
+                if (!realpath(path, repo->git_dir)) return false;
+            } else if (!read_first_line(path, line, sizeof(line)) || strncmp(line, "gitdir: ", 8) != 0 ||
+                       !resolve_relative(dir, line + 8, repo->git_dir)) {
+                return false;
+            }
+            break;
         }
+        char *slash = strrchr(dir, '/');
+        if (!slash || dir[1] == '\0') {
+            return false;
+        }
+        slash[slash == dir ? 1 : 0] = '\0';
     }
-    close(head_fd);
+    snprintf(repo->work_tree, sizeof(repo->work_tree), "%s", dir);
 
-    char buffer_path[] = "/tmp/arc_git_buffer_XXXXXX";
-    int buffer_fd = mkstemp(buffer_path);
-    if (buffer_fd == -1) {
-        unlink(head_path);
-        return;
+    char path[PATH_MAX + 16];
+    char line[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/commondir", repo->git_dir);
+    if (!read_first_line(path, line, sizeof(line)) || !resolve_relative(repo->git_dir, line, repo->common_dir)) {
+        snprintf(repo->common_dir, sizeof(repo->common_dir), "%s", repo->git_dir);
     }
+    return true;
+}
 
-    char* content = buffer_get_content(buffer);
-    if (content) {
-        write(buffer_fd, content, strlen(content));
-        free(content);
+// Reads HEAD: the ref it points at ("refs/heads/main"), or the commit id
+// when detached. Returns false if there is no HEAD.
+static bool git_read_head(char *head, size_t size, bool *is_ref) {
+    char path[PATH_MAX + 8];
+    char line[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/HEAD", repository.git_dir);
+    if (!read_first_line(path, line, sizeof(line))) {
+        return false;
     }
-    close(buffer_fd);
+    *is_ref = strncmp(line, "ref: ", 5) == 0;
+    snprintf(head, size, "%s", *is_ref ? line + 5 : line);
+    return true;
+}
 
-    snprintf(command, sizeof(command), "git diff --no-index --no-color -U0 %s %s", head_path, buffer_path);
-    FILE* fp = popen(command, "r");
+// Resolves a ref such as "refs/heads/main" to its commit id, loose or packed.
+static bool git_resolve_ref(const char *ref, char *id, size_t size) {
+    char path[PATH_MAX * 2];
+    char line[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", repository.common_dir, ref);
+    if (read_first_line(path, line, sizeof(line))) {
+        snprintf(id, size, "%.*s", (int)strspn(line, "0123456789abcdef"), line);
+        return id[0] != '\0';
+    }
+    snprintf(path, sizeof(path), "%s/packed-refs", repository.common_dir);
+    FILE *fp = fopen(path, "r");
     if (!fp) {
-        unlink(head_path);
-        unlink(buffer_path);
-        return;
+        return false;
+    }
+    bool found = false;
+    size_t ref_len = strlen(ref);
+    while (!found && fgets(line, sizeof(line), fp)) {
+        size_t id_len = strspn(line, "0123456789abcdef");
+        if (id_len > 0 && line[id_len] == ' ' && strncmp(line + id_len + 1, ref, ref_len) == 0 &&
+            (line[id_len + 1 + ref_len] == '\n' || line[id_len + 1 + ref_len] == '\0')) {
+            snprintf(id, size, "%.*s", (int)id_len, line);
+            found = true;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+// Watches the directory holding the current ref, replacing any earlier
+// watch. Refs are written as "<name>.lock" and renamed into place.
+static int watch_head_ref(int fd, int old_wd, char *ref_name, size_t size) {
+    if (old_wd >= 0) {
+        inotify_rm_watch(fd, old_wd);
+    }
+    ref_name[0] = '\0';
+    char ref[PATH_MAX];
+    bool is_ref;
+    if (!git_read_head(ref, sizeof(ref), &is_ref) || !is_ref) {
+        return -1;
+    }
+    char path[PATH_MAX * 2];
+    snprintf(path, sizeof(path), "%s/%s", repository.common_dir, ref);
+    char *slash = strrchr(path, '/');
+    snprintf(ref_name, size, "%s", slash + 1);
+    *slash = '\0';
+    int wd = inotify_add_watch(fd, path, IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE);
+    if (wd < 0) {
+        log_error("git.watch_head_ref: inotify_add_watch failed for %s", path);
     }
+    return wd;
+}
 
-    char line[1024];
-    while (fgets(line, sizeof(line), fp)) {
-        if (strncmp(line, "@@", 2) == 0) {
-            buffer->hunk_count++;
-            buffer->hunks = realloc(buffer->hunks, sizeof(GitHunk) * buffer->hunk_count);
-            parse_hunk_header(line, &buffer->hunks[buffer->hunk_count - 1]);
+// Whether tracked files differ from HEAD. Optional locks are off so git does
+// not rewrite the index, which would wake the watcher again.
+static bool git_worktree_dirty(void) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        log_error("git.git_worktree_dirty: fork failed");
+        return false;
+    }
+    if (pid == 0) {
+        int dev_null = open("/dev/null", O_RDWR);
+        if (dev_null != -1) {
+            dup2(dev_null, STDIN_FILENO);
+            dup2(dev_null, STDOUT_FILENO);
+            dup2(dev_null, STDERR_FILENO);
+            close(dev_null);
+        }
+        setenv("GIT_OPTIONAL_LOCKS", "0", 1);
+        execlp("git", "git", "diff", "--no-ext-diff", "--quiet", "HEAD", "--", (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 1;
+}
+
+static void git_publish_state(void) {
+    GitState *state = calloc(1, sizeof(GitState));
+    if (!state) {
+        log_error("git.git_publish_state: calloc failed");
+        exit(1);
+    }
+    char head[PATH_MAX];
+    bool is_ref;
+    int max = sizeof(state->branch) - 1; // branch names this long are cut short
+    if (!git_read_head(head, sizeof(head), &is_ref)) {
+        snprintf(state->branch, sizeof(state->branch), "EMPTY_HEAD_FILE");
+    } else if (!is_ref) {
+        snprintf(state->branch, sizeof(state->branch), "%.*s", max, head); // detached
+        snprintf(state->head, sizeof(state->head), "%.*s", (int)strspn(head, "0123456789abcdef"), head);
+    } else {
+        if (strncmp(head, "refs/heads/", 11) == 0) {
+            snprintf(state->branch, sizeof(state->branch), "%.*s", max, head + 11);
+        } else {
+            snprintf(state->branch, sizeof(state->branch), "UNKNOWN_REF_FORMAT");
+        }
+        if (!git_resolve_ref(head, state->head, sizeof(state->head))) {
+            state->head[0] = '\0'; // unborn branch
         }
     }
+    state->dirty = git_worktree_dirty();
+
+    free(atomic_exchange(&pending_state, state));
+    editor_request_redraw();
+}
+
+const GitState *git_state(void) {
+    GitState *next = atomic_exchange(&pending_state, NULL);
+    if (next) {
+        free(current_state);
+        current_state = next;
+    }
+    return current_state ? current_state : &empty_state;
+}
+
+void git_state_refresh(void) {
+    int fd = atomic_load(&wake_fd);
+    if (fd >= 0) {
+        uint64_t one = 1;
+        if (write(fd, &one, sizeof(one)) < 0) {
+            log_error("git.git_state_refresh: write failed");
+        }
+    }
+}
+
+void *watch_git_dir(void *arg __attribute__((unused))) {
+    PERF_THREAD_NAME("git watcher");
+    if (!git_find_repository(&repository)) {
+        return NULL; // not in a repository
+    }
+    int fd = inotify_init();
+    if (fd < 0) {
+        log_error("git.watch_git_dir: inotify_init failed");
+        return NULL;
+    }
+    int wake = eventfd(0, 0);
+    if (wake < 0) {
+        log_error("git.watch_git_dir: eventfd failed");
+        close(fd);
+        return NULL;
+    }
+    uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE;
+    int git_wd = inotify_add_watch(fd, repository.git_dir, mask);
+    int common_wd = inotify_add_watch(fd, repository.common_dir, mask); // same wd when not a worktree
+    if (git_wd < 0 || common_wd < 0) {
+        log_error("git.watch_git_dir: inotify_add_watch failed for %s", repository.git_dir);
+        close(wake);
+        close(fd);
+        return NULL;
+    }
+    char ref_name[NAME_MAX + 1];
+    int ref_wd = watch_head_ref(fd, -1, ref_name, sizeof(ref_name));
+    atomic_store(&wake_fd, wake);
+    git_publish_state();
+
+    char read_buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = { { .fd = fd, .events = POLLIN }, { .fd = wake, .events = POLLIN } };
+    while (1) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            log_error("git.watch_git_dir: poll failed");
+            break;
+        }
+
+        bool changed = false;
+        bool head_moved = false;
+        bool refresh = false;
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            refresh = read(wake, &count, sizeof(count)) == sizeof(count);
+        }
+        if (fds[0].revents & POLLIN) {
+            ssize_t len = read(fd, read_buffer, sizeof(read_buffer));
+            if (len < 0) {
+                log_error("git.watch_git_dir: read failed");
+                break;
+            }
+            for (char *p = read_buffer; p < read_buffer + len; ) {
+                struct inotify_event *event = (struct inotify_event *)p;
+                if (event->len && (event->wd == git_wd || event->wd == common_wd)) {
+                    if (event->wd == git_wd && strcmp(event->name, "HEAD") == 0) {
+                        head_moved = true;
+                    } else if ((event->wd == git_wd && strcmp(event->name, "index") == 0) ||
+                               (event->wd == common_wd && strcmp(event->name, "packed-refs") == 0)) {
+                        changed = true;
+                    }
+                }
+                if (event->len && event->wd == ref_wd && strcmp(event->name, ref_name) == 0) {
+                    changed = true;
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (head_moved) {
+            ref_wd = watch_head_ref(fd, ref_wd, ref_name, sizeof(ref_name));
+        }
+        if (changed || head_moved) {
+            git_invalidate_head();
+        }
+        if (changed || head_moved || refresh) {
+            git_publish_state();
+        }
+    }
+
+    atomic_store(&wake_fd, -1);
+    close(wake);
+    close(fd);
+    return NULL;
+}
 
-    pclose(fp);
-    unlink(head_path);
-    unlink(buffer_path);
+void git_shutdown(void) {
+    pthread_mutex_lock(&cat_file_mutex);
+    cat_file_stop();
+    pthread_mutex_unlock(&cat_file_mutex);
 }
 
 GitLineStatus git_get_line_status(const Buffer *buffer, int line_num, int* deleted_lines) {
@@ -1,7 +1,7 @@
 #ifndef GIT_H
 #define GIT_H
 
-#include <time.h>
+#include <linux/limits.h>
 #include "buffer.h"
 
 typedef enum {
@@ -19,8 +19,56 @@ typedef struct GitHunk {
     struct GitHunk* next;
 } GitHunk;
 
+// The repository containing the working directory. HEAD and the index live
+// in git_dir; refs and packed-refs live in common_dir, which differs from
+// git_dir in linked worktrees.
+typedef struct {
+    char work_tree[PATH_MAX];
+    char git_dir[PATH_MAX];
+    char common_dir[PATH_MAX];
+} GitRepository;
+
+// Finds the nearest .git going up from the working directory. It is a
+// directory, or in worktrees and submodules a file holding "gitdir: <path>".
+bool git_find_repository(GitRepository *repo);
+
+// Diffs the buffer against the HEAD version of its file, which is cached
+// until watch_git_dir sees HEAD, the current ref or the index change.
 void git_update_diff(Buffer *buffer);
+void git_release_head(Buffer *buffer);
+// Marks buffer lines [start_row, old_end_row] as replaced by
+// [start_row, new_end_row] for the next git_update_diff, which then only
+// re-diffs around them.
+void git_note_edit(Buffer *buffer, int start_row, int old_end_row, int new_end_row);
+// An edit whose extent is unknown; the next git_update_diff is a full diff.
+void git_note_unknown_edit(Buffer *buffer);
+// Bumped whenever HEAD, the current ref or the index changes.
+unsigned git_head_generation(void);
+// Bumps the generation, so every buffer re-reads its HEAD version on its
+// next diff. watch_git_dir calls this when HEAD or the index changes.
+void git_invalidate_head(void);
+// Whether HEAD moved or the buffer was edited since it was last diffed.
+bool git_diff_outdated(const Buffer *buffer);
+// The 0-based HEAD line a buffer row came from, going by the last diff, or
+// -1 if the row was added or changed.
+int git_head_line(const Buffer *buffer, int row);
+// The git state service: resolves the repository from the working
+// directory, watches HEAD, the current ref and the index, and publishes
+// GitState. Started alongside the config watcher.
+void *watch_git_dir(void *arg);
+// Stops the cat-file coprocess.
+void git_shutdown(void);
 GitLineStatus git_get_line_status(const Buffer *buffer, int line_num, int* deleted_lines);
-void git_current_branch(char *buffer, size_t buffer_size);
+typedef struct {
+    char branch[256]; // empty outside a repository
+    char head[65]; // commit id HEAD resolves to, empty if there is none
+    bool dirty; // tracked files differ from HEAD
+} GitState;
+
+// The latest state published by watch_git_dir. Render thread only; never
+// touches the filesystem.
+const GitState *git_state(void);
+// Asks the service to recompute the state, e.g. after a file is written.
+void git_state_refresh(void);
 
 #endif
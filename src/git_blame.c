@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "git.h"
+#include "git_blame.h"
+#include "editor.h"
+#include "log.h"
+#include "perf.h"
+#include "utf8.h"
+#define ALLOC_TAG ALLOC_TAG_GIT
+#include "alloc.h"
+
+#define BLAME_CACHE_SIZE 32
+#define BLAME_AUTHOR_WIDTH 13
+
+typedef struct {
+    char id[65]; // hex, SHA-1 or SHA-256
+    char author[64];
+    long long time;
+} BlameCommit;
+
+// One file's blame at one HEAD commit, shared by the cache and the buffers
+// showing it.
+typedef struct GitBlame {
+    atomic_int refs;
+    char head[65]; // the commit blamed
+    BlameCommit *commits;
+    int commit_count;
+    int commit_capacity;
+    int *slots; // open addressing over commits, index + 1, 0 when empty
+    int slot_count;
+    int *line_commits; // commit index per HEAD line, -1 if not reported
+    int line_count;
+} GitBlame;
+
+typedef enum {
+    BLAME_PENDING,
+    BLAME_RUNNING,
+    BLAME_READY,
+} BlameState;
+
+// Keyed by commit rather than by git_head_generation, which also moves when
+// the index changes: staging a file does not change its blame.
+typedef struct {
+    char *file_name;
+    char head[65];
+    BlameState state;
+    GitBlame *blame; // NULL when ready but git could not blame the file
+    unsigned long last_used;
+} BlameCacheEntry;
+
+static BlameCacheEntry cache[BLAME_CACHE_SIZE];
+static int cache_count = 0;
+static unsigned long use_clock = 0;
+static pthread_mutex_t blame_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t blame_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t worker_thread;
+static bool worker_started = false;
+static bool shutting_down = false;
+static pid_t blame_pid = 0; // the running `git blame`, under blame_mutex
+static atomic_bool enabled = false;
+
+void git_blame_toggle(void) {
+    atomic_store(&enabled, !atomic_load(&enabled));
+}
+
+int git_blame_width(void) {
+    return atomic_load(&enabled) ? GIT_BLAME_WIDTH : 0;
+}
+
+static void blame_retain(GitBlame *blame) {
+    if (blame) {
+        atomic_fetch_add(&blame->refs, 1);
+    }
+}
+
+static void blame_release(GitBlame *blame) {
+    if (blame && atomic_fetch_sub(&blame->refs, 1) == 1) {
+        free(blame->commits);
+        free(blame->slots);
+        free(blame->line_commits);
+        free(blame);
+    }
+}
+
+static uint64_t commit_hash(const char *id) {
+    uint64_t hash = 0;
+    for (int i = 0; i < 16 && id[i]; i++) {
+        hash = hash << 4 | (uint64_t)(id[i] <= '9' ? id[i] - '0' : (id[i] | 0x20) - 'a' + 10);
+    }
+    return hash;
+}
+
+// The index of the commit with this id, added if it is new.
+static int blame_commit(GitBlame *blame, const char *id, size_t len) {
+    if (blame->commit_count * 2 >= blame->slot_count) {
+        int slot_count = blame->slot_count ? blame->slot_count * 2 : 64;
+        int *slots = calloc(slot_count, sizeof(int));
+        if (!slots) {
+            log_error("git_blame.blame_commit: calloc failed");
+            exit(1);
+        }
+        for (int i = 0; i < blame->commit_count; i++) {
+            size_t slot = commit_hash(blame->commits[i].id) & (slot_count - 1);
+            while (slots[slot]) slot = (slot + 1) & (slot_count - 1);
+            slots[slot] = i + 1;
+        }
+        free(blame->slots);
+        blame->slots = slots;
+        blame->slot_count = slot_count;
+    }
+    char key[65];
+    snprintf(key, sizeof(key), "%.*s", (int)len, id);
+    size_t slot = commit_hash(key) & (blame->slot_count - 1);
+    while (blame->slots[slot]) {
+        int index = blame->slots[slot] - 1;
+        if (strcmp(blame->commits[index].id, key) == 0) {
+            return index;
+        }
+        slot = (slot + 1) & (blame->slot_count - 1);
+    }
+
+    if (blame->commit_count == blame->commit_capacity) {
+        blame->commit_capacity = blame->commit_capacity ? blame->commit_capacity * 2 : 16;
+        BlameCommit *grown = realloc(blame->commits, sizeof(BlameCommit) * blame->commit_capacity);
+        if (!grown) {
+            log_error("git_blame.blame_commit: realloc failed");
+            exit(1);
+        }
+        blame->commits = grown;
+    }
+    BlameCommit *commit = &blame->commits[blame->commit_count];
+    memset(commit, 0, sizeof(*commit));
+    memcpy(commit->id, key, sizeof(key));
+    blame->slots[slot] = ++blame->commit_count;
+    return blame->commit_count - 1;
+}
+
+static void blame_set_lines(GitBlame *blame, int start, int count, int commit) {
+    if (start < 0 || count <= 0 || start + count > INT32_MAX / 2) {
+        return;
+    }
+    if (start + count > blame->line_count) {
+        int *grown = realloc(blame->line_commits, sizeof(int) * (start + count));
+        if (!grown) {
+            log_error("git_blame.blame_set_lines: realloc failed");
+            exit(1);
+        }
+        for (int i = blame->line_count; i < start + count; i++) {
+            grown[i] = -1;
+        }
+        blame->line_commits = grown;
+        blame->line_count = start + count;
+    }
+    for (int i = start; i < start + count; i++) {
+        blame->line_commits[i] = commit;
+    }
+}
+
+GitBlame *git_blame_parse(FILE *fp, const char *head) {
+    GitBlame *blame = calloc(1, sizeof(GitBlame));
+    if (!blame) {
+        log_error("git_blame.git_blame_parse: calloc failed");
+        exit(1);
+    }
+    atomic_init(&blame->refs, 1);
+    snprintf(blame->head, sizeof(blame->head), "%s", head);
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    int current = -1;
+    while ((len = getline(&line, &capacity, fp)) > 0) {
+        line[strcspn(line, "\n")] = '\0';
+        size_t id_len = strspn(line, "0123456789abcdef");
+        int source, start, count;
+        if ((id_len == 40 || id_len == 64) && line[id_len] == ' ' &&
+            sscanf(line + id_len, " %d %d %d", &source, &start, &count) == 3) {
+            current = blame_commit(blame, line, id_len);
+            blame_set_lines(blame, start - 1, count, current);
+        } else if (current >= 0 && strncmp(line, "author ", 7) == 0) {
+            snprintf(blame->commits[current].author, sizeof(blame->commits[current].author), "%s", line + 7);
+        } else if (current >= 0 && strncmp(line, "author-time ", 12) == 0) {
+            blame->commits[current].time = atoll(line + 12);
+        }
+    }
+    free(line);
+    return blame;
+}
+
+// Runs `git blame --incremental` on the file at the given commit.
+static GitBlame *blame_run(const char *file_name, const char *head) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        log_error("git_blame.blame_run: pipe failed");
+        return NULL;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        log_error("git_blame.blame_run: fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        int dev_null = open("/dev/null", O_RDWR);
+        if (dev_null != -1) {
+            dup2(dev_null, STDIN_FILENO);
+            dup2(dev_null, STDERR_FILENO);
+            close(dev_null);
+        }
+        setenv("GIT_OPTIONAL_LOCKS", "0", 1);
+        execlp("git", "git", "blame", "--incremental", head, "--", file_name, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    pthread_mutex_lock(&blame_mutex);
+    blame_pid = pid;
+    pthread_mutex_unlock(&blame_mutex);
+
+    FILE *fp = fdopen(fds[0], "r");
+    if (!fp) {
+        log_error("git_blame.blame_run: fdopen failed");
+        exit(1);
+    }
+    GitBlame *blame = git_blame_parse(fp, head);
+    fclose(fp);
+
+    pthread_mutex_lock(&blame_mutex);
+    blame_pid = 0; // before reaping, so shutdown cannot signal a reused pid
+    pthread_mutex_unlock(&blame_mutex);
+    int status;
+    bool ok = waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (!ok) {
+        blame_release(blame); // untracked, outside a repository, or killed
+        return NULL;
+    }
+    return blame;
+}
+
+static BlameCacheEntry *cache_find(const char *file_name, const char *head) {
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].head, head) == 0 && strcmp(cache[i].file_name, file_name) == 0) {
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+// Adds a pending entry, evicting the least recently used one that is not
+// being computed when the cache is full.
+static BlameCacheEntry *cache_insert(const char *file_name, const char *head) {
+    BlameCacheEntry *entry = NULL;
+    if (cache_count < BLAME_CACHE_SIZE) {
+        entry = &cache[cache_count++];
+    } else {
+        for (int i = 0; i < cache_count; i++) {
+            if (cache[i].state != BLAME_RUNNING && (!entry || cache[i].last_used < entry->last_used)) {
+                entry = &cache[i];
+            }
+        }
+        if (!entry) {
+            return NULL;
+        }
+        free(entry->file_name);
+        blame_release(entry->blame);
+    }
+    *entry = (BlameCacheEntry){ .file_name = strdup(file_name), .state = BLAME_PENDING };
+    snprintf(entry->head, sizeof(entry->head), "%s", head);
+    if (!entry->file_name) {
+        log_error("git_blame.cache_insert: strdup failed");
+        exit(1);
+    }
+    return entry;
+}
+
+static void *blame_worker(void *arg __attribute__((unused))) {
+    PERF_THREAD_NAME("git blame");
+    pthread_mutex_lock(&blame_mutex);
+    while (!shutting_down) {
+        BlameCacheEntry *entry = NULL;
+        for (int i = 0; i < cache_count && !entry; i++) {
+            if (cache[i].state == BLAME_PENDING) {
+                entry = &cache[i];
+            }
+        }
+        if (!entry) {
+            pthread_cond_wait(&blame_cond, &blame_mutex);
+            continue;
+        }
+        entry->state = BLAME_RUNNING;
+        char *file_name = strdup(entry->file_name);
+        char head[65];
+        memcpy(head, entry->head, sizeof(head));
+        if (!file_name) {
+            log_error("git_blame.blame_worker: strdup failed");
+            exit(1);
+        }
+        pthread_mutex_unlock(&blame_mutex);
+
+        GitBlame *blame = blame_run(file_name, head);
+
+        pthread_mutex_lock(&blame_mutex);
+        entry = cache_find(file_name, head); // running entries are not evicted
+        entry->blame = blame;
+        entry->state = BLAME_READY;
+        free(file_name);
+        editor_request_redraw();
+    }
+    pthread_mutex_unlock(&blame_mutex);
+    return NULL;
+}
+
+void git_blame_prepare(Buffer *buffer) {
+    if (!atomic_load(&enabled) || !buffer->file_name) {
+        return;
+    }
+    const char *head = git_state()->head;
+    if (buffer->git_blame && strcmp(buffer->git_blame->head, head) == 0) {
+        return;
+    }
+    if (!head[0]) {
+        git_blame_release(buffer); // outside a repository, or nothing committed
+        return;
+    }
+    // The worker only holds the lock between blames, so a busy lock means
+    // a result is being stored; it is picked up on the redraw that follows.
+    if (pthread_mutex_trylock(&blame_mutex) != 0) {
+        return;
+    }
+    BlameCacheEntry *entry = cache_find(buffer->file_name, head);
+    if (!entry && !shutting_down && (entry = cache_insert(buffer->file_name, head))) {
+        if (!worker_started) {
+            worker_started = pthread_create(&worker_thread, NULL, blame_worker, NULL) == 0;
+            if (!worker_started) {
+                log_error("git_blame.git_blame_prepare: pthread_create failed");
+            }
+        }
+        pthread_cond_signal(&blame_cond);
+    }
+    if (entry) {
+        entry->last_used = ++use_clock;
+    }
+    // Rows stay blank until the new commit's blame is ready.
+    GitBlame *blame = entry && entry->state == BLAME_READY ? entry->blame : NULL;
+    if (blame != buffer->git_blame) {
+        blame_retain(blame);
+        blame_release(buffer->git_blame);
+        buffer->git_blame = blame;
+    }
+    pthread_mutex_unlock(&blame_mutex);
+}
+
+static void format_age(long long seconds, char *out, size_t size) {
+    if (seconds < 3600) {
+        snprintf(out, size, "%lldm", seconds < 0 ? 0 : seconds / 60);
+    } else if (seconds < 86400) {
+        snprintf(out, size, "%lldh", seconds / 3600);
+    } else if (seconds < 86400 * 30) {
+        snprintf(out, size, "%lldd", seconds / 86400);
+    } else if (seconds < 86400 * 365) {
+        snprintf(out, size, "%lldmo", seconds / (86400 * 30));
+    } else {
+        snprintf(out, size, "%lldy", seconds / (86400 * 365));
+    }
+}
+
+void git_blame_format(const Buffer *buffer, int row, time_t now, char *out, size_t size) {
+    snprintf(out, size, "%*s", GIT_BLAME_WIDTH, "");
+    const GitBlame *blame = buffer->git_blame;
+    int line = blame ? git_head_line(buffer, row) : -1;
+    if (line < 0 || line >= blame->line_count ||
+        blame->line_commits[line] < 0 || size < GIT_BLAME_WIDTH * 4 + 1) {
+        return;
+    }
+    const BlameCommit *commit = &blame->commits[blame->line_commits[line]];
+
+    // The author, cut at BLAME_AUTHOR_WIDTH columns and padded with spaces.
+    size_t len = 0;
+    int width = 0;
+    for (const char *p = commit->author; *p;) {
+        int char_len = utf8_char_len(p);
+        int char_width = utf8_char_width(p);
+        if (width + char_width > BLAME_AUTHOR_WIDTH) {
+            break;
+        }
+        memcpy(out + len, p, char_len);
+        len += char_len;
+        width += char_width;
+        p += char_len;
+    }
+    char age[16];
+    format_age((long long)now - commit->time, age, sizeof(age));
+    snprintf(out + len, size - len, "%*s %5s ", BLAME_AUTHOR_WIDTH - width, "", age);
+}
+
+void git_blame_release(Buffer *buffer) {
+    blame_release(buffer->git_blame);
+    buffer->git_blame = NULL;
+}
+
+void git_blame_shutdown(void) {
+    pthread_mutex_lock(&blame_mutex);
+    shutting_down = true;
+    if (blame_pid > 0) {
+        kill(blame_pid, SIGTERM);
+    }
+    pthread_cond_signal(&blame_cond);
+    pthread_mutex_unlock(&blame_mutex);
+    if (worker_started) {
+        pthread_join(worker_thread, NULL);
+        worker_started = false;
+    }
+    for (int i = 0; i < cache_count; i++) {
+        free(cache[i].file_name);
+        blame_release(cache[i].blame);
+    }
+    cache_count = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef GIT_BLAME_H
+#define GIT_BLAME_H
+
+#include <stdio.h>
+#include <time.h>
+#include "buffer.h"
+
+// Columns the blame gutter takes when shown: author, age and a space.
+#define GIT_BLAME_WIDTH 20
+
+void git_blame_toggle(void);
+// GIT_BLAME_WIDTH while the blame gutter is shown, otherwise 0.
+int git_blame_width(void);
+// Picks up the blame of the buffer's file at HEAD if the worker has it,
+// otherwise queues it. Never waits for the worker.
+void git_blame_prepare(Buffer *buffer);
+// Writes a row's gutter text, GIT_BLAME_WIDTH columns. Rows are blank until
+// the blame arrives, and when they were added or changed since HEAD.
+void git_blame_format(const Buffer *buffer, int row, time_t now, char *out, size_t size);
+void git_blame_release(Buffer *buffer);
+// Reads `git blame --incremental` output: a header per group of lines,
+// "<commit> <source line> <line> <count>", followed by the commit's details
+// the first time it appears. head is the commit that was blamed.
+struct GitBlame *git_blame_parse(FILE *fp, const char *head);
+// Stops the worker, killing any blame in progress.
+void git_blame_shutdown(void);
+
+#endif // GIT_BLAME_H
@@ -0,0 +1,921 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "git.h"
+#include "git_status.h"
+#include "ignore.h"
+#include "log.h"
+#define ALLOC_TAG ALLOC_TAG_GIT
+#include "alloc.h"
+
+#define SHA1_SIZE 20
+#define STAT_CHUNK 512
+#define STAT_MAX_THREADS 8
+
+// Flags in the on-disk index entry.
+#define INDEX_ASSUME_VALID 0x8000
+#define INDEX_EXTENDED 0x4000
+#define INDEX_NAME_MASK 0x0fff
+#define INDEX_SKIP_WORKTREE 0x4000 // extended flags
+#define INDEX_INTENT_TO_ADD 0x2000
+#define S_IFGITLINK 0160000
+
+typedef struct {
+    const char *path;
+    const unsigned char *oid;
+    uint32_t ctime_sec, ctime_nsec;
+    uint32_t mtime_sec, mtime_nsec;
+    uint32_t ino;
+    uint32_t mode;
+    uint32_t uid, gid;
+    uint32_t size;
+    uint16_t flags;
+    uint16_t extended_flags;
+} IndexEntry;
+
+// .git/index, mapped read-only. Entries are in path order.
+typedef struct {
+    unsigned char *map;
+    size_t map_size;
+    IndexEntry *entries;
+    int count;
+    char *paths; // version 4 paths, which are prefix-compressed on disk
+    int hash_size;
+    struct timespec mtime; // entries modified since are racily clean
+} GitIndex;
+
+enum { WORKTREE_CLEAN, WORKTREE_MODIFIED, WORKTREE_DELETED };
+
+typedef struct {
+    const GitIndex *index;
+    const char *work_tree;
+    unsigned char *result; // WORKTREE_* per entry
+    atomic_int next;
+} StatJob;
+
+typedef struct {
+    const GitIndex *index;
+    const char *work_tree;
+    IgnoreList *lists; // innermost last
+    int list_count;
+    int list_capacity;
+    char **untracked;
+    int untracked_count;
+    int untracked_capacity;
+} Walk;
+
+typedef struct {
+    const char *path;
+    GitStatusKind kind;
+} StatusChange;
+
+typedef struct {
+    uint32_t h[5];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} Sha1;
+
+static uint32_t be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t be16(const unsigned char *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t rol(uint32_t x, int n) {
+    return x << n | x >> (32 - n);
+}
+
+static void sha1_block(uint32_t h[5], const unsigned char *p) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) w[i] = be32(p + 4 * i);
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static void sha1_init(Sha1 *s) {
+    *s = (Sha1){ .h = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 } };
+}
+
+static void sha1_update(Sha1 *s, const unsigned char *data, size_t len) {
+    s->length += len;
+    if (s->used) {
+        size_t take = 64 - s->used < len ? 64 - s->used : len;
+        memcpy(s->block + s->used, data, take);
+        s->used += take;
+        data += take;
+        len -= take;
+        if (s->used < 64) return;
+        sha1_block(s->h, s->block);
+        s->used = 0;
+    }
+    for (; len >= 64; data += 64, len -= 64) {
+        sha1_block(s->h, data);
+    }
+    memcpy(s->block, data, len);
+    s->used = len;
+}
+
+static void sha1_final(Sha1 *s, unsigned char out[SHA1_SIZE]) {
+    uint64_t bits = s->length * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t pad_len = (s->used < 56 ? 56 : 120) - s->used;
+    for (int i = 0; i < 8; i++) {
+        pad[pad_len + i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+    sha1_update(s, pad, pad_len + 8);
+    for (int i = 0; i < 5; i++) {
+        out[4 * i] = (unsigned char)(s->h[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(s->h[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(s->h[i] >> 8);
+        out[4 * i + 3] = (unsigned char)s->h[i];
+    }
+}
+
+// The object id git gives this content as a blob.
+static void hash_blob(const void *data, size_t len, unsigned char oid[SHA1_SIZE]) {
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "blob %zu", len) + 1;
+    Sha1 s;
+    sha1_init(&s);
+    sha1_update(&s, (const unsigned char *)header, header_len);
+    sha1_update(&s, data, len);
+    sha1_final(&s, oid);
+}
+
+// SHA-256 repositories have longer object ids; their content is not rehashed.
+static int repository_hash_size(const GitRepository *repo) {
+    char path[PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s/config", repo->common_dir);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return SHA1_SIZE;
+    }
+    int size = SHA1_SIZE;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        const char *key = line + strspn(line, " \t");
+        if (strncasecmp(key, "objectformat", 12) == 0 && strstr(key, "sha256")) {
+            size = 32;
+        }
+    }
+    fclose(fp);
+    return size;
+}
+
+static void index_unload(GitIndex *index) {
+    if (index->map) {
+        munmap(index->map, index->map_size);
+    }
+    free(index->entries);
+    free(index->paths);
+    memset(index, 0, sizeof(*index));
+}
+
+// Reads the entries of an index in format version 2, 3 or 4. A missing index
+// has no entries.
+static bool index_load(GitIndex *index, const char *path, int hash_size) {
+    memset(index, 0, sizeof(*index));
+    index->hash_size = hash_size;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return errno == ENOENT;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 12 + hash_size) {
+        close(fd);
+        return false;
+    }
+    index->mtime = st.st_mtim;
+    index->map_size = st.st_size;
+    index->map = mmap(NULL, index->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        return false;
+    }
+
+    const unsigned char *p = index->map;
+    const unsigned char *end = index->map + index->map_size - hash_size; // trailing checksum
+    uint32_t version = be32(p + 4);
+    uint32_t count = be32(p + 8);
+    if (memcmp(p, "DIRC", 4) != 0 || version < 2 || version > 4 || count > index->map_size / 32) {
+        return false;
+    }
+    p += 12;
+    index->entries = malloc(sizeof(IndexEntry) * (count ? count : 1));
+    if (!index->entries) {
+        log_error("git_status.index_load: malloc failed");
+        exit(1);
+    }
+
+    // Version 4 paths are expanded into index->paths; offsets are turned into
+    // pointers once it stops growing.
+    size_t *offsets = NULL;
+    size_t paths_len = 0, paths_capacity = 0, previous = 0, previous_len = 0;
+    if (version == 4) {
+        offsets = malloc(sizeof(size_t) * (count ? count : 1));
+        if (!offsets) {
+            log_error("git_status.index_load: malloc failed");
+            exit(1);
+        }
+    }
+
+    size_t fixed = 40 + hash_size + 2; // stat data, object id, flags
+    for (uint32_t i = 0; i < count; i++) {
+        if ((size_t)(end - p) < fixed + 2) {
+            free(offsets);
+            return false;
+        }
+        IndexEntry *e = &index->entries[i];
+        e->ctime_sec = be32(p);
+        e->ctime_nsec = be32(p + 4);
+        e->mtime_sec = be32(p + 8);
+        e->mtime_nsec = be32(p + 12);
+        e->ino = be32(p + 20);
+        e->mode = be32(p + 24);
+        e->uid = be32(p + 28);
+        e->gid = be32(p + 32);
+        e->size = be32(p + 36);
+        e->oid = p + 40;
+        e->flags = be16(p + 40 + hash_size);
+        e->extended_flags = 0;
+        const unsigned char *name = p + fixed;
+        if (e->flags & INDEX_EXTENDED) {
+            e->extended_flags = be16(name);
+            name += 2;
+        }
+        const unsigned char *nul = memchr(name, '\0', end - name);
+        if (!nul) {
+            free(offsets);
+            return false;
+        }
+
+        if (version < 4) {
+            e->path = (const char *)name;
+            p += ((name - p) + (nul - name) + 8) & ~(size_t)7; // NUL padded to 8 bytes
+            continue;
+        }
+
+        // Version 4: a varint of bytes to drop from the previous path, then
+        // the rest of this one.
+        size_t strip = *name & 127;
+        while (*name++ & 128) {
+            if (name >= end) {
+                free(offsets);
+                return false;
+            }
+            strip = ((strip + 1) << 7) | (*name & 127);
+        }
+        nul = memchr(name, '\0', end - name);
+        if (!nul || strip > previous_len) {
+            free(offsets);
+            return false;
+        }
+        size_t keep = previous_len - strip, suffix = nul - name;
+        if (paths_len + keep + suffix + 1 > paths_capacity) {
+            paths_capacity = (paths_len + keep + suffix + 1) * 2;
+            char *grown = realloc(index->paths, paths_capacity);
+            if (!grown) {
+                log_error("git_status.index_load: realloc failed");
+                exit(1);
+            }
+            index->paths = grown;
+        }
+        memcpy(index->paths + paths_len, index->paths + previous, keep);
+        memcpy(index->paths + paths_len + keep, name, suffix);
+        index->paths[paths_len + keep + suffix] = '\0';
+        offsets[i] = previous = paths_len;
+        previous_len = keep + suffix;
+        paths_len += previous_len + 1;
+        p = nul + 1;
+    }
+    if (offsets) {
+        for (uint32_t i = 0; i < count; i++) {
+            index->entries[i].path = index->paths + offsets[i];
+        }
+        free(offsets);
+    }
+    index->count = count;
+
+    // A split index keeps most entries in a shared index file.
+    while (end - p >= 8) {
+        if (memcmp(p, "link", 4) == 0) {
+            log_error("git_status.index_load: split index is not supported");
+            return false;
+        }
+        p += 8 + (size_t)be32(p + 4);
+    }
+    return true;
+}
+
+static int index_entry_stage(const IndexEntry *e) {
+    return (e->flags >> 12) & 3;
+}
+
+// The first entry whose path is not before path.
+static int index_lower_bound(const GitIndex *index, const char *path) {
+    int low = 0, high = index->count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (strcmp(index->entries[mid].path, path) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static bool index_has_path(const GitIndex *index, const char *path) {
+    int i = index_lower_bound(index, path);
+    return i < index->count && strcmp(index->entries[i].path, path) == 0;
+}
+
+// Whether anything is tracked below dir, which ends in '/'.
+static bool index_has_directory(const GitIndex *index, const char *dir, size_t len) {
+    int i = index_lower_bound(index, dir);
+    return i < index->count && strncmp(index->entries[i].path, dir, len) == 0;
+}
+
+static bool content_matches(const GitIndex *index, const IndexEntry *e, const char *path, const struct stat *st) {
+    if (index->hash_size != SHA1_SIZE) {
+        return false;
+    }
+    unsigned char oid[SHA1_SIZE];
+    if (S_ISLNK(st->st_mode)) {
+        char target[PATH_MAX];
+        ssize_t len = readlink(path, target, sizeof(target));
+        if (len < 0) {
+            return false;
+        }
+        hash_blob(target, len, oid);
+    } else {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        void *data = st->st_size ? mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        hash_blob(data, st->st_size, oid);
+        if (data) {
+            munmap(data, st->st_size);
+        }
+    }
+    return memcmp(oid, e->oid, SHA1_SIZE) == 0;
+}
+
+// Compares an entry with the file like git's ie_match_stat: a changed size or
+// mode is a change; other changed stat data, or an entry written in the same
+// instant as the index, is settled by hashing the file.
+static unsigned char worktree_status(const GitIndex *index, const IndexEntry *e, const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        return errno == ENOENT || errno == ENOTDIR ? WORKTREE_DELETED : WORKTREE_CLEAN;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return WORKTREE_DELETED;
+    }
+    uint32_t type = e->mode & S_IFMT;
+    if ((uint32_t)(S_ISLNK(st.st_mode) ? S_IFLNK : S_IFREG) != type) {
+        return WORKTREE_MODIFIED;
+    }
+    if (type == S_IFREG && ((st.st_mode ^ e->mode) & 0100)) {
+        return WORKTREE_MODIFIED;
+    }
+    bool size_changed = (uint32_t)st.st_size != e->size;
+    if (size_changed && e->size != 0) {
+        return WORKTREE_MODIFIED; // a zero size may be a racily smudged entry
+    }
+    bool stat_changed = size_changed ||
+                        (uint32_t)st.st_mtim.tv_sec != e->mtime_sec || (uint32_t)st.st_mtim.tv_nsec != e->mtime_nsec ||
+                        (uint32_t)st.st_ctim.tv_sec != e->ctime_sec || (uint32_t)st.st_ctim.tv_nsec != e->ctime_nsec ||
+                        (uint32_t)st.st_ino != e->ino || st.st_uid != e->uid || st.st_gid != e->gid;
+    bool racy = e->mtime_sec > (uint32_t)index->mtime.tv_sec ||
+                (e->mtime_sec == (uint32_t)index->mtime.tv_sec && e->mtime_nsec >= (uint32_t)index->mtime.tv_nsec);
+    if (!stat_changed && !racy) {
+        return WORKTREE_CLEAN;
+    }
+    return content_matches(index, e, path, &st) ? WORKTREE_CLEAN : WORKTREE_MODIFIED;
+}
+
+// Workers take STAT_CHUNK entries at a time until the index is done.
+static void *stat_worker(void *arg) {
+    StatJob *job = arg;
+    const GitIndex *index = job->index;
+    char path[PATH_MAX];
+    size_t root_len = snprintf(path, sizeof(path), "%s/", job->work_tree);
+    for (;;) {
+        int start = atomic_fetch_add(&job->next, STAT_CHUNK);
+        if (start >= index->count) {
+            break;
+        }
+        int end = start + STAT_CHUNK < index->count ? start + STAT_CHUNK : index->count;
+        for (int i = start; i < end; i++) {
+            const IndexEntry *e = &index->entries[i];
+            uint32_t type = e->mode & S_IFMT;
+            if (index_entry_stage(e) != 0 || (e->flags & INDEX_ASSUME_VALID) ||
+                (e->extended_flags & (INDEX_SKIP_WORKTREE | INDEX_INTENT_TO_ADD)) ||
+                (type != S_IFREG && type != S_IFLNK)) {
+                continue; // submodules and sparse directories too
+            }
+            if ((size_t)snprintf(path + root_len, sizeof(path) - root_len, "%s", e->path) >= sizeof(path) - root_len) {
+                continue;
+            }
+            job->result[i] = worktree_status(index, e, path);
+        }
+    }
+    return NULL;
+}
+
+// Pushes the patterns in file, which apply to paths below base_len bytes.
+// Returns false if there is no such file.
+static bool ignore_push(Walk *walk, const char *file, size_t base_len) {
+    if (walk->list_count == walk->list_capacity) {
+        walk->list_capacity = walk->list_capacity ? walk->list_capacity * 2 : 8;
+        IgnoreList *grown = realloc(walk->lists, sizeof(IgnoreList) * walk->list_capacity);
+        if (!grown) {
+            log_error("git_status.ignore_push: realloc failed");
+            exit(1);
+        }
+        walk->lists = grown;
+    }
+    IgnoreList *list = &walk->lists[walk->list_count];
+    *list = (IgnoreList){ .base_len = base_len };
+    if (!ignore_list_load(list, file)) {
+        return false;
+    }
+    walk->list_count++;
+    return true;
+}
+
+static void ignore_pop(Walk *walk) {
+    ignore_list_free(&walk->lists[--walk->list_count]);
+}
+
+// Deeper files take precedence.
+static bool is_ignored(const Walk *walk, const char *path, bool is_dir) {
+    for (int l = walk->list_count - 1; l >= 0; l--) {
+        int matched = ignore_list_match(&walk->lists[l], path, is_dir);
+        if (matched) {
+            return matched > 0;
+        }
+    }
+    return false;
+}
+
+static bool entry_is_directory(const Walk *walk, const struct dirent *entry, const char *rel) {
+    if (entry->d_type != DT_UNKNOWN) {
+        return entry->d_type == DT_DIR;
+    }
+    char path[PATH_MAX * 2];
+    snprintf(path, sizeof(path), "%s/%s", walk->work_tree, rel);
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void add_untracked(Walk *walk, const char *rel) {
+    if (walk->untracked_count == walk->untracked_capacity) {
+        walk->untracked_capacity = walk->untracked_capacity ? walk->untracked_capacity * 2 : 64;
+        char **grown = realloc(walk->untracked, sizeof(char *) * walk->untracked_capacity);
+        if (!grown) {
+            log_error("git_status.add_untracked: realloc failed");
+            exit(1);
+        }
+        walk->untracked = grown;
+    }
+    walk->untracked[walk->untracked_count] = strdup(rel);
+    if (!walk->untracked[walk->untracked_count]) {
+        log_error("git_status.add_untracked: strdup failed");
+        exit(1);
+    }
+    walk->untracked_count++;
+}
+
+// Opens the directory rel (ending in '/', or empty for the root) and pushes
+// its .gitignore.
+static DIR *walk_open(Walk *walk, const char *rel, size_t rel_len, bool *pushed) {
+    char path[PATH_MAX * 2];
+    snprintf(path, sizeof(path), "%s/%s", walk->work_tree, rel);
+    DIR *dir = opendir(path);
+    if (dir) {
+        snprintf(path, sizeof(path), "%s/%s.gitignore", walk->work_tree, rel);
+        *pushed = ignore_push(walk, path, rel_len);
+    }
+    return dir;
+}
+
+// Whether an untracked directory holds anything that is not ignored. Like git,
+// a nested repository counts and empty directories do not.
+static bool directory_has_untracked(Walk *walk, char *rel, size_t rel_len) {
+    bool pushed = false;
+    DIR *dir = walk_open(walk, rel, rel_len, &pushed);
+    if (!dir) {
+        return false;
+    }
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        if (strcmp(name, ".git") == 0) {
+            found = true;
+            break;
+        }
+        size_t len = rel_len + strlen(name);
+        if (len + 2 >= PATH_MAX) {
+            continue;
+        }
+        memcpy(rel + rel_len, name, len - rel_len + 1);
+        bool is_dir = entry_is_directory(walk, entry, rel);
+        if (is_ignored(walk, rel, is_dir)) {
+            continue;
+        }
+        if (!is_dir) {
+            found = true;
+        } else {
+            rel[len] = '/';
+            rel[len + 1] = '\0';
+            found = directory_has_untracked(walk, rel, len + 1);
+        }
+    }
+    rel[rel_len] = '\0';
+    if (pushed) {
+        ignore_pop(walk);
+    }
+    closedir(dir);
+    return found;
+}
+
+// Descends through directories with tracked files. Untracked directories are
+// reported as a whole, as `git status` does by default.
+static void walk_directory(Walk *walk, char *rel, size_t rel_len) {
+    bool pushed = false;
+    DIR *dir = walk_open(walk, rel, rel_len, &pushed);
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0) {
+            continue;
+        }
+        size_t len = rel_len + strlen(name);
+        if (len + 2 >= PATH_MAX) {
+            continue;
+        }
+        memcpy(rel + rel_len, name, len - rel_len + 1);
+        bool is_dir = entry_is_directory(walk, entry, rel);
+        if (index_has_path(walk->index, rel) || is_ignored(walk, rel, is_dir)) {
+            continue; // tracked files and submodules
+        }
+        if (!is_dir) {
+            add_untracked(walk, rel);
+            continue;
+        }
+        rel[len] = '/';
+        rel[len + 1] = '\0';
+        if (index_has_directory(walk->index, rel, len + 1)) {
+            walk_directory(walk, rel, len + 1);
+        } else if (directory_has_untracked(walk, rel, len + 1)) {
+            add_untracked(walk, rel);
+        }
+    }
+    rel[rel_len] = '\0';
+    if (pushed) {
+        ignore_pop(walk);
+    }
+    closedir(dir);
+}
+
+static void *walk_worker(void *arg) {
+    Walk *walk = arg;
+    char rel[PATH_MAX] = "";
+    walk_directory(walk, rel, 0);
+    return NULL;
+}
+
+// Starts `git diff-index --cached`, which lists staged changes against HEAD.
+// HEAD's tree is compressed, so unlike the index it is left to git; with the
+// index's cache tree git does not need to touch the work tree for this.
+static pid_t spawn_diff_index(const char *work_tree, int *out_fd) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        log_error("git_status.spawn_diff_index: pipe failed");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        log_error("git_status.spawn_diff_index: fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        int dev_null = open("/dev/null", O_RDWR);
+        if (dev_null != -1) {
+            dup2(dev_null, STDIN_FILENO);
+            dup2(dev_null, STDERR_FILENO);
+            close(dev_null);
+        }
+        if (chdir(work_tree) != 0) {
+            _exit(127);
+        }
+        setenv("GIT_OPTIONAL_LOCKS", "0", 1);
+        execlp("git", "git", "diff-index", "--cached", "--no-renames", "--name-status", "-z", "HEAD", (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    *out_fd = fds[0];
+    return pid;
+}
+
+static char *read_all(int fd, size_t *len) {
+    size_t capacity = 4096;
+    char *data = malloc(capacity);
+    if (!data) {
+        log_error("git_status.read_all: malloc failed");
+        exit(1);
+    }
+    *len = 0;
+    for (;;) {
+        if (*len + 1 == capacity) {
+            capacity *= 2;
+            char *grown = realloc(data, capacity);
+            if (!grown) {
+                log_error("git_status.read_all: realloc failed");
+                exit(1);
+            }
+            data = grown;
+        }
+        ssize_t n = read(fd, data + *len, capacity - *len - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        *len += n;
+    }
+    data[*len] = '\0';
+    return data;
+}
+
+static void add_change(StatusChange **changes, int *count, int *capacity, const char *path, GitStatusKind kind) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        StatusChange *grown = realloc(*changes, sizeof(StatusChange) * *capacity);
+        if (!grown) {
+            log_error("git_status.add_change: realloc failed");
+            exit(1);
+        }
+        *changes = grown;
+    }
+    (*changes)[(*count)++] = (StatusChange){ path, kind };
+}
+
+// When a file is both staged and changed in the work tree, the kind listed
+// first here is shown.
+static int kind_rank(GitStatusKind kind) {
+    switch (kind) {
+        case GIT_STATUS_UNMERGED: return 0;
+        case GIT_STATUS_DELETED: return 1;
+        case GIT_STATUS_ADDED: return 2;
+        default: return 3;
+    }
+}
+
+static int compare_changes(const void *a, const void *b) {
+    const StatusChange *x = a, *y = b;
+    int order = strcmp(x->path, y->path);
+    return order ? order : kind_rank(x->kind) - kind_rank(y->kind);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Rewrites a work tree path relative to the working directory, which is at
+// prefix ("" or "src/lib/") in the work tree.
+static char *relative_path(const char *path, const char *prefix) {
+    size_t common = 0;
+    for (size_t i = 0; prefix[i] && prefix[i] == path[i]; i++) {
+        if (prefix[i] == '/') common = i + 1;
+    }
+    int ups = 0;
+    for (const char *p = prefix + common; *p; p++) {
+        ups += *p == '/';
+    }
+    size_t rest = strlen(path + common);
+    char *out = malloc(ups * 3 + rest + 1);
+    if (!out) {
+        log_error("git_status.relative_path: malloc failed");
+        exit(1);
+    }
+    for (int i = 0; i < ups; i++) {
+        memcpy(out + i * 3, "../", 3);
+    }
+    memcpy(out + ups * 3, path + common, rest + 1);
+    return out;
+}
+
+int git_status_collect(GitStatusEntry **entries) {
+    *entries = NULL;
+    GitRepository repo;
+    char cwd[PATH_MAX];
+    if (!git_find_repository(&repo) || !getcwd(cwd, sizeof(cwd))) {
+        return -1;
+    }
+    // git_find_repository walks up from getcwd, so the work tree is a prefix.
+    char prefix[PATH_MAX];
+    const char *inside = cwd + strlen(repo.work_tree);
+    snprintf(prefix, sizeof(prefix), "%s%s", *inside == '/' ? inside + 1 : inside, *inside ? "/" : "");
+
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/index", repo.git_dir);
+    GitIndex index;
+    if (!index_load(&index, path, repository_hash_size(&repo))) {
+        log_error("git_status.git_status_collect: unable to read %s", path);
+        index_unload(&index);
+        return -1;
+    }
+
+    int staged_fd = -1;
+    pid_t staged_pid = spawn_diff_index(repo.work_tree, &staged_fd);
+
+    StatJob job = { .index = &index, .work_tree = repo.work_tree };
+    job.result = calloc(index.count ? index.count : 1, 1);
+    if (!job.result) {
+        log_error("git_status.git_status_collect: calloc failed");
+        exit(1);
+    }
+    Walk walk = { .index = &index, .work_tree = repo.work_tree };
+    snprintf(path, sizeof(path), "%s/info/exclude", repo.common_dir);
+    bool exclude_pushed = ignore_push(&walk, path, 0);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = cpus < 1 ? 1 : cpus > STAT_MAX_THREADS ? STAT_MAX_THREADS : (int)cpus;
+    int per_thread = (index.count + STAT_CHUNK - 1) / STAT_CHUNK;
+    if (thread_count > per_thread) {
+        thread_count = per_thread;
+    }
+    pthread_t threads[STAT_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&threads[started], NULL, stat_worker, &job) == 0) {
+            started++;
+        }
+    }
+    pthread_t walk_thread;
+    bool walk_started = pthread_create(&walk_thread, NULL, walk_worker, &walk) == 0;
+
+    size_t staged_len = 0;
+    char *staged = NULL;
+    bool has_head = true;
+    if (staged_pid > 0) {
+        staged = read_all(staged_fd, &staged_len);
+        close(staged_fd);
+        int status;
+        if (waitpid(staged_pid, &status, 0) == -1 || !WIFEXITED(status)) {
+            staged_len = 0;
+        } else if (WEXITSTATUS(status) != 0) {
+            has_head = WEXITSTATUS(status) != 128; // an unborn branch
+            staged_len = 0;
+        }
+    }
+
+    stat_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (walk_started) {
+        pthread_join(walk_thread, NULL);
+    } else {
+        walk_worker(&walk);
+    }
+    if (exclude_pushed) {
+        ignore_pop(&walk);
+    }
+    free(walk.lists);
+
+    StatusChange *changes = NULL;
+    int change_count = 0, change_capacity = 0;
+    for (int i = 0; i < index.count; i++) {
+        const IndexEntry *e = &index.entries[i];
+        if (index_entry_stage(e) != 0) {
+            if (i == 0 || strcmp(index.entries[i - 1].path, e->path) != 0) {
+                add_change(&changes, &change_count, &change_capacity, e->path, GIT_STATUS_UNMERGED);
+            }
+        } else if ((e->extended_flags & INDEX_INTENT_TO_ADD) || !has_head) {
+            add_change(&changes, &change_count, &change_capacity, e->path, GIT_STATUS_ADDED);
+        }
+        if (job.result[i] != WORKTREE_CLEAN) {
+            add_change(&changes, &change_count, &change_capacity, e->path,
+                       job.result[i] == WORKTREE_DELETED ? GIT_STATUS_DELETED : GIT_STATUS_MODIFIED);
+        }
+    }
+    // NUL-separated pairs of status letter and path.
+    for (const char *p = staged; p && p < staged + staged_len;) {
+        const char *status = p;
+        const char *file = status + strlen(status) + 1;
+        if (file >= staged + staged_len) {
+            break;
+        }
+        p = file + strlen(file) + 1;
+        GitStatusKind kind = *status == 'A' ? GIT_STATUS_ADDED
+                           : *status == 'D' ? GIT_STATUS_DELETED
+                           : *status == 'U' ? GIT_STATUS_UNMERGED
+                           : GIT_STATUS_MODIFIED;
+        add_change(&changes, &change_count, &change_capacity, file, kind);
+    }
+    if (change_count > 1) {
+        qsort(changes, change_count, sizeof(StatusChange), compare_changes);
+    }
+    if (walk.untracked_count > 1) {
+        qsort(walk.untracked, walk.untracked_count, sizeof(char *), compare_strings);
+    }
+
+    GitStatusEntry *result = malloc(sizeof(GitStatusEntry) * (change_count + walk.untracked_count + 1));
+    if (!result) {
+        log_error("git_status.git_status_collect: malloc failed");
+        exit(1);
+    }
+    int count = 0;
+    for (int i = 0; i < change_count; i++) {
+        if (i > 0 && strcmp(changes[i - 1].path, changes[i].path) == 0) {
+            continue; // sorted so the kind shown comes first
+        }
+        result[count++] = (GitStatusEntry){ relative_path(changes[i].path, prefix), changes[i].kind };
+    }
+    for (int i = 0; i < walk.untracked_count; i++) {
+        result[count++] = (GitStatusEntry){ relative_path(walk.untracked[i], prefix), GIT_STATUS_UNTRACKED };
+        free(walk.untracked[i]);
+    }
+
+    free(walk.untracked);
+    free(changes);
+    free(staged);
+    free(job.result);
+    index_unload(&index);
+    *entries = result;
+    return count;
+}
+
+void git_status_free(GitStatusEntry *entries, int count) {
+    for (int i = 0; i < count; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
@@ -0,0 +1,25 @@
+#ifndef GIT_STATUS_H
+#define GIT_STATUS_H
+
+typedef enum {
+    GIT_STATUS_MODIFIED,
+    GIT_STATUS_ADDED,
+    GIT_STATUS_DELETED,
+    GIT_STATUS_UNMERGED,
+    GIT_STATUS_UNTRACKED,
+} GitStatusKind;
+
+typedef struct {
+    char *path; // relative to the working directory; untracked directories end in '/'
+    GitStatusKind kind;
+} GitStatusEntry;
+
+// Changed files in the repository of the working directory: tracked files
+// that are staged or differ from the index, then untracked files, each in
+// path order. .git/index is read directly and its stat data compared against
+// the work tree on several threads. Returns the count, or -1 outside a
+// repository.
+int git_status_collect(GitStatusEntry **entries);
+void git_status_free(GitStatusEntry *entries, int count);
+
+#endif // GIT_STATUS_H
@@ -4,6 +4,8 @@
 #include <string.h>
 #include "history.h"
 #include "log.h"
+#define ALLOC_TAG ALLOC_TAG_HISTORY
+#include "alloc.h"
 
 static Change* change_create(ChangeType type, int y, int x, const char *text) {
     Change *change = malloc(sizeof(Change));
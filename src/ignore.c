@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "ignore.h"
+#include "log.h"
+#define ALLOC_TAG ALLOC_TAG_GIT
+#include "alloc.h"
+
+// Most patterns are a plain name or "*.ext", which need no wildmatch.
+enum { IGNORE_GLOB, IGNORE_LITERAL, IGNORE_SUFFIX };
+
+// Matches a gitignore pattern against a path: '*' and '?' stop at '/', "**/"
+// matches any number of leading directories and a trailing "**" anything.
+static bool wildmatch(const char *p, const char *s) {
+    for (; *p; p++, s++) {
+        switch (*p) {
+            case '?':
+                if (!*s || *s == '/') return false;
+                break;
+            case '*': {
+                bool double_star = p[1] == '*';
+                while (*p == '*') p++;
+                if (double_star && *p == '/') {
+                    for (const char *t = s;; t++) {
+                        if ((t == s || t[-1] == '/') && wildmatch(p + 1, t)) return true;
+                        if (!*t) return false;
+                    }
+                }
+                if (!*p) {
+                    return double_star || !strchr(s, '/');
+                }
+                for (const char *t = s;; t++) {
+                    if (wildmatch(p, t)) return true;
+                    if (!*t || (!double_star && *t == '/')) return false;
+                }
+            }
+            case '[': {
+                if (!*s || *s == '/') return false;
+                const char *q = p + 1;
+                bool negate = *q == '!' || *q == '^';
+                if (negate) q++;
+                bool matched = false;
+                do { // a ']' first in the class is literal
+                    if (!*q) return false;
+                    if (*q == '\\' && q[1]) q++;
+                    unsigned char low = *q, high = low;
+                    if (q[1] == '-' && q[2] && q[2] != ']') {
+                        q += 2;
+                        if (*q == '\\' && q[1]) q++;
+                        high = *q;
+                    }
+                    matched |= (unsigned char)*s >= low && (unsigned char)*s <= high;
+                    q++;
+                } while (*q != ']');
+                if (matched == negate) return false;
+                p = q;
+                break;
+            }
+            case '\\':
+                if (p[1]) p++;
+                if (*p != *s) return false;
+                break;
+            default:
+                if (*p != *s) return false;
+                break;
+        }
+    }
+    return !*s;
+}
+
+static void ignore_add(IgnoreList *list, char *line) {
+    size_t len = strcspn(line, "\r\n");
+    while (len > 0 && line[len - 1] == ' ' && (len < 2 || line[len - 2] != '\\')) {
+        len--;
+    }
+    line[len] = '\0';
+    if (len == 0 || line[0] == '#') {
+        return;
+    }
+    IgnorePattern pattern = { 0 };
+    if (line[0] == '!') {
+        pattern.negate = true;
+        line++;
+        len--;
+    }
+    if (len > 0 && line[len - 1] == '/') {
+        pattern.dir_only = true;
+        line[--len] = '\0';
+    }
+    pattern.basename_only = !strchr(line, '/');
+    if (line[0] == '/') {
+        line++;
+    }
+    if (!*line) {
+        return;
+    }
+    if (!strpbrk(line, "*?[\\")) {
+        pattern.kind = IGNORE_LITERAL;
+    } else if (line[0] == '*' && !strpbrk(line + 1, "*?[\\/")) {
+        pattern.kind = IGNORE_SUFFIX;
+        line++;
+    }
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        IgnorePattern *grown = realloc(list->patterns, sizeof(IgnorePattern) * list->capacity);
+        if (!grown) {
+            log_error("ignore.ignore_add: realloc failed");
+            exit(1);
+        }
+        list->patterns = grown;
+    }
+    pattern.pattern = strdup(line);
+    if (!pattern.pattern) {
+        log_error("ignore.ignore_add: strdup failed");
+        exit(1);
+    }
+    pattern.length = strlen(line);
+    list->patterns[list->count++] = pattern;
+}
+
+bool ignore_list_load(IgnoreList *list, const char *file) {
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        return false;
+    }
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), fp)) {
+        ignore_add(list, line);
+    }
+    fclose(fp);
+    return true;
+}
+
+void ignore_list_free(IgnoreList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->patterns[i].pattern);
+    }
+    free(list->patterns);
+    list->patterns = NULL;
+    list->count = list->capacity = 0;
+}
+
+int ignore_list_match(const IgnoreList *list, const char *path, bool is_dir) {
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    const char *relative = path + list->base_len;
+    size_t name_len = strlen(name);
+    for (int i = list->count - 1; i >= 0; i--) {
+        const IgnorePattern *pattern = &list->patterns[i];
+        if (pattern->dir_only && !is_dir) {
+            continue;
+        }
+        const char *subject = pattern->basename_only ? name : relative;
+        bool matched;
+        switch (pattern->kind) {
+            case IGNORE_LITERAL:
+                matched = strcmp(pattern->pattern, subject) == 0;
+                break;
+            case IGNORE_SUFFIX: { // the '*' may not cross a '/'
+                size_t len = pattern->basename_only ? name_len : strlen(subject);
+                matched = len >= pattern->length &&
+                          memcmp(subject + len - pattern->length, pattern->pattern, pattern->length) == 0 &&
+                          (pattern->basename_only || !strchr(subject, '/'));
+                break;
+            }
+            default:
+                matched = wildmatch(pattern->pattern, subject);
+                break;
+        }
+        if (matched) {
+            return pattern->negate ? -1 : 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    char *pattern;
+    size_t length;
+    int kind; // how it is matched, picked when it is parsed
+    bool negate;
+    bool dir_only;
+    bool basename_only; // no slash: matches the last component at any depth
+} IgnorePattern;
+
+// The patterns of gitignore-style files, which apply to paths below base_len
+// bytes, the directory they were read from plus its slash.
+typedef struct {
+    IgnorePattern *patterns;
+    int count;
+    int capacity;
+    size_t base_len;
+} IgnoreList;
+
+// Appends the patterns in file, so they take precedence over those already
+// in list. Returns false if there is no such file.
+bool ignore_list_load(IgnoreList *list, const char *file);
+void ignore_list_free(IgnoreList *list);
+// 1 if the last pattern in list that matches path ignores it, -1 if it
+// re-includes it, 0 if none matches.
+int ignore_list_match(const IgnoreList *list, const char *path, bool is_dir);
+
+#endif // IGNORE_H
@@ -0,0 +1,273 @@
+#include <string.h>
+#include "json_scan.h"
+
+void json_scan_init(JsonScanner *s, const char *data, size_t len) {
+    s->p = data;
+    s->end = data + len;
+    s->failed = false;
+}
+
+static void skip_whitespace(JsonScanner *s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\n' || *s->p == '\r' || *s->p == '\t')) {
+        s->p++;
+    }
+}
+
+static bool fail(JsonScanner *s) {
+    s->failed = true;
+    s->p = s->end;
+    return false;
+}
+
+static bool expect(JsonScanner *s, char c) {
+    skip_whitespace(s);
+    if (s->p >= s->end || *s->p != c) {
+        return fail(s);
+    }
+    s->p++;
+    return true;
+}
+
+JsonScanType json_scan_peek(JsonScanner *s) {
+    skip_whitespace(s);
+    if (s->failed) return JSON_SCAN_INVALID;
+    if (s->p >= s->end) return JSON_SCAN_END;
+    switch (*s->p) {
+        case '{': return JSON_SCAN_OBJECT;
+        case '[': return JSON_SCAN_ARRAY;
+        case '"': return JSON_SCAN_STRING;
+        case 't': case 'f': case 'n': return JSON_SCAN_LITERAL;
+        case '-': return JSON_SCAN_NUMBER;
+        default:
+            return *s->p >= '0' && *s->p <= '9' ? JSON_SCAN_NUMBER : JSON_SCAN_INVALID;
+    }
+}
+
+bool json_scan_object_begin(JsonScanner *s) {
+    return expect(s, '{');
+}
+
+bool json_scan_array_begin(JsonScanner *s) {
+    return expect(s, '[');
+}
+
+// Consumes a separating comma or the closing bracket of a container.
+static bool next_in_container(JsonScanner *s, char close) {
+    skip_whitespace(s);
+    if (s->p < s->end && *s->p == ',') {
+        s->p++;
+        skip_whitespace(s);
+    }
+    if (s->p >= s->end) {
+        return fail(s);
+    }
+    if (*s->p == close) {
+        s->p++;
+        return false;
+    }
+    return true;
+}
+
+bool json_scan_string_raw(JsonScanner *s, JsonSpan *raw) {
+    if (!expect(s, '"')) {
+        return false;
+    }
+    const char *start = s->p;
+    while (s->p < s->end) {
+        const char *stop = s->p;
+        while (stop < s->end && *stop != '"' && *stop != '\\') {
+            stop++;
+        }
+        if (stop >= s->end) {
+            break;
+        }
+        if (*stop == '"') {
+            raw->start = start;
+            raw->len = stop - start;
+            s->p = stop + 1;
+            return true;
+        }
+        s->p = stop + 2; // backslash and the escaped character
+    }
+    return fail(s);
+}
+
+bool json_scan_next_key(JsonScanner *s, JsonSpan *key) {
+    if (!next_in_container(s, '}')) {
+        return false;
+    }
+    return json_scan_string_raw(s, key) && expect(s, ':');
+}
+
+bool json_scan_next_element(JsonScanner *s) {
+    return next_in_container(s, ']');
+}
+
+bool json_scan_int(JsonScanner *s, long long *out) {
+    if (json_scan_peek(s) != JSON_SCAN_NUMBER) {
+        return fail(s);
+    }
+    bool negative = *s->p == '-';
+    if (negative) s->p++;
+    long long value = 0;
+    const char *digits = s->p;
+    while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+        value = value * 10 + (*s->p - '0');
+        s->p++;
+    }
+    if (s->p == digits) {
+        return fail(s);
+    }
+    while (s->p < s->end && (*s->p == '.' || *s->p == 'e' || *s->p == 'E' || *s->p == '+' ||
+                             *s->p == '-' || (*s->p >= '0' && *s->p <= '9'))) {
+        s->p++;
+    }
+    *out = negative ? -value : value;
+    return true;
+}
+
+bool json_scan_skip(JsonScanner *s, JsonSpan *value) {
+    JsonScanType type = json_scan_peek(s);
+    const char *start = s->p;
+    switch (type) {
+        case JSON_SCAN_STRING: {
+            JsonSpan raw;
+            if (!json_scan_string_raw(s, &raw)) return false;
+            break;
+        }
+        case JSON_SCAN_NUMBER: {
+            long long ignored;
+            if (!json_scan_int(s, &ignored)) return false;
+            break;
+        }
+        case JSON_SCAN_LITERAL: {
+            static const char *literals[] = { "true", "false", "null" };
+            bool matched = false;
+            for (int i = 0; i < 3 && !matched; i++) {
+                size_t len = strlen(literals[i]);
+                if ((size_t)(s->end - s->p) >= len && memcmp(s->p, literals[i], len) == 0) {
+                    s->p += len;
+                    matched = true;
+                }
+            }
+            if (!matched) return fail(s);
+            break;
+        }
+        case JSON_SCAN_OBJECT:
+        case JSON_SCAN_ARRAY: {
+            // Bracket matching only needs to step over strings correctly.
+            int depth = 0;
+            do {
+                if (s->p >= s->end) return fail(s);
+                char c = *s->p;
+                if (c == '"') {
+                    JsonSpan raw;
+                    if (!json_scan_string_raw(s, &raw)) return false;
+                    continue;
+                }
+                if (c == '{' || c == '[') depth++;
+                else if (c == '}' || c == ']') depth--;
+                s->p++;
+            } while (depth > 0);
+            break;
+        }
+        default:
+            return fail(s);
+    }
+    if (value) {
+        value->start = start;
+        value->len = s->p - start;
+    }
+    return true;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static long read_hex4(const char *p, const char *end) {
+    if (end - p < 4) return -1;
+    long value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_value(p[i]);
+        if (digit < 0) return -1;
+        value = value * 16 + digit;
+    }
+    return value;
+}
+
+static char *put_utf8(char *out, unsigned long cp) {
+    if (cp < 0x80) {
+        *out++ = (char)cp;
+    } else if (cp < 0x800) {
+        *out++ = (char)(0xC0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *out++ = (char)(0xE0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+long json_span_decode(JsonSpan raw, char *out) {
+    const char *p = raw.start;
+    const char *end = raw.start + raw.len;
+    char *o = out;
+    while (p < end) {
+        const char *backslash = memchr(p, '\\', end - p);
+        size_t plain = (backslash ? backslash : end) - p;
+        memcpy(o, p, plain);
+        o += plain;
+        p += plain;
+        if (!backslash) break;
+
+        if (end - p < 2) return -1;
+        char c = p[1];
+        p += 2;
+        switch (c) {
+            case '"': *o++ = '"'; break;
+            case '\\': *o++ = '\\'; break;
+            case '/': *o++ = '/'; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u': {
+                long cp = read_hex4(p, end);
+                if (cp < 0) return -1;
+                p += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    long low = read_hex4(p + 2, end);
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                if (cp >= 0xD800 && cp <= 0xDFFF) {
+                    cp = 0xFFFD; // unpaired surrogate
+                }
+                o = put_utf8(o, (unsigned long)cp);
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    *o = '\0';
+    return o - out;
+}
+
+bool json_span_equals(JsonSpan span, const char *literal) {
+    size_t len = strlen(literal);
+    return span.len == len && memcmp(span.start, literal, len) == 0;
+}
@@ -0,0 +1,62 @@
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Pull-style JSON scanner for decoding known message shapes without building
+// a tree. It reads in place and never allocates. It is not a validator:
+// malformed input sets `failed` and stops further progress, but some invalid
+// documents (stray commas) are accepted.
+//
+//   json_scan_object_begin(&s);
+//   while (json_scan_next_key(&s, &key)) {
+//       if (json_span_equals(key, "line")) json_scan_int(&s, &line);
+//       else json_scan_skip(&s, NULL);
+//   }
+
+typedef enum {
+    JSON_SCAN_END,
+    JSON_SCAN_OBJECT,
+    JSON_SCAN_ARRAY,
+    JSON_SCAN_STRING,
+    JSON_SCAN_NUMBER,
+    JSON_SCAN_LITERAL, // true, false or null
+    JSON_SCAN_INVALID,
+} JsonScanType;
+
+typedef struct {
+    const char *start;
+    size_t len;
+} JsonSpan;
+
+typedef struct {
+    const char *p;
+    const char *end;
+    bool failed;
+} JsonScanner;
+
+void json_scan_init(JsonScanner *s, const char *data, size_t len);
+JsonScanType json_scan_peek(JsonScanner *s);
+
+bool json_scan_object_begin(JsonScanner *s);
+// Reads the next key and its colon. key is the raw text between the quotes.
+// Returns false after consuming the closing brace, or on error.
+bool json_scan_next_key(JsonScanner *s, JsonSpan *key);
+bool json_scan_array_begin(JsonScanner *s);
+// Returns true when another element follows, false after the closing bracket.
+bool json_scan_next_element(JsonScanner *s);
+
+// Skips one value of any type; value, if given, receives its raw text.
+bool json_scan_skip(JsonScanner *s, JsonSpan *value);
+// Reads a number, truncating any fraction or exponent.
+bool json_scan_int(JsonScanner *s, long long *out);
+// Reads a string without decoding it; raw excludes the quotes.
+bool json_scan_string_raw(JsonScanner *s, JsonSpan *raw);
+// Decodes escapes in a raw string span into out, which needs raw.len + 1
+// bytes, and NUL-terminates it. Returns the decoded length or -1.
+long json_span_decode(JsonSpan raw, char *out);
+
+bool json_span_equals(JsonSpan span, const char *literal);
+
+#endif // JSON_SCAN_H
@@ -1,25 +1,44 @@
+#define _GNU_SOURCE
 #define _XOPEN_SOURCE 700
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <strings.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <signal.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <stdint.h>
 #include <time.h>
 #include "lsp.h"
 #include "log.h"
 #include "cJSON.h"
 #include "editor.h"
 #include "str.h"
+#include "perf.h"
+#include "json_scan.h"
+#define ALLOC_TAG ALLOC_TAG_LSP
+#include "alloc.h"
 
 #define MAX_LSP_SERVERS 10
 #define DEBOUNCE_MS 100
+#define MAX_PENDING_CHANGES 1024
+
+#define LSP_READER_INITIAL_CAPACITY 16384
+#define LSP_READER_RETAIN_CAPACITY (1024 * 1024)
+#define LSP_READER_MAX_HEADER 8192
+#define LSP_OUTBOUND_LIMIT (64 * 1024 * 1024)
+#define LSP_WRITER_DRAIN_MS 1000
+
+#define LSP_SYNC_FULL 1
+#define LSP_SYNC_INCREMENTAL 2
 
 char *find_project_root(const char *file_path) {
     char path[PATH_MAX];
@@ -92,6 +111,13 @@ char *find_project_root(const char *file_path) {
 static LspServer *lsp_servers[MAX_LSP_SERVERS] = {NULL};
 static int lsp_server_count = 0;
 
+// Guards every server's debounce list and the list of servers the debouncer
+// walks.
+static pthread_mutex_t debounce_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t debounce_cond;
+static pthread_t debouncer_thread;
+static bool debouncer_running = false;
+
 static bool lsp_wait_for_initialization(LspServer *server) {
   if (!server) return false;
 
@@ -123,197 +149,954 @@ static LspServer *get_server(const char *lang_name) {
   return NULL;
 }
 
-static void lsp_send_message(LspServer *server, cJSON *json_rpc) {
+typedef struct LspOutboundMessage {
+  char header[32];
+  size_t header_len;
+  char *body;
+  size_t body_len;
+  struct LspOutboundMessage *next;
+} LspOutboundMessage;
+
+static bool lsp_write_message(int fd, LspOutboundMessage *message) {
+  struct iovec iov[2] = {
+    { message->header, message->header_len },
+    { message->body, message->body_len },
+  };
+  struct iovec *vec = iov;
+  int count = 2;
+  while (count > 0) {
+    ssize_t written = writev(fd, vec, count);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      log_error("lsp.lsp_write_message: writev failed: %s", strerror(errno));
+      return false;
+    }
+    while (count > 0 && (size_t)written >= vec->iov_len) {
+      written -= vec->iov_len;
+      vec++;
+      count--;
+    }
+    if (count > 0) {
+      vec->iov_base = (char *)vec->iov_base + written;
+      vec->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+static void lsp_free_outbound(LspOutboundMessage *message) {
+  while (message) {
+    LspOutboundMessage *next = message->next;
+    free(message->body);
+    free(message);
+    message = next;
+  }
+}
+
+static void *lsp_writer_thread_func(void *arg) {
+  LspServer *server = (LspServer *)arg;
+  PERF_THREAD_NAME("lsp writer");
+  pthread_mutex_lock(&server->outbound_mutex);
+  while (1) {
+    while (!server->outbound_head && !server->writer_stopping) {
+      pthread_cond_wait(&server->outbound_cond, &server->outbound_mutex);
+    }
+    LspOutboundMessage *message = server->outbound_head;
+    if (!message) {
+      break; // stopping and drained
+    }
+    server->outbound_head = message->next;
+    if (!server->outbound_head) {
+      server->outbound_tail = NULL;
+    }
+    server->outbound_bytes -= message->body_len;
+    pthread_mutex_unlock(&server->outbound_mutex);
+
+    PERF_START("lsp_write");
+    bool ok = lsp_write_message(server->to_server_pipe[1], message);
+    PERF_END();
+    message->next = NULL;
+    lsp_free_outbound(message);
+
+    pthread_mutex_lock(&server->outbound_mutex);
+    if (!ok) {
+      // The server is gone; later messages are dropped in lsp_send_message.
+      server->writer_failed = true;
+      lsp_free_outbound(server->outbound_head);
+      server->outbound_head = NULL;
+      server->outbound_tail = NULL;
+      server->outbound_bytes = 0;
+      break;
+    }
+  }
+  server->writer_exited = true;
+  pthread_cond_broadcast(&server->outbound_cond);
+  pthread_mutex_unlock(&server->outbound_mutex);
+  return NULL;
+}
+
+// Waits up to ms for the writer to exit. Called with outbound_mutex held.
+static bool lsp_writer_wait(LspServer *server, int ms) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += ms / 1000;
+  deadline.tv_nsec += (long)(ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  while (!server->writer_exited) {
+    if (pthread_cond_timedwait(&server->outbound_cond, &server->outbound_mutex, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  return server->writer_exited;
+}
+
+// Flushes what is queued and waits for the writer to exit. A server that
+// stopped reading leaves the writer blocked in writev, so once the drain
+// takes too long the server is terminated, which fails the write with EPIPE.
+static void lsp_writer_stop(LspServer *server) {
+  pthread_mutex_lock(&server->outbound_mutex);
+  server->writer_stopping = true;
+  pthread_cond_broadcast(&server->outbound_cond);
+  if (!lsp_writer_wait(server, LSP_WRITER_DRAIN_MS)) {
+    log_warning("lsp.lsp_writer_stop: %s is not reading, terminating it with %zu bytes queued",
+                server->lang_name, server->outbound_bytes);
+    kill(server->pid, SIGTERM);
+    if (!lsp_writer_wait(server, LSP_WRITER_DRAIN_MS)) {
+      kill(server->pid, SIGKILL);
+    }
+  }
+  pthread_mutex_unlock(&server->outbound_mutex);
+  pthread_join(server->writer_thread, NULL);
+}
+
+// Queues a message for the writer thread and returns false if it was dropped.
+// Never blocks on the pipe, so it is safe to call with editor_mutex held.
+static bool lsp_send_message(LspServer *server, cJSON *json_rpc) {
   if (!server || server->pid <= 0)
+    return false;
+
+  LspOutboundMessage *message = malloc(sizeof(LspOutboundMessage));
+  if (!message) {
+    log_error("lsp.lsp_send_message: malloc failed");
+    exit(1);
+  }
+  message->body = cJSON_PrintUnformatted(json_rpc);
+  if (!message->body) {
+    free(message);
+    return false;
+  }
+  message->body_len = strlen(message->body);
+  message->header_len = snprintf(message->header, sizeof(message->header),
+                                 "Content-Length: %zu\r\n\r\n", message->body_len);
+  message->next = NULL;
+
+  cJSON *method = cJSON_GetObjectItem(json_rpc, "method");
+  cJSON *id = cJSON_GetObjectItem(json_rpc, "id");
+  const char *name = cJSON_IsString(method) ? method->valuestring : "response";
+  int id_value = cJSON_IsNumber(id) ? id->valueint : 0;
+  size_t body_len = message->body_len;
+
+  pthread_mutex_lock(&server->outbound_mutex);
+  bool full = server->outbound_head && server->outbound_bytes + body_len > LSP_OUTBOUND_LIMIT;
+  bool queued = !server->writer_failed && !server->writer_stopping && !full;
+  if (queued) {
+    if (server->outbound_tail) {
+      server->outbound_tail->next = message;
+    } else {
+      server->outbound_head = message;
+    }
+    server->outbound_tail = message;
+    server->outbound_bytes += body_len;
+    pthread_cond_signal(&server->outbound_cond);
+  }
+  pthread_mutex_unlock(&server->outbound_mutex);
+
+  if (!queued) {
+    lsp_free_outbound(message);
+    atomic_store(&server->outbound_dropped, true);
+    log_error("lsp.lsp_send_message: %s dropped %s (%zu bytes), %s", server->lang_name, name,
+              body_len, full ? "server is not reading" : "writer stopped");
+    return false;
+  }
+  if (id_value) {
+    log_info("lsp.lsp_send_message: %s %s id=%d (%zu bytes)", server->lang_name, name, id_value, body_len);
+  } else {
+    log_info("lsp.lsp_send_message: %s %s (%zu bytes)", server->lang_name, name, body_len);
+  }
+  return true;
+}
+
+static bool timespec_before(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+typedef struct LspCompletion {
+  LspResponseCallback callback;
+  void *user_data;
+  cJSON *message; // the response, or a synthesized {"error": ...}
+  struct LspCompletion *next;
+} LspCompletion;
+
+// Responses waiting for the editor thread, oldest first.
+static pthread_mutex_t completions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LspCompletion *completions_head = NULL;
+static LspCompletion *completions_tail = NULL;
+static atomic_int completion_count = 0;
+static atomic_int pending_request_count = 0;
+static atomic_int next_request_id = 1;
+
+static cJSON *lsp_error_response(int code, const char *text) {
+  cJSON *message = cJSON_CreateObject();
+  cJSON *error = cJSON_CreateObject();
+  cJSON_AddNumberToObject(error, "code", code);
+  cJSON_AddStringToObject(error, "message", text);
+  cJSON_AddItemToObject(message, "error", error);
+  return message;
+}
+
+static void lsp_run_callback(LspResponseCallback callback, void *user_data, cJSON *message) {
+  if (!callback) return;
+  cJSON *error = cJSON_GetObjectItem(message, "error");
+  callback(error ? NULL : cJSON_GetObjectItem(message, "result"), error, user_data);
+}
+
+// Delivers the response for a request already removed from the pending list.
+// Takes ownership of both.
+static void lsp_complete(LspPendingRequest *req, cJSON *message) {
+  atomic_fetch_sub(&pending_request_count, 1);
+  if (req->on_reader_thread || !req->callback) {
+    lsp_run_callback(req->callback, req->user_data, message);
+    cJSON_Delete(message);
+    free(req);
     return;
+  }
+
+  LspCompletion *completion = malloc(sizeof(LspCompletion));
+  if (!completion) {
+    log_error("lsp.lsp_complete: malloc failed");
+    exit(1);
+  }
+  completion->callback = req->callback;
+  completion->user_data = req->user_data;
+  completion->message = message;
+  completion->next = NULL;
+  free(req);
+
+  pthread_mutex_lock(&completions_mutex);
+  if (completions_tail) {
+    completions_tail->next = completion;
+  } else {
+    completions_head = completion;
+  }
+  completions_tail = completion;
+  atomic_fetch_add(&completion_count, 1);
+  pthread_mutex_unlock(&completions_mutex);
+}
+
+static LspPendingRequest *lsp_take_pending(LspServer *server, int id) {
+  pthread_mutex_lock(&server->requests_mutex);
+  LspPendingRequest **link = &server->pending_requests;
+  while (*link && (*link)->id != id) {
+    link = &(*link)->next;
+  }
+  LspPendingRequest *req = *link;
+  if (req) {
+    *link = req->next;
+  }
+  pthread_mutex_unlock(&server->requests_mutex);
+  return req;
+}
+
+static void lsp_send_cancel(LspServer *server, int id) {
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddStringToObject(root, "jsonrpc", "2.0");
+  cJSON_AddStringToObject(root, "method", "$/cancelRequest");
+  cJSON *params = cJSON_CreateObject();
+  cJSON_AddNumberToObject(params, "id", id);
+  cJSON_AddItemToObject(root, "params", params);
+  lsp_send_message(server, root);
+  cJSON_Delete(root);
+}
+
+// Registers the request before writing it so the reader can never see a
+// response for an id it doesn't know. timeout_ms <= 0 waits forever.
+static int lsp_send_request(LspServer *server, const char *method, cJSON *params, int timeout_ms,
+                            bool supersede, bool on_reader_thread,
+                            LspResponseCallback callback, void *user_data) {
+  LspPendingRequest *req = malloc(sizeof(LspPendingRequest));
+  if (!req) {
+    log_error("lsp.lsp_send_request: malloc failed");
+    exit(1);
+  }
+  req->id = atomic_fetch_add(&next_request_id, 1);
+  strncpy(req->method, method, sizeof(req->method) - 1);
+  req->method[sizeof(req->method) - 1] = '\0';
+  req->deadline = (struct timespec){0};
+  if (timeout_ms > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &req->deadline);
+    req->deadline.tv_sec += timeout_ms / 1000;
+    req->deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (req->deadline.tv_nsec >= 1000000000) {
+      req->deadline.tv_sec++;
+      req->deadline.tv_nsec -= 1000000000;
+    }
+  }
+  req->callback = callback;
+  req->user_data = user_data;
+  req->on_reader_thread = on_reader_thread;
+
+  LspPendingRequest *superseded = NULL;
+  pthread_mutex_lock(&server->requests_mutex);
+  if (supersede) {
+    LspPendingRequest **link = &server->pending_requests;
+    while (*link && strcmp((*link)->method, req->method) != 0) {
+      link = &(*link)->next;
+    }
+    superseded = *link;
+    if (superseded) {
+      *link = superseded->next;
+    }
+  }
+  req->next = server->pending_requests;
+  server->pending_requests = req;
+  atomic_fetch_add(&pending_request_count, 1);
+  pthread_mutex_unlock(&server->requests_mutex);
+
+  if (superseded) {
+    lsp_send_cancel(server, superseded->id);
+    lsp_complete(superseded, lsp_error_response(LSP_ERROR_REQUEST_CANCELLED, "superseded"));
+  }
+
+  int id = req->id;
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddStringToObject(root, "jsonrpc", "2.0");
+  cJSON_AddNumberToObject(root, "id", id);
+  cJSON_AddStringToObject(root, "method", method);
+  if (params) {
+    cJSON_AddItemToObject(root, "params", params);
+  }
+  lsp_send_message(server, root);
+  cJSON_Delete(root);
+  return id;
+}
+
+// Answers requests the server sends to us. Servers block on some of these
+// (workspace/configuration in particular), so everything gets a reply.
+static void lsp_handle_server_request(LspServer *server, cJSON *message) {
+  cJSON *method = cJSON_GetObjectItem(message, "method");
+  cJSON *params = cJSON_GetObjectItem(message, "params");
+
+  cJSON *reply = cJSON_CreateObject();
+  cJSON_AddStringToObject(reply, "jsonrpc", "2.0");
+  cJSON_AddItemToObject(reply, "id", cJSON_Duplicate(cJSON_GetObjectItem(message, "id"), true));
+  if (strcmp(method->valuestring, "workspace/configuration") == 0) {
+    cJSON *result = cJSON_CreateArray();
+    int count = cJSON_GetArraySize(params ? cJSON_GetObjectItem(params, "items") : NULL);
+    for (int i = 0; i < count; i++) {
+      cJSON_AddItemToArray(result, cJSON_CreateNull());
+    }
+    cJSON_AddItemToObject(reply, "result", result);
+  } else if (strcmp(method->valuestring, "window/workDoneProgress/create") == 0 ||
+             strcmp(method->valuestring, "client/registerCapability") == 0 ||
+             strcmp(method->valuestring, "client/unregisterCapability") == 0 ||
+             strcmp(method->valuestring, "workspace/workspaceFolders") == 0) {
+    cJSON_AddNullToObject(reply, "result");
+  } else {
+    log_warning("lsp.lsp_handle_server_request: unsupported request %s", method->valuestring);
+    cJSON *error = cJSON_CreateObject();
+    cJSON_AddNumberToObject(error, "code", LSP_ERROR_METHOD_NOT_FOUND);
+    cJSON_AddStringToObject(error, "message", "method not supported");
+    cJSON_AddItemToObject(reply, "error", error);
+  }
+  lsp_send_message(server, reply);
+  cJSON_Delete(reply);
+}
 
-  char *message = cJSON_PrintUnformatted(json_rpc);
-  if (!message)
+int lsp_request(const char *lang_name, const char *method, cJSON *params,
+                int timeout_ms, bool supersede, LspResponseCallback callback, void *user_data) {
+  LspServer *server = get_server(lang_name);
+  if (!server || !lsp_wait_for_initialization(server)) {
+    cJSON_Delete(params);
+    return 0;
+  }
+  return lsp_send_request(server, method, params, timeout_ms, supersede, false, callback, user_data);
+}
+
+void lsp_cancel_request(int id) {
+  for (int i = 0; i < lsp_server_count; i++) {
+    LspPendingRequest *req = lsp_take_pending(lsp_servers[i], id);
+    if (req) {
+      lsp_send_cancel(lsp_servers[i], id);
+      lsp_complete(req, lsp_error_response(LSP_ERROR_REQUEST_CANCELLED, "cancelled"));
+      return;
+    }
+  }
+}
+
+static void lsp_expire_requests(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (int i = 0; i < lsp_server_count; i++) {
+    LspServer *server = lsp_servers[i];
+    LspPendingRequest *expired = NULL;
+    pthread_mutex_lock(&server->requests_mutex);
+    LspPendingRequest **link = &server->pending_requests;
+    while (*link) {
+      LspPendingRequest *req = *link;
+      bool has_deadline = req->deadline.tv_sec || req->deadline.tv_nsec;
+      if (has_deadline && !timespec_before(&now, &req->deadline)) {
+        *link = req->next;
+        req->next = expired;
+        expired = req;
+      } else {
+        link = &req->next;
+      }
+    }
+    pthread_mutex_unlock(&server->requests_mutex);
+
+    while (expired) {
+      LspPendingRequest *next = expired->next;
+      log_warning("lsp.lsp_expire_requests: %s request %d timed out", expired->method, expired->id);
+      lsp_send_cancel(server, expired->id);
+      lsp_complete(expired, lsp_error_response(LSP_ERROR_TIMED_OUT, "timed out"));
+      expired = next;
+    }
+  }
+}
+
+void lsp_dispatch_responses(void) {
+  if (atomic_load(&pending_request_count) > 0) {
+    lsp_expire_requests();
+  }
+  if (atomic_load(&completion_count) == 0) {
     return;
+  }
+
+  pthread_mutex_lock(&completions_mutex);
+  LspCompletion *completion = completions_head;
+  completions_head = NULL;
+  completions_tail = NULL;
+  atomic_store(&completion_count, 0);
+  pthread_mutex_unlock(&completions_mutex);
+
+  while (completion) {
+    LspCompletion *next = completion->next;
+    lsp_run_callback(completion->callback, completion->user_data, completion->message);
+    cJSON_Delete(completion->message);
+    free(completion);
+    completion = next;
+  }
+}
 
-  char header[64];
-  int len = strlen(message);
-  snprintf(header, sizeof(header), "Content-Length: %d\r\n\r\n", len);
+void lsp_reader_init(LspReader *reader) {
+  reader->data = NULL;
+  reader->capacity = 0;
+  reader->start = 0;
+  reader->end = 0;
+}
 
-  ssize_t header_written = write(server->to_server_pipe[1], header, strlen(header));
-  ssize_t message_written = write(server->to_server_pipe[1], message, len);
-  log_info("lsp.lsp_send_message: %s", message);
+void lsp_reader_destroy(LspReader *reader) {
+  free(reader->data);
+  lsp_reader_init(reader);
+}
 
-  if (header_written < 0 || message_written < 0) {
-    log_error("lsp_send_message: write failed");
+// Makes room for at least `needed` more bytes after reader->end, first by
+// moving unconsumed bytes to the front and then by growing the buffer.
+static void lsp_reader_reserve(LspReader *reader, size_t needed) {
+  if (reader->capacity - reader->end >= needed) {
+    return;
+  }
+  if (reader->start > 0) {
+    memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    if (reader->capacity - reader->end >= needed) {
+      return;
+    }
+  }
+  size_t capacity = reader->capacity ? reader->capacity : LSP_READER_INITIAL_CAPACITY;
+  while (capacity - reader->end < needed) {
+    capacity *= 2;
+  }
+  char *data = realloc(reader->data, capacity);
+  if (!data) {
+    log_error("lsp.lsp_reader_reserve: realloc failed for %zu bytes", capacity);
+    exit(1);
   }
+  reader->data = data;
+  reader->capacity = capacity;
+}
 
-  free(message);
+static bool lsp_reader_fill(LspReader *reader, int fd, size_t needed) {
+  lsp_reader_reserve(reader, needed);
+  ssize_t bytes_read = read(fd, reader->data + reader->end, reader->capacity - reader->end);
+  if (bytes_read <= 0) {
+    return false;
+  }
+  reader->end += bytes_read;
+  return true;
 }
 
-static cJSON *lsp_read_message(LspServer *server) {
-  while (1) {
-    char *header_end = strstr(server->read_buffer, "\r\n\r\n");
-    if (!header_end) {
-      ssize_t bytes_read =
-          read(server->from_server_pipe[0],
-               server->read_buffer + server->buffer_pos,
-               sizeof(server->read_buffer) - server->buffer_pos - 1);
-      if (bytes_read <= 0) {
-        return NULL;
+// Returns the Content-Length from a header block, or -1 if it is missing.
+// Header names are case-insensitive and other headers are ignored.
+static long long lsp_parse_content_length(const char *headers, size_t len) {
+  const char *p = headers;
+  const char *end = headers + len;
+  while (p < end) {
+    const char *line_end = memchr(p, '\n', end - p);
+    if (!line_end) line_end = end;
+    static const char name[] = "Content-Length:";
+    if ((size_t)(line_end - p) > sizeof(name) - 1 && strncasecmp(p, name, sizeof(name) - 1) == 0) {
+      char *num_end;
+      long long value = strtoll(p + sizeof(name) - 1, &num_end, 10);
+      if (num_end == p + sizeof(name) - 1 || value < 0) {
+        return -1;
       }
-      server->buffer_pos += bytes_read;
-      server->read_buffer[server->buffer_pos] = '\0';
-      continue;
+      return value;
     }
+    p = line_end + 1;
+  }
+  return -1;
+}
 
-    char *content_length_start =
-        strstr(server->read_buffer, "Content-Length: ");
-    if (!content_length_start || content_length_start > header_end) {
-      log_error("lsp_read_message: invalid header format");
-      return NULL;
+bool lsp_reader_next_raw(LspReader *reader, int fd, const char **body, size_t *len) {
+  if (reader->start == reader->end) {
+    reader->start = 0;
+    reader->end = 0;
+    // Don't hold on to the space a single huge response needed.
+    if (reader->capacity > LSP_READER_RETAIN_CAPACITY) {
+      free(reader->data);
+      lsp_reader_init(reader);
     }
+  }
 
-    int content_length = atoi(content_length_start + 16);
-    if (content_length <= 0 || content_length > 1048576) {
-      log_error("lsp_read_message: invalid content length %d", content_length);
-      return NULL;
+  char *header_end;
+  while (1) {
+    size_t available = reader->end - reader->start;
+    header_end = available ? memmem(reader->data + reader->start, available, "\r\n\r\n", 4) : NULL;
+    if (header_end) {
+      break;
+    }
+    if (available > LSP_READER_MAX_HEADER) {
+      log_error("lsp.lsp_reader_next_raw: no header terminator in %zu bytes", available);
+      return false;
+    }
+    if (!lsp_reader_fill(reader, fd, 4096)) {
+      return false;
     }
+  }
 
-    char *json_start = header_end + 4;
-    int header_size = json_start - server->read_buffer;
-    int available_json = server->buffer_pos - header_size;
+  char *headers = reader->data + reader->start;
+  long long content_length = lsp_parse_content_length(headers, header_end - headers);
+  if (content_length < 0) {
+    log_error("lsp.lsp_reader_next_raw: missing or invalid Content-Length");
+    return false;
+  }
 
-    if (available_json >= content_length) {
-      char *json_copy = malloc(content_length + 1);
-      if (!json_copy) {
-        log_error("lsp_read_message: malloc failed");
-        return NULL;
-      }
+  size_t body_offset = (header_end + 4) - reader->data;
+  size_t message_end = body_offset + content_length;
+  while (reader->end < message_end) {
+    // Compaction may move the message, so keep offsets relative to start.
+    size_t body_from_start = body_offset - reader->start;
+    size_t missing = message_end - reader->end;
+    if (!lsp_reader_fill(reader, fd, missing)) {
+      return false;
+    }
+    body_offset = reader->start + body_from_start;
+    message_end = body_offset + content_length;
+  }
+
+  // The body stays in place until the next call.
+  *body = reader->data + body_offset;
+  *len = content_length;
+  reader->start = message_end;
+  return true;
+}
+
+cJSON *lsp_reader_next(LspReader *reader, int fd) {
+  const char *body;
+  size_t len;
+  if (!lsp_reader_next_raw(reader, fd, &body, &len)) {
+    return NULL;
+  }
+  PERF_START("lsp_read");
+  cJSON *parsed = cJSON_ParseWithLength(body, len);
+  PERF_END();
+  if (!parsed) {
+    log_error("lsp.lsp_reader_next: failed to parse %zu byte message", len);
+  }
+  return parsed;
+}
+
+static atomic_int diagnostic_totals[LSP_DIAGNOSTIC_SEVERITY_COUNT];
+static atomic_int diagnostics_generation = 0;
+
+static const char *uri_to_path(const char *uri) {
+  return strncmp(uri, "file://", 7) == 0 ? uri + 7 : uri;
+}
+
+static uint32_t hash_path(const char *path) {
+  uint32_t hash = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+    hash = (hash ^ *p) * 16777619u;
+  }
+  return hash;
+}
+
+// A set is one allocation: the header, then the items, then an arena holding
+// the path and every message.
+static DiagnosticSet *diagnostic_set_alloc(int capacity, size_t arena_size, char **arena) {
+  DiagnosticSet *set = malloc(sizeof(DiagnosticSet) + sizeof(Diagnostic) * capacity + arena_size);
+  if (!set) {
+    log_error("lsp.diagnostic_set_alloc: malloc failed");
+    exit(1);
+  }
+  atomic_init(&set->refcount, 1);
+  set->path = NULL;
+  set->version = atomic_fetch_add(&diagnostics_generation, 1) + 1;
+  set->document_version = -1;
+  set->position_encoding = LSP_POSITION_UTF16;
+  set->count = 0;
+  memset(set->severity_counts, 0, sizeof(set->severity_counts));
+  *arena = (char *)&set->items[capacity];
+  return set;
+}
+
+static DiagnosticSeverity diagnostic_severity(long long value) {
+  if (value >= LSP_DIAGNOSTIC_SEVERITY_ERROR && value <= LSP_DIAGNOSTIC_SEVERITY_HINT) {
+    return (DiagnosticSeverity)value;
+  }
+  return LSP_DIAGNOSTIC_SEVERITY_HINT;
+}
+
+static DiagnosticSet *diagnostic_set_create(const char *uri, cJSON *diagnostics_json, int document_version) {
+  const char *path = uri_to_path(uri);
+  size_t arena_size = strlen(path) + 1;
+  int capacity = 0;
+  cJSON *diag_json;
+  cJSON_ArrayForEach(diag_json, diagnostics_json) {
+    cJSON *message_json = cJSON_GetObjectItem(diag_json, "message");
+    if (cJSON_IsString(message_json)) {
+      arena_size += strlen(message_json->valuestring) + 1;
+    }
+    capacity++;
+  }
 
-      memcpy(json_copy, json_start, content_length);
-      json_copy[content_length] = '\0';
+  char *arena;
+  DiagnosticSet *set = diagnostic_set_alloc(capacity, arena_size, &arena);
+  set->document_version = document_version;
+  set->path = arena;
+  arena = stpcpy(arena, path) + 1;
+
+  cJSON_ArrayForEach(diag_json, diagnostics_json) {
+    cJSON *range = cJSON_GetObjectItem(diag_json, "range");
+    cJSON *start = range ? cJSON_GetObjectItem(range, "start") : NULL;
+    cJSON *end = range ? cJSON_GetObjectItem(range, "end") : NULL;
+    cJSON *message_json = cJSON_GetObjectItem(diag_json, "message");
+    if (!start || !end || !cJSON_IsString(message_json)) continue;
+    cJSON *line_obj = cJSON_GetObjectItem(start, "line");
+    cJSON *char_start_obj = cJSON_GetObjectItem(start, "character");
+    cJSON *char_end_obj = cJSON_GetObjectItem(end, "character");
+    if (!line_obj || !char_start_obj || !char_end_obj) continue;
+
+    cJSON *severity_json = cJSON_GetObjectItem(diag_json, "severity");
+    DiagnosticSeverity severity = diagnostic_severity(cJSON_IsNumber(severity_json) ? severity_json->valueint : 0);
+
+    Diagnostic *d = &set->items[set->count++];
+    d->line = line_obj->valueint;
+    d->col_start = char_start_obj->valueint;
+    d->col_end = char_end_obj->valueint;
+    d->severity = severity;
+    d->uri = set->path;
+    d->message = arena;
+    arena = stpcpy(arena, message_json->valuestring) + 1;
+    set->severity_counts[severity]++;
+  }
+  return set;
+}
 
-      cJSON *parsed = cJSON_Parse(json_copy);
-      free(json_copy);
+static bool scan_position(JsonScanner *s, long long *line, long long *character) {
+  JsonSpan key;
+  if (!json_scan_object_begin(s)) return false;
+  while (json_scan_next_key(s, &key)) {
+    if (json_span_equals(key, "line")) json_scan_int(s, line);
+    else if (json_span_equals(key, "character")) json_scan_int(s, character);
+    else json_scan_skip(s, NULL);
+  }
+  return !s->failed;
+}
 
-      int remaining = server->buffer_pos - (header_size + content_length);
-      if (remaining > 0) {
-        memmove(server->read_buffer, json_start + content_length, remaining);
+static bool scan_diagnostic(JsonScanner *s, Diagnostic *d, char **arena) {
+  long long line = -1, col_start = -1, end_line = -1, col_end = -1, severity = 0;
+  bool has_message = false;
+  JsonSpan key;
+  if (!json_scan_object_begin(s)) return false;
+  while (json_scan_next_key(s, &key)) {
+    if (json_span_equals(key, "range")) {
+      JsonSpan range_key;
+      if (!json_scan_object_begin(s)) return false;
+      while (json_scan_next_key(s, &range_key)) {
+        if (json_span_equals(range_key, "start")) scan_position(s, &line, &col_start);
+        else if (json_span_equals(range_key, "end")) scan_position(s, &end_line, &col_end);
+        else json_scan_skip(s, NULL);
       }
-      server->buffer_pos = remaining;
-      server->read_buffer[server->buffer_pos] = '\0';
+    } else if (json_span_equals(key, "severity")) {
+      json_scan_int(s, &severity);
+    } else if (json_span_equals(key, "message")) {
+      JsonSpan raw;
+      long len = json_scan_string_raw(s, &raw) ? json_span_decode(raw, *arena) : -1;
+      if (len < 0) return false;
+      d->message = *arena;
+      *arena += len + 1;
+      has_message = true;
+    } else {
+      json_scan_skip(s, NULL);
+    }
+  }
+  if (s->failed || !has_message || line < 0 || col_start < 0 || col_end < 0) {
+    return false;
+  }
+  d->line = (int)line;
+  d->col_start = (int)col_start;
+  d->col_end = (int)col_end;
+  d->severity = diagnostic_severity(severity);
+  return true;
+}
 
-      return parsed;
+// Finds the "params" object of a publishDiagnostics notification.
+static bool scan_publish_params(const char *body, size_t len, JsonSpan *params) {
+  JsonScanner s;
+  json_scan_init(&s, body, len);
+  bool is_publish = false;
+  bool has_params = false;
+  JsonSpan key;
+  if (!json_scan_object_begin(&s)) return false;
+  while (json_scan_next_key(&s, &key)) {
+    if (json_span_equals(key, "method")) {
+      JsonSpan method;
+      if (!json_scan_string_raw(&s, &method) || !json_span_equals(method, "textDocument/publishDiagnostics")) {
+        return false;
+      }
+      is_publish = true;
+    } else if (json_span_equals(key, "params")) {
+      has_params = json_scan_skip(&s, params);
     } else {
-      int needed = content_length - available_json;
-      if (server->buffer_pos + needed >= (int)sizeof(server->read_buffer)) {
-        log_error("lsp_read_message: message too large for buffer");
-        return NULL;
+      json_scan_skip(&s, NULL);
+    }
+  }
+  return !s.failed && is_publish && has_params;
+}
+
+DiagnosticSet *lsp_parse_publish_diagnostics(const char *body, size_t len) {
+  JsonSpan params;
+  if (!scan_publish_params(body, len, &params)) {
+    return NULL;
+  }
+
+  // First pass: find the uri and the diagnostics array, counting entries.
+  JsonScanner s;
+  json_scan_init(&s, params.start, params.len);
+  JsonSpan uri = { 0 }, diagnostics = { 0 }, key;
+  bool has_uri = false;
+  long long document_version = -1;
+  int capacity = 0;
+  if (!json_scan_object_begin(&s)) return NULL;
+  while (json_scan_next_key(&s, &key)) {
+    if (json_span_equals(key, "uri")) {
+      has_uri = json_scan_string_raw(&s, &uri);
+    } else if (json_span_equals(key, "diagnostics")) {
+      const char *start = s.p;
+      if (!json_scan_array_begin(&s)) return NULL;
+      while (json_scan_next_element(&s)) {
+        if (!json_scan_skip(&s, NULL)) return NULL;
+        capacity++;
       }
+      diagnostics.start = start;
+      diagnostics.len = s.p - start;
+    } else if (json_span_equals(key, "version") && json_scan_peek(&s) == JSON_SCAN_NUMBER) {
+      json_scan_int(&s, &document_version);
+    } else {
+      json_scan_skip(&s, NULL);
+    }
+  }
+  if (s.failed || !has_uri || !diagnostics.start) {
+    return NULL;
+  }
 
-      ssize_t bytes_read = read(server->from_server_pipe[0],
-                                server->read_buffer + server->buffer_pos, needed);
-      if (bytes_read <= 0) {
+  // Decoded strings are never longer than their escaped form, so the raw
+  // sizes bound the arena.
+  char *arena;
+  DiagnosticSet *set = diagnostic_set_alloc(capacity, uri.len + 1 + diagnostics.len, &arena);
+  set->document_version = (int)document_version;
+  if (json_span_decode(uri, arena) < 0) {
+    free(set);
+    return NULL;
+  }
+  set->path = arena;
+  if (strncmp(arena, "file://", 7) == 0) {
+    set->path += 7;
+  }
+  arena += strlen(arena) + 1;
+
+  json_scan_init(&s, diagnostics.start, diagnostics.len);
+  json_scan_array_begin(&s);
+  while (json_scan_next_element(&s)) {
+    Diagnostic *d = &set->items[set->count];
+    char *mark = arena;
+    if (!scan_diagnostic(&s, d, &arena)) {
+      if (s.failed) {
+        free(set);
         return NULL;
       }
-      server->buffer_pos += bytes_read;
-      server->read_buffer[server->buffer_pos] = '\0';
+      arena = mark; // incomplete entry, skipped like the cJSON path does
+      continue;
+    }
+    d->uri = set->path;
+    set->severity_counts[d->severity]++;
+    set->count++;
+  }
+  return set;
+}
+
+void lsp_diagnostics_release(DiagnosticSet *set) {
+  if (!set || atomic_fetch_sub(&set->refcount, 1) != 1) {
+    return;
+  }
+  free(set);
+}
+
+// Returns the slot holding path, or the empty slot where it belongs.
+static DiagnosticSet **diagnostic_store_slot(DiagnosticSet **sets, int capacity, const char *path) {
+  uint32_t i = hash_path(path) & (capacity - 1);
+  while (sets[i] && strcmp(sets[i]->path, path) != 0) {
+    i = (i + 1) & (capacity - 1);
+  }
+  return &sets[i];
+}
+
+static void diagnostic_store_grow(LspServer *server) {
+  int capacity = server->diagnostic_set_capacity ? server->diagnostic_set_capacity * 2 : 16;
+  DiagnosticSet **sets = calloc(capacity, sizeof(DiagnosticSet *));
+  if (!sets) {
+    log_error("lsp.diagnostic_store_grow: calloc failed");
+    exit(1);
+  }
+  for (int i = 0; i < server->diagnostic_set_capacity; i++) {
+    DiagnosticSet *set = server->diagnostic_sets[i];
+    if (set) {
+      *diagnostic_store_slot(sets, capacity, set->path) = set;
+    }
+  }
+  free(server->diagnostic_sets);
+  server->diagnostic_sets = sets;
+  server->diagnostic_set_capacity = capacity;
+}
+
+static void diagnostic_totals_adjust(const DiagnosticSet *set, int sign) {
+  for (int i = 0; i < LSP_DIAGNOSTIC_SEVERITY_COUNT; i++) {
+    if (set->severity_counts[i]) {
+      atomic_fetch_add(&diagnostic_totals[i], sign * set->severity_counts[i]);
     }
   }
 }
 
+// Replaces the set for the document, taking over the caller's reference.
+static void diagnostic_store_publish(LspServer *server, DiagnosticSet *set) {
+  set->position_encoding = server->position_encoding;
+  pthread_mutex_lock(&server->diagnostics_mutex);
+  if ((server->diagnostic_set_count + 1) * 2 > server->diagnostic_set_capacity) {
+    diagnostic_store_grow(server);
+  }
+  DiagnosticSet **slot = diagnostic_store_slot(server->diagnostic_sets, server->diagnostic_set_capacity, set->path);
+  DiagnosticSet *old = *slot;
+  if (!old) {
+    server->diagnostic_set_count++;
+  }
+  *slot = set;
+  diagnostic_totals_adjust(set, 1);
+  if (old) {
+    diagnostic_totals_adjust(old, -1);
+  }
+  pthread_mutex_unlock(&server->diagnostics_mutex);
+  lsp_diagnostics_release(old);
+}
+
+DiagnosticSet *lsp_diagnostics_acquire(const char *absolute_path) {
+  LspServer *server = get_server(str_get_lang_name_from_file_name(absolute_path));
+  if (!server) {
+    return NULL;
+  }
+  DiagnosticSet *set = NULL;
+  pthread_mutex_lock(&server->diagnostics_mutex);
+  if (server->diagnostic_set_capacity) {
+    set = *diagnostic_store_slot(server->diagnostic_sets, server->diagnostic_set_capacity, absolute_path);
+    if (set) {
+      atomic_fetch_add(&set->refcount, 1);
+    }
+  }
+  pthread_mutex_unlock(&server->diagnostics_mutex);
+  return set;
+}
+
+void lsp_diagnostic_totals(int totals[LSP_DIAGNOSTIC_SEVERITY_COUNT]) {
+  for (int i = 0; i < LSP_DIAGNOSTIC_SEVERITY_COUNT; i++) {
+    totals[i] = atomic_load(&diagnostic_totals[i]);
+  }
+}
+
 static void *lsp_reader_thread_func(void *arg) {
   LspServer *server = (LspServer *)arg;
+  PERF_THREAD_NAME("lsp reader");
   while (1) {
-    cJSON *message = lsp_read_message(server);
-    if (!message) {
+    const char *body;
+    size_t len;
+    if (!lsp_reader_next_raw(&server->reader, server->from_server_pipe[0], &body, &len)) {
       break;
     }
 
-    cJSON *method = cJSON_GetObjectItem(message, "method");
-    if (method && strcmp(method->valuestring, "textDocument/publishDiagnostics") == 0) {
-      cJSON *params = cJSON_GetObjectItem(message, "params");
-      if (!params) {
-        cJSON_Delete(message);
-        continue;
-      }
-      cJSON *uriobj = cJSON_GetObjectItem(params, "uri");
-      if (!uriobj) {
-        cJSON_Delete(message);
-        continue;
-      }
-      char *uri = strdup(uriobj->valuestring);
-      cJSON *diagnostics_json = cJSON_GetObjectItem(params, "diagnostics");
-      if (!diagnostics_json) {
-        cJSON_Delete(message);
-        continue;
-      }
+    // Diagnostics are most of the traffic; decode them without a cJSON tree.
+    PERF_START("lsp_scan");
+    DiagnosticSet *set = lsp_parse_publish_diagnostics(body, len);
+    PERF_END();
+    if (set) {
+      diagnostic_store_publish(server, set);
+      editor_request_redraw();
+      continue;
+    }
 
-      pthread_mutex_lock(&server->diagnostics_mutex);
-      server->diagnostics_version++;
+    PERF_START("lsp_read");
+    cJSON *message = cJSON_ParseWithLength(body, len);
+    PERF_END();
+    if (!message) {
+      log_error("lsp.lsp_reader_thread_func: failed to parse %zu byte message", len);
+      continue;
+    }
 
-      
-      int incoming_diagnostic_count = cJSON_GetArraySize(diagnostics_json);
-      Diagnostic *new_diagnostics = malloc(sizeof(Diagnostic) * (incoming_diagnostic_count + server->diagnostic_count));
-      if (!new_diagnostics) {
-        pthread_mutex_unlock(&server->diagnostics_mutex);
-        cJSON_Delete(message);
-        continue;
-      }
-      int new_diagnostics_count = 0;
-      for (int i = 0; i < server->diagnostic_count; i++) {
-        if (!strcmp(server->diagnostics[i].uri, uri)) {
-          free(server->diagnostics[i].message);
-          free(server->diagnostics[i].uri);
-        } else {
-          new_diagnostics[new_diagnostics_count++] = server->diagnostics[i];
-        }
+    cJSON *method = cJSON_GetObjectItem(message, "method");
+    cJSON *id = cJSON_GetObjectItem(message, "id");
+    if (cJSON_IsString(method) && id) {
+      lsp_handle_server_request(server, message);
+    } else if (cJSON_IsString(method) && strcmp(method->valuestring, "textDocument/publishDiagnostics") == 0) {
+      cJSON *params = cJSON_GetObjectItem(message, "params");
+      cJSON *uri = params ? cJSON_GetObjectItem(params, "uri") : NULL;
+      cJSON *diagnostics_json = params ? cJSON_GetObjectItem(params, "diagnostics") : NULL;
+      cJSON *version = params ? cJSON_GetObjectItem(params, "version") : NULL;
+      if (cJSON_IsString(uri) && cJSON_IsArray(diagnostics_json)) {
+        diagnostic_store_publish(server, diagnostic_set_create(uri->valuestring, diagnostics_json,
+                                                               cJSON_IsNumber(version) ? version->valueint : -1));
+        editor_request_redraw();
       }
-      free(uri);
-      free(server->diagnostics);
-      server->diagnostics = new_diagnostics;
-      server->diagnostic_count = new_diagnostics_count + incoming_diagnostic_count;
-      if (incoming_diagnostic_count > 0) {
-        for (int i = 0; i < incoming_diagnostic_count; i++) {
-          cJSON *diag_json = cJSON_GetArrayItem(diagnostics_json, i);
-          if (!diag_json) continue;
-          cJSON *range = cJSON_GetObjectItem(diag_json, "range");
-          if (!range) continue;
-          cJSON *start = cJSON_GetObjectItem(range, "start");
-          cJSON *end = cJSON_GetObjectItem(range, "end");
-          if (!start || !end) continue;
-          cJSON *message_json = cJSON_GetObjectItem(diag_json, "message");
-          if (!message_json) continue;
-          cJSON *severity_json = cJSON_GetObjectItem(diag_json, "severity");
-          cJSON *line_obj = cJSON_GetObjectItem(start, "line");
-          cJSON *char_start_obj = cJSON_GetObjectItem(start, "character");
-          cJSON *char_end_obj = cJSON_GetObjectItem(end, "character");
-          if (!line_obj || !char_start_obj || !char_end_obj) continue;
-          int new_index = new_diagnostics_count + i;
-          server->diagnostics[new_index].line = line_obj->valueint;
-          server->diagnostics[new_index].col_start = char_start_obj->valueint;
-          server->diagnostics[new_index].col_end = char_end_obj->valueint;
-
-          if (severity_json) {
-            server->diagnostics[new_index].severity = (DiagnosticSeverity)severity_json->valueint;
-          } else {
-            server->diagnostics[new_index].severity = LSP_DIAGNOSTIC_SEVERITY_HINT;
-          }
-          server->diagnostics[new_index].uri = strdup(uriobj->valuestring);
-          server->diagnostics[new_index].message = strdup(message_json->valuestring);
-        }
+    } else if (cJSON_IsNumber(id)) {
+      LspPendingRequest *req = lsp_take_pending(server, id->valueint);
+      if (req) {
+        lsp_complete(req, message);
+        message = NULL;
+      } else {
+        log_warning("lsp.lsp_reader_thread_func: response for unknown request %d", id->valueint);
       }
-
-      pthread_mutex_unlock(&server->diagnostics_mutex);
-      editor_request_redraw();
-    } else if (cJSON_GetObjectItem(message, "id") && cJSON_GetObjectItem(message, "id")->valueint == 1) {
-      log_info("lsp.lsp_reader_thread_func: received initialize response");
-      pthread_mutex_lock(&server->init_mutex);
-      server->initialized = true;
-      pthread_cond_signal(&server->init_cond);
-      pthread_mutex_unlock(&server->init_mutex);
-      cJSON *root = cJSON_CreateObject();
-      cJSON_AddStringToObject(root, "jsonrpc", "2.0");
-      cJSON_AddStringToObject(root, "method", "initialized");
-      cJSON_AddItemToObject(root, "params", cJSON_CreateObject());
-      lsp_send_message(server, root);
-      cJSON_Delete(root);
     } else {
       char *message_str = cJSON_PrintUnformatted(message);
       log_warning("lsp.lsp_reader_thread_func: unhandled message %s", message_str);
@@ -326,71 +1109,211 @@ static void *lsp_reader_thread_func(void *arg) {
   return NULL;
 }
 
-static void *debouncer_thread_func(void *arg) {
-    LspServer *server = (LspServer *)arg;
-    server->debouncer_thread_running = true;
-
-    while (server->debouncer_thread_running) {
-        struct timespec sleep_time = {0, 10 * 1000 * 1000}; // 10ms
-        nanosleep(&sleep_time, NULL);
-
-        pthread_mutex_lock(&server->debounce_mutex);
-
-        DebounceRequest *current = server->debounce_requests_head;
-        DebounceRequest *prev = NULL;
+static void debounce_request_clear_changes(DebounceRequest *req) {
+    for (int i = 0; i < req->change_count; i++) {
+        free(req->changes[i].text);
+    }
+    req->change_count = 0;
+}
 
-        while (current) {
-            struct timespec now;
-            clock_gettime(CLOCK_MONOTONIC, &now);
+static void debounce_request_free(DebounceRequest *req) {
+    debounce_request_clear_changes(req);
+    free(req->changes);
+    free(req->file_path);
+    free(req->text);
+    free(req);
+}
 
-            long long elapsed_ms = (now.tv_sec - current->last_change_time.tv_sec) * 1000 +
-                                   (now.tv_nsec - current->last_change_time.tv_nsec) / 1000000;
+static cJSON *content_change_to_json(const LspContentChange *change) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON *range = cJSON_CreateObject();
+    cJSON *start = cJSON_CreateObject();
+    cJSON_AddNumberToObject(start, "line", change->start_line);
+    cJSON_AddNumberToObject(start, "character", change->start_character);
+    cJSON *end = cJSON_CreateObject();
+    cJSON_AddNumberToObject(end, "line", change->end_line);
+    cJSON_AddNumberToObject(end, "character", change->end_character);
+    cJSON_AddItemToObject(range, "start", start);
+    cJSON_AddItemToObject(range, "end", end);
+    cJSON_AddItemToObject(json, "range", range);
+    cJSON_AddStringToObject(json, "text", change->text ? change->text : "");
+    return json;
+}
 
-            if (elapsed_ms >= DEBOUNCE_MS) {
-                cJSON *root = cJSON_CreateObject();
-                cJSON_AddStringToObject(root, "jsonrpc", "2.0");
-                cJSON_AddStringToObject(root, "method", "textDocument/didChange");
+static void lsp_send_did_change(LspServer *server, DebounceRequest *req) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "jsonrpc", "2.0");
+    cJSON_AddStringToObject(root, "method", "textDocument/didChange");
 
-                cJSON *params = cJSON_CreateObject();
-                cJSON *text_document = cJSON_CreateObject();
-                char uri[2048];
-                snprintf(uri, sizeof(uri), "file://%s", current->file_path);
-                cJSON_AddStringToObject(text_document, "uri", uri);
-                cJSON_AddNumberToObject(text_document, "version", current->version);
-                cJSON_AddItemToObject(params, "textDocument", text_document);
+    cJSON *params = cJSON_CreateObject();
+    cJSON *text_document = cJSON_CreateObject();
+    char uri[2048];
+    snprintf(uri, sizeof(uri), "file://%s", req->file_path);
+    cJSON_AddStringToObject(text_document, "uri", uri);
+    cJSON_AddNumberToObject(text_document, "version", req->version);
+    cJSON_AddItemToObject(params, "textDocument", text_document);
+
+    cJSON *content_changes = cJSON_CreateArray();
+    if (req->text) {
+        cJSON *change = cJSON_CreateObject();
+        cJSON_AddStringToObject(change, "text", req->text);
+        cJSON_AddItemToArray(content_changes, change);
+    }
+    for (int i = 0; i < req->change_count; i++) {
+        cJSON_AddItemToArray(content_changes, content_change_to_json(&req->changes[i]));
+    }
+    cJSON_AddItemToObject(params, "contentChanges", content_changes);
 
-                cJSON *content_changes = cJSON_CreateArray();
-                cJSON *change = cJSON_CreateObject();
-                cJSON_AddStringToObject(change, "text", current->text);
-                cJSON_AddItemToArray(content_changes, change);
-                cJSON_AddItemToObject(params, "contentChanges", content_changes);
+    cJSON_AddItemToObject(root, "params", params);
 
-                cJSON_AddItemToObject(root, "params", params);
+    // A full text resynchronizes the server after a dropped change.
+    if (lsp_send_message(server, root) && req->text) {
+        atomic_store(&server->outbound_dropped, false);
+    }
+    cJSON_Delete(root);
+}
 
-                lsp_send_message(server, root);
-                cJSON_Delete(root);
+static struct timespec debounce_deadline(const LspServer *server, const DebounceRequest *req) {
+    struct timespec deadline = req->last_change_time;
+    deadline.tv_sec += server->debounce_ms / 1000;
+    deadline.tv_nsec += (long)(server->debounce_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return deadline;
+}
 
-                if (prev) {
-                    prev->next = current->next;
+// One thread serves every server. It sleeps until the earliest pending
+// deadline, or indefinitely when nothing is pending, and is woken by
+// debounce_cond when a document gets its first pending change.
+static void *debouncer_thread_func(void *arg __attribute__((unused))) {
+    PERF_THREAD_NAME("lsp debouncer");
+    pthread_mutex_lock(&debounce_mutex);
+    while (debouncer_running) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        bool sent = false;
+        bool have_next = false;
+        struct timespec next = {0};
+        for (int i = 0; i < lsp_server_count; i++) {
+            LspServer *server = lsp_servers[i];
+            DebounceRequest *due = NULL;
+            DebounceRequest **link = &server->debounce_requests_head;
+            while (*link) {
+                DebounceRequest *current = *link;
+                struct timespec deadline = debounce_deadline(server, current);
+                if (!timespec_before(&now, &deadline)) {
+                    *link = current->next;
+                    current->next = due;
+                    due = current;
                 } else {
-                    server->debounce_requests_head = current->next;
+                    if (!have_next || timespec_before(&deadline, &next)) {
+                        next = deadline;
+                        have_next = true;
+                    }
+                    link = &current->next;
+                }
+            }
+
+            if (due) {
+                // Writing to the server can block; let editing continue meanwhile.
+                pthread_mutex_unlock(&debounce_mutex);
+                while (due) {
+                    DebounceRequest *next_due = due->next;
+                    lsp_send_did_change(server, due);
+                    debounce_request_free(due);
+                    due = next_due;
                 }
-                DebounceRequest *to_free = current;
-                current = current->next;
-
-                free(to_free->file_path);
-                free(to_free->text);
-                free(to_free);
-            } else {
-                prev = current;
-                current = current->next;
+                pthread_mutex_lock(&debounce_mutex);
+                sent = true;
             }
         }
-        pthread_mutex_unlock(&server->debounce_mutex);
+
+        if (sent) {
+            continue; // lists may have changed while unlocked
+        }
+        if (have_next) {
+            pthread_cond_timedwait(&debounce_cond, &debounce_mutex, &next);
+        } else {
+            pthread_cond_wait(&debounce_cond, &debounce_mutex);
+        }
     }
+    pthread_mutex_unlock(&debounce_mutex);
     return NULL;
 }
 
+static void debouncer_start(void) {
+    static bool cond_initialized = false;
+    if (!cond_initialized) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&debounce_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        cond_initialized = true;
+    }
+    if (debouncer_running) {
+        return;
+    }
+    debouncer_running = true;
+    if (pthread_create(&debouncer_thread, NULL, debouncer_thread_func, NULL) != 0) {
+        log_error("lsp.debouncer_start: failed to create debouncer thread");
+        debouncer_running = false;
+    }
+}
+
+static void debouncer_stop(void) {
+    pthread_mutex_lock(&debounce_mutex);
+    bool running = debouncer_running;
+    debouncer_running = false;
+    pthread_cond_signal(&debounce_cond);
+    pthread_mutex_unlock(&debounce_mutex);
+    if (running) {
+        pthread_join(debouncer_thread, NULL);
+    }
+}
+
+static void on_initialize_response(cJSON *result, cJSON *error, void *user_data) {
+  LspServer *server = user_data;
+  log_info("lsp.on_initialize_response: received initialize response");
+  if (error) {
+    log_error("lsp.on_initialize_response: initialize failed");
+    return;
+  }
+  int sync = LSP_SYNC_FULL;
+  cJSON *capabilities = result ? cJSON_GetObjectItem(result, "capabilities") : NULL;
+  cJSON *sync_json = capabilities ? cJSON_GetObjectItem(capabilities, "textDocumentSync") : NULL;
+  if (cJSON_IsObject(sync_json)) {
+    sync_json = cJSON_GetObjectItem(sync_json, "change");
+  }
+  if (cJSON_IsNumber(sync_json)) {
+    sync = sync_json->valueint;
+  }
+  LspPositionEncoding encoding = LSP_POSITION_UTF16;
+  cJSON *encoding_json = capabilities ? cJSON_GetObjectItem(capabilities, "positionEncoding") : NULL;
+  if (cJSON_IsString(encoding_json)) {
+    if (strcmp(encoding_json->valuestring, "utf-32") == 0) {
+      encoding = LSP_POSITION_UTF32;
+    } else if (strcmp(encoding_json->valuestring, "utf-8") == 0) {
+      encoding = LSP_POSITION_UTF8;
+    }
+  }
+  pthread_mutex_lock(&server->init_mutex);
+  server->text_document_sync = sync;
+  server->position_encoding = encoding;
+  server->initialized = true;
+  pthread_cond_signal(&server->init_cond);
+  pthread_mutex_unlock(&server->init_mutex);
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddStringToObject(root, "jsonrpc", "2.0");
+  cJSON_AddStringToObject(root, "method", "initialized");
+  cJSON_AddItemToObject(root, "params", cJSON_CreateObject());
+  lsp_send_message(server, root);
+  cJSON_Delete(root);
+}
+
 void lsp_init(const Config *config, const char *file_name) {
   const char *lang_name = str_get_lang_name_from_file_name(file_name);
   if (!lang_name || get_server(lang_name) != NULL) {
@@ -439,18 +1362,36 @@ void lsp_init(const Config *config, const char *file_name) {
 
   strncpy(server->lang_name, lang_name, sizeof(server->lang_name) - 1);
   server->lang_name[sizeof(server->lang_name) - 1] = '\0';
-  server->diagnostics = NULL;
-  server->diagnostic_count = 0;
-  server->diagnostics_version = 0;
+  server->diagnostic_sets = NULL;
+  server->diagnostic_set_count = 0;
+  server->diagnostic_set_capacity = 0;
   pthread_mutex_init(&server->diagnostics_mutex, NULL);
   pthread_mutex_init(&server->init_mutex, NULL);
   pthread_cond_init(&server->init_cond, NULL);
-  server->buffer_pos = 0;
-  server->next_id = 1;
+  lsp_reader_init(&server->reader);
+  server->pending_requests = NULL;
+  pthread_mutex_init(&server->requests_mutex, NULL);
   server->initialized = false;
+  server->text_document_sync = LSP_SYNC_FULL;
+  server->position_encoding = LSP_POSITION_UTF16;
   server->debounce_requests_head = NULL;
-  pthread_mutex_init(&server->debounce_mutex, NULL);
-  server->debouncer_thread_running = false;
+  server->debounce_ms = DEBOUNCE_MS;
+  server->outbound_head = NULL;
+  server->outbound_tail = NULL;
+  server->outbound_bytes = 0;
+  server->writer_stopping = false;
+  server->writer_failed = false;
+  server->writer_exited = false;
+  atomic_init(&server->outbound_dropped, false);
+  pthread_mutex_init(&server->outbound_mutex, NULL);
+  pthread_cond_init(&server->outbound_cond, NULL);
+  if (config->toml_result.ok) {
+    snprintf(key, sizeof(key), "lsp.debounce.%s", lang_name);
+    toml_datum_t debounce_datum = toml_seek(config->toml_result.toptab, key);
+    if (debounce_datum.type == TOML_INT64 && debounce_datum.u.int64 >= 0) {
+      server->debounce_ms = (int)debounce_datum.u.int64;
+    }
+  }
 
   if (pipe(server->to_server_pipe) == -1 ||
       pipe(server->from_server_pipe) == -1) {
@@ -504,12 +1445,15 @@ void lsp_init(const Config *config, const char *file_name) {
     close(server->from_server_pipe[1]);
     log_info("LSP server for %s started with PID %d", server->lang_name, server->pid);
 
-    lsp_servers[lsp_server_count++] = server;
+    if (pthread_create(&server->writer_thread, NULL, lsp_writer_thread_func, server) != 0) {
+      log_error("lsp_init: failed to create writer thread");
+      exit(1);
+    }
 
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "jsonrpc", "2.0");
-    cJSON_AddNumberToObject(root, "id", server->next_id++);
-    cJSON_AddStringToObject(root, "method", "initialize");
+    pthread_mutex_lock(&debounce_mutex);
+    lsp_servers[lsp_server_count++] = server;
+    debouncer_start();
+    pthread_mutex_unlock(&debounce_mutex);
 
     cJSON *params = cJSON_CreateObject();
     cJSON_AddNumberToObject(params, "processId", getpid());
@@ -546,18 +1490,23 @@ void lsp_init(const Config *config, const char *file_name) {
     cJSON *workspace = cJSON_CreateObject();
     cJSON_AddBoolToObject(workspace, "workspaceFolders", true);
     cJSON_AddItemToObject(capabilities, "workspace", workspace);
+
+    // Columns are codepoints in the buffer, so utf-32 needs no conversion
+    // and utf-8 only a walk over bytes; utf-16 stays the fallback.
+    cJSON *general = cJSON_CreateObject();
+    cJSON *encodings = cJSON_CreateArray();
+    cJSON_AddItemToArray(encodings, cJSON_CreateString("utf-32"));
+    cJSON_AddItemToArray(encodings, cJSON_CreateString("utf-8"));
+    cJSON_AddItemToArray(encodings, cJSON_CreateString("utf-16"));
+    cJSON_AddItemToObject(general, "positionEncodings", encodings);
+    cJSON_AddItemToObject(capabilities, "general", general);
     cJSON_AddItemToObject(params, "capabilities", capabilities);
-    cJSON_AddItemToObject(root, "params", params);
 
-    lsp_send_message(server, root);
-    cJSON_Delete(root);
+    lsp_send_request(server, "initialize", params, 0, false, true, on_initialize_response, server);
 
     if (pthread_create(&server->reader_thread, NULL, lsp_reader_thread_func, server) != 0) {
       log_error("lsp_init: failed to create reader thread");
     }
-    if (pthread_create(&server->debouncer_thread, NULL, debouncer_thread_func, server) != 0) {
-        log_error("lsp_init: failed to create debouncer thread");
-    }
   }
 }
 
@@ -598,16 +1547,17 @@ void lsp_did_change(const char *file_path, const char *text, int version) {
         return;
     }
 
-    pthread_mutex_lock(&server->debounce_mutex);
+    pthread_mutex_lock(&debounce_mutex);
 
     DebounceRequest *req = server->debounce_requests_head;
     while (req) {
         if (strcmp(req->file_path, file_path) == 0) {
             free(req->text);
             req->text = strdup(text);
+            debounce_request_clear_changes(req);
             req->version = version;
             clock_gettime(CLOCK_MONOTONIC, &req->last_change_time);
-            pthread_mutex_unlock(&server->debounce_mutex);
+            pthread_mutex_unlock(&debounce_mutex);
             return;
         }
         req = req->next;
@@ -616,47 +1566,154 @@ void lsp_did_change(const char *file_path, const char *text, int version) {
     DebounceRequest *new_req = malloc(sizeof(DebounceRequest));
     if (!new_req) {
         log_error("lsp_did_change: malloc failed");
-        pthread_mutex_unlock(&server->debounce_mutex);
+        pthread_mutex_unlock(&debounce_mutex);
         return;
     }
     new_req->file_path = strdup(file_path);
     new_req->text = strdup(text);
+    new_req->changes = NULL;
+    new_req->change_count = 0;
+    new_req->change_capacity = 0;
     new_req->version = version;
     clock_gettime(CLOCK_MONOTONIC, &new_req->last_change_time);
     new_req->next = server->debounce_requests_head;
     server->debounce_requests_head = new_req;
+    pthread_cond_signal(&debounce_cond);
+
+    pthread_mutex_unlock(&debounce_mutex);
+}
+
+static int text_length(const char *text, LspPositionEncoding encoding) {
+    if (encoding == LSP_POSITION_UTF8) {
+        return (int)strlen(text);
+    }
+    int units = 0;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if ((*p & 0xC0) != 0x80) {
+            units += *p >= 0xF0 && encoding == LSP_POSITION_UTF16 ? 2 : 1;
+        }
+    }
+    return units;
+}
 
-    pthread_mutex_unlock(&server->debounce_mutex);
+// Typing produces one insertion per key; fold an insertion that continues the
+// previous one on the same line into it so a burst becomes a single change.
+static bool debounce_request_coalesce(DebounceRequest *req, const LspContentChange *change,
+                                      LspPositionEncoding encoding) {
+    if (req->change_count == 0) return false;
+    LspContentChange *last = &req->changes[req->change_count - 1];
+    if (last->start_line != last->end_line || last->start_character != last->end_character) return false;
+    if (change->start_line != change->end_line || change->start_character != change->end_character) return false;
+    if (!last->text || strchr(last->text, '\n')) return false;
+    if (change->start_line != last->start_line ||
+        change->start_character != last->start_character + text_length(last->text, encoding)) {
+        return false;
+    }
+
+    size_t old_len = strlen(last->text);
+    size_t add_len = strlen(change->text);
+    char *text = realloc(last->text, old_len + add_len + 1);
+    if (!text) {
+        log_error("lsp.debounce_request_coalesce: realloc failed");
+        exit(1);
+    }
+    memcpy(text + old_len, change->text, add_len + 1);
+    last->text = text;
+    return true;
+}
+
+bool lsp_did_change_incremental(const char *file_path, const LspContentChange *changes,
+                                int change_count, int version) {
+    const char *lang_name = str_get_lang_name_from_file_name(file_path);
+    LspServer *server = get_server(lang_name);
+    if (!server)
+        return true;
+
+    if (!lsp_wait_for_initialization(server)) {
+        return true;
+    }
+    if (server->text_document_sync != LSP_SYNC_INCREMENTAL || atomic_load(&server->outbound_dropped)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&debounce_mutex);
+
+    DebounceRequest *req = server->debounce_requests_head;
+    while (req && strcmp(req->file_path, file_path) != 0) {
+        req = req->next;
+    }
+    if (!req && change_count == 0) {
+        pthread_mutex_unlock(&debounce_mutex);
+        return true;
+    }
+    if (req && req->change_count + change_count > MAX_PENDING_CHANGES) {
+        pthread_mutex_unlock(&debounce_mutex);
+        return false;
+    }
+    if (!req) {
+        req = calloc(1, sizeof(DebounceRequest));
+        if (!req) {
+            log_error("lsp_did_change_incremental: calloc failed");
+            exit(1);
+        }
+        req->file_path = strdup(file_path);
+        req->next = server->debounce_requests_head;
+        server->debounce_requests_head = req;
+        pthread_cond_signal(&debounce_cond);
+    }
+
+    for (int i = 0; i < change_count; i++) {
+        const LspContentChange *change = &changes[i];
+        if (debounce_request_coalesce(req, change, server->position_encoding)) {
+            continue;
+        }
+        if (req->change_count == req->change_capacity) {
+            int capacity = req->change_capacity ? req->change_capacity * 2 : 16;
+            LspContentChange *grown = realloc(req->changes, sizeof(LspContentChange) * capacity);
+            if (!grown) {
+                log_error("lsp_did_change_incremental: realloc failed");
+                exit(1);
+            }
+            req->changes = grown;
+            req->change_capacity = capacity;
+        }
+        LspContentChange *copy = &req->changes[req->change_count++];
+        *copy = *change;
+        copy->text = strdup(change->text ? change->text : "");
+    }
+    req->version = version;
+    clock_gettime(CLOCK_MONOTONIC, &req->last_change_time);
+
+    pthread_mutex_unlock(&debounce_mutex);
+    return true;
 }
 
 static void lsp_shutdown(LspServer *server) {
   if (server && server->pid > 0) {
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "jsonrpc", "2.0");
-    cJSON_AddNumberToObject(root, "id", server->next_id++);
-    cJSON_AddStringToObject(root, "method", "shutdown");
-    lsp_send_message(server, root);
-    cJSON_Delete(root);
+    lsp_send_request(server, "shutdown", NULL, 0, false, true, NULL, NULL);
 
-    root = cJSON_CreateObject();
+    cJSON *root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "jsonrpc", "2.0");
     cJSON_AddStringToObject(root, "method", "exit");
     lsp_send_message(server, root);
     cJSON_Delete(root);
+    lsp_writer_stop(server);
 
     pthread_join(server->reader_thread, NULL);
 
-    if (server->debouncer_thread_running) {
-        server->debouncer_thread_running = false;
-        pthread_join(server->debouncer_thread, NULL);
+    // Nothing will answer these now.
+    LspPendingRequest *pending = server->pending_requests;
+    server->pending_requests = NULL;
+    while (pending) {
+        LspPendingRequest *next = pending->next;
+        lsp_complete(pending, lsp_error_response(LSP_ERROR_REQUEST_CANCELLED, "server shut down"));
+        pending = next;
     }
 
     DebounceRequest *req = server->debounce_requests_head;
     while (req) {
         DebounceRequest *next = req->next;
-        free(req->file_path);
-        free(req->text);
-        free(req);
+        debounce_request_free(req);
         req = next;
     }
 
@@ -666,103 +1723,92 @@ static void lsp_shutdown(LspServer *server) {
     close(server->from_server_pipe[0]);
     log_info("LSP server for %s shut down", server->lang_name);
 
-    for (int i = 0; i < server->diagnostic_count; i++) {
-      free(server->diagnostics[i].message);
+    for (int i = 0; i < server->diagnostic_set_capacity; i++) {
+      DiagnosticSet *set = server->diagnostic_sets[i];
+      if (set) {
+        diagnostic_totals_adjust(set, -1);
+        lsp_diagnostics_release(set);
+      }
     }
-    free(server->diagnostics);
+    free(server->diagnostic_sets);
+    lsp_reader_destroy(&server->reader);
     pthread_mutex_destroy(&server->diagnostics_mutex);
+    pthread_mutex_destroy(&server->requests_mutex);
+    pthread_mutex_destroy(&server->outbound_mutex);
+    pthread_cond_destroy(&server->outbound_cond);
     pthread_mutex_destroy(&server->init_mutex);
     pthread_cond_destroy(&server->init_cond);
-    pthread_mutex_destroy(&server->debounce_mutex);
     free(server);
   }
 }
 
 void lsp_shutdown_all(void) {
+  debouncer_stop();
   for (int i = 0; i < lsp_server_count; i++) {
     lsp_shutdown(lsp_servers[i]);
     lsp_servers[i] = NULL;
   }
   lsp_server_count = 0;
+  lsp_dispatch_responses();
 }
 
-int __attribute__((weak)) lsp_get_diagnostics(const char *file_path, Diagnostic **out_diagnostics, int *out_diagnostic_count) {
-  char *project_root = find_project_root(file_path);
-  if (!project_root) {
-    *out_diagnostic_count = 0;
-    *out_diagnostics = NULL;
-    return 0;
-  }
-  char root_uri[1024 + 7];
-  snprintf(root_uri, sizeof(root_uri), "file://%s/%s", project_root, file_path);
-
-  const char *lang_name = str_get_lang_name_from_file_name(file_path);
-  LspServer *server = get_server(lang_name);
-  if (!server) {
-    *out_diagnostic_count = 0;
-    *out_diagnostics = NULL;
-    return 0;
-  }
-
-  pthread_mutex_lock(&server->diagnostics_mutex);
-  *out_diagnostic_count = 0;
-  if (server->diagnostic_count > 0) {
-    *out_diagnostics = malloc(sizeof(Diagnostic) * server->diagnostic_count);
-    if (*out_diagnostics) {
-      for (int i = 0; i < server->diagnostic_count; i++) {
-        if (strcmp(server->diagnostics[i].uri, root_uri)) continue;
-        (*out_diagnostics)[*out_diagnostic_count] = server->diagnostics[i];
-        (*out_diagnostics)[*out_diagnostic_count].message = strdup(server->diagnostics[i].message);
-        (*out_diagnostic_count)++;
-      }
-    } else {
-      *out_diagnostic_count = 0;
-      *out_diagnostics = NULL;
-    }
-  } else {
-    *out_diagnostics = NULL;
+static Diagnostic *diagnostics_copy(const DiagnosticSet *set, Diagnostic *out) {
+  for (int i = 0; i < set->count; i++) {
+    *out = set->items[i];
+    out->message = strdup(set->items[i].message);
+    out->uri = strdup(set->path);
+    out++;
   }
-  int version = server->diagnostics_version;
-  pthread_mutex_unlock(&server->diagnostics_mutex);
-  return version;
+  return out;
 }
 
 int lsp_get_all_diagnostics(Diagnostic **out_diagnostics) {
+  int totals[LSP_DIAGNOSTIC_SEVERITY_COUNT];
+  lsp_diagnostic_totals(totals);
   int total_diagnostics = 0;
-  for (int i = 0; i < lsp_server_count; i++) {
-    LspServer *server = lsp_servers[i];
-    pthread_mutex_lock(&server->diagnostics_mutex);
-    total_diagnostics += server->diagnostic_count;
-    pthread_mutex_unlock(&server->diagnostics_mutex);
+  for (int i = 0; i < LSP_DIAGNOSTIC_SEVERITY_COUNT; i++) {
+    total_diagnostics += totals[i];
   }
 
+  *out_diagnostics = NULL;
   if (total_diagnostics == 0) {
-    *out_diagnostics = NULL;
     return 0;
   }
-
   *out_diagnostics = malloc(sizeof(Diagnostic) * total_diagnostics);
   if (!*out_diagnostics) {
     return 0;
   }
 
-  int current_diagnostic = 0;
+  // Totals may move while copying; stay within the allocation.
+  Diagnostic *out = *out_diagnostics;
+  Diagnostic *out_end = out + total_diagnostics;
   for (int i = 0; i < lsp_server_count; i++) {
     LspServer *server = lsp_servers[i];
     pthread_mutex_lock(&server->diagnostics_mutex);
-    for (int j = 0; j < server->diagnostic_count; j++) {
-      (*out_diagnostics)[current_diagnostic] = server->diagnostics[j];
-      (*out_diagnostics)[current_diagnostic].message = strdup(server->diagnostics[j].message);
-      (*out_diagnostics)[current_diagnostic].uri = strdup(server->diagnostics[j].uri);
-      current_diagnostic++;
+    for (int j = 0; j < server->diagnostic_set_capacity; j++) {
+      DiagnosticSet *set = server->diagnostic_sets[j];
+      if (set && set->count <= out_end - out) {
+        out = diagnostics_copy(set, out);
+      }
     }
     pthread_mutex_unlock(&server->diagnostics_mutex);
   }
 
-  return total_diagnostics;
+  return out - *out_diagnostics;
 }
 
 bool lsp_is_running(const char *language_id) {
   return get_server(language_id) != NULL;
 }
 
+LspPositionEncoding lsp_position_encoding(const char *lang_name) {
+  LspServer *server = get_server(lang_name);
+  if (!server) {
+    return LSP_POSITION_UTF16;
+  }
+  pthread_mutex_lock(&server->init_mutex);
+  LspPositionEncoding encoding = server->initialized ? server->position_encoding : LSP_POSITION_UTF16;
+  pthread_mutex_unlock(&server->init_mutex);
+  return encoding;
+}
+
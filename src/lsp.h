@@ -5,15 +5,57 @@
 #include <stdbool.h>
 #include <pthread.h>
 #include <time.h>
+#include <stdatomic.h>
+
+// Units of the character offsets in positions, agreed in initialize.
+typedef enum {
+  LSP_POSITION_UTF16, // the protocol default
+  LSP_POSITION_UTF8,
+  LSP_POSITION_UTF32,
+} LspPositionEncoding;
+
+// A textDocument/didChange content change. Positions are zero-based lines
+// and characters in the server's LspPositionEncoding; text replaces the
+// range and may be empty.
+typedef struct LspContentChange {
+  int start_line;
+  int start_character;
+  int end_line;
+  int end_character;
+  char *text;
+} LspContentChange;
 
 typedef struct DebounceRequest {
   char *file_path;
-  char *text;
+  char *text; // full document, sent before any changes; NULL if incremental
+  LspContentChange *changes;
+  int change_count;
+  int change_capacity;
   int version;
   struct timespec last_change_time;
   struct DebounceRequest *next;
 } DebounceRequest;
 
+struct cJSON;
+
+#define LSP_ERROR_METHOD_NOT_FOUND -32601
+#define LSP_ERROR_REQUEST_CANCELLED -32800
+#define LSP_ERROR_TIMED_OUT -32001 // client side, never sent by servers
+
+// Runs exactly once per request, with either the result or an error object
+// (server error, cancellation or timeout). Both are freed after it returns.
+typedef void (*LspResponseCallback)(struct cJSON *result, struct cJSON *error, void *user_data);
+
+typedef struct LspPendingRequest {
+  int id;
+  char method[64];
+  struct timespec deadline;
+  LspResponseCallback callback;
+  void *user_data;
+  bool on_reader_thread; // internal requests answered before the editor runs
+  struct LspPendingRequest *next;
+} LspPendingRequest;
+
 typedef enum {
   LSP_DIAGNOSTIC_SEVERITY_ERROR = 1,
   LSP_DIAGNOSTIC_SEVERITY_WARNING = 2,
@@ -21,7 +63,7 @@ typedef enum {
   LSP_DIAGNOSTIC_SEVERITY_HINT = 4
 } DiagnosticSeverity;
 
-typedef struct {
+typedef struct Diagnostic {
   int line;
   int col_start;
   int col_end;
@@ -30,39 +72,115 @@ typedef struct {
   char *uri;
 } Diagnostic;
 
+#define LSP_DIAGNOSTIC_SEVERITY_COUNT (LSP_DIAGNOSTIC_SEVERITY_HINT + 1)
+
+// The diagnostics of one document as of one publishDiagnostics. A set is
+// never modified after it is published; readers hold a reference while they
+// use it. Items point into the set for their message and uri.
+typedef struct DiagnosticSet {
+  atomic_int refcount;
+  char *path; // document path, without the file:// scheme
+  int version;
+  int document_version; // params.version, or -1 when the server omits it
+  LspPositionEncoding position_encoding; // units of the item columns
+  int count;
+  int severity_counts[LSP_DIAGNOSTIC_SEVERITY_COUNT];
+  Diagnostic items[];
+} DiagnosticSet;
+
+// Buffered reader for Content-Length framed JSON-RPC messages. The buffer
+// grows to fit the largest message seen and bodies are parsed in place.
+typedef struct {
+  char *data;
+  size_t capacity;
+  size_t start; // first unconsumed byte
+  size_t end;   // one past the last byte read
+} LspReader;
+
 typedef struct {
   char lang_name[64];
   pid_t pid;
   int to_server_pipe[2];
   int from_server_pipe[2];
   pthread_t reader_thread;
-  Diagnostic *diagnostics;
-  int diagnostic_count;
-  int diagnostics_version;
+  // Open-addressed by path; entries stay once a document has been published.
+  DiagnosticSet **diagnostic_sets;
+  int diagnostic_set_count;
+  int diagnostic_set_capacity;
   pthread_mutex_t diagnostics_mutex;
   pthread_mutex_t init_mutex;
   pthread_cond_t init_cond;
-  char read_buffer[16384];
-  int buffer_pos;
-  int next_id;
+  LspReader reader;
+  LspPendingRequest *pending_requests;
+  pthread_mutex_t requests_mutex;
   bool initialized;
+  int text_document_sync; // TextDocumentSyncKind from the initialize result
+  LspPositionEncoding position_encoding;
 
   struct DebounceRequest *debounce_requests_head;
-  pthread_mutex_t debounce_mutex;
-  pthread_t debouncer_thread;
-  bool debouncer_thread_running;
+  int debounce_ms; // [lsp.debounce] <lang> = ms, default 100
+
+  // Outgoing messages, written by writer_thread so a server that stops
+  // reading never blocks the caller. Bounded by LSP_OUTBOUND_LIMIT bytes.
+  struct LspOutboundMessage *outbound_head;
+  struct LspOutboundMessage *outbound_tail;
+  size_t outbound_bytes;
+  bool writer_stopping;
+  bool writer_failed;
+  bool writer_exited; // signalled on outbound_cond for lsp_writer_stop
+  atomic_bool outbound_dropped; // a message was dropped; next didChange sends full text
+  pthread_mutex_t outbound_mutex;
+  pthread_cond_t outbound_cond;
+  pthread_t writer_thread;
 } LspServer;
 
 void lsp_init(const Config *config, const char *file_name);
 void lsp_shutdown_all(void);
-int lsp_get_diagnostics(const char *file_path, Diagnostic **diagnostics,
-                        int *diagnostic_count);
 void lsp_did_open(const char *file_path, const char *language_id,
                   const char *text);
 void lsp_did_change(const char *file_path, const char *text, int version);
+// The encoding the language's server uses for columns; UTF-16 when there is
+// no server or it hasn't finished initializing.
+LspPositionEncoding lsp_position_encoding(const char *lang_name);
+// Queues range changes for the next didChange. Returns false if the server
+// only accepts full syncs or too many changes are pending; the caller should
+// send the whole document with lsp_did_change instead.
+bool lsp_did_change_incremental(const char *file_path, const LspContentChange *changes,
+                                int change_count, int version);
 int lsp_get_all_diagnostics(Diagnostic **diagnostics);
+// Returns the current diagnostics for an absolute path with a reference
+// held, or NULL if there are none. Doesn't allocate.
+DiagnosticSet *lsp_diagnostics_acquire(const char *absolute_path);
+void lsp_diagnostics_release(DiagnosticSet *set);
+// Workspace-wide counts indexed by DiagnosticSeverity.
+void lsp_diagnostic_totals(int totals[LSP_DIAGNOSTIC_SEVERITY_COUNT]);
 bool lsp_is_running(const char *language_id);
+
+// Sends a request and returns its id, or 0 if no server runs for lang_name.
+// params is consumed. The callback runs on the editor thread from
+// lsp_dispatch_responses. With supersede, a pending request for the same
+// method is cancelled first, as a newer hover replaces an older one.
+int lsp_request(const char *lang_name, const char *method, struct cJSON *params,
+                int timeout_ms, bool supersede, LspResponseCallback callback, void *user_data);
+// Sends $/cancelRequest; the callback gets LSP_ERROR_REQUEST_CANCELLED.
+void lsp_cancel_request(int id);
+// Runs callbacks for answered, cancelled and timed out requests. Called from
+// the render loop with the editor lock held.
+void lsp_dispatch_responses(void);
 char *find_project_root(const char *file_path);
 
+void lsp_reader_init(LspReader *reader);
+void lsp_reader_destroy(LspReader *reader);
+// Blocks until a whole message has been read from fd and points body at it.
+// The body is not NUL-terminated and stays valid until the next call.
+// Returns false on end of stream, read error or a malformed header.
+bool lsp_reader_next_raw(LspReader *reader, int fd, const char **body, size_t *len);
+// lsp_reader_next_raw, parsed; also NULL for a malformed body.
+struct cJSON *lsp_reader_next(LspReader *reader, int fd);
+// Decodes a publishDiagnostics notification straight from its text into a
+// single-allocation set. Returns NULL for any other message, or anything the
+// scanner doesn't understand, so the caller can fall back to cJSON.
+DiagnosticSet *lsp_parse_publish_diagnostics(const char *body, size_t len);
+
 #endif // LSP_H
 
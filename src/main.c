@@ -1,5 +1,9 @@
 #include "editor.h"
 #include "lsp.h"
+#include "git.h"
+#include "git_blame.h"
+#include "perf.h"
+#include "benchmark.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
@@ -7,20 +11,35 @@
 int main(int argc, char *argv[]) {
     char *filename = NULL;
     bool benchmark_mode = false;
+    const char *benchmark_script = NULL;
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--version") == 0) {
             printf("arc %s\n", EDITOR_VERSION);
             return 0;
         } else if (strcmp(argv[i], "--benchmark") == 0) {
             benchmark_mode = true;
+        } else if (strncmp(argv[i], "--benchmark=", 12) == 0) {
+            benchmark_mode = true;
+            benchmark_script = argv[i] + 12;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            perf_trace_enable(argv[++i]);
         } else if (filename == NULL) {
             filename = argv[i];
         } else {
-            fprintf(stderr, "Usage: arc [--version] [--benchmark] [filename]\n");
+            fprintf(stderr, "Usage: arc [--version] [--benchmark[=SCRIPT]] [--trace out.json] [filename]\n");
             return 1;
         }
     }
-    editor_start(filename, benchmark_mode);
+    PERF_THREAD_NAME("main");
+    int status = 0;
+    if (benchmark_mode) {
+        status = benchmark_run(filename, benchmark_script);
+    } else {
+        editor_start(filename);
+    }
     lsp_shutdown_all();
-    return 0;
+    git_blame_shutdown();
+    git_shutdown();
+    perf_trace_write();
+    return status;
 }
@@ -9,6 +9,9 @@
 #include "picker_buffer.h"
 #include "picker_search.h"
 #include "picker_diagnostics.h"
+#include "picker_memstats.h"
+#include "picker_git_status.h"
+#include "git_blame.h"
 #include "visual.h"
 #include "utf8.h"
 
@@ -236,6 +239,15 @@ int normal_handle_input(const char *ch_str) {
       case 'b':
         picker_buffer_show();
         break;
+      case 'g':
+        picker_git_status_show();
+        break;
+      case 'B':
+        git_blame_toggle();
+        break;
+      case 'm':
+        picker_memstats_show();
+        break;
       case 'c':
         if (editor_get_active_buffer()->dirty) {
         } else {
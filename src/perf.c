@@ -1,26 +1,339 @@
-#define _POSIX_C_SOURCE 199309L
+#define _GNU_SOURCE
 
 #include <time.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include "perf.h"
 #include "log.h"
 
-struct timespec ts;
-const char *curr_name = NULL;
+#define PERF_RING_SIZE 65536 // must be a power of two
+#define PERF_MAX_DEPTH 64
+#define PERF_MAX_COUNTED_SPANS 64
 
-void perf_start(const char *name) {
-    curr_name = name;
+typedef struct {
+    const char *name;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} PerfEvent;
+
+// Single producer (the owning thread), read once by perf_trace_write. When the
+// ring wraps the oldest spans are overwritten.
+typedef struct PerfRing {
+    PerfEvent events[PERF_RING_SIZE];
+    _Atomic uint64_t head;
+    int tid;
+    const char *thread_name;
+    struct PerfRing *next;
+} PerfRing;
+
+typedef struct {
+    const char *name;
+    uint64_t start_ns;
+    bool counting;
+    uint64_t counters[PERF_COUNTER_COUNT];
+} PerfFrame;
+
+typedef struct {
+    const char *name;
+    PerfCounters totals;
+} PerfCountedSpan;
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counter_events[PERF_COUNTER_COUNT] = {
+    [PERF_COUNTER_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_COUNTER_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_COUNTER_CACHE_MISSES] = { "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_COUNTER_BRANCH_MISSES] = { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_COUNTER_PAGE_FAULTS] = { "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static atomic_bool enabled = false;
+static char *trace_path = NULL;
+static uint64_t epoch_ns = 0;
+static _Atomic(PerfRing *) rings = NULL;
+static atomic_int next_tid = 1;
+
+static _Thread_local PerfRing *thread_ring = NULL;
+static _Thread_local const char *thread_name = NULL;
+static _Thread_local PerfFrame stack[PERF_MAX_DEPTH];
+static _Thread_local int depth = 0;
+
+// Counter group of the calling thread. The page fault counter leads the group
+// because software events open everywhere; hardware counters join if they can.
+static _Thread_local int counter_leader_fd = -1;
+static _Thread_local int counter_fds[PERF_COUNTER_COUNT] = { -1, -1, -1, -1, -1 };
+static _Thread_local int counter_slots[PERF_COUNTER_COUNT];
+static _Thread_local int counter_slot_count = 0;
+static _Thread_local PerfCountedSpan counted_spans[PERF_MAX_COUNTED_SPANS];
+static _Thread_local int counted_span_count = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static PerfRing *get_thread_ring(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+    PerfRing *ring = calloc(1, sizeof(PerfRing));
+    if (!ring) {
+        log_error("perf.get_thread_ring: calloc failed");
+        return NULL;
+    }
+    ring->tid = atomic_fetch_add(&next_tid, 1);
+    ring->thread_name = thread_name;
+    PerfRing *head = atomic_load(&rings);
+    do {
+        ring->next = head;
+    } while (!atomic_compare_exchange_weak(&rings, &head, ring));
+    thread_ring = ring;
+    return ring;
+}
+
+void perf_trace_enable(const char *output_path) {
+    free(trace_path);
+    trace_path = strdup(output_path);
+    epoch_ns = now_ns();
+    atomic_store(&enabled, true);
+}
+
+bool perf_trace_enabled(void) {
+    return atomic_load_explicit(&enabled, memory_order_relaxed);
 }
 
-void perf_end() {
-    if (curr_name == NULL) {
-        log_error("perf.perf_end: curr_name is NULL");
-        exit(1);
+void perf_set_thread_name(const char *name) {
+    thread_name = name;
+    if (thread_ring) {
+        thread_ring->thread_name = name;
     }
-    struct timespec end;
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    long elapsed_ns = (end.tv_sec - ts.tv_sec) * 1000000000L + (end.tv_nsec - ts.tv_nsec);
-    log_info("perf.perf_end: %s: %.3f μs", curr_name, elapsed_ns / 1000.0);
 }
 
+static int open_counter(PerfCounter counter, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[counter].type;
+    attr.config = counter_events[counter].config;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+bool perf_counters_open(const char **reason) {
+    if (counter_leader_fd != -1) {
+        return true;
+    }
+    counter_leader_fd = open_counter(PERF_COUNTER_PAGE_FAULTS, -1);
+    if (counter_leader_fd == -1) {
+        if (reason) {
+            *reason = errno == EACCES || errno == EPERM
+                ? "perf_event_open not permitted (see /proc/sys/kernel/perf_event_paranoid)"
+                : errno == ENOSYS ? "perf_event_open not supported by this kernel"
+                : "perf_event_open failed";
+        }
+        log_warning("perf.perf_counters_open: perf_event_open failed: %s", strerror(errno));
+        return false;
+    }
+    counter_fds[PERF_COUNTER_PAGE_FAULTS] = counter_leader_fd;
+    counter_slots[PERF_COUNTER_PAGE_FAULTS] = 0;
+    counter_slot_count = 1;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (i == PERF_COUNTER_PAGE_FAULTS) {
+            continue;
+        }
+        counter_fds[i] = open_counter(i, counter_leader_fd);
+        if (counter_fds[i] == -1) {
+            log_warning("perf.perf_counters_open: %s unavailable: %s", counter_events[i].name, strerror(errno));
+            continue;
+        }
+        counter_slots[i] = counter_slot_count++;
+    }
+    ioctl(counter_leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counter_leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void perf_counters_close(void) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counter_fds[i] != -1) {
+            close(counter_fds[i]);
+            counter_fds[i] = -1;
+        }
+    }
+    counter_leader_fd = -1;
+    counter_slot_count = 0;
+    counted_span_count = 0;
+}
+
+bool perf_counter_available(PerfCounter counter) {
+    return counter_fds[counter] != -1;
+}
+
+const char *perf_counter_name(PerfCounter counter) {
+    return counter_events[counter].name;
+}
+
+void perf_counters_get(const char *name, PerfCounters *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < counted_span_count; i++) {
+        if (strcmp(counted_spans[i].name, name) == 0) {
+            *out = counted_spans[i].totals;
+            return;
+        }
+    }
+}
+
+// Reads the group and scales each value if the kernel had to multiplex it.
+static bool read_counters(uint64_t values[PERF_COUNTER_COUNT]) {
+    uint64_t data[3 + PERF_COUNTER_COUNT];
+    if (read(counter_leader_fd, data, sizeof(data)) < (ssize_t)(sizeof(uint64_t) * 3)) {
+        return false;
+    }
+    uint64_t enabled_ns = data[1];
+    uint64_t running_ns = data[2];
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (counter_fds[i] == -1) {
+            values[i] = 0;
+            continue;
+        }
+        uint64_t value = data[3 + counter_slots[i]];
+        if (running_ns && running_ns < enabled_ns) {
+            value = (uint64_t)((double)value * enabled_ns / running_ns);
+        }
+        values[i] = value;
+    }
+    return true;
+}
+
+static void add_counted_span(const char *name, const uint64_t start[PERF_COUNTER_COUNT]) {
+    uint64_t end[PERF_COUNTER_COUNT];
+    if (!read_counters(end)) {
+        return;
+    }
+    PerfCountedSpan *span = NULL;
+    for (int i = 0; i < counted_span_count; i++) {
+        if (counted_spans[i].name == name || strcmp(counted_spans[i].name, name) == 0) {
+            span = &counted_spans[i];
+            break;
+        }
+    }
+    if (!span) {
+        if (counted_span_count == PERF_MAX_COUNTED_SPANS) {
+            return;
+        }
+        span = &counted_spans[counted_span_count++];
+        memset(span, 0, sizeof(*span));
+        span->name = name;
+    }
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        span->totals.values[i] += end[i] - start[i];
+    }
+    span->totals.calls++;
+}
+
+void perf_start(const char *name) {
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed) && counter_leader_fd == -1) {
+        return;
+    }
+    if (depth < PERF_MAX_DEPTH) {
+        stack[depth].name = name;
+        stack[depth].start_ns = now_ns();
+        stack[depth].counting = counter_leader_fd != -1 && read_counters(stack[depth].counters);
+    }
+    depth++;
+}
+
+void perf_end(void) {
+    if (depth == 0) {
+        return;
+    }
+    depth--;
+    if (depth >= PERF_MAX_DEPTH) {
+        return;
+    }
+    if (stack[depth].counting && counter_leader_fd != -1) {
+        add_counted_span(stack[depth].name, stack[depth].counters);
+    }
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) {
+        return;
+    }
+    PerfRing *ring = get_thread_ring();
+    if (!ring) {
+        return;
+    }
+    uint64_t end_ns = now_ns();
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    PerfEvent *event = &ring->events[head & (PERF_RING_SIZE - 1)];
+    event->name = stack[depth].name;
+    event->start_ns = stack[depth].start_ns;
+    event->duration_ns = end_ns - stack[depth].start_ns;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void write_json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', fp);
+        }
+        if ((unsigned char)*s >= 0x20) {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+void perf_trace_write(void) {
+    if (!atomic_exchange(&enabled, false) || !trace_path) {
+        return;
+    }
+
+    FILE *fp = fopen(trace_path, "w");
+    if (!fp) {
+        log_error("perf.perf_trace_write: unable to open %s", trace_path);
+        return;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    int first = 1;
+    long event_count = 0;
+    for (PerfRing *ring = atomic_load(&rings); ring; ring = ring->next) {
+        if (ring->thread_name) {
+            fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", ring->tid);
+            write_json_string(fp, ring->thread_name);
+            fprintf(fp, "}}");
+            first = 0;
+        }
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t start = head > PERF_RING_SIZE ? head - PERF_RING_SIZE : 0;
+        for (uint64_t i = start; i < head; i++) {
+            PerfEvent *event = &ring->events[i & (PERF_RING_SIZE - 1)];
+            fprintf(fp, "%s\n{\"name\":", first ? "" : ",");
+            write_json_string(fp, event->name);
+            fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    ring->tid,
+                    (event->start_ns - epoch_ns) / 1000.0,
+                    event->duration_ns / 1000.0);
+            first = 0;
+            event_count++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    log_info("perf.perf_trace_write: wrote %ld spans to %s", event_count, trace_path);
+}
@@ -1,7 +1,57 @@
 #ifndef PERF_H
 #define PERF_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// Span-based tracer. Every thread records into its own lock-free ring buffer;
+// spans nest per thread and are exported as Chrome trace-event JSON
+// (chrome://tracing, ui.perfetto.dev) by perf_trace_write().
+//
+// Use the PERF_* macros at call sites so the whole tracer can be compiled out
+// with -DARC_NO_PERF (make NO_PERF=1).
+
+void perf_trace_enable(const char *output_path);
+bool perf_trace_enabled(void);
+void perf_trace_write(void);
+void perf_set_thread_name(const char *name);
+
+// name must be a string literal or otherwise outlive the trace.
 void perf_start(const char *name);
-void perf_end();
+void perf_end(void);
+
+// Hardware counters (perf_event_open) for the calling thread, accumulated
+// inclusively per span name while open. Counters the kernel or CPU does not
+// provide are reported as unavailable; if none can be opened, reason says why.
+typedef enum {
+    PERF_COUNTER_CYCLES,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_CACHE_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTER_PAGE_FAULTS,
+    PERF_COUNTER_COUNT,
+} PerfCounter;
+
+typedef struct {
+    uint64_t values[PERF_COUNTER_COUNT];
+    uint64_t calls;
+} PerfCounters;
+
+bool perf_counters_open(const char **reason);
+void perf_counters_close(void);
+bool perf_counter_available(PerfCounter counter);
+const char *perf_counter_name(PerfCounter counter);
+// Totals so far for span name on the calling thread; zero if never seen.
+void perf_counters_get(const char *name, PerfCounters *out);
+
+#ifdef ARC_NO_PERF
+#define PERF_START(name) ((void)0)
+#define PERF_END() ((void)0)
+#define PERF_THREAD_NAME(name) ((void)0)
+#else
+#define PERF_START(name) perf_start(name)
+#define PERF_END() perf_end()
+#define PERF_THREAD_NAME(name) perf_set_thread_name(name)
+#endif
 
 #endif
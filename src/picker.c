@@ -6,6 +6,9 @@
 #include "normal.h"
 #include "theme.h"
 #include "fuzzy.h"
+#include "perf.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
 
 extern Editor editor;
 
@@ -114,7 +117,9 @@ int picker_handle_input(const char *ch_str) {
     }
 
     if (delegate->update_results) {
+        PERF_START("picker_search");
         delegate->update_results(search);
+        PERF_END();
     }
     editor_request_redraw();
 
@@ -145,9 +150,32 @@ void picker_draw(int screen_cols, int screen_rows, Theme *theme) {
         adj_search_len = w - 2;
     }
     printf(" %s", search_ptr);
-    for (int i = search_len + 1; i < w; i++) {
+    // Async delegates show how many results are in, and whether more are coming.
+    char status[64] = "";
+    int status_width = 0;
+    if (delegate->is_searching) {
+        int searching = delegate->is_searching();
+        int count = delegate->get_results_count();
+        status_width = snprintf(status, sizeof(status), searching ? "%d searching… " : "%d ", count);
+        if (searching) {
+            status_width -= strlen("…") - 1;
+        }
+        if (adj_search_len + 2 + status_width > w) {
+            status[0] = '\0';
+            status_width = 0;
+        }
+    }
+    for (int i = adj_search_len + 1; i < w - status_width; i++) {
         putchar(' ');
     }
+    if (status_width > 0) {
+        Style status_style = search_style;
+        status_style.fg_r = theme->picker_border.fg_r;
+        status_style.fg_g = theme->picker_border.fg_g;
+        status_style.fg_b = theme->picker_border.fg_b;
+        editor_set_style(&status_style, 1, 1);
+        printf("%s", status);
+    }
     y += 2;
     h -= 4;
 
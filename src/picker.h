@@ -20,6 +20,10 @@ typedef struct {
     int (*get_results_count)();
     int (*get_result_index)(int result_idx);
     void (*get_item_style)(int index, PickerItemStyle *style);
+    // Set by delegates whose update_results only starts a search: results
+    // keep arriving from other threads, each followed by a redraw request,
+    // for as long as this returns 1.
+    int (*is_searching)();
 } PickerDelegate;
 
 void picker_set_delegate(PickerDelegate *delegate);
@@ -3,6 +3,8 @@
 #include "picker.h"
 #include "editor.h"
 #include "buffer.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
 
 static int *filtered_indices = NULL;
 static int results_count = 0;
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include "fuzzy.h"
@@ -13,6 +14,8 @@
 #include "buffer.h"
 #include "log.h"
 #include "str.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
 
 // For both pickers
 static Diagnostic *diagnostics = NULL;
@@ -116,7 +119,25 @@ static void file_on_open() {
     if (!buffer || !buffer->file_name) {
         return;
     }
-    lsp_get_diagnostics(buffer->file_name, &diagnostics, &diagnostic_count);
+    // A copy of what is drawn, which a redraw may replace while the picker
+    // is open.
+    DiagnosticSet *set;
+    int count;
+    const Diagnostic *items = editor_buffer_diagnostics(buffer, &set, &count);
+    if (count > 0) {
+        diagnostics = malloc(sizeof(Diagnostic) * count);
+        if (!diagnostics) {
+            log_error("picker_diagnostics.file_on_open: malloc failed");
+            exit(1);
+        }
+        for (int i = 0; i < count; i++) {
+            diagnostics[i] = items[i];
+            diagnostics[i].message = strdup(items[i].message);
+            diagnostics[i].uri = NULL;
+        }
+        diagnostic_count = count;
+    }
+    lsp_diagnostics_release(set);
     if (diagnostic_count == 0) {
         return;
     }
@@ -3,52 +3,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-#include <sys/stat.h>
-#include <unistd.h>
 #include "fuzzy.h"
 #include "picker.h"
 #include "editor.h"
+#include "log.h"
+#include "walk.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
 
 static char **files = NULL;
 static int file_count = 0;
-static int file_capacity = 0;
 static int *filtered_indices = NULL;
 static int results_count = 0;
 
-static void add_file_to_list(const char *filepath) {
-    if (file_count >= file_capacity) {
-        file_capacity = file_capacity == 0 ? 16 : file_capacity * 2;
-        files = realloc(files, sizeof(char*) * file_capacity);
-        filtered_indices = realloc(filtered_indices, sizeof(int) * file_capacity);
+// Hidden files are left out along with ignored ones. Binary files stay, as
+// telling them apart would mean opening every file the picker lists.
+static void scan_files(void) {
+    WalkFile *walked;
+    int count = walk_files("", WALK_SKIP_HIDDEN, NULL, &walked);
+    files = malloc(sizeof(char *) * (count ? count : 1));
+    filtered_indices = malloc(sizeof(int) * (count ? count : 1));
+    if (!files || !filtered_indices) {
+        log_error("picker_file.scan_files: malloc failed");
+        exit(1);
     }
-    files[file_count++] = strdup(filepath);
-}
-
-static void scan_directory_recursive(const char *dirpath) {
-    DIR *dir = opendir(dirpath);
-    if (!dir) return;
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') continue;
-        char fullpath[1024];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", dirpath, entry->d_name);
-        struct stat statbuf;
-        if (stat(fullpath, &statbuf) == 0) {
-            if (S_ISREG(statbuf.st_mode)) {
-                const char *clean_path = strncmp(fullpath, "./", 2) == 0 ? fullpath + 2 : fullpath;
-                add_file_to_list(clean_path);
-            } else if (S_ISDIR(statbuf.st_mode)) {
-                scan_directory_recursive(fullpath);
-            }
-        }
+    for (int i = 0; i < count; i++) {
+        files[i] = walked[i].path;
     }
-    closedir(dir);
+    file_count = count;
+    free(walked);
 }
 
 static void on_open() {
-    if (file_count == 0) {
-        scan_directory_recursive(".");
+    if (!files) {
+        scan_files();
     }
     results_count = fuzzy_search((const char**)files, file_count, "", filtered_indices);
 }
@@ -62,7 +50,6 @@ static void on_close() {
     files = NULL;
     filtered_indices = NULL;
     file_count = 0;
-    file_capacity = 0;
     results_count = 0;
 }
 
@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fuzzy.h"
+#include "picker.h"
+#include "picker_git_status.h"
+#include "git_status.h"
+#include "editor.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
+
+static GitStatusEntry *entries = NULL;
+static int entry_count = 0;
+static const char **paths = NULL;
+static int *filtered_indices = NULL;
+static int results_count = 0;
+
+static void on_open() {
+    entry_count = git_status_collect(&entries);
+    if (entry_count <= 0) {
+        entry_count = 0;
+        return;
+    }
+    paths = malloc(sizeof(char*) * entry_count);
+    filtered_indices = malloc(sizeof(int) * entry_count);
+    for (int i = 0; i < entry_count; i++) {
+        paths[i] = entries[i].path;
+    }
+    results_count = fuzzy_search(paths, entry_count, "", filtered_indices);
+}
+
+static void on_close() {
+    git_status_free(entries, entry_count);
+    free(paths);
+    free(filtered_indices);
+    entries = NULL;
+    paths = NULL;
+    filtered_indices = NULL;
+    entry_count = 0;
+    results_count = 0;
+}
+
+static void on_select(int selection_idx, int *close_picker) {
+    GitStatusEntry *entry = &entries[filtered_indices[selection_idx]];
+    // Nothing to open for deleted files and untracked directories.
+    if (entry->kind != GIT_STATUS_DELETED && entry->path[strlen(entry->path) - 1] != '/') {
+        editor_open(entry->path);
+    }
+    *close_picker = 1;
+}
+
+static int get_item_count() {
+    return entry_count;
+}
+
+static const char* get_item_text(int index) {
+    return entries[index].path;
+}
+
+static void update_results(const char *search) {
+    results_count = fuzzy_search(paths, entry_count, search, filtered_indices);
+}
+
+static int get_results_count() {
+    return results_count;
+}
+
+static int get_result_index(int result_idx) {
+    return filtered_indices[result_idx];
+}
+
+static void set_color(PickerItemStyle *style, const Style *color) {
+    style->has_fg_color = 1;
+    style->fg_r = color->fg_r;
+    style->fg_g = color->fg_g;
+    style->fg_b = color->fg_b;
+}
+
+static void get_item_style(int index, PickerItemStyle *style) {
+    style->style = 0;
+    style->has_fg_color = 0;
+    switch (entries[index].kind) {
+        case GIT_STATUS_MODIFIED:
+            style->flag = "M";
+            set_color(style, &editor.current_theme.git_modified);
+            break;
+        case GIT_STATUS_ADDED:
+            style->flag = "A";
+            set_color(style, &editor.current_theme.git_added);
+            break;
+        case GIT_STATUS_DELETED:
+            style->flag = "D";
+            set_color(style, &editor.current_theme.git_deleted);
+            break;
+        case GIT_STATUS_UNMERGED:
+            style->flag = "U";
+            set_color(style, &editor.current_theme.diagnostics_error);
+            break;
+        case GIT_STATUS_UNTRACKED:
+            style->flag = "?";
+            break;
+    }
+}
+
+static PickerDelegate delegate = {
+    .on_open = on_open,
+    .on_close = on_close,
+    .on_select = on_select,
+    .get_item_count = get_item_count,
+    .get_item_text = get_item_text,
+    .update_results = update_results,
+    .get_results_count = get_results_count,
+    .get_result_index = get_result_index,
+    .get_item_style = get_item_style,
+};
+
+void picker_git_status_show() {
+    picker_set_delegate(&delegate);
+    picker_open();
+}
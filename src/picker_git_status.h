@@ -0,0 +1,6 @@
+#ifndef PICKER_GIT_STATUS_H
+#define PICKER_GIT_STATUS_H
+
+void picker_git_status_show();
+
+#endif
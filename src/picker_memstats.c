@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include "fuzzy.h"
+#include "picker.h"
+#include "picker_memstats.h"
+#include "alloc.h"
+
+#define MEMSTATS_LINE_LEN 128
+#define MEMSTATS_MAX_LINES (ALLOC_TAG_COUNT + 2)
+
+// Snapshot taken when the picker opens; one line per subsystem plus a total.
+static char lines[MEMSTATS_MAX_LINES][MEMSTATS_LINE_LEN];
+static const char *line_ptrs[MEMSTATS_MAX_LINES];
+static int line_count = 0;
+static int filtered_indices[MEMSTATS_MAX_LINES];
+static int results_count = 0;
+
+static void format_bytes(char *out, size_t out_size, double bytes) {
+    const char *units[] = { "B", "K", "M", "G" };
+    int unit = 0;
+    while ((bytes >= 1024 || bytes <= -1024) && unit < 3) {
+        bytes /= 1024;
+        unit++;
+    }
+    snprintf(out, out_size, unit ? "%.1f%s" : "%.0f%s", bytes, units[unit]);
+}
+
+static void add_line(const char *name, const AllocStats *stats, uint64_t keystrokes) {
+    char bytes[16];
+    char live[16];
+    format_bytes(bytes, sizeof(bytes), (double)stats->bytes);
+    format_bytes(live, sizeof(live), (double)stats->live_bytes);
+    double per_key = keystrokes ? (double)stats->allocations / keystrokes : 0;
+    snprintf(lines[line_count], MEMSTATS_LINE_LEN, "%-8s allocs %-9llu bytes %-8s live %-8s per key %.1f",
+             name, (unsigned long long)stats->allocations, bytes, live, per_key);
+    line_count++;
+}
+
+static void on_open() {
+    line_count = 0;
+    uint64_t keystrokes = alloc_keystrokes();
+    if (!alloc_stats_enabled()) {
+        snprintf(lines[line_count++], MEMSTATS_LINE_LEN, "allocation stats are off (build with make ALLOC_STATS=1)");
+    } else {
+        for (int i = 0; i < ALLOC_TAG_COUNT; i++) {
+            AllocStats stats;
+            alloc_stats_get(i, &stats);
+            add_line(alloc_tag_name(i), &stats, keystrokes);
+        }
+        AllocStats total;
+        alloc_stats_total(&total);
+        add_line("total", &total, keystrokes);
+        snprintf(lines[line_count++], MEMSTATS_LINE_LEN, "keystrokes %llu", (unsigned long long)keystrokes);
+    }
+    for (int i = 0; i < line_count; i++) {
+        line_ptrs[i] = lines[i];
+        filtered_indices[i] = i;
+    }
+    results_count = line_count;
+}
+
+static void on_close() {
+    results_count = 0;
+}
+
+static void on_select(int selection_idx, int *close_picker) {
+    (void)selection_idx;
+    *close_picker = 1;
+}
+
+static int get_item_count() {
+    return line_count;
+}
+
+static const char *get_item_text(int index) {
+    return lines[index];
+}
+
+static void update_results(const char *search) {
+    if (search[0] == '\0') {
+        for (int i = 0; i < line_count; i++) {
+            filtered_indices[i] = i;
+        }
+        results_count = line_count;
+        return;
+    }
+    results_count = fuzzy_search(line_ptrs, line_count, search, filtered_indices);
+}
+
+static int get_results_count() {
+    return results_count;
+}
+
+static int get_result_index(int result_idx) {
+    return filtered_indices[result_idx];
+}
+
+static PickerDelegate delegate = {
+    .on_open = on_open,
+    .on_close = on_close,
+    .on_select = on_select,
+    .get_item_count = get_item_count,
+    .get_item_text = get_item_text,
+    .update_results = update_results,
+    .get_results_count = get_results_count,
+    .get_result_index = get_result_index,
+    .get_item_style = NULL,
+};
+
+void picker_memstats_show(void) {
+    picker_set_delegate(&delegate);
+    picker_open();
+}
@@ -0,0 +1,6 @@
+#ifndef PICKER_MEMSTATS_H
+#define PICKER_MEMSTATS_H
+
+void picker_memstats_show(void);
+
+#endif
@@ -3,123 +3,52 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
-#include <sys/stat.h>
-#include <unistd.h>
 #include "picker.h"
 #include "editor.h"
 #include "picker_search.h"
-
-// Data structure for a single search result
-typedef struct {
-    char *filename;
-    int line_number;
-    int column_number;
-    char *content;
-    char *display_text;
-} SearchResult;
+#include "project_search.h"
+#include "search_index.h"
+#include "log.h"
+#include "walk.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
 
 // List of all files to search
 static char **files = NULL;
 static int file_count = 0;
-static int file_capacity = 0;
-
-// List of search results
-static SearchResult *results = NULL;
-static int results_count = 0;
-static int results_capacity = 0;
-
-// --- File Scanner ---
-static void add_file_to_list(const char *filepath) {
-    if (file_count >= file_capacity) {
-        file_capacity = file_capacity == 0 ? 1024 : file_capacity * 2;
-        files = realloc(files, sizeof(char*) * file_capacity);
-    }
-    files[file_count++] = strdup(filepath);
-}
-
-static void scan_directory_recursive(const char *dirpath) {
-    // Basic protection against recursive symlinks
-    static int depth = 0;
-    if (depth > 20) {
-        return;
-    }
-    depth++;
 
-    DIR *dir = opendir(dirpath);
-    if (!dir) {
-        depth--;
-        return;
-    }
+// Files the search index narrowed the current search to, if it could
+static char **candidates = NULL;
+static int candidate_count = 0;
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        // Simple exclusion for .git
-        if (strcmp(entry->d_name, ".git") == 0) {
-            continue;
-        }
+// get_item_text formats rows as they are drawn; matches come from
+// project_search, which finds them in the background.
+static char *display_text = NULL;
+static size_t display_capacity = 0;
 
-        char fullpath[1024];
-        snprintf(fullpath, sizeof(fullpath), "%s/%s", dirpath, entry->d_name);
-        struct stat statbuf;
-        if (lstat(fullpath, &statbuf) == 0) {
-            if (S_ISREG(statbuf.st_mode)) {
-                const char *clean_path = strncmp(fullpath, "./", 2) == 0 ? fullpath + 2 : fullpath;
-                add_file_to_list(clean_path);
-            } else if (S_ISDIR(statbuf.st_mode) && !S_ISLNK(statbuf.st_mode)) {
-                scan_directory_recursive(fullpath);
-            }
-        }
-    }
-    closedir(dir);
-    depth--;
-}
-
-// --- Results Management ---
-static void clear_results() {
-    if (results) {
-        for (int i = 0; i < results_count; i++) {
-            free(results[i].filename);
-            free(results[i].content);
-            free(results[i].display_text);
-        }
-        free(results);
-        results = NULL;
+// --- File Scanner ---
+// Binary files are left out here rather than rejected by every search.
+static void scan_files(void) {
+    WalkFile *walked;
+    int count = walk_files("", WALK_SKIP_BINARY, NULL, &walked);
+    files = malloc(sizeof(char *) * (count ? count : 1));
+    if (!files) {
+        log_error("picker_search.scan_files: malloc failed");
+        exit(1);
     }
-    results_count = 0;
-    results_capacity = 0;
-}
-
-static void add_result(const char *filename, int line_number, int column_number, const char *content) {
-    if (results_count >= results_capacity) {
-        results_capacity = results_capacity == 0 ? 128 : results_capacity * 2;
-        results = realloc(results, sizeof(SearchResult) * results_capacity);
+    for (int i = 0; i < count; i++) {
+        files[i] = walked[i].path;
     }
-    results[results_count].filename = strdup(filename);
-    results[results_count].line_number = line_number;
-    results[results_count].column_number = column_number;
-    results[results_count].content = strdup(content);
-
-    int display_text_len = snprintf(NULL, 0, "%s:%d:%d: %s", filename, line_number, column_number + 1, content);
-    results[results_count].display_text = malloc(display_text_len + 1);
-    snprintf(results[results_count].display_text, display_text_len + 1, "%s:%d:%d: %s", filename, line_number, column_number + 1, content);
-
-    results_count++;
+    file_count = count;
+    free(walked);
 }
 
-
 // --- Picker Delegate Functions ---
-static void on_open() {
-    if (file_count == 0) {
-        scan_directory_recursive(".");
-    }
-}
-
 static void on_close() {
-    clear_results();
+    project_search_stop();
+    search_index_free_candidates(candidates, candidate_count);
+    candidates = NULL;
+    candidate_count = 0;
     // Free file list as well
     if (files) {
         for (int i = 0; i < file_count; i++) {
@@ -129,26 +58,28 @@ static void on_close() {
         files = NULL;
     }
     file_count = 0;
-    file_capacity = 0;
 }
 
 static void on_select(int selection_idx, int *close_picker) {
-    if (selection_idx < 0 || selection_idx >= results_count) {
+    project_search_lock();
+    const ProjectSearchMatch *match = project_search_match(selection_idx);
+    ProjectSearchMatch result = match ? *match : (ProjectSearchMatch){ 0 };
+    project_search_unlock();
+    if (!match) {
         return;
     }
-    SearchResult *result = &results[selection_idx];
-    editor_open(result->filename);
+    editor_open((char *)result.path);
 
     Buffer *b = editor_get_active_buffer();
 
     // Set line number, clamping to valid range
-    b->position_y = result->line_number - 1;
+    b->position_y = result.line - 1;
     if (b->position_y >= b->line_count) {
         b->position_y = b->line_count > 0 ? b->line_count - 1 : 0;
     }
 
     // Set column number, clamping to valid range
-    b->position_x = result->column_number;
+    b->position_x = result.column;
     if (b->position_y < b->line_count) {
       BufferLine *current_line = b->lines[b->position_y];
       if (b->position_x >= current_line->char_count) {
@@ -163,47 +94,50 @@ static void on_select(int selection_idx, int *close_picker) {
     *close_picker = 1;
 }
 
+// Called from the render thread while the search may still be publishing.
 static const char* get_item_text(int index) {
-    if (index < 0 || index >= results_count) {
-        return "";
+    project_search_lock();
+    const ProjectSearchMatch *match = project_search_match(index);
+    if (match) {
+        int len = snprintf(NULL, 0, "%s:%d:%d: %s", match->path, match->line, match->column + 1, match->content);
+        if ((size_t)len + 1 > display_capacity) {
+            display_capacity = len + 1;
+            display_text = realloc(display_text, display_capacity);
+        }
+        snprintf(display_text, display_capacity, "%s:%d:%d: %s", match->path, match->line, match->column + 1, match->content);
     }
-    return results[index].display_text;
+    project_search_unlock();
+    return match ? display_text : "";
 }
 
 static void update_results(const char *search) {
-    clear_results();
-    if (strlen(search) == 0) {
-        editor_request_redraw();
-        return;
-    }
-
-    for (int i = 0; i < file_count; i++) {
-        FILE *f = fopen(files[i], "r");
-        if (!f) continue;
-
-        char *line = NULL;
-        size_t len = 0;
-        int line_number = 1;
-        while (getline(&line, &len, f) != -1) {
-            char *line_ptr = line;
-            char *match;
-            while ((match = strstr(line_ptr, search))) {
-                // Remove trailing newline
-                line[strcspn(line, "\n")] = 0;
-                int column_number = match - line;
-                add_result(files[i], line_number, column_number, line);
-                line_ptr = match + 1;
-            }
-            line_number++;
-        }
-        free(line);
-        fclose(f);
+    // Without the index, or for searches shorter than a trigram, every file
+    // in the project is searched; the list is only scanned when first needed.
+    int count = 0;
+    char **narrowed = search_index_candidates(search, &count);
+    if (!narrowed && !files) {
+        scan_files();
     }
-    editor_request_redraw();
+    project_search_start(narrowed ? narrowed : files, narrowed ? count : file_count, search, editor_request_redraw);
+    // Starting the search dropped the matches that pointed into these.
+    search_index_free_candidates(candidates, candidate_count);
+    candidates = narrowed;
+    candidate_count = count;
 }
 
 static int get_results_count() {
-    return results_count;
+    project_search_lock();
+    int count = project_search_count(NULL);
+    project_search_unlock();
+    return count;
+}
+
+static int is_searching() {
+    bool searching;
+    project_search_lock();
+    project_search_count(&searching);
+    project_search_unlock();
+    return searching;
 }
 
 static int get_result_index(int result_idx) {
@@ -211,7 +145,7 @@ static int get_result_index(int result_idx) {
 }
 
 static PickerDelegate delegate = {
-    .on_open = on_open,
+    .on_open = NULL,
     .on_close = on_close,
     .on_select = on_select,
     .get_item_count = get_results_count,
@@ -220,6 +154,7 @@ static PickerDelegate delegate = {
     .get_results_count = get_results_count,
     .get_result_index = get_result_index,
     .get_item_style = NULL,
+    .is_searching = is_searching,
 };
 
 void picker_search_show() {
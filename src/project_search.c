@@ -0,0 +1,522 @@
+#define _GNU_SOURCE
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "project_search.h"
+#include "log.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
+
+// Files smaller than this are read into the worker's buffer and larger ones
+// mapped; mapping and unmapping costs more than the copy for the small files
+// most projects have.
+#define SEARCH_READ_LIMIT (128 * 1024)
+#define SEARCH_BINARY_PROBE 8000
+// Files a worker claims at a time. Claims are taken from the front so the
+// files before the published ones finish first and matches stream in order;
+// stealing only evens out the tail.
+#define SEARCH_CLAIM 16
+// Bytes scanned between checks for a newer search.
+#define SEARCH_WINDOW (1024 * 1024)
+#define SEARCH_TEXT_BLOCK (64 * 1024)
+#define MATCH_BLOCK 4096
+
+// Line contents, in blocks that never move so published matches can point
+// into them while workers keep adding.
+typedef struct TextBlock {
+    struct TextBlock *next;
+    size_t len;
+    size_t capacity;
+    char text[];
+} TextBlock;
+
+typedef struct {
+    // Files the worker has yet to search, next << 32 | end. The owner takes
+    // from the front and thieves split off the back half, both by CAS.
+    _Alignas(64) _Atomic uint64_t range;
+    ProjectSearchMatch *matches; // of the file being searched
+    int count;
+    int capacity;
+    TextBlock *text;
+    char *buffer;
+} SearchWorker;
+
+typedef struct {
+    ProjectSearchMatch *matches;
+    int count;
+    _Atomic bool done;
+} FileMatches;
+
+typedef struct {
+    char *const *paths;
+    int path_count;
+    char *needle;
+    size_t needle_len;
+    unsigned generation;
+    _Atomic int next; // first file nobody has claimed
+    FileMatches *files;
+    void (*notify)(void);
+} SearchJob;
+
+static SearchWorker workers[PROJECT_SEARCH_MAX_THREADS];
+// Bumped by every start and stop; workers drop a job once it moves on.
+static _Atomic unsigned search_generation = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_idle = PTHREAD_COND_INITIALIZER;
+static SearchJob *pool_job = NULL;
+static int pool_busy = 0;
+static int pool_size = 0;
+static bool pool_started = false;
+
+// Published matches, in blocks of MATCH_BLOCK so they never move.
+static pthread_mutex_t results_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t results_done = PTHREAD_COND_INITIALIZER;
+static ProjectSearchMatch **match_blocks = NULL;
+static int match_block_capacity = 0;
+static int match_count = 0;
+static int published_files = 0;
+static bool searching = false;
+
+// First occurrence of needle in [p, end). With SSE2, sixteen candidate
+// positions are checked at a time against the needle's first and last byte
+// and only the survivors are compared in full.
+static const char *search_find(const char *p, const char *end, const char *needle, size_t needle_len) {
+    if ((size_t)(end - p) < needle_len) {
+        return NULL;
+    }
+    if (needle_len == 1) {
+        return memchr(p, needle[0], end - p);
+    }
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+    for (; end - p >= (ptrdiff_t)(needle_len - 1 + 16); p += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *)p);
+        __m128i tail = _mm_loadu_si128((const __m128i *)(p + needle_len - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            if (memcmp(p + i + 1, needle + 1, needle_len - 2) == 0) {
+                return p + i;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return memmem(p, end - p, needle, needle_len);
+}
+
+static int count_newlines(const char *p, const char *end) {
+    int count = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+    }
+#endif
+    for (; p < end; p++) {
+        count += *p == '\n';
+    }
+    return count;
+}
+
+static const char *worker_add_text(SearchWorker *worker, const char *text, size_t len) {
+    TextBlock *block = worker->text;
+    if (!block || block->len + len + 1 > block->capacity) {
+        size_t capacity = len + 1 > SEARCH_TEXT_BLOCK ? len + 1 : SEARCH_TEXT_BLOCK;
+        block = malloc(sizeof(TextBlock) + capacity);
+        if (!block) {
+            log_error("project_search.worker_add_text: malloc failed");
+            exit(1);
+        }
+        block->next = worker->text;
+        block->len = 0;
+        block->capacity = capacity;
+        worker->text = block;
+    }
+    char *copy = block->text + block->len;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    block->len += len + 1;
+    return copy;
+}
+
+static void worker_add_match(const SearchJob *job, SearchWorker *worker, int file, int line, int column, const char *content) {
+    if (worker->count == worker->capacity) {
+        worker->capacity = worker->capacity == 0 ? 16 : worker->capacity * 2;
+        worker->matches = realloc(worker->matches, sizeof(ProjectSearchMatch) * worker->capacity);
+        if (!worker->matches) {
+            log_error("project_search.worker_add_match: realloc failed");
+            exit(1);
+        }
+    }
+    worker->matches[worker->count++] = (ProjectSearchMatch){ file, job->paths[file], line, column, content };
+}
+
+static bool job_cancelled(const SearchJob *job) {
+    return atomic_load_explicit(&search_generation, memory_order_relaxed) != job->generation;
+}
+
+static void search_data(const SearchJob *job, SearchWorker *worker, int file, const char *data, size_t len) {
+    // A NUL early on marks a binary file, as it does for git.
+    if (memchr(data, '\0', len < SEARCH_BINARY_PROBE ? len : SEARCH_BINARY_PROBE)) {
+        return;
+    }
+    const char *end = data + len;
+    const char *counted = data;
+    const char *line_start = data;
+    const char *content_line = NULL;
+    const char *content = NULL;
+    int line = 1;
+    const char *p = data;
+    while (p < end) {
+        // Large files are scanned a window at a time so a newer search does
+        // not wait for them; a window holds every match that starts in its
+        // first SEARCH_WINDOW bytes.
+        size_t window = (size_t)(end - p);
+        if (window > SEARCH_WINDOW + job->needle_len) {
+            window = SEARCH_WINDOW + job->needle_len - 1;
+        }
+        const char *match = search_find(p, p + window, job->needle, job->needle_len);
+        if (!match) {
+            if (p + window == end || job_cancelled(job)) {
+                return;
+            }
+            p += SEARCH_WINDOW;
+            continue;
+        }
+        if (match > counted) {
+            line += count_newlines(counted, match);
+            const char *newline = memrchr(counted, '\n', match - counted);
+            if (newline) {
+                line_start = newline + 1;
+            }
+            counted = match;
+        }
+        // Matches on one line share its copy.
+        if (line_start != content_line) {
+            const char *line_end = memchr(match, '\n', end - match);
+            if (!line_end) {
+                line_end = end;
+            }
+            content = worker_add_text(worker, line_start, line_end - line_start);
+            content_line = line_start;
+        }
+        worker_add_match(job, worker, file, line, match - line_start, content);
+        p = match + 1;
+    }
+}
+
+static void search_file(const SearchJob *job, SearchWorker *worker, int file) {
+    int fd = open(job->paths[file], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (!worker->buffer) {
+        worker->buffer = malloc(SEARCH_READ_LIMIT);
+        if (!worker->buffer) {
+            log_error("project_search.search_file: malloc failed");
+            exit(1);
+        }
+    }
+    // Read first: for most files that is the whole file and saves an fstat.
+    // A short read of a regular file means its end was reached.
+    ssize_t n = read(fd, worker->buffer, SEARCH_READ_LIMIT);
+    size_t len = n > 0 ? (size_t)n : 0;
+    struct stat st;
+    if (len < SEARCH_READ_LIMIT) {
+        close(fd);
+        search_data(job, worker, file, worker->buffer, len);
+    } else if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        search_data(job, worker, file, data, st.st_size);
+        munmap(data, st.st_size);
+    } else {
+        close(fd);
+    }
+}
+
+static void results_append(const ProjectSearchMatch *match) {
+    int block = match_count / MATCH_BLOCK;
+    if (block == match_block_capacity) {
+        match_block_capacity = match_block_capacity == 0 ? 16 : match_block_capacity * 2;
+        match_blocks = realloc(match_blocks, sizeof(ProjectSearchMatch *) * match_block_capacity);
+        if (!match_blocks) {
+            log_error("project_search.results_append: realloc failed");
+            exit(1);
+        }
+        memset(match_blocks + block, 0, sizeof(ProjectSearchMatch *) * (match_block_capacity - block));
+    }
+    if (!match_blocks[block]) {
+        match_blocks[block] = malloc(sizeof(ProjectSearchMatch) * MATCH_BLOCK);
+        if (!match_blocks[block]) {
+            log_error("project_search.results_append: malloc failed");
+            exit(1);
+        }
+    }
+    match_blocks[block][match_count % MATCH_BLOCK] = *match;
+    match_count++;
+}
+
+// Hands the file's matches to the job, then publishes every file that now
+// has all the files before it done.
+static void publish(SearchJob *job, SearchWorker *worker, int file) {
+    FileMatches *entry = &job->files[file];
+    if (worker->count > 0) {
+        entry->matches = worker->matches;
+        entry->count = worker->count;
+        worker->matches = NULL;
+        worker->count = 0;
+        worker->capacity = 0;
+    }
+    atomic_store_explicit(&entry->done, true, memory_order_release);
+
+    pthread_mutex_lock(&results_lock);
+    int count = match_count;
+    bool finished = false;
+    while (published_files < job->path_count &&
+           atomic_load_explicit(&job->files[published_files].done, memory_order_acquire)) {
+        FileMatches *ready = &job->files[published_files];
+        for (int i = 0; i < ready->count; i++) {
+            results_append(&ready->matches[i]);
+        }
+        free(ready->matches);
+        ready->matches = NULL;
+        if (++published_files == job->path_count) {
+            searching = false;
+            finished = true;
+            pthread_cond_broadcast(&results_done);
+        }
+    }
+    bool changed = finished || match_count != count;
+    pthread_mutex_unlock(&results_lock);
+    if (changed && job->notify && !job_cancelled(job)) {
+        job->notify();
+    }
+}
+
+static int take_file(SearchWorker *worker) {
+    uint64_t range = atomic_load(&worker->range);
+    while ((uint32_t)(range >> 32) < (uint32_t)range) {
+        if (atomic_compare_exchange_weak(&worker->range, &range, range + ((uint64_t)1 << 32))) {
+            return (int)(range >> 32);
+        }
+    }
+    return -1;
+}
+
+static bool claim_files(SearchJob *job, SearchWorker *worker) {
+    int start = atomic_fetch_add(&job->next, SEARCH_CLAIM);
+    if (start >= job->path_count) {
+        return false;
+    }
+    uint64_t end = start + SEARCH_CLAIM < job->path_count ? start + SEARCH_CLAIM : job->path_count;
+    atomic_store(&worker->range, (uint64_t)start << 32 | end);
+    return true;
+}
+
+// Moves the back half of another worker's files into this one's range.
+static bool steal_files(SearchWorker *worker) {
+    int self = (int)(worker - workers);
+    for (int i = 1; i < pool_size; i++) {
+        SearchWorker *victim = &workers[(self + i) % pool_size];
+        uint64_t range = atomic_load(&victim->range);
+        uint32_t next, end;
+        while ((next = range >> 32) < (end = (uint32_t)range)) {
+            uint32_t middle = next + (end - next) / 2;
+            if (atomic_compare_exchange_weak(&victim->range, &range, (uint64_t)next << 32 | middle)) {
+                atomic_store(&worker->range, (uint64_t)middle << 32 | end);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void search_run(SearchJob *job, int id) {
+    SearchWorker *worker = &workers[id];
+    while (!job_cancelled(job)) {
+        int file = take_file(worker);
+        if (file >= 0) {
+            search_file(job, worker, file);
+            publish(job, worker, file);
+        } else if (!claim_files(job, worker) && !steal_files(worker)) {
+            return;
+        }
+    }
+}
+
+static void *pool_worker(void *arg) {
+    int id = (int)(intptr_t)arg;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!pool_job || pool_job->generation == seen) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        SearchJob *job = pool_job;
+        seen = job->generation;
+        pthread_mutex_unlock(&pool_lock);
+        search_run(job, id);
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_busy == 0) {
+            pthread_cond_signal(&pool_idle);
+        }
+    }
+    return NULL;
+}
+
+static void pool_start(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = cpus < 1 ? 1 : cpus > PROJECT_SEARCH_MAX_THREADS ? PROJECT_SEARCH_MAX_THREADS : (int)cpus;
+    while (pool_size < wanted) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, (void *)(intptr_t)pool_size) != 0) {
+            log_error("project_search.pool_start: unable to create search thread");
+            break;
+        }
+        pthread_detach(thread);
+        pool_size++;
+    }
+    pool_started = true;
+}
+
+static void job_free(SearchJob *job) {
+    for (int i = 0; i < job->path_count; i++) {
+        free(job->files[i].matches);
+    }
+    free(job->files);
+    free(job->needle);
+    free(job);
+}
+
+// Cancels the current job, waits for the workers to leave it and drops it
+// along with its matches. Called with pool_lock held.
+static void pool_clear(void) {
+    atomic_fetch_add(&search_generation, 1);
+    while (pool_busy > 0) {
+        pthread_cond_wait(&pool_idle, &pool_lock);
+    }
+    if (pool_job) {
+        job_free(pool_job);
+        pool_job = NULL;
+    }
+    for (int i = 0; i < PROJECT_SEARCH_MAX_THREADS; i++) {
+        SearchWorker *worker = &workers[i];
+        while (worker->text) {
+            TextBlock *next = worker->text->next;
+            free(worker->text);
+            worker->text = next;
+        }
+        worker->count = 0;
+        atomic_store(&worker->range, 0);
+    }
+
+    pthread_mutex_lock(&results_lock);
+    for (int i = 0; i < match_block_capacity; i++) {
+        free(match_blocks[i]);
+    }
+    free(match_blocks);
+    match_blocks = NULL;
+    match_block_capacity = 0;
+    match_count = 0;
+    published_files = 0;
+    searching = false;
+    pthread_cond_broadcast(&results_done);
+    pthread_mutex_unlock(&results_lock);
+}
+
+void project_search_start(char *const *paths, int path_count, const char *needle, void (*notify)(void)) {
+    pthread_mutex_lock(&pool_lock);
+    pool_clear();
+    if (path_count <= 0 || needle[0] == '\0') {
+        pthread_mutex_unlock(&pool_lock);
+        return;
+    }
+    if (!pool_started) {
+        pool_start();
+    }
+
+    SearchJob *job = calloc(1, sizeof(SearchJob));
+    FileMatches *files = calloc(path_count, sizeof(FileMatches));
+    char *copy = strdup(needle);
+    if (!job || !files || !copy) {
+        log_error("project_search.project_search_start: allocation failed");
+        exit(1);
+    }
+    job->paths = paths;
+    job->path_count = path_count;
+    job->needle = copy;
+    job->needle_len = strlen(copy);
+    job->generation = atomic_load(&search_generation);
+    job->files = files;
+    job->notify = notify;
+
+    pthread_mutex_lock(&results_lock);
+    searching = true;
+    pthread_mutex_unlock(&results_lock);
+
+    pool_job = job;
+    pool_busy = pool_size;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    if (pool_size == 0) {
+        // No threads to be had: search in the caller instead.
+        search_run(job, 0);
+    }
+}
+
+void project_search_stop(void) {
+    pthread_mutex_lock(&pool_lock);
+    pool_clear();
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void project_search_wait(void) {
+    pthread_mutex_lock(&results_lock);
+    while (searching) {
+        pthread_cond_wait(&results_done, &results_lock);
+    }
+    pthread_mutex_unlock(&results_lock);
+}
+
+void project_search_lock(void) {
+    pthread_mutex_lock(&results_lock);
+}
+
+void project_search_unlock(void) {
+    pthread_mutex_unlock(&results_lock);
+}
+
+int project_search_count(bool *in_progress) {
+    if (in_progress) {
+        *in_progress = searching;
+    }
+    return match_count;
+}
+
+const ProjectSearchMatch *project_search_match(int index) {
+    if (index < 0 || index >= match_count) {
+        return NULL;
+    }
+    return &match_blocks[index / MATCH_BLOCK][index % MATCH_BLOCK];
+}
@@ -0,0 +1,37 @@
+#ifndef PROJECT_SEARCH_H
+#define PROJECT_SEARCH_H
+
+#include <stdbool.h>
+
+#define PROJECT_SEARCH_MAX_THREADS 8
+
+typedef struct {
+    int file;            // index into the searched paths
+    const char *path;    // paths[file]
+    int line;            // 1-based
+    int column;          // byte offset of the match in the line
+    const char *content; // the line, without its newline
+} ProjectSearchMatch;
+
+// Finds every occurrence of needle in the given files, overlapping ones
+// included, on a pool of background threads, and returns at once. Starting a
+// search cancels the one before it. Matches are published in path order, then
+// position order, as soon as every file before theirs is done, and notify, if
+// set, is called from a search thread whenever more are published and when
+// the search ends. Unreadable and binary files are skipped. paths must stay
+// valid until the search ends or is stopped.
+void project_search_start(char *const *paths, int path_count, const char *needle, void (*notify)(void));
+// Cancels the search in progress, if any, and frees the published matches.
+void project_search_stop(void);
+// Blocks until the search in progress ends.
+void project_search_wait(void);
+
+// The published matches may only be read between these two calls; search
+// threads publish under the same lock.
+void project_search_lock(void);
+void project_search_unlock(void);
+// Published matches so far; *searching is set while more may follow.
+int project_search_count(bool *searching);
+const ProjectSearchMatch *project_search_match(int index);
+
+#endif // PROJECT_SEARCH_H
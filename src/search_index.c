@@ -0,0 +1,899 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "search_index.h"
+#include "walk.h"
+#include "log.h"
+#include "perf.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
+
+#define INDEX_MAGIC "arctri1\n"
+// Larger files are not read for trigrams; every search checks them instead.
+#define INDEX_MAX_FILE_SIZE (16 * 1024 * 1024)
+#define INDEX_BINARY_PROBE 8000
+#define INDEX_FILE_UNINDEXED 1
+// Changed files that get folded into a rebuild once no event has come for
+// INDEX_SETTLE_MS. Until then searches check them in full.
+#define INDEX_REBUILD_DIRTY 64
+#define INDEX_SETTLE_MS 2000
+// How often mtimes are checked when not every directory could be watched.
+#define INDEX_RESCAN_MS (60 * 1000)
+#define INDEX_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+// The index file: header, file table, postings, trigram table, then paths.
+// Postings are file ids in ascending order, each stored as the LEB128
+// distance from the one before plus one.
+typedef struct {
+    char magic[8];
+    uint32_t file_count;
+    uint32_t trigram_count;
+    uint64_t files_offset;
+    uint64_t postings_offset;
+    uint64_t trigrams_offset;
+    uint64_t paths_offset;
+    uint64_t size;
+    uint32_t root; // offset of the project's absolute path in paths
+    uint32_t reserved;
+} IndexHeader;
+
+typedef struct {
+    int64_t mtime_ns;
+    int64_t size;
+    uint32_t path; // offset in paths
+    uint32_t flags;
+} IndexFile;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t offset; // in postings
+} IndexTrigram;
+
+typedef struct {
+    void *data;
+    size_t size;
+    const IndexHeader *header;
+    const IndexFile *files;
+    const uint8_t *postings;
+    const IndexTrigram *trigrams;
+    const char *paths;
+    uint8_t *stale; // per file: changed since the index was written
+    uint32_t *unindexed;
+    int unindexed_count;
+} Index;
+
+// Postings of the files indexed by a rebuild, gathered in file id order.
+typedef struct {
+    uint32_t key; // trigram | 1 << 24, 0 for an empty slot
+    uint32_t last; // id + 1 of the last file added
+    uint8_t *bytes;
+    uint32_t len;
+    uint32_t capacity;
+} Posting;
+
+typedef struct {
+    Posting *slots;
+    uint32_t capacity;
+    uint32_t count;
+} PostingTable;
+
+typedef struct {
+    uint32_t *ids;
+    int count;
+    int capacity;
+} IdList;
+
+typedef struct {
+    char **slots;
+    int capacity;
+    int count;
+} PathSet;
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+// Replaced only by rebuilds, which run on one thread at a time; readers on
+// other threads hold index_lock.
+static Index *current = NULL;
+// Files changed since the current index was written, and whether events were
+// lost so that nothing but a rebuild can be trusted.
+static PathSet dirty = { 0 };
+static bool overflowed = false;
+
+static int inotify_fd = -1;
+static char **watch_paths = NULL; // by watch descriptor
+static int watch_capacity = 0;
+static bool watches_incomplete = false;
+
+static uint64_t hash_string(const char *s) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (; *s; s++) {
+        hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool path_set_add(PathSet *set, const char *path) {
+    if ((set->count + 1) * 2 > set->capacity) {
+        int capacity = set->capacity == 0 ? 64 : set->capacity * 2;
+        char **slots = calloc(capacity, sizeof(char *));
+        if (!slots) {
+            log_error("search_index.path_set_add: calloc failed");
+            exit(1);
+        }
+        for (int i = 0; i < set->capacity; i++) {
+            if (set->slots[i]) {
+                int j = hash_string(set->slots[i]) & (capacity - 1);
+                while (slots[j]) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = set->slots[i];
+            }
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = capacity;
+    }
+    int i = hash_string(path) & (set->capacity - 1);
+    for (; set->slots[i]; i = (i + 1) & (set->capacity - 1)) {
+        if (strcmp(set->slots[i], path) == 0) {
+            return false;
+        }
+    }
+    set->slots[i] = strdup(path);
+    if (!set->slots[i]) {
+        log_error("search_index.path_set_add: strdup failed");
+        exit(1);
+    }
+    set->count++;
+    return true;
+}
+
+static void path_set_clear(PathSet *set) {
+    for (int i = 0; i < set->capacity; i++) {
+        free(set->slots[i]);
+    }
+    free(set->slots);
+    *set = (PathSet){ 0 };
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// ~/.cache/arc/index/<hash of the project path>.idx
+static bool index_location(char *path, size_t size, char *root) {
+    const char *home = getenv("HOME");
+    if (!home || !getcwd(root, PATH_MAX)) {
+        return false;
+    }
+    const char *levels[] = { "/.cache", "/.cache/arc", "/.cache/arc/index" };
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, size, "%s%s", home, levels[i]);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            log_warning("search_index.index_location: unable to create %s", path);
+            return false;
+        }
+    }
+    int len = snprintf(path, size, "%s/.cache/arc/index/%016llx.idx", home, (unsigned long long)hash_string(root));
+    return len > 0 && (size_t)len < size;
+}
+
+static void watch_directory(const char *dir) {
+    if (inotify_fd < 0) {
+        return;
+    }
+    int wd = inotify_add_watch(inotify_fd, dir[0] ? dir : ".", INDEX_WATCH_MASK);
+    if (wd < 0) {
+        if (!watches_incomplete) {
+            log_warning("search_index.watch_directory: unable to watch %s, falling back to mtime checks", dir);
+        }
+        watches_incomplete = true;
+        return;
+    }
+    if (wd >= watch_capacity) {
+        int capacity = watch_capacity == 0 ? 256 : watch_capacity;
+        while (capacity <= wd) {
+            capacity *= 2;
+        }
+        watch_paths = realloc(watch_paths, sizeof(char *) * capacity);
+        if (!watch_paths) {
+            log_error("search_index.watch_directory: realloc failed");
+            exit(1);
+        }
+        memset(watch_paths + watch_capacity, 0, sizeof(char *) * (capacity - watch_capacity));
+        watch_capacity = capacity;
+    }
+    free(watch_paths[wd]);
+    watch_paths[wd] = strdup(dir);
+}
+
+static void posting_add(PostingTable *table, uint32_t trigram, uint32_t file) {
+    if ((table->count + 1) * 2 > table->capacity) {
+        uint32_t capacity = table->capacity == 0 ? 4096 : table->capacity * 2;
+        Posting *slots = calloc(capacity, sizeof(Posting));
+        if (!slots) {
+            log_error("search_index.posting_add: calloc failed");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < table->capacity; i++) {
+            if (table->slots[i].key) {
+                uint32_t j = (table->slots[i].key * 2654435761u) & (capacity - 1);
+                while (slots[j].key) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = table->slots[i];
+            }
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = capacity;
+    }
+    uint32_t key = trigram | 1u << 24;
+    uint32_t i = (key * 2654435761u) & (table->capacity - 1);
+    while (table->slots[i].key && table->slots[i].key != key) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    Posting *posting = &table->slots[i];
+    if (!posting->key) {
+        posting->key = key;
+        table->count++;
+    }
+    if (posting->last == file + 1) {
+        return;
+    }
+    if (posting->len + 5 > posting->capacity) {
+        posting->capacity = posting->capacity == 0 ? 8 : posting->capacity * 2;
+        posting->bytes = realloc(posting->bytes, posting->capacity);
+        if (!posting->bytes) {
+            log_error("search_index.posting_add: realloc failed");
+            exit(1);
+        }
+    }
+    for (uint32_t delta = file + 1 - posting->last; ; delta >>= 7) {
+        if (delta < 0x80) {
+            posting->bytes[posting->len++] = delta;
+            break;
+        }
+        posting->bytes[posting->len++] = (delta & 0x7f) | 0x80;
+    }
+    posting->last = file + 1;
+}
+
+// Trigrams spanning a newline are left out: a search never crosses lines.
+static void index_text(PostingTable *table, uint32_t file, const unsigned char *text, size_t len) {
+    if (len < 3) {
+        return;
+    }
+    uint32_t trigram = text[0] << 8 | text[1];
+    for (size_t i = 2; i < len; i++) {
+        trigram = (trigram << 8 | text[i]) & 0xffffff;
+        if (text[i] == '\n' || text[i - 1] == '\n' || text[i - 2] == '\n') {
+            continue;
+        }
+        posting_add(table, trigram, file);
+    }
+}
+
+// Reads a file's trigrams, or flags it when it is too large to index.
+static void index_file(PostingTable *table, uint32_t id, const WalkFile *file, uint32_t *flags) {
+    if (file->size > INDEX_MAX_FILE_SIZE) {
+        *flags = INDEX_FILE_UNINDEXED;
+        return;
+    }
+    if (file->size == 0) {
+        return;
+    }
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+    size_t probe = file->size < INDEX_BINARY_PROBE ? file->size : INDEX_BINARY_PROBE;
+    if (!memchr(data, '\0', probe)) { // binary files are never searched
+        index_text(table, id, data, file->size);
+    }
+    munmap(data, file->size);
+}
+
+static void id_list_push(IdList *list, uint32_t id) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+        list->ids = realloc(list->ids, sizeof(uint32_t) * list->capacity);
+        if (!list->ids) {
+            log_error("search_index.id_list_push: realloc failed");
+            exit(1);
+        }
+    }
+    list->ids[list->count++] = id;
+}
+
+// Appends the ids of an encoded posting list, stopping at the end of the
+// postings if the file is damaged.
+static void decode_postings(const uint8_t *p, const uint8_t *end, uint32_t count, IdList *list) {
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < count && p < end; i++) {
+        uint32_t delta = 0;
+        for (int shift = 0; p < end && shift < 35; shift += 7) {
+            uint8_t byte = *p++;
+            delta |= (uint32_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        previous += delta;
+        id_list_push(list, previous - 1);
+    }
+}
+
+static void write_postings(FILE *out, const IdList *list) {
+    uint32_t previous = 0;
+    for (int i = 0; i < list->count; i++) {
+        uint32_t delta = list->ids[i] + 1 - previous;
+        for (; delta >= 0x80; delta >>= 7) {
+            fputc((delta & 0x7f) | 0x80, out);
+        }
+        fputc(delta, out);
+        previous = list->ids[i] + 1;
+    }
+}
+
+static int compare_postings(const void *a, const void *b) {
+    uint32_t x = (*(Posting *const *)a)->key, y = (*(Posting *const *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+static void index_free(Index *index) {
+    if (!index) {
+        return;
+    }
+    munmap(index->data, index->size);
+    free(index->stale);
+    free(index->unindexed);
+    free(index);
+}
+
+static Index *index_load(const char *path, const char *root) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    const IndexHeader *header = data;
+    const char *bytes = data;
+    size_t size = st.st_size;
+    bool valid = memcmp(header->magic, INDEX_MAGIC, 8) == 0 && header->size == size &&
+                 header->files_offset + (uint64_t)header->file_count * sizeof(IndexFile) <= header->postings_offset &&
+                 header->postings_offset <= header->trigrams_offset &&
+                 header->trigrams_offset + (uint64_t)header->trigram_count * sizeof(IndexTrigram) <= header->paths_offset &&
+                 header->files_offset % 8 == 0 && header->trigrams_offset % 8 == 0 &&
+                 header->paths_offset < size && bytes[size - 1] == '\0' &&
+                 header->root < size - header->paths_offset &&
+                 strcmp(bytes + header->paths_offset + header->root, root) == 0;
+    const IndexFile *files = (const IndexFile *)(bytes + (valid ? header->files_offset : 0));
+    for (uint32_t i = 0; valid && i < header->file_count; i++) {
+        valid = files[i].path < size - header->paths_offset;
+    }
+    if (!valid) {
+        munmap(data, size);
+        return NULL;
+    }
+
+    Index *index = calloc(1, sizeof(Index));
+    if (!index) {
+        log_error("search_index.index_load: calloc failed");
+        exit(1);
+    }
+    index->data = data;
+    index->size = size;
+    index->header = header;
+    index->files = files;
+    index->postings = (const uint8_t *)(bytes + header->postings_offset);
+    index->trigrams = (const IndexTrigram *)(bytes + header->trigrams_offset);
+    index->paths = bytes + header->paths_offset;
+    index->stale = calloc(header->file_count + 1, 1);
+    index->unindexed = malloc(sizeof(uint32_t) * (header->file_count + 1));
+    if (!index->stale || !index->unindexed) {
+        log_error("search_index.index_load: allocation failed");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < header->file_count; i++) {
+        if (files[i].flags & INDEX_FILE_UNINDEXED) {
+            index->unindexed[index->unindexed_count++] = i;
+        }
+    }
+    return index;
+}
+
+static int find_file(const Index *index, const char *path) {
+    int low = 0, high = (int)index->header->file_count - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        int cmp = strcmp(path, index->paths + index->files[mid].path);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            high = mid - 1;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return -1;
+}
+
+static const IndexTrigram *find_trigram(const Index *index, uint32_t trigram) {
+    int low = 0, high = (int)index->header->trigram_count - 1;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        if (index->trigrams[mid].trigram == trigram) {
+            return &index->trigrams[mid];
+        }
+        if (index->trigrams[mid].trigram < trigram) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+// Writes the index for files, sorted by path. Files the old index knew
+// unchanged keep their postings, remapped to their new ids; the rest are read.
+static bool index_write(const char *path, const char *root, const WalkFile *files, int file_count, const Index *old) {
+    uint32_t *remap = NULL;
+    uint32_t *flags = calloc(file_count + 1, sizeof(uint32_t));
+    PostingTable table = { 0 };
+    if (!flags) {
+        log_error("search_index.index_write: calloc failed");
+        exit(1);
+    }
+    uint32_t old_count = old ? old->header->file_count : 0;
+    if (old) {
+        remap = malloc(sizeof(uint32_t) * (old_count + 1));
+        if (!remap) {
+            log_error("search_index.index_write: malloc failed");
+            exit(1);
+        }
+        memset(remap, 0xff, sizeof(uint32_t) * (old_count + 1));
+    }
+    uint32_t j = 0;
+    for (int i = 0; i < file_count; i++) {
+        const WalkFile *file = &files[i];
+        int cmp = 1;
+        while (j < old_count && (cmp = strcmp(old->paths + old->files[j].path, file->path)) < 0) {
+            j++;
+        }
+        if (j < old_count && cmp == 0 && !old->stale[j] &&
+            old->files[j].mtime_ns == file->mtime_ns && old->files[j].size == file->size) {
+            remap[j] = i;
+            flags[i] = old->files[j].flags;
+        } else {
+            index_file(&table, i, file, &flags[i]);
+        }
+    }
+
+    Posting **fresh = malloc(sizeof(Posting *) * (table.count + 1));
+    if (!fresh) {
+        log_error("search_index.index_write: malloc failed");
+        exit(1);
+    }
+    uint32_t fresh_count = 0;
+    for (uint32_t i = 0; i < table.capacity; i++) {
+        if (table.slots[i].key) {
+            fresh[fresh_count++] = &table.slots[i];
+        }
+    }
+    qsort(fresh, fresh_count, sizeof(Posting *), compare_postings);
+
+    char temp[PATH_MAX + 72];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *out = fopen(temp, "wb");
+    bool ok = out != NULL;
+    IndexHeader header = { .file_count = file_count };
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    IndexTrigram *trigrams = NULL;
+    uint32_t trigram_count = 0;
+    if (ok) {
+        header.files_offset = sizeof(IndexHeader);
+        fseek(out, header.files_offset, SEEK_SET);
+        uint32_t path_offset = strlen(root) + 1;
+        for (int i = 0; i < file_count; i++) {
+            IndexFile file = { files[i].mtime_ns, files[i].size, path_offset, flags[i] };
+            fwrite(&file, sizeof(file), 1, out);
+            path_offset += strlen(files[i].path) + 1;
+        }
+        header.postings_offset = ftell(out);
+
+        // Merge the old trigram table with the fresh postings, both sorted.
+        uint32_t old_trigrams = old ? old->header->trigram_count : 0;
+        trigrams = malloc(sizeof(IndexTrigram) * (old_trigrams + fresh_count + 1));
+        if (!trigrams) {
+            log_error("search_index.index_write: malloc failed");
+            exit(1);
+        }
+        IdList kept = { 0 }, added = { 0 }, merged = { 0 };
+        const uint8_t *postings_end = old ? (const uint8_t *)old->trigrams : NULL;
+        uint32_t a = 0, b = 0;
+        while (a < old_trigrams || b < fresh_count) {
+            uint32_t old_trigram = a < old_trigrams ? old->trigrams[a].trigram : UINT32_MAX;
+            uint32_t fresh_trigram = b < fresh_count ? fresh[b]->key & 0xffffff : UINT32_MAX;
+            uint32_t trigram = old_trigram < fresh_trigram ? old_trigram : fresh_trigram;
+            kept.count = added.count = merged.count = 0;
+            if (old_trigram == trigram) {
+                IdList raw = { 0 };
+                const IndexTrigram *entry = &old->trigrams[a++];
+                if (entry->offset < (uint64_t)(postings_end - old->postings)) {
+                    decode_postings(old->postings + entry->offset, postings_end, entry->count, &raw);
+                }
+                for (int k = 0; k < raw.count; k++) {
+                    if (raw.ids[k] < old_count && remap[raw.ids[k]] != UINT32_MAX) {
+                        id_list_push(&kept, remap[raw.ids[k]]);
+                    }
+                }
+                free(raw.ids);
+            }
+            if (fresh_trigram == trigram) {
+                Posting *posting = fresh[b++];
+                decode_postings(posting->bytes, posting->bytes + posting->len, UINT32_MAX, &added);
+            }
+            int x = 0, y = 0;
+            while (x < kept.count || y < added.count) {
+                if (y == added.count || (x < kept.count && kept.ids[x] < added.ids[y])) {
+                    id_list_push(&merged, kept.ids[x++]);
+                } else {
+                    id_list_push(&merged, added.ids[y++]);
+                }
+            }
+            if (merged.count > 0) {
+                trigrams[trigram_count++] = (IndexTrigram){ trigram, merged.count, ftell(out) - header.postings_offset };
+                write_postings(out, &merged);
+            }
+        }
+        free(kept.ids);
+        free(added.ids);
+        free(merged.ids);
+
+        long offset = ftell(out);
+        while (offset % 8) {
+            fputc(0, out);
+            offset++;
+        }
+        header.trigrams_offset = offset;
+        header.trigram_count = trigram_count;
+        fwrite(trigrams, sizeof(IndexTrigram), trigram_count, out);
+        header.paths_offset = ftell(out);
+        header.root = 0;
+        fwrite(root, strlen(root) + 1, 1, out);
+        for (int i = 0; i < file_count; i++) {
+            fwrite(files[i].path, strlen(files[i].path) + 1, 1, out);
+        }
+        header.size = ftell(out);
+        fseek(out, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, out);
+        ok = !ferror(out);
+        ok = fclose(out) == 0 && ok;
+        ok = ok && rename(temp, path) == 0;
+        if (!ok) {
+            log_warning("search_index.index_write: unable to write %s", path);
+            unlink(temp);
+        }
+    } else {
+        log_warning("search_index.index_write: unable to create %s", temp);
+    }
+
+    free(trigrams);
+    for (uint32_t i = 0; i < table.capacity; i++) {
+        free(table.slots[i].bytes);
+    }
+    free(table.slots);
+    free(fresh);
+    free(flags);
+    free(remap);
+    return ok;
+}
+
+bool search_index_rebuild(void) {
+    char path[PATH_MAX + 64];
+    char root[PATH_MAX];
+    if (!index_location(path, sizeof(path), root)) {
+        return false;
+    }
+    PERF_START("search_index_rebuild");
+    // The files the search picker lists, plus binary ones: those get no
+    // trigrams, so are never candidates, but listing them spares the next
+    // rebuild reading them again.
+    WalkFile *files;
+    int file_count = walk_files("", WALK_STAT, watch_directory, &files);
+
+    // The first rebuild picks up what an earlier session left on disk.
+    Index *old = current ? current : index_load(path, root);
+    bool ok = index_write(path, root, files, file_count, old);
+    Index *index = ok ? index_load(path, root) : NULL;
+    if (old != current) {
+        index_free(old);
+    }
+    walk_free(files, file_count);
+
+    if (index) {
+        pthread_mutex_lock(&index_lock);
+        old = current;
+        current = index;
+        path_set_clear(&dirty);
+        overflowed = false;
+        pthread_mutex_unlock(&index_lock);
+        index_free(old);
+    }
+    PERF_END();
+    return index != NULL;
+}
+
+static void mark_changed(const char *path) {
+    pthread_mutex_lock(&index_lock);
+    path_set_add(&dirty, path);
+    if (current) {
+        int id = find_file(current, path);
+        if (id >= 0) {
+            current->stale[id] = 1;
+        }
+    }
+    pthread_mutex_unlock(&index_lock);
+}
+
+static void mark_directory(const char *dir) {
+    WalkFile *files;
+    int file_count = walk_files(dir, 0, watch_directory, &files);
+    for (int i = 0; i < file_count; i++) {
+        mark_changed(files[i].path);
+    }
+    walk_free(files, file_count);
+}
+
+// Paths that walk_files would leave out are left out here too, with the
+// rules of the directory the last events came from kept for the next ones.
+static void read_events(void) {
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    WalkRules *rules = NULL;
+    int rules_wd = -1;
+    ssize_t len;
+    while ((len = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + len; ) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                pthread_mutex_lock(&index_lock);
+                overflowed = true;
+                pthread_mutex_unlock(&index_lock);
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= watch_capacity || !watch_paths[event->wd]) {
+                continue;
+            }
+            const char *dir = watch_paths[event->wd];
+            if (event->mask & IN_IGNORED) {
+                free(watch_paths[event->wd]);
+                watch_paths[event->wd] = NULL;
+                if (event->wd == rules_wd) {
+                    rules_wd = -1;
+                }
+                continue;
+            }
+            if (!event->len || strcmp(event->name, ".git") == 0) {
+                continue;
+            }
+            char path[PATH_MAX];
+            int n = dir[0] ? snprintf(path, sizeof(path), "%s/%s", dir, event->name)
+                           : snprintf(path, sizeof(path), "%s", event->name);
+            if (n < 0 || (size_t)n >= sizeof(path)) {
+                continue;
+            }
+            if (event->wd != rules_wd) {
+                if (rules) {
+                    walk_rules_free(rules);
+                }
+                rules = walk_rules_load(dir);
+                rules_wd = event->wd;
+            }
+            if (walk_rules_ignore(rules, path, event->mask & IN_ISDIR)) {
+                continue;
+            }
+            if (!(event->mask & IN_ISDIR)) {
+                mark_changed(path);
+            } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                mark_directory(path);
+            }
+        }
+    }
+    if (rules) {
+        walk_rules_free(rules);
+    }
+}
+
+static void *index_thread(void *arg __attribute__((unused))) {
+    PERF_THREAD_NAME("search index");
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd < 0) {
+        log_warning("search_index.index_thread: inotify_init1 failed, falling back to mtime checks");
+        watches_incomplete = true;
+    }
+    search_index_rebuild();
+
+    long long last_event = 0;
+    long long last_rebuild = now_ms();
+    struct pollfd fds[1] = { { .fd = inotify_fd, .events = POLLIN } };
+    for (;;) {
+        pthread_mutex_lock(&index_lock);
+        bool pending = overflowed || dirty.count >= INDEX_REBUILD_DIRTY;
+        pthread_mutex_unlock(&index_lock);
+        int timeout = pending ? INDEX_SETTLE_MS : watches_incomplete ? INDEX_RESCAN_MS : -1;
+        int ready = poll(fds, inotify_fd >= 0 ? 1 : 0, timeout);
+        if (ready < 0 && errno != EINTR) {
+            log_error("search_index.index_thread: poll failed");
+            break;
+        }
+        long long now = now_ms();
+        if (ready > 0) {
+            read_events();
+            last_event = now;
+        }
+        if ((pending && now - last_event >= INDEX_SETTLE_MS) ||
+            (watches_incomplete && now - last_rebuild >= INDEX_RESCAN_MS)) {
+            search_index_rebuild();
+            last_rebuild = now_ms();
+        }
+    }
+    return NULL;
+}
+
+void search_index_start(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, index_thread, NULL) != 0) {
+        log_error("search_index.search_index_start: unable to create index thread");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_counts(const void *a, const void *b) {
+    uint32_t x = (*(const IndexTrigram *const *)a)->count, y = (*(const IndexTrigram *const *)b)->count;
+    return x < y ? -1 : x > y;
+}
+
+char **search_index_candidates(const char *needle, int *count) {
+    size_t len = strlen(needle);
+    if (len < 3) {
+        return NULL;
+    }
+    pthread_mutex_lock(&index_lock);
+    Index *index = current;
+    if (!index || overflowed) {
+        pthread_mutex_unlock(&index_lock);
+        return NULL;
+    }
+
+    // Intersect the posting lists of the needle's trigrams, rarest first.
+    const IndexTrigram **entries = malloc(sizeof(IndexTrigram *) * len);
+    if (!entries) {
+        log_error("search_index.search_index_candidates: malloc failed");
+        exit(1);
+    }
+    int entry_count = 0;
+    bool missing = false;
+    for (size_t i = 0; i + 2 < len && !missing; i++) {
+        uint32_t trigram = (unsigned char)needle[i] << 16 | (unsigned char)needle[i + 1] << 8 | (unsigned char)needle[i + 2];
+        const IndexTrigram *entry = find_trigram(index, trigram);
+        missing = entry == NULL;
+        entries[entry_count++] = entry;
+    }
+    IdList ids = { 0 }, next = { 0 };
+    const uint8_t *postings_end = (const uint8_t *)index->trigrams;
+    if (!missing) {
+        qsort(entries, entry_count, sizeof(IndexTrigram *), compare_counts);
+        for (int i = 0; i < entry_count && (i == 0 || ids.count > 0); i++) {
+            if (entries[i]->offset >= (uint64_t)(postings_end - index->postings)) {
+                ids.count = 0;
+                break;
+            }
+            if (i > 0 && entries[i] == entries[i - 1]) {
+                continue;
+            }
+            next.count = 0;
+            decode_postings(index->postings + entries[i]->offset, postings_end, entries[i]->count, &next);
+            if (i == 0) {
+                IdList swap = ids;
+                ids = next;
+                next = swap;
+                continue;
+            }
+            int kept = 0;
+            for (int x = 0, y = 0; x < ids.count && y < next.count; ) {
+                if (ids.ids[x] < next.ids[y]) {
+                    x++;
+                } else if (ids.ids[x] > next.ids[y]) {
+                    y++;
+                } else {
+                    ids.ids[kept++] = ids.ids[x];
+                    x++;
+                    y++;
+                }
+            }
+            ids.count = kept;
+        }
+    }
+    free(entries);
+    free(next.ids);
+
+    int capacity = ids.count + index->unindexed_count + dirty.count + 1;
+    char **paths = malloc(sizeof(char *) * capacity);
+    if (!paths) {
+        log_error("search_index.search_index_candidates: malloc failed");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; i < ids.count; i++) {
+        if (ids.ids[i] < index->header->file_count && !index->stale[ids.ids[i]] &&
+            !(index->files[ids.ids[i]].flags & INDEX_FILE_UNINDEXED)) {
+            paths[n++] = strdup(index->paths + index->files[ids.ids[i]].path);
+        }
+    }
+    for (int i = 0; i < index->unindexed_count; i++) {
+        if (!index->stale[index->unindexed[i]]) {
+            paths[n++] = strdup(index->paths + index->files[index->unindexed[i]].path);
+        }
+    }
+    for (int i = 0; i < dirty.capacity; i++) {
+        if (dirty.slots[i]) {
+            paths[n++] = strdup(dirty.slots[i]);
+        }
+    }
+    pthread_mutex_unlock(&index_lock);
+    free(ids.ids);
+
+    for (int i = 0; i < n; i++) {
+        if (!paths[i]) {
+            log_error("search_index.search_index_candidates: strdup failed");
+            exit(1);
+        }
+    }
+    qsort(paths, n, sizeof(char *), compare_paths);
+    *count = n;
+    return paths;
+}
+
+void search_index_free_candidates(char **paths, int count) {
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
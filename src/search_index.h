@@ -0,0 +1,21 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <stdbool.h>
+
+// Starts the index thread for the working directory: it loads the trigram
+// index kept in ~/.cache/arc/index, brings it up to date with the files'
+// mtimes, writes it back, and then follows changes through inotify, folding
+// them in with another rebuild once enough pile up.
+void search_index_start(void);
+// Walks the project and writes and loads a fresh index, reusing what the
+// previous one knew about files whose mtime and size are unchanged.
+bool search_index_rebuild(void);
+// Files that may contain needle, relative to the working directory and in
+// path order: those the index lists under every trigram of needle, plus any
+// changed since it was written. NULL when the index cannot narrow the search,
+// because it is not loaded or needle is shorter than a trigram.
+char **search_index_candidates(const char *needle, int *count);
+void search_index_free_candidates(char **paths, int count);
+
+#endif // SEARCH_INDEX_H
@@ -6,6 +6,8 @@
 #include "tomlc17.h"
 #include "theme.h"
 #include "log.h"
+#define ALLOC_TAG ALLOC_TAG_CONFIG
+#include "alloc.h"
 
 static const CaptureInfo capture_info_table[] = {
     {"constructor", 85, offsetof(Theme, syntax_constant)},
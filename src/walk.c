@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "git.h"
+#include "ignore.h"
+#include "walk.h"
+#include "log.h"
+#include "perf.h"
+#define ALLOC_TAG ALLOC_TAG_PICKER
+#include "alloc.h"
+
+#define WALK_BUFFER_SIZE 32768
+#define WALK_BINARY_PROBE 8000
+
+// The ignore files of one directory, on top of those of the directories above.
+typedef struct WalkIgnore {
+    IgnoreList list;
+    const struct WalkIgnore *parent;
+    bool absolute; // read above the working directory, so matched against absolute paths
+    struct WalkIgnore *next; // every WalkIgnore of the walk, to free them
+} WalkIgnore;
+
+typedef struct {
+    char *path; // no trailing slash, "" for the working directory
+    const WalkIgnore *ignore;
+} WalkDirectory;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    WalkDirectory *queue; // a stack, so threads tend to stay in one subtree
+    int queue_count;
+    int queue_capacity;
+    int active; // directories being read
+    WalkIgnore *ignores;
+    int flags;
+    void (*on_directory)(const char *dir);
+    pthread_mutex_t directory_lock;
+    char cwd[PATH_MAX]; // with a trailing slash, for the absolute ignore files
+} Walk;
+
+typedef struct {
+    Walk *walk;
+    WalkFile *files;
+    int count;
+    int capacity;
+    char *buffer; // getdents64 entries of the directory being read
+    size_t buffer_capacity;
+} WalkWorker;
+
+// Reads the given ignore files of dir, which apply below it, or the files
+// themselves if they are absolute. Returns parent if none has a pattern.
+static const WalkIgnore *ignore_push(Walk *walk, const WalkIgnore *parent, const char *dir,
+                                     const char *const *names, int name_count) {
+    WalkIgnore *ignore = calloc(1, sizeof(WalkIgnore));
+    if (!ignore) {
+        log_error("walk.ignore_push: calloc failed");
+        exit(1);
+    }
+    ignore->list.base_len = dir[0] ? strlen(dir) + 1 : 0;
+    for (int i = 0; i < name_count; i++) {
+        char file[PATH_MAX];
+        int len = names[i][0] == '/' ? snprintf(file, sizeof(file), "%s", names[i])
+                                     : snprintf(file, sizeof(file), "%s%s%s", dir, dir[0] ? "/" : "", names[i]);
+        if (len > 0 && (size_t)len < sizeof(file)) {
+            ignore_list_load(&ignore->list, file);
+        }
+    }
+    if (ignore->list.count == 0) {
+        ignore_list_free(&ignore->list);
+        free(ignore);
+        return parent;
+    }
+    ignore->parent = parent;
+    ignore->absolute = dir[0] == '/';
+    pthread_mutex_lock(&walk->lock);
+    ignore->next = walk->ignores;
+    walk->ignores = ignore;
+    pthread_mutex_unlock(&walk->lock);
+    return ignore;
+}
+
+static const char *const ignore_files[] = { ".gitignore", ".ignore" };
+
+// The rules of the directories above dir still apply to it, up to the work
+// tree and its info/exclude.
+static const WalkIgnore *ignore_above(Walk *walk, const char *dir) {
+    const WalkIgnore *ignore = NULL;
+    GitRepository repo;
+    if (git_find_repository(&repo) && getcwd(walk->cwd, sizeof(walk->cwd) - 1)) {
+        char exclude[PATH_MAX + 16];
+        snprintf(exclude, sizeof(exclude), "%s/info/exclude", repo.common_dir);
+        const char *const exclude_files[] = { exclude };
+        ignore = ignore_push(walk, NULL, repo.work_tree, exclude_files, 1);
+        // git_find_repository walks up from getcwd, so the work tree is a prefix.
+        for (char *slash = walk->cwd + strlen(repo.work_tree); slash && *slash == '/'; slash = strchr(slash + 1, '/')) {
+            *slash = '\0';
+            ignore = ignore_push(walk, ignore, walk->cwd, ignore_files, 2);
+            *slash = '/';
+        }
+        strcat(walk->cwd, "/");
+    }
+    char ancestor[PATH_MAX];
+    for (const char *slash = dir; dir[0] && slash; slash = strchr(slash + 1, '/')) {
+        size_t len = slash == dir ? 0 : (size_t)(slash - dir);
+        if (len >= sizeof(ancestor)) {
+            break;
+        }
+        memcpy(ancestor, dir, len);
+        ancestor[len] = '\0';
+        ignore = ignore_push(walk, ignore, ancestor, ignore_files, 2);
+    }
+    return ignore;
+}
+
+static void ignore_free_all(Walk *walk) {
+    while (walk->ignores) {
+        WalkIgnore *next = walk->ignores->next;
+        ignore_list_free(&walk->ignores->list);
+        free(walk->ignores);
+        walk->ignores = next;
+    }
+}
+
+// Deeper files take precedence.
+static bool is_ignored(const Walk *walk, const WalkIgnore *ignore, const char *path, bool is_dir) {
+    char absolute[PATH_MAX * 2];
+    absolute[0] = '\0';
+    for (; ignore; ignore = ignore->parent) {
+        const char *subject = path;
+        if (ignore->absolute) {
+            if (!absolute[0]) {
+                snprintf(absolute, sizeof(absolute), "%s%s", walk->cwd, path);
+            }
+            subject = absolute;
+        }
+        int matched = ignore_list_match(&ignore->list, subject, is_dir);
+        if (matched) {
+            return matched > 0;
+        }
+    }
+    return false;
+}
+
+// A symlink to a directory that contains one the walk went through to reach
+// it, directly or by other symlinks, would be walked forever.
+static bool is_symlink_loop(const char *dir, const char *path) {
+    char target[PATH_MAX];
+    if (!realpath(path, target)) {
+        return true;
+    }
+    size_t len = strlen(target);
+    char ancestor[PATH_MAX];
+    snprintf(ancestor, sizeof(ancestor), "%s", dir);
+    for (;;) {
+        char real[PATH_MAX];
+        if (!realpath(ancestor[0] ? ancestor : ".", real)) {
+            return true;
+        }
+        if (strncmp(real, target, len) == 0 && (real[len] == '\0' || real[len] == '/' || len == 1)) {
+            return true;
+        }
+        if (!ancestor[0]) {
+            return false;
+        }
+        char *slash = strrchr(ancestor, '/');
+        *(slash ? slash : ancestor) = '\0';
+    }
+}
+
+static bool is_binary(int dir_fd, const char *name) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return true; // unreadable, so not worth listing either
+    }
+    char probe[WALK_BINARY_PROBE];
+    ssize_t len = read(fd, probe, sizeof(probe));
+    close(fd);
+    return len > 0 && memchr(probe, '\0', len) != NULL;
+}
+
+static void worker_add_file(WalkWorker *worker, const char *path, const struct stat *st) {
+    if (worker->count == worker->capacity) {
+        worker->capacity = worker->capacity ? worker->capacity * 2 : 256;
+        WalkFile *grown = realloc(worker->files, sizeof(WalkFile) * worker->capacity);
+        if (!grown) {
+            log_error("walk.worker_add_file: realloc failed");
+            exit(1);
+        }
+        worker->files = grown;
+    }
+    WalkFile *file = &worker->files[worker->count++];
+    file->path = strdup(path);
+    if (!file->path) {
+        log_error("walk.worker_add_file: strdup failed");
+        exit(1);
+    }
+    file->mtime_ns = st ? st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec : 0;
+    file->size = st ? st->st_size : 0;
+}
+
+static void walk_push(Walk *walk, char *path, const WalkIgnore *ignore) {
+    if (walk->queue_count == walk->queue_capacity) {
+        walk->queue_capacity = walk->queue_capacity ? walk->queue_capacity * 2 : 64;
+        WalkDirectory *grown = realloc(walk->queue, sizeof(WalkDirectory) * walk->queue_capacity);
+        if (!grown) {
+            log_error("walk.walk_push: realloc failed");
+            exit(1);
+        }
+        walk->queue = grown;
+    }
+    walk->queue[walk->queue_count++] = (WalkDirectory){ path, ignore };
+}
+
+// Reads all of a directory before looking at its entries, so that its own
+// ignore files apply to them.
+static bool read_entries(WalkWorker *worker, int fd, size_t *used) {
+    *used = 0;
+    for (;;) {
+        if (worker->buffer_capacity - *used < WALK_BUFFER_SIZE / 2) {
+            worker->buffer_capacity = worker->buffer_capacity ? worker->buffer_capacity * 2 : WALK_BUFFER_SIZE;
+            worker->buffer = realloc(worker->buffer, worker->buffer_capacity);
+            if (!worker->buffer) {
+                log_error("walk.read_entries: realloc failed");
+                exit(1);
+            }
+        }
+        ssize_t len = getdents64(fd, worker->buffer + *used, worker->buffer_capacity - *used);
+        if (len < 0) {
+            return false;
+        }
+        if (len == 0) {
+            return true;
+        }
+        *used += len;
+    }
+}
+
+static void walk_directory(WalkWorker *worker, WalkDirectory dir) {
+    Walk *walk = worker->walk;
+    int fd = open(dir.path[0] ? dir.path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    size_t used;
+    if (fd < 0 || !read_entries(worker, fd, &used)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(dir.path);
+        return;
+    }
+    if (walk->on_directory) {
+        pthread_mutex_lock(&walk->directory_lock);
+        walk->on_directory(dir.path);
+        pthread_mutex_unlock(&walk->directory_lock);
+    }
+
+    bool has_gitignore = false, has_ignore = false;
+    for (size_t offset = 0; offset < used; offset += ((struct dirent64 *)(worker->buffer + offset))->d_reclen) {
+        const char *name = ((struct dirent64 *)(worker->buffer + offset))->d_name;
+        has_gitignore |= strcmp(name, ".gitignore") == 0;
+        has_ignore |= strcmp(name, ".ignore") == 0;
+    }
+    // .ignore goes last so that it wins, as in ripgrep.
+    const char *ignore_names[2];
+    int ignore_count = 0;
+    if (has_gitignore) {
+        ignore_names[ignore_count++] = ".gitignore";
+    }
+    if (has_ignore) {
+        ignore_names[ignore_count++] = ".ignore";
+    }
+    const WalkIgnore *ignore = ignore_count ? ignore_push(walk, dir.ignore, dir.path, ignore_names, ignore_count)
+                                            : dir.ignore;
+
+    char **subdirectories = NULL;
+    int subdirectory_count = 0;
+    int subdirectory_capacity = 0;
+    for (size_t offset = 0; offset < used; ) {
+        const struct dirent64 *entry = (const struct dirent64 *)(worker->buffer + offset);
+        offset += entry->d_reclen;
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0 ||
+            (name[0] == '.' && (walk->flags & WALK_SKIP_HIDDEN))) {
+            continue;
+        }
+        char path[PATH_MAX];
+        int len = dir.path[0] ? snprintf(path, sizeof(path), "%s/%s", dir.path, name)
+                              : snprintf(path, sizeof(path), "%s", name);
+        if (len < 0 || (size_t)len >= sizeof(path)) {
+            continue;
+        }
+        // d_type saves a stat per entry, except on the odd filesystem that
+        // leaves it unknown. Symlinks are followed to what they point at.
+        unsigned char type = entry->d_type;
+        struct stat st;
+        bool have_stat = false;
+        if (type == DT_UNKNOWN) {
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+            have_stat = true;
+        }
+        if (type == DT_LNK) {
+            if (fstatat(fd, name, &st, 0) != 0) {
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) && !is_symlink_loop(dir.path, path) ? DT_DIR
+                   : S_ISREG(st.st_mode)                                  ? DT_REG
+                                                                          : DT_UNKNOWN;
+            have_stat = true;
+        }
+        if ((type != DT_DIR && type != DT_REG) || is_ignored(walk, ignore, path, type == DT_DIR)) {
+            continue;
+        }
+        if (type == DT_DIR) {
+            if (subdirectory_count == subdirectory_capacity) {
+                subdirectory_capacity = subdirectory_capacity ? subdirectory_capacity * 2 : 16;
+                subdirectories = realloc(subdirectories, sizeof(char *) * subdirectory_capacity);
+                if (!subdirectories) {
+                    log_error("walk.walk_directory: realloc failed");
+                    exit(1);
+                }
+            }
+            subdirectories[subdirectory_count] = strdup(path);
+            if (!subdirectories[subdirectory_count]) {
+                log_error("walk.walk_directory: strdup failed");
+                exit(1);
+            }
+            subdirectory_count++;
+            continue;
+        }
+        if ((walk->flags & WALK_STAT) && !have_stat) {
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            have_stat = true;
+        }
+        if ((walk->flags & WALK_SKIP_BINARY) && is_binary(fd, name)) {
+            continue;
+        }
+        worker_add_file(worker, path, have_stat ? &st : NULL);
+    }
+    close(fd);
+    free(dir.path);
+
+    if (subdirectory_count > 0) {
+        pthread_mutex_lock(&walk->lock);
+        for (int i = 0; i < subdirectory_count; i++) {
+            walk_push(walk, subdirectories[i], ignore);
+        }
+        pthread_cond_broadcast(&walk->cond);
+        pthread_mutex_unlock(&walk->lock);
+    }
+    free(subdirectories);
+}
+
+static void *walk_worker(void *arg) {
+    WalkWorker *worker = arg;
+    Walk *walk = worker->walk;
+    pthread_mutex_lock(&walk->lock);
+    for (;;) {
+        while (walk->queue_count == 0 && walk->active > 0) {
+            pthread_cond_wait(&walk->cond, &walk->lock);
+        }
+        if (walk->queue_count == 0) {
+            break;
+        }
+        WalkDirectory dir = walk->queue[--walk->queue_count];
+        walk->active++;
+        pthread_mutex_unlock(&walk->lock);
+        walk_directory(worker, dir);
+        pthread_mutex_lock(&walk->lock);
+        if (--walk->active == 0 && walk->queue_count == 0) {
+            pthread_cond_broadcast(&walk->cond);
+        }
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+static int compare_files(const void *a, const void *b) {
+    return strcmp(((const WalkFile *)a)->path, ((const WalkFile *)b)->path);
+}
+
+int walk_files(const char *dir, int flags, void (*on_directory)(const char *dir), WalkFile **files) {
+    PERF_START("walk_files");
+    Walk walk = { .flags = flags, .on_directory = on_directory };
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.cond, NULL);
+    pthread_mutex_init(&walk.directory_lock, NULL);
+
+    const WalkIgnore *ignore = ignore_above(&walk, dir);
+    char *root = strdup(dir);
+    if (!root) {
+        log_error("walk.walk_files: strdup failed");
+        exit(1);
+    }
+    walk_push(&walk, root, ignore);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = cpus < 1 ? 1 : cpus > WALK_MAX_THREADS ? WALK_MAX_THREADS : (int)cpus;
+    WalkWorker workers[WALK_MAX_THREADS] = { 0 };
+    pthread_t threads[WALK_MAX_THREADS];
+    bool started[WALK_MAX_THREADS] = { false };
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].walk = &walk;
+    }
+    for (int i = 1; i < thread_count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, walk_worker, &workers[i]) == 0;
+    }
+    walk_worker(&workers[0]);
+    int count = 0;
+    for (int i = 0; i < thread_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        count += workers[i].count;
+    }
+
+    *files = malloc(sizeof(WalkFile) * (count ? count : 1));
+    if (!*files) {
+        log_error("walk.walk_files: malloc failed");
+        exit(1);
+    }
+    count = 0;
+    for (int i = 0; i < thread_count; i++) {
+        if (workers[i].count) {
+            memcpy(*files + count, workers[i].files, sizeof(WalkFile) * workers[i].count);
+        }
+        count += workers[i].count;
+        free(workers[i].files);
+        free(workers[i].buffer);
+    }
+    qsort(*files, count, sizeof(WalkFile), compare_files);
+
+    ignore_free_all(&walk);
+    free(walk.queue);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.cond);
+    pthread_mutex_destroy(&walk.directory_lock);
+    PERF_END();
+    return count;
+}
+
+void walk_free(WalkFile *files, int count) {
+    for (int i = 0; i < count; i++) {
+        free(files[i].path);
+    }
+    free(files);
+}
+
+struct WalkRules {
+    Walk walk; // only holds the ignore files
+    const WalkIgnore *ignore;
+};
+
+WalkRules *walk_rules_load(const char *dir) {
+    WalkRules *rules = calloc(1, sizeof(WalkRules));
+    if (!rules) {
+        log_error("walk.walk_rules_load: calloc failed");
+        exit(1);
+    }
+    pthread_mutex_init(&rules->walk.lock, NULL);
+    rules->ignore = ignore_push(&rules->walk, ignore_above(&rules->walk, dir), dir, ignore_files, 2);
+    return rules;
+}
+
+bool walk_rules_ignore(const WalkRules *rules, const char *path, bool is_dir) {
+    return is_ignored(&rules->walk, rules->ignore, path, is_dir);
+}
+
+void walk_rules_free(WalkRules *rules) {
+    ignore_free_all(&rules->walk);
+    pthread_mutex_destroy(&rules->walk.lock);
+    free(rules);
+}
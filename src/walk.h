@@ -0,0 +1,39 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WALK_MAX_THREADS 8
+
+enum {
+    WALK_STAT = 1,        // fill in mtime_ns and size
+    WALK_SKIP_HIDDEN = 2, // leave out names starting with '.'
+    WALK_SKIP_BINARY = 4, // leave out files with a NUL near the start
+};
+
+typedef struct {
+    char *path; // relative to the working directory
+    int64_t mtime_ns;
+    int64_t size;
+} WalkFile;
+
+// Lists the regular files below dir, relative to the working directory and
+// "" for all of it, sorted by path. Directories are read on a pool of
+// threads. Symlinks are followed, except to a directory the walk is already
+// in. .git and whatever the .gitignore and .ignore files along the way, from
+// the work tree down, or info/exclude ignore are left out. on_directory, if
+// set, is called with each directory visited, dir included, from any of the
+// threads but never two at once.
+int walk_files(const char *dir, int flags, void (*on_directory)(const char *dir), WalkFile **files);
+void walk_free(WalkFile *files, int count);
+
+// The ignore files that walk_files applies to the entries of dir, for
+// checking paths that show up later without walking again.
+typedef struct WalkRules WalkRules;
+WalkRules *walk_rules_load(const char *dir);
+// Whether walk_files would leave out path, an entry of the rules' dir.
+bool walk_rules_ignore(const WalkRules *rules, const char *path, bool is_dir);
+void walk_rules_free(WalkRules *rules);
+
+#endif // WALK_H
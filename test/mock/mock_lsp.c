@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200809L
+
+// A scriptable stand-in language server for tests and benchmarks.
+//
+//   mock_lsp [--sync N] storm FILES PER_FILE [ROUNDS]
+//       After `initialized`, publishes PER_FILE diagnostics for each of FILES
+//       synthetic documents, ROUNDS times. Every didOpen and didChange gets
+//       PER_FILE diagnostics for its own document.
+//
+//   mock_lsp replay SESSION
+//       Plays back a recorded session. Each line is one of
+//         expect <method>   skip client messages until one with this method
+//         send <json>       write a message; "$id" becomes the id of the
+//                           last expected message
+//         sleep <ms>
+//       Blank lines and lines starting with # are ignored.
+//
+// In both modes shutdown gets a null result and exit ends the process.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "cJSON.h"
+
+static int sync_kind = 2;
+
+static void send_raw(const char *body, size_t len) {
+    printf("Content-Length: %zu\r\n\r\n", len);
+    fwrite(body, 1, len, stdout);
+    fflush(stdout);
+}
+
+static void send_json(cJSON *message) {
+    char *body = cJSON_PrintUnformatted(message);
+    send_raw(body, strlen(body));
+    free(body);
+    cJSON_Delete(message);
+}
+
+static cJSON *read_message(void) {
+    char line[256];
+    long length = -1;
+    while (fgets(line, sizeof(line), stdin)) {
+        if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0) {
+            if (length < 0) {
+                return NULL;
+            }
+            char *body = malloc(length + 1);
+            if (!body || fread(body, 1, length, stdin) != (size_t)length) {
+                free(body);
+                return NULL;
+            }
+            body[length] = '\0';
+            cJSON *message = cJSON_ParseWithLength(body, length);
+            free(body);
+            return message;
+        }
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            length = strtol(line + 15, NULL, 10);
+        }
+    }
+    return NULL;
+}
+
+static const char *message_method(cJSON *message) {
+    cJSON *method = cJSON_GetObjectItem(message, "method");
+    return cJSON_IsString(method) ? method->valuestring : NULL;
+}
+
+static void reply(cJSON *request, cJSON *result) {
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "jsonrpc", "2.0");
+    cJSON_AddItemToObject(response, "id", cJSON_Duplicate(cJSON_GetObjectItem(request, "id"), 1));
+    cJSON_AddItemToObject(response, "result", result ? result : cJSON_CreateNull());
+    send_json(response);
+}
+
+static void publish(const char *uri, int count, int round) {
+    cJSON *message = cJSON_CreateObject();
+    cJSON_AddStringToObject(message, "jsonrpc", "2.0");
+    cJSON_AddStringToObject(message, "method", "textDocument/publishDiagnostics");
+    cJSON *params = cJSON_CreateObject();
+    cJSON_AddStringToObject(params, "uri", uri);
+    cJSON *diagnostics = cJSON_CreateArray();
+    for (int i = 0; i < count; i++) {
+        cJSON *diagnostic = cJSON_CreateObject();
+        cJSON *range = cJSON_CreateObject();
+        cJSON *start = cJSON_CreateObject();
+        cJSON_AddNumberToObject(start, "line", i);
+        cJSON_AddNumberToObject(start, "character", 0);
+        cJSON *end = cJSON_CreateObject();
+        cJSON_AddNumberToObject(end, "line", i);
+        cJSON_AddNumberToObject(end, "character", 8);
+        cJSON_AddItemToObject(range, "start", start);
+        cJSON_AddItemToObject(range, "end", end);
+        cJSON_AddItemToObject(diagnostic, "range", range);
+        cJSON_AddNumberToObject(diagnostic, "severity", i % 4 + 1);
+        char text[96];
+        snprintf(text, sizeof(text), "mock diagnostic %d of round %d: unused variable 'value_%d'", i, round, i);
+        cJSON_AddStringToObject(diagnostic, "message", text);
+        cJSON_AddItemToArray(diagnostics, diagnostic);
+    }
+    cJSON_AddItemToObject(params, "diagnostics", diagnostics);
+    cJSON_AddItemToObject(message, "params", params);
+    send_json(message);
+}
+
+static const char *document_uri(cJSON *message) {
+    cJSON *params = cJSON_GetObjectItem(message, "params");
+    cJSON *document = params ? cJSON_GetObjectItem(params, "textDocument") : NULL;
+    cJSON *uri = document ? cJSON_GetObjectItem(document, "uri") : NULL;
+    return cJSON_IsString(uri) ? uri->valuestring : NULL;
+}
+
+// Answers the requests every session needs. Returns 0 on exit.
+static int handle_common(cJSON *message) {
+    const char *method = message_method(message);
+    if (!method) {
+        return 1;
+    }
+    if (strcmp(method, "initialize") == 0) {
+        cJSON *result = cJSON_CreateObject();
+        cJSON *capabilities = cJSON_CreateObject();
+        cJSON *sync = cJSON_CreateObject();
+        cJSON_AddBoolToObject(sync, "openClose", 1);
+        cJSON_AddNumberToObject(sync, "change", sync_kind);
+        cJSON_AddItemToObject(capabilities, "textDocumentSync", sync);
+        cJSON_AddItemToObject(result, "capabilities", capabilities);
+        reply(message, result);
+    } else if (strcmp(method, "shutdown") == 0) {
+        reply(message, NULL);
+    } else if (strcmp(method, "exit") == 0) {
+        return 0;
+    } else if (cJSON_GetObjectItem(message, "id")) {
+        reply(message, NULL);
+    }
+    return 1;
+}
+
+static int run_storm(int files, int per_file, int rounds) {
+    cJSON *message;
+    while ((message = read_message())) {
+        const char *method = message_method(message);
+        if (method && strcmp(method, "initialized") == 0) {
+            for (int round = 0; round < rounds; round++) {
+                for (int i = 0; i < files; i++) {
+                    char uri[64];
+                    snprintf(uri, sizeof(uri), "file:///mock_lsp/file%d.c", i);
+                    publish(uri, per_file, round);
+                }
+            }
+        } else if (method && (strcmp(method, "textDocument/didOpen") == 0 ||
+                              strcmp(method, "textDocument/didChange") == 0)) {
+            const char *uri = document_uri(message);
+            if (uri) {
+                publish(uri, per_file, 0);
+            }
+        } else if (!handle_common(message)) {
+            cJSON_Delete(message);
+            return 0;
+        }
+        cJSON_Delete(message);
+    }
+    return 0;
+}
+
+static void send_script_line(const char *json, int id) {
+    size_t len = strlen(json);
+    char *body = malloc(len + 16);
+    if (!body) {
+        exit(1);
+    }
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (strncmp(json + i, "$id", 3) == 0) {
+            out += sprintf(body + out, "%d", id);
+            i += 2;
+        } else {
+            body[out++] = json[i];
+        }
+    }
+    send_raw(body, out);
+    free(body);
+}
+
+static int run_replay(const char *path) {
+    FILE *script = fopen(path, "r");
+    if (!script) {
+        fprintf(stderr, "mock_lsp: cannot open %s\n", path);
+        return 1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    int last_id = 0;
+    while ((length = getline(&line, &capacity, script)) > 0) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#') {
+            continue;
+        }
+        if (strncmp(line, "send ", 5) == 0) {
+            send_script_line(line + 5, last_id);
+        } else if (strncmp(line, "sleep ", 6) == 0) {
+            long ms = strtol(line + 6, NULL, 10);
+            struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+            nanosleep(&ts, NULL);
+        } else if (strncmp(line, "expect ", 7) == 0) {
+            cJSON *message;
+            while ((message = read_message())) {
+                const char *method = message_method(message);
+                if (method && strcmp(method, line + 7) == 0) {
+                    cJSON *id = cJSON_GetObjectItem(message, "id");
+                    last_id = cJSON_IsNumber(id) ? id->valueint : 0;
+                    cJSON_Delete(message);
+                    break;
+                }
+                int running = handle_common(message);
+                cJSON_Delete(message);
+                if (!running) {
+                    free(line);
+                    fclose(script);
+                    return 0;
+                }
+            }
+            if (!message) {
+                break;
+            }
+        } else {
+            fprintf(stderr, "mock_lsp: bad script line: %s\n", line);
+        }
+    }
+    free(line);
+    fclose(script);
+
+    cJSON *message;
+    while ((message = read_message())) {
+        int running = handle_common(message);
+        cJSON_Delete(message);
+        if (!running) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: mock_lsp [--sync N] storm FILES PER_FILE [ROUNDS]\n"
+            "       mock_lsp [--sync N] replay SESSION\n");
+}
+
+int main(int argc, char *argv[]) {
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "--sync") == 0) {
+        sync_kind = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (arg + 2 < argc && strcmp(argv[arg], "storm") == 0) {
+        int rounds = arg + 3 < argc ? atoi(argv[arg + 3]) : 1;
+        return run_storm(atoi(argv[arg + 1]), atoi(argv[arg + 2]), rounds);
+    }
+    if (arg + 1 < argc && strcmp(argv[arg], "replay") == 0) {
+        return run_replay(argv[arg + 1]);
+    }
+    usage();
+    return 1;
+}
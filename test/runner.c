@@ -6,6 +6,12 @@
 #include "test_undo.h"
 #include "test_picker.h"
 #include "test_lsp.h"
+#include "test_diff.h"
+#include "test_git.h"
+#include "test_git_status.h"
+#include "test_project_search.h"
+#include "test_search_index.h"
+#include "test_walk.h"
 #include <stdio.h>
 #include <unistd.h>
 
@@ -164,6 +170,12 @@ int main(void) {
     test_helper("test_mid_file_multi_line_from_bottom_dap", "foo\n\nbar\nbaz\n\nbat", 3, 0, "dap", "foo\n\nbat");
 
     test_lsp_suite();
+    test_diff_suite();
+    test_git_suite();
+    test_git_status_suite();
+    test_project_search_suite();
+    test_search_index_suite();
+    test_walk_suite();
     run_normal_tests();
     run_undo_tests();
     test_picker_suite();
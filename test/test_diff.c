@@ -0,0 +1,74 @@
+#include "test.h"
+#include "test_diff.h"
+#include "../src/diff.h"
+
+#define MAX_TEST_LINES 16
+
+// Diffs two texts given one character per line.
+static int diff_chars(const char *old_text, const char *new_text, DiffHunk **hunks) {
+    uint64_t old_lines[MAX_TEST_LINES], new_lines[MAX_TEST_LINES];
+    int old_count = strlen(old_text), new_count = strlen(new_text);
+    for (int i = 0; i < old_count; i++) old_lines[i] = diff_hash_line(old_text + i, 1);
+    for (int i = 0; i < new_count; i++) new_lines[i] = diff_hash_line(new_text + i, 1);
+    return diff_lines(old_lines, old_count, new_lines, new_count, hunks);
+}
+
+static void assert_hunk(const char *test_name, const DiffHunk *h, int old_start, int old_count,
+                        int new_start, int new_count) {
+    ASSERT(test_name, h->old_start == old_start && h->old_count == old_count &&
+                      h->new_start == new_start && h->new_count == new_count);
+    if (h->old_start != old_start || h->old_count != old_count ||
+        h->new_start != new_start || h->new_count != new_count) {
+        fprintf(stderr, "  got -%d,%d +%d,%d\n", h->old_start, h->old_count, h->new_start, h->new_count);
+    }
+}
+
+static void test_diff_hunks() {
+    printf("  - test_diff_hunks\n");
+    DiffHunk *hunks;
+
+    ASSERT_EQUAL("identical", diff_chars("abc", "abc", &hunks), 0);
+    free(hunks);
+
+    ASSERT_EQUAL("one modified line", diff_chars("abcde", "abXde", &hunks), 1);
+    assert_hunk("modified", &hunks[0], 3, 1, 3, 1);
+    free(hunks);
+
+    // -U0 numbers an empty side by the line before the change.
+    ASSERT_EQUAL("inserted lines", diff_chars("abc", "abXYc", &hunks), 1);
+    assert_hunk("inserted", &hunks[0], 2, 0, 3, 2);
+    free(hunks);
+
+    ASSERT_EQUAL("deleted line", diff_chars("abcd", "abd", &hunks), 1);
+    assert_hunk("deleted", &hunks[0], 3, 1, 2, 0);
+    free(hunks);
+
+    ASSERT_EQUAL("insert at top", diff_chars("ab", "Xab", &hunks), 1);
+    assert_hunk("insert at top", &hunks[0], 0, 0, 1, 1);
+    free(hunks);
+
+    ASSERT_EQUAL("into empty file", diff_chars("", "ab", &hunks), 1);
+    assert_hunk("into empty file", &hunks[0], 0, 0, 1, 2);
+    free(hunks);
+
+    ASSERT_EQUAL("separate hunks", diff_chars("abcdefgh", "aXcdefYh", &hunks), 2);
+    assert_hunk("first of two", &hunks[0], 2, 1, 2, 1);
+    assert_hunk("second of two", &hunks[1], 7, 1, 7, 1);
+    free(hunks);
+
+    // Myers' paper example: an edit distance of 5.
+    int count = diff_chars("abcabba", "cbabac", &hunks);
+    int removed = 0, added = 0;
+    for (int i = 0; i < count; i++) {
+        removed += hunks[i].old_count;
+        added += hunks[i].new_count;
+    }
+    ASSERT_EQUAL("shortest script removes", removed, 3);
+    ASSERT_EQUAL("shortest script adds", added, 2);
+    free(hunks);
+}
+
+void test_diff_suite(void) {
+    printf("--- Diff tests ---\n");
+    test_diff_hunks();
+}
@@ -0,0 +1,6 @@
+#ifndef TEST_DIFF_H
+#define TEST_DIFF_H
+
+void test_diff_suite(void);
+
+#endif // TEST_DIFF_H
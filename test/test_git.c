@@ -0,0 +1,277 @@
+#define _DEFAULT_SOURCE
+
+#include <unistd.h>
+#include <limits.h>
+#include "test.h"
+#include "test_git.h"
+#include "../src/buffer.h"
+#include "../src/git.h"
+#include "../src/git_blame.h"
+
+#define GIT_COMMIT "git -c user.name=test -c user.email=test@localhost -c commit.gpgsign=false commit -q"
+
+// Creates a scratch repository, runs setup in it and moves into it.
+static bool repository_open(char *dir, char *cwd, size_t cwd_size, const char *setup) {
+    if (!getcwd(cwd, cwd_size) || !mkdtemp(dir)) {
+        return false;
+    }
+    char command[PATH_MAX * 2];
+    snprintf(command, sizeof(command), "cd '%s' && git init -q && %s", dir, setup);
+    return system(command) == 0 && chdir(dir) == 0;
+}
+
+static void repository_close(const char *dir, const char *cwd) {
+    git_shutdown(); // cat-file runs in the scratch repository
+    if (chdir(cwd) != 0) {
+        ASSERT("restore working directory", 0);
+    }
+    char command[PATH_MAX * 2];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    ASSERT("remove scratch repository", system(command) == 0);
+}
+
+static BufferLine *line_new(const char *text, size_t len) {
+    BufferLine *line = calloc(1, sizeof(BufferLine));
+    line->text = strndup(text, len);
+    line->text_len = len;
+    return line;
+}
+
+// Only what git.c reads of a buffer: its file name and lines. As in a
+// loaded buffer, text ending in a newline leaves an empty last line.
+static void buffer_set_text(Buffer *b, const char *text) {
+    for (int i = 0; i < b->line_count; i++) {
+        buffer_line_destroy(b->lines[i]);
+        free(b->lines[i]);
+    }
+    b->line_count = 1;
+    for (const char *p = text; *p; p++) {
+        b->line_count += *p == '\n';
+    }
+    b->lines = realloc(b->lines, sizeof(BufferLine *) * b->line_count);
+    const char *p = text;
+    for (int i = 0; i < b->line_count; i++) {
+        size_t len = strcspn(p, "\n");
+        b->lines[i] = line_new(p, len);
+        p += len + (p[len] == '\n');
+    }
+}
+
+// Replaces lines [start, old_end] with the lines of text and notes the edit
+// the way buffer edits do.
+static void buffer_replace_lines(Buffer *b, int start, int old_end, const char *text) {
+    int count = 1;
+    for (const char *p = text; *p; p++) {
+        count += *p == '\n';
+    }
+    int line_count = b->line_count - (old_end - start + 1) + count;
+    BufferLine **lines = malloc(sizeof(BufferLine *) * line_count);
+    memcpy(lines, b->lines, sizeof(BufferLine *) * start);
+    const char *p = text;
+    for (int i = 0; i < count; i++) {
+        size_t len = strcspn(p, "\n");
+        lines[start + i] = line_new(p, len);
+        p += len + (p[len] == '\n');
+    }
+    memcpy(lines + start + count, b->lines + old_end + 1, sizeof(BufferLine *) * (b->line_count - old_end - 1));
+    for (int i = start; i <= old_end; i++) {
+        buffer_line_destroy(b->lines[i]);
+        free(b->lines[i]);
+    }
+    free(b->lines);
+    b->lines = lines;
+    b->line_count = line_count;
+    git_note_edit(b, start, old_end, start + count - 1);
+}
+
+static void buffer_free_text(Buffer *b) {
+    buffer_set_text(b, "");
+    buffer_line_destroy(b->lines[0]);
+    free(b->lines[0]);
+    free(b->lines);
+    free(b->hunks);
+    git_release_head(b);
+}
+
+static void hunks_text(const Buffer *b, char *out, size_t size) {
+    out[0] = '\0';
+    for (int i = 0; i < b->hunk_count; i++) {
+        size_t len = strlen(out);
+        const GitHunk *h = &b->hunks[i];
+        snprintf(out + len, size - len, "%s-%d,%d +%d,%d", i ? " " : "", h->old_start, h->old_count,
+                 h->new_start, h->new_count);
+    }
+}
+
+// Edits made after HEAD moves still diff against the cached HEAD version
+// until the generation is bumped; then it is read again.
+static void test_git_head_cache() {
+    printf("  - test_git_head_cache\n");
+    char cwd[PATH_MAX];
+    char dir[] = "/tmp/arc_test_git_XXXXXX";
+    if (!repository_open(dir, cwd, sizeof(cwd), "printf 'a\\nb\\nc\\n' > f.txt && git add f.txt && " GIT_COMMIT " -m one")) {
+        ASSERT("git setup", 0);
+        return;
+    }
+    Buffer b = { .file_name = "f.txt" };
+    char hunks[256];
+    buffer_set_text(&b, "a\nb\nc\n");
+    git_update_diff(&b);
+    hunks_text(&b, hunks, sizeof(hunks));
+    ASSERT_STRING_EQUAL("same as HEAD", hunks, "");
+
+    ASSERT("move HEAD", system("printf 'a\\nX\\nc\\n' > f.txt && " GIT_COMMIT " -am two") == 0);
+    buffer_set_text(&b, "A\nb\nc\n");
+    git_note_edit(&b, 0, 0, 0);
+    git_update_diff(&b);
+    hunks_text(&b, hunks, sizeof(hunks));
+    ASSERT_STRING_EQUAL("cached HEAD", hunks, "-1,1 +1,1");
+    ASSERT("not outdated", !git_diff_outdated(&b));
+
+    git_invalidate_head();
+    ASSERT("outdated", git_diff_outdated(&b));
+    git_update_diff(&b);
+    hunks_text(&b, hunks, sizeof(hunks));
+    ASSERT_STRING_EQUAL("new HEAD", hunks, "-1,2 +1,2");
+
+    buffer_free_text(&b);
+    repository_close(dir, cwd);
+}
+
+// Checks the hunks git_update_diff splices together after the edits noted
+// since the last diff against a full diff of the same text.
+static void assert_window_diff(const char *test_name, Buffer *b, Buffer *full) {
+    git_update_diff(b);
+    char text[1024] = "";
+    for (int i = 0; i < b->line_count; i++) {
+        size_t len = strlen(text);
+        snprintf(text + len, sizeof(text) - len, "%s%s", i ? "\n" : "", b->lines[i]->text);
+    }
+    buffer_set_text(full, text);
+    git_note_unknown_edit(full);
+    git_update_diff(full);
+    char spliced[256], expected[256];
+    hunks_text(b, spliced, sizeof(spliced));
+    hunks_text(full, expected, sizeof(expected));
+    ASSERT_STRING_EQUAL(test_name, spliced, expected);
+}
+
+// Edits inside, between and across existing hunks, several at a time, and
+// one that undoes a hunk.
+static void test_git_window_diff() {
+    printf("  - test_git_window_diff\n");
+    char cwd[PATH_MAX];
+    char dir[] = "/tmp/arc_test_git_XXXXXX";
+    if (!repository_open(dir, cwd, sizeof(cwd),
+                         "printf 'a\\nb\\nc\\nd\\ne\\nf\\ng\\nh\\ni\\nj\\nk\\nl\\nm\\nn\\no\\np\\nq\\nr\\ns\\nt\\n' > f.txt && "
+                         "git add f.txt && " GIT_COMMIT " -m one")) {
+        ASSERT("git setup", 0);
+        return;
+    }
+    Buffer b = { .file_name = "f.txt" };
+    Buffer full = { .file_name = "f.txt" };
+    buffer_set_text(&b, "a\nb\nc\nd\ne\nf\ng\nh\ni\nj\nk\nl\nm\nn\no\np\nq\nr\ns\nt\n");
+    assert_window_diff("unchanged", &b, &full);
+    ASSERT_EQUAL("no hunks", b.hunk_count, 0);
+
+    buffer_replace_lines(&b, 5, 5, "F");
+    assert_window_diff("change a line", &b, &full);
+    buffer_replace_lines(&b, 12, 12, "M");
+    assert_window_diff("second hunk", &b, &full);
+    buffer_replace_lines(&b, 8, 8, "x\ny\ni");
+    assert_window_diff("insert between hunks", &b, &full);
+    buffer_replace_lines(&b, 4, 7, "h");
+    assert_window_diff("delete across a hunk", &b, &full);
+    buffer_replace_lines(&b, 10, 12, "L\nm\nN\nO");
+    assert_window_diff("insert across a hunk", &b, &full);
+    buffer_replace_lines(&b, 1, 1, "B");
+    buffer_replace_lines(&b, 8, 9, "k");
+    buffer_replace_lines(&b, 0, 0, "top\na");
+    assert_window_diff("several edits", &b, &full);
+    buffer_replace_lines(&b, 2, 2, "b");
+    assert_window_diff("undo a hunk", &b, &full);
+    buffer_replace_lines(&b, 3, 13, "z");
+    assert_window_diff("delete across hunks", &b, &full);
+
+    buffer_free_text(&b);
+    buffer_free_text(&full);
+    repository_close(dir, cwd);
+}
+
+// git blame --incremental output for a six line file: a group of three
+// lines whose commit is described once and reused by a later group, a
+// boundary commit, and a line not committed yet.
+static const char *blame_output =
+    "1111111111111111111111111111111111111111 1 1 3\n"
+    "author Ada Lovelace-Byron\n"
+    "author-mail <ada@localhost>\n"
+    "author-time 1699982000\n"
+    "author-tz +0000\n"
+    "summary one\n"
+    "filename f.txt\n"
+    "2222222222222222222222222222222222222222 4 4 1\n"
+    "author Bob\n"
+    "author-time 1699827200\n"
+    "summary two\n"
+    "boundary\n"
+    "filename f.txt\n"
+    "1111111111111111111111111111111111111111 5 5 1\n"
+    "filename f.txt\n"
+    "0000000000000000000000000000000000000000 6 6 1\n"
+    "author Not Committed Yet\n"
+    "author-time 1699999880\n"
+    "filename f.txt\n";
+
+static void assert_blame_row(const char *test_name, const Buffer *b, int row, const char *expected) {
+    char text[GIT_BLAME_WIDTH * 4 + 1];
+    git_blame_format(b, row, 1700000000, text, sizeof(text));
+    ASSERT_STRING_EQUAL(test_name, text, expected);
+}
+
+// Parses canned blame output and formats rows through git_head_line, before
+// and after edits move buffer rows away from their HEAD lines.
+static void test_git_blame() {
+    printf("  - test_git_blame\n");
+    char cwd[PATH_MAX];
+    char dir[] = "/tmp/arc_test_git_XXXXXX";
+    if (!repository_open(dir, cwd, sizeof(cwd),
+                         "printf 'a\\nb\\nc\\nd\\ne\\nf\\n' > f.txt && git add f.txt && " GIT_COMMIT " -m one")) {
+        ASSERT("git setup", 0);
+        return;
+    }
+    Buffer b = { .file_name = "f.txt" };
+    buffer_set_text(&b, "a\nb\nc\nd\ne\nf\n");
+    git_update_diff(&b);
+    FILE *fp = fmemopen((void *)blame_output, strlen(blame_output), "r");
+    b.git_blame = git_blame_parse(fp, "1111111111111111111111111111111111111111");
+    fclose(fp);
+
+    assert_blame_row("first of a group", &b, 0, "Ada Lovelace-    5h ");
+    assert_blame_row("last of a group", &b, 2, "Ada Lovelace-    5h ");
+    assert_blame_row("boundary commit", &b, 3, "Bob              2d ");
+    assert_blame_row("commit seen before", &b, 4, "Ada Lovelace-    5h ");
+    assert_blame_row("not committed", &b, 5, "Not Committed    2m ");
+    assert_blame_row("past the end", &b, 6, "                    ");
+
+    buffer_replace_lines(&b, 3, 3, "D\nx");
+    buffer_replace_lines(&b, 0, 1, "b");
+    git_update_diff(&b);
+    ASSERT_EQUAL("deleted above", git_head_line(&b, 0), 1);
+    ASSERT_EQUAL("changed line", git_head_line(&b, 2), -1);
+    ASSERT_EQUAL("added line", git_head_line(&b, 3), -1);
+    ASSERT_EQUAL("after the edits", git_head_line(&b, 4), 4);
+    assert_blame_row("moved up", &b, 1, "Ada Lovelace-    5h ");
+    assert_blame_row("changed since HEAD", &b, 2, "                    ");
+    assert_blame_row("moved down", &b, 5, "Not Committed    2m ");
+
+    git_blame_release(&b);
+    buffer_free_text(&b);
+    repository_close(dir, cwd);
+}
+
+void test_git_suite(void) {
+    printf("--- Git tests ---\n");
+    test_git_head_cache();
+    test_git_window_diff();
+    test_git_blame();
+}
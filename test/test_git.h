@@ -0,0 +1,6 @@
+#ifndef TEST_GIT_H
+#define TEST_GIT_H
+
+void test_git_suite(void);
+
+#endif // TEST_GIT_H
@@ -0,0 +1,80 @@
+#define _DEFAULT_SOURCE
+
+#include <unistd.h>
+#include <limits.h>
+#include "test.h"
+#include "test_git_status.h"
+#include "../src/git_status.h"
+
+static const char *status_of(GitStatusEntry *entries, int count, const char *path) {
+    static const char *kinds[] = { "modified", "added", "deleted", "unmerged", "untracked" };
+    for (int i = 0; i < count; i++) {
+        if (strcmp(entries[i].path, path) == 0) {
+            return kinds[entries[i].kind];
+        }
+    }
+    return "clean";
+}
+
+// Commits a few files to a scratch repository, changes them in every way the
+// picker shows, and checks git_status_collect from the top and from a
+// subdirectory.
+static void test_git_status_collect() {
+    printf("  - test_git_status_collect\n");
+    char cwd[PATH_MAX];
+    char repo[] = "/tmp/arc_test_git_status_XXXXXX";
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(repo)) {
+        ASSERT("scratch repository", 0);
+        return;
+    }
+    char command[PATH_MAX * 2];
+    snprintf(command, sizeof(command),
+             "cd '%s' && git init -q && mkdir src && "
+             "printf 'one\\n' > same.c && printf 'one\\n' > touched.c && printf 'one\\n' > size.c && "
+             "printf 'two\\n' > samesize.c && printf 'one\\n' > gone.c && printf 'one\\n' > src/lib.c && "
+             "printf '*.o\\n!keep.o\\nbuild/\\n' > .gitignore && git add . && "
+             "git -c user.name=test -c user.email=test@localhost -c commit.gpgsign=false commit -q -m test && "
+             "sleep 0.01 && touch touched.c && printf 'one more\\n' > size.c && printf 'TWO\\n' > samesize.c && "
+             "rm gone.c && printf 'new\\n' > new.c && git add new.c && printf 'x\\n' > loose.c && "
+             "printf 'x\\n' > a.o && printf 'x\\n' > keep.o && mkdir -p build out/deep && "
+             "printf 'x\\n' > build/b && printf 'x\\n' > out/deep/c && mkdir empty",
+             repo);
+    if (system(command) != 0 || chdir(repo) != 0) {
+        ASSERT("git setup", 0);
+        return;
+    }
+
+    GitStatusEntry *entries;
+    int count = git_status_collect(&entries);
+    ASSERT_STRING_EQUAL("unchanged", status_of(entries, count, "same.c"), "clean");
+    ASSERT_STRING_EQUAL("touched only", status_of(entries, count, "touched.c"), "clean");
+    ASSERT_STRING_EQUAL("size changed", status_of(entries, count, "size.c"), "modified");
+    ASSERT_STRING_EQUAL("same size", status_of(entries, count, "samesize.c"), "modified");
+    ASSERT_STRING_EQUAL("removed", status_of(entries, count, "gone.c"), "deleted");
+    ASSERT_STRING_EQUAL("staged", status_of(entries, count, "new.c"), "added");
+    ASSERT_STRING_EQUAL("untracked", status_of(entries, count, "loose.c"), "untracked");
+    ASSERT_STRING_EQUAL("ignored", status_of(entries, count, "a.o"), "clean");
+    ASSERT_STRING_EQUAL("re-included", status_of(entries, count, "keep.o"), "untracked");
+    ASSERT_STRING_EQUAL("ignored directory", status_of(entries, count, "build/"), "clean");
+    ASSERT_STRING_EQUAL("untracked directory", status_of(entries, count, "out/"), "untracked");
+    ASSERT_STRING_EQUAL("empty directory", status_of(entries, count, "empty/"), "clean");
+    ASSERT_EQUAL("change count", count, 7);
+    git_status_free(entries, count);
+
+    if (chdir("src") == 0) {
+        count = git_status_collect(&entries);
+        ASSERT_STRING_EQUAL("relative to subdirectory", status_of(entries, count, "../size.c"), "modified");
+        git_status_free(entries, count);
+    }
+
+    if (chdir(cwd) != 0) {
+        ASSERT("restore working directory", 0);
+    }
+    snprintf(command, sizeof(command), "rm -rf '%s'", repo);
+    ASSERT("remove scratch repository", system(command) == 0);
+}
+
+void test_git_status_suite(void) {
+    printf("--- Git status tests ---\n");
+    test_git_status_collect();
+}
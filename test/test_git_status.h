@@ -0,0 +1,6 @@
+#ifndef TEST_GIT_STATUS_H
+#define TEST_GIT_STATUS_H
+
+void test_git_status_suite(void);
+
+#endif // TEST_GIT_STATUS_H
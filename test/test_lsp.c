@@ -1,8 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "test_lsp.h"
 #include "test.h"
 #include "../src/config.h"
 #include "../src/lsp.h"
+#include "../src/buffer.h"
+#include "cJSON.h"
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MOCK_LSP "build/test/mock_lsp"
 
 static void test_multi_server_lifecycle() {
     Config config;
@@ -26,7 +34,335 @@ static void test_multi_server_lifecycle() {
     config_destroy(&config); // Assumes a function to clean up config
 }
 
+static void test_incremental_change_positions() {
+    Buffer b;
+    buffer_init(&b, NULL);
+    const char *text = "a\xc3\xa9\xf0\x9f\x98\x80" "b"; // a, e-acute, emoji, b
+    buffer_line_realloc_for_capacity(b.lines[0], strlen(text) + 1);
+    strcpy(b.lines[0]->text, text);
+    b.lines[0]->text_len = strlen(text);
+    b.lines[0]->char_count = 4;
+
+    ASSERT_EQUAL("utf16 column after 2-byte char", buffer_line_lsp_column(&b, b.lines[0], 3), 2);
+    ASSERT_EQUAL("utf16 column after astral char", buffer_line_lsp_column(&b, b.lines[0], 7), 4);
+    ASSERT_EQUAL("utf16 width of astral char", buffer_lsp_char_width(&b, 4), 2);
+    ASSERT_EQUAL("utf16 column to char index", buffer_line_char_index(b.lines[0], 4, LSP_POSITION_UTF16), 3);
+
+    b.lsp_position_encoding = LSP_POSITION_UTF8;
+    ASSERT_EQUAL("utf8 column is the byte offset", buffer_line_lsp_column(&b, b.lines[0], 7), 7);
+    ASSERT_EQUAL("utf8 column to char index", buffer_line_char_index(b.lines[0], 7, LSP_POSITION_UTF8), 3);
+    b.lsp_position_encoding = LSP_POSITION_UTF32;
+    ASSERT_EQUAL("utf32 column is the char index", buffer_line_lsp_column(&b, b.lines[0], 7), 3);
+    ASSERT_EQUAL("column past the end", buffer_line_char_index(b.lines[0], 6, LSP_POSITION_UTF16), 5);
+    b.lsp_position_encoding = LSP_POSITION_UTF16;
+
+    buffer_record_edit(&b, &(TSInputEdit){
+        .start_point = { 0, 7 },
+        .old_end_point = { 0, 8 },
+    }, 4, 5, "x");
+    ASSERT_EQUAL("edit is recorded", b.lsp_change_count, 1);
+    ASSERT_EQUAL("start character", b.lsp_changes[0].start_character, 4);
+    ASSERT_EQUAL("end character", b.lsp_changes[0].end_character, 5);
+    ASSERT_STRING_EQUAL("inserted text", b.lsp_changes[0].text, "x");
+
+    buffer_clear_lsp_changes(&b);
+    ASSERT_EQUAL("changes cleared", b.lsp_change_count, 0);
+    buffer_destroy(&b);
+}
+
+typedef struct {
+    int fd;
+    char *data;
+    size_t len;
+} PipeWriter;
+
+static void *write_all(void *arg) {
+    PipeWriter *w = arg;
+    size_t written = 0;
+    while (written < w->len) {
+        ssize_t n = write(w->fd, w->data + written, w->len - written);
+        if (n <= 0) break;
+        written += n;
+    }
+    close(w->fd);
+    return NULL;
+}
+
+static void test_reader_large_messages() {
+    size_t body_len = 3 * 1024 * 1024;
+    char *body = malloc(body_len + 1);
+    memset(body, 'x', body_len);
+    memcpy(body, "{\"id\":7,\"result\":\"", 18);
+    memcpy(body + body_len - 2, "\"}", 2);
+    body[body_len] = '\0';
+
+    const char *small = "{\"id\":8}";
+    size_t cap = body_len + 256;
+    char *stream = malloc(cap);
+    int len = snprintf(stream, cap, "Content-Length: %zu\r\n\r\n%s"
+                       "content-length: %zu\r\nContent-Type: application/vscode-jsonrpc\r\n\r\n%s",
+                       body_len, body, strlen(small), small);
+
+    int fds[2];
+    ASSERT("pipe", pipe(fds) == 0);
+    PipeWriter writer = { .fd = fds[1], .data = stream, .len = (size_t)len };
+    pthread_t thread;
+    pthread_create(&thread, NULL, write_all, &writer);
+
+    LspReader reader;
+    lsp_reader_init(&reader);
+    cJSON *first = lsp_reader_next(&reader, fds[0]);
+    ASSERT("large message parsed", first != NULL);
+    if (first) {
+        ASSERT_EQUAL("large message id", cJSON_GetObjectItem(first, "id")->valueint, 7);
+        ASSERT_EQUAL("large message result length", (int)strlen(cJSON_GetObjectItem(first, "result")->valuestring), (int)body_len - 20);
+        cJSON_Delete(first);
+    }
+    cJSON *second = lsp_reader_next(&reader, fds[0]);
+    ASSERT("lowercase header parsed", second != NULL);
+    if (second) {
+        ASSERT_EQUAL("second message id", cJSON_GetObjectItem(second, "id")->valueint, 8);
+        cJSON_Delete(second);
+    }
+    ASSERT("end of stream", lsp_reader_next(&reader, fds[0]) == NULL);
+
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    lsp_reader_destroy(&reader);
+    free(stream);
+    free(body);
+}
+
+static void test_parse_publish_diagnostics() {
+    const char *body =
+        "{\"params\":{\"diagnostics\":["
+        "{\"range\":{\"start\":{\"line\":3,\"character\":1},\"end\":{\"line\":3,\"character\":7}},"
+        "\"severity\":2,\"code\":\"-Wunused\",\"relatedInformation\":[{\"message\":\"x\",\"n\":[1,{}]}],"
+        "\"message\":\"say \\\"hi\\\"\\n\\u00e9\\ud83d\\ude00\"},"
+        "{\"message\":\"no range\"},"
+        "{\"message\":\"hint\",\"range\":{\"end\":{\"character\":2,\"line\":0},\"start\":{\"line\":0,\"character\":0}}}"
+        "],\"uri\":\"file:///tmp/a%20b.c\",\"version\":4},"
+        "\"method\":\"textDocument/publishDiagnostics\",\"jsonrpc\":\"2.0\"}";
+    DiagnosticSet *set = lsp_parse_publish_diagnostics(body, strlen(body));
+    ASSERT("publishDiagnostics scanned", set != NULL);
+    if (set) {
+        ASSERT_STRING_EQUAL("scanned path", set->path, "/tmp/a%20b.c");
+        ASSERT_EQUAL("entries without a range are skipped", set->count, 2);
+        ASSERT_EQUAL("scanned line", set->items[0].line, 3);
+        ASSERT_EQUAL("scanned col_end", set->items[0].col_end, 7);
+        ASSERT_EQUAL("scanned severity", (int)set->items[0].severity, (int)LSP_DIAGNOSTIC_SEVERITY_WARNING);
+        ASSERT_STRING_EQUAL("escapes decoded", set->items[0].message, "say \"hi\"\n\xc3\xa9\xf0\x9f\x98\x80");
+        ASSERT_EQUAL("missing severity is a hint", (int)set->items[1].severity, (int)LSP_DIAGNOSTIC_SEVERITY_HINT);
+        ASSERT("uri shared with the set", set->items[1].uri == set->path);
+        ASSERT_EQUAL("document version", set->document_version, 4);
+        lsp_diagnostics_release(set);
+    }
+
+    const char *response = "{\"jsonrpc\":\"2.0\",\"id\":3,\"result\":null}";
+    ASSERT("other messages fall back", lsp_parse_publish_diagnostics(response, strlen(response)) == NULL);
+    const char *truncated = "{\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":\"file:///a\",\"diagnostics\":[{";
+    ASSERT("truncated message falls back", lsp_parse_publish_diagnostics(truncated, strlen(truncated)) == NULL);
+}
+
+static void set_line(Buffer *b, int y, const char *text) {
+    buffer_line_realloc_for_capacity(b->lines[y], strlen(text) + 1);
+    strcpy(b->lines[y]->text, text);
+    b->lines[y]->text_len = strlen(text);
+    b->lines[y]->char_count = strlen(text);
+}
+
+static void test_diagnostic_remap() {
+    Buffer b;
+    buffer_init(&b, NULL);
+    set_line(&b, 0, "int value;");
+    const char *body =
+        "{\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":\"file:///remap.c\",\"version\":1,"
+        "\"diagnostics\":[{\"range\":{\"start\":{\"line\":0,\"character\":4},\"end\":{\"line\":0,\"character\":9}},"
+        "\"message\":\"unused\"}]}}";
+    DiagnosticSet *set = lsp_parse_publish_diagnostics(body, strlen(body));
+    ASSERT("remap set parsed", set != NULL);
+    if (!set) {
+        buffer_destroy(&b);
+        return;
+    }
+
+    // Version 2 inserts "static " at the start of the line.
+    set_line(&b, 0, "static int value;");
+    buffer_record_edit(&b, &(TSInputEdit){ 0 }, 0, 0, "static ");
+    b.version++;
+    buffer_log_edits(&b);
+    buffer_clear_lsp_changes(&b);
+    int count = 0;
+    const Diagnostic *items = buffer_display_diagnostics(&b, set, &count);
+    ASSERT_EQUAL("remapped count", count, 1);
+    ASSERT_EQUAL("start shifted by the insertion", items[0].col_start, 11);
+    ASSERT_EQUAL("end shifted by the insertion", items[0].col_end, 16);
+
+    // Version 3 splits the line before the flagged name.
+    buffer_record_edit(&b, &(TSInputEdit){ .start_point = { 0, 7 }, .old_end_point = { 0, 7 } }, 7, 7, "\n");
+    b.version++;
+    buffer_log_edits(&b);
+    buffer_clear_lsp_changes(&b);
+    items = buffer_display_diagnostics(&b, set, &count);
+    ASSERT_EQUAL("line follows the split", items[0].line, 1);
+    ASSERT_EQUAL("column follows the split", items[0].col_start, 4);
+
+    // An edit that was not recorded leaves positions as published.
+    b.version++;
+    buffer_log_edits(&b);
+    items = buffer_display_diagnostics(&b, set, &count);
+    ASSERT_EQUAL("unrecorded edit stops remapping", items[0].line, 0);
+
+    lsp_diagnostics_release(set);
+    buffer_destroy(&b);
+}
+
+static bool mock_config(Config *config, const char *args) {
+    if (access(MOCK_LSP, X_OK) != 0) {
+        printf("  skipping, %s is not built\n", MOCK_LSP);
+        return false;
+    }
+    config_init(config);
+    char toml[512];
+    int len = snprintf(toml, sizeof(toml), "[lsp]\nc = \"%s %s\"\n", MOCK_LSP, args);
+    config->toml_result = toml_parse(toml, len);
+    return config->toml_result.ok;
+}
+
+static int diagnostic_total(void) {
+    int totals[LSP_DIAGNOSTIC_SEVERITY_COUNT];
+    lsp_diagnostic_totals(totals);
+    int total = 0;
+    for (int i = 0; i < LSP_DIAGNOSTIC_SEVERITY_COUNT; i++) {
+        total += totals[i];
+    }
+    return total;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { 0, ms * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static bool wait_for_diagnostics(int expected) {
+    for (int waited = 0; waited < 10000; waited += 5) {
+        if (diagnostic_total() == expected) {
+            return true;
+        }
+        sleep_ms(5);
+    }
+    return false;
+}
+
+static void test_diagnostic_storm() {
+    Config config;
+    if (!mock_config(&config, "storm 1000 10")) {
+        return;
+    }
+    lsp_init(&config, "storm.c");
+    ASSERT("storm ingested", wait_for_diagnostics(10000));
+
+    DiagnosticSet *set = lsp_diagnostics_acquire("/mock_lsp/file7.c");
+    ASSERT("storm file has a set", set != NULL);
+    if (set) {
+        ASSERT_EQUAL("storm file count", set->count, 10);
+        ASSERT_EQUAL("storm file errors", set->severity_counts[LSP_DIAGNOSTIC_SEVERITY_ERROR], 3);
+        ASSERT_EQUAL("storm diagnostic line", set->items[9].line, 9);
+        lsp_diagnostics_release(set);
+    }
+
+    lsp_shutdown_all();
+    ASSERT_EQUAL("totals cleared on shutdown", diagnostic_total(), 0);
+    config_destroy(&config);
+}
+
+typedef struct {
+    bool done;
+    bool pong;
+    int error_code;
+} MockResponse;
+
+static void on_mock_response(cJSON *result, cJSON *error, void *user_data) {
+    MockResponse *response = user_data;
+    response->done = true;
+    if (error) {
+        response->error_code = cJSON_GetObjectItem(error, "code")->valueint;
+    } else if (cJSON_IsObject(result)) {
+        response->pong = cJSON_GetObjectItem(result, "pong") != NULL;
+    }
+}
+
+static void wait_for_response(MockResponse *response) {
+    for (int waited = 0; waited < 5000 && !response->done; waited += 5) {
+        lsp_dispatch_responses();
+        sleep_ms(5);
+    }
+}
+
+static void test_replay_session() {
+    Config config;
+    if (!mock_config(&config, "replay test/lsp_session.txt")) {
+        return;
+    }
+    lsp_init(&config, "replay.c");
+    ASSERT("replayed diagnostics", wait_for_diagnostics(2));
+
+    MockResponse ping = { 0 };
+    int id = lsp_request("c", "arc/ping", NULL, 2000, false, on_mock_response, &ping);
+    ASSERT("request sent", id > 0);
+    wait_for_response(&ping);
+    ASSERT("ping answered", ping.done && ping.pong && ping.error_code == 0);
+
+    MockResponse slow = { 0 };
+    lsp_request("c", "arc/slow", NULL, 100, false, on_mock_response, &slow);
+    wait_for_response(&slow);
+    ASSERT("slow request timed out", slow.done);
+    ASSERT_EQUAL("timeout error", slow.error_code, LSP_ERROR_TIMED_OUT);
+
+    lsp_shutdown_all();
+    config_destroy(&config);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Queues more than the pipe holds for a server that no longer reads, so the
+// writer blocks mid-write, and checks shutdown gives up on the drain.
+static void test_shutdown_stalled_server() {
+    Config config;
+    if (!mock_config(&config, "replay test/lsp_stalled_session.txt")) {
+        return;
+    }
+    lsp_init(&config, "stalled.c");
+    size_t len = 256 * 1024;
+    char *text = malloc(len + 1);
+    memset(text, 'x', len);
+    text[len] = '\0';
+    for (int i = 0; i < 4; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/mock_lsp/stalled%d.c", i);
+        lsp_did_open(path, "c", text);
+    }
+    free(text);
+
+    double start = now_ms();
+    lsp_shutdown_all();
+    ASSERT("shutdown does not wait for the stalled server", now_ms() - start < 10000);
+    ASSERT("server stopped", !lsp_is_running("c"));
+    config_destroy(&config);
+}
+
 void test_lsp_suite(void) {
     printf("Running LSP tests...\n");
     test_multi_server_lifecycle();
+    test_incremental_change_positions();
+    test_reader_large_messages();
+    test_parse_publish_diagnostics();
+    test_diagnostic_remap();
+    test_diagnostic_storm();
+    test_replay_session();
+    test_shutdown_stalled_server();
 }
@@ -0,0 +1,84 @@
+#define _DEFAULT_SOURCE
+
+#include <unistd.h>
+#include <limits.h>
+#include "test.h"
+#include "test_project_search.h"
+#include "../src/project_search.h"
+
+static void write_file(const char *path, const char *text, int repeat) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return;
+    }
+    for (int i = 0; i < repeat; i++) {
+        fputs(text, f);
+    }
+    fclose(f);
+}
+
+// Searches a small file, one without matches, a missing one and one large
+// enough to be mapped, and checks the matches come back in path order with
+// overlapping matches and a final line without a newline, after cancelling
+// an earlier search.
+static void test_project_search_files() {
+    printf("  - test_project_search_files\n");
+    char dir[] = "/tmp/arc_test_project_search_XXXXXX";
+    if (!mkdtemp(dir)) {
+        ASSERT("scratch directory", 0);
+        return;
+    }
+    char paths[4][PATH_MAX];
+    snprintf(paths[0], PATH_MAX, "%s/small.txt", dir);
+    snprintf(paths[1], PATH_MAX, "%s/none.txt", dir);
+    snprintf(paths[2], PATH_MAX, "%s/missing.txt", dir);
+    snprintf(paths[3], PATH_MAX, "%s/large.txt", dir);
+    write_file(paths[0], "one\nababa two\n\naba\n", 1);
+    write_file(paths[1], "nothing here\n", 1);
+    write_file(paths[3], "filler line without the needle\n", 10000);
+    FILE *f = fopen(paths[3], "a");
+    if (f) {
+        fputs("last aba", f);
+        fclose(f);
+    }
+
+    char *list[] = { paths[0], paths[1], paths[2], paths[3] };
+    // The first search is superseded at once and must leave nothing behind.
+    project_search_start(list, 4, "filler", NULL);
+    project_search_start(list, 4, "aba", NULL);
+    project_search_wait();
+    project_search_lock();
+    bool searching;
+    ASSERT_EQUAL("match count", project_search_count(&searching), 4);
+    ASSERT("finished", !searching);
+    if (project_search_count(NULL) == 4) {
+        const ProjectSearchMatch *first = project_search_match(0);
+        ASSERT_EQUAL("first file", first->file, 0);
+        ASSERT_EQUAL("first line", first->line, 2);
+        ASSERT_EQUAL("first column", first->column, 0);
+        ASSERT_EQUAL("overlapping column", project_search_match(1)->column, 2);
+        ASSERT_STRING_EQUAL("content", project_search_match(1)->content, "ababa two");
+        ASSERT_EQUAL("line after blank", project_search_match(2)->line, 4);
+        ASSERT_EQUAL("large file", project_search_match(3)->file, 3);
+        ASSERT_EQUAL("large line", project_search_match(3)->line, 10001);
+        ASSERT_STRING_EQUAL("last line", project_search_match(3)->content, "last aba");
+    }
+    project_search_unlock();
+
+    project_search_start(list, 4, "absent", NULL);
+    project_search_wait();
+    project_search_lock();
+    ASSERT_EQUAL("no matches", project_search_count(NULL), 0);
+    project_search_unlock();
+    project_search_stop();
+
+    for (int i = 0; i < 4; i++) {
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+}
+
+void test_project_search_suite(void) {
+    printf("--- Project search tests ---\n");
+    test_project_search_files();
+}
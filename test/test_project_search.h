@@ -0,0 +1,6 @@
+#ifndef TEST_PROJECT_SEARCH_H
+#define TEST_PROJECT_SEARCH_H
+
+void test_project_search_suite(void);
+
+#endif // TEST_PROJECT_SEARCH_H
@@ -0,0 +1,81 @@
+#define _DEFAULT_SOURCE
+
+#include <unistd.h>
+#include <limits.h>
+#include "test.h"
+#include "test_search_index.h"
+#include "../src/search_index.h"
+
+static void candidates_of(const char *needle, char *out, size_t size) {
+    int count;
+    char **paths = search_index_candidates(needle, &count);
+    if (!paths) {
+        snprintf(out, size, "none");
+        return;
+    }
+    out[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(out);
+        snprintf(out + len, size - len, "%s%s", i ? " " : "", paths[i]);
+    }
+    search_index_free_candidates(paths, count);
+}
+
+// Indexes a scratch project, then changes, adds and removes files and checks
+// the next rebuild notices by mtime and size alone.
+static void test_search_index_rebuild() {
+    printf("  - test_search_index_rebuild\n");
+    char cwd[PATH_MAX];
+    char dir[] = "/tmp/arc_test_search_index_XXXXXX";
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir)) {
+        ASSERT("scratch directory", 0);
+        return;
+    }
+    const char *home = getenv("HOME");
+    char *saved_home = home ? strdup(home) : NULL;
+    char command[PATH_MAX * 2];
+    snprintf(command, sizeof(command),
+             "cd '%s' && mkdir -p home project/sub && cd project && printf 'hello world\\n' > a.c && "
+             "printf 'goodbye\\n' > b.c && printf 'say hello\\n' > sub/c.c && printf 'hel\\nlo\\n' > d.c",
+             dir);
+    char home_dir[PATH_MAX + 8];
+    snprintf(home_dir, sizeof(home_dir), "%s/home", dir);
+    char project_dir[PATH_MAX + 16];
+    snprintf(project_dir, sizeof(project_dir), "%s/project", dir);
+    if (system(command) != 0 || chdir(project_dir) != 0) {
+        ASSERT("project setup", 0);
+        return;
+    }
+    setenv("HOME", home_dir, 1);
+
+    char result[256];
+    ASSERT("first build", search_index_rebuild());
+    candidates_of("hello", result, sizeof(result));
+    ASSERT_STRING_EQUAL("files with every trigram", result, "a.c sub/c.c");
+    candidates_of("he", result, sizeof(result));
+    ASSERT_STRING_EQUAL("shorter than a trigram", result, "none");
+    candidates_of("absent", result, sizeof(result));
+    ASSERT_STRING_EQUAL("no candidates", result, "");
+
+    ASSERT("change files", system("printf 'hello again\\n' > b.c && rm a.c && printf 'hello\\n' > e.c") == 0);
+    ASSERT("rebuild", search_index_rebuild());
+    candidates_of("hello", result, sizeof(result));
+    ASSERT_STRING_EQUAL("after changes", result, "b.c e.c sub/c.c");
+    candidates_of("goodbye", result, sizeof(result));
+    ASSERT_STRING_EQUAL("stale trigrams dropped", result, "");
+
+    if (saved_home) {
+        setenv("HOME", saved_home, 1);
+        free(saved_home);
+    }
+    if (chdir(cwd) != 0) {
+        ASSERT("restore working directory", 0);
+    }
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    ASSERT("remove scratch directory", system(command) == 0);
+}
+
+void test_search_index_suite(void) {
+    printf("--- Search index tests ---\n");
+    test_search_index_rebuild();
+}
@@ -0,0 +1,6 @@
+#ifndef TEST_SEARCH_INDEX_H
+#define TEST_SEARCH_INDEX_H
+
+void test_search_index_suite(void);
+
+#endif // TEST_SEARCH_INDEX_H
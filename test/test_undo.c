@@ -1,4 +1,25 @@
 #include "test.h"
+#include "../src/editor.h"
+
+// Undo and redo that re-insert text report each character as its own edit,
+// so the log that remaps diagnostics keeps every edit instead of resetting.
+static void test_undo_redo_keep_edit_log() {
+    printf("  - test_undo_redo_keep_edit_log\n");
+    FILE *fp = fopen("test.txt", "w");
+    fprintf(fp, "hello");
+    fclose(fp);
+    editor_open("test.txt");
+    Buffer *b = editor_get_active_buffer();
+    b->position_y = 0;
+    b->position_x = 0;
+    editor_handle_input("x");
+    editor_handle_input("u");
+    ASSERT_EQUAL("undo a delete", b->edit_log_count, 2);
+    editor_handle_input("U");
+    ASSERT_EQUAL("redo a delete", b->edit_log_count, 3);
+    editor_close_buffer(editor_get_active_buffer_idx());
+    remove("test.txt");
+}
 
 void run_undo_tests(void) {
     printf("--- Undo/Redo tests ---\n");
@@ -12,4 +33,6 @@ void run_undo_tests(void) {
 
     test_helper("test_multiline_insert_undo", "line1\nline3", 0, 5, "i\nline2\x1bu", "line1\nline3");
     // test_helper("test_multiline_insert_undo_redo", "line1\nline3", 0, 5, "i\nline2\x1buU", "line1\nline2\nline3");
+
+    test_undo_redo_keep_edit_log();
 }
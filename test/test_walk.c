@@ -0,0 +1,87 @@
+#define _DEFAULT_SOURCE
+
+#include <unistd.h>
+#include <limits.h>
+#include "test.h"
+#include "test_walk.h"
+#include "../src/walk.h"
+
+static void walked(const char *dir, int flags, char *out, size_t size) {
+    WalkFile *files;
+    int count = walk_files(dir, flags, NULL, &files);
+    out[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(out);
+        snprintf(out + len, size - len, "%s%s", i ? " " : "", files[i].path);
+    }
+    walk_free(files, count);
+}
+
+// Builds a tree with ignore files at several levels, symlinks and a binary
+// file, and checks which files each kind of walk lists.
+static void test_walk_files() {
+    printf("  - test_walk_files\n");
+    char cwd[PATH_MAX];
+    char dir[] = "/tmp/arc_test_walk_XXXXXX";
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(dir)) {
+        ASSERT("scratch directory", 0);
+        return;
+    }
+    char command[PATH_MAX * 2];
+    snprintf(command, sizeof(command),
+             "cd '%s' && mkdir -p .git/info build src/gen src/deep/er lib/out lib/sub/out && "
+             "printf 'secret\\n' > .git/info/exclude && printf '*.o\\n!keep.o\\nbuild/\\n*/out\\n' > .gitignore && "
+             "printf 'gen/\\n' > src/.gitignore && printf '!gen/\\n*.log\\n' > src/deep/.ignore && "
+             "touch a.c a.o keep.o secret .hidden build/b.c src/s.c src/gen/g.c src/x.log src/deep/er/e.c src/deep/d.log && "
+             "touch lib/out/o.c lib/sub/out/p.c src/z.o src/secret && "
+             "printf 'x\\0y' > bin.dat && ln -s a.c link.c && ln -s src srclink && ln -s .. src/up && ln -s none dangling",
+             dir);
+    if (system(command) != 0 || chdir(dir) != 0) {
+        ASSERT("tree setup", 0);
+        return;
+    }
+
+    char result[1024];
+    walked("", 0, result, sizeof(result));
+    ASSERT_STRING_EQUAL("all", result,
+                        ".gitignore .hidden a.c bin.dat keep.o lib/sub/out/p.c link.c src/.gitignore src/deep/.ignore "
+                        "src/deep/er/e.c src/s.c src/x.log srclink/.gitignore srclink/deep/.ignore srclink/deep/er/e.c "
+                        "srclink/s.c srclink/x.log");
+    walked("", WALK_SKIP_HIDDEN | WALK_SKIP_BINARY, result, sizeof(result));
+    ASSERT_STRING_EQUAL("no hidden or binary files", result,
+                        "a.c keep.o lib/sub/out/p.c link.c src/deep/er/e.c src/s.c src/x.log srclink/deep/er/e.c "
+                        "srclink/s.c srclink/x.log");
+    walked("src/deep", 0, result, sizeof(result));
+    ASSERT_STRING_EQUAL("subdirectory", result, "src/deep/.ignore src/deep/er/e.c");
+    WalkRules *rules = walk_rules_load("src");
+    ASSERT("rules of the directory", walk_rules_ignore(rules, "src/gen", true));
+    ASSERT("rules from above", walk_rules_ignore(rules, "src/new.o", false));
+    ASSERT("excluded", walk_rules_ignore(rules, "src/secret", false));
+    ASSERT("not ignored", !walk_rules_ignore(rules, "src/new.c", false));
+    ASSERT("file named like a directory rule", !walk_rules_ignore(rules, "src/gen", false));
+    walk_rules_free(rules);
+    if (chdir("src") != 0) {
+        ASSERT("enter subdirectory", 0);
+    }
+    walked("", 0, result, sizeof(result));
+    ASSERT_STRING_EQUAL("below the work tree", result, ".gitignore deep/.ignore deep/er/e.c s.c x.log");
+    if (chdir("..") != 0) {
+        ASSERT("leave subdirectory", 0);
+    }
+
+    WalkFile *files;
+    int count = walk_files("src", WALK_STAT, NULL, &files);
+    ASSERT("stat", count > 0 && files[0].mtime_ns > 0);
+    walk_free(files, count);
+
+    if (chdir(cwd) != 0) {
+        ASSERT("restore working directory", 0);
+    }
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    ASSERT("remove scratch directory", system(command) == 0);
+}
+
+void test_walk_suite(void) {
+    printf("--- Walk tests ---\n");
+    test_walk_files();
+}
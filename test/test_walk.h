@@ -0,0 +1,6 @@
+#ifndef TEST_WALK_H
+#define TEST_WALK_H
+
+void test_walk_suite(void);
+
+#endif // TEST_WALK_H